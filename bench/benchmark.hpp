@@ -0,0 +1,358 @@
+#ifndef __ETCD_BENCHMARK_HPP_INCLUDED__
+#define __ETCD_BENCHMARK_HPP_INCLUDED__
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace etcd {
+namespace bench {
+
+/*
+ * A small stand-in for Google Benchmark, so the suites build with nothing
+ * but the client's own dependencies. The registration macro, the State
+ * loop and the command line flags follow Google Benchmark:
+ *
+ *   static void BM_Something(etcd::bench::State& state) {
+ *       Setup();                       // not timed
+ *       while (state.KeepRunning())
+ *           etcd::bench::DoNotOptimize(Something());
+ *   }
+ *   ETCD_BENCHMARK(BM_Something);
+ *
+ *   --benchmark_filter=<regex>     run matching benchmarks only
+ *   --benchmark_min_time=<sec>     time each benchmark at least this long
+ *   --benchmark_format=console|json
+ *   --benchmark_out=<file>         also write the JSON report to file
+ */
+
+/**
+ * @brief Keep the compiler from optimizing value, and the code computing
+ * it, away
+ */
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+/**
+ * @brief Iteration control and counters of one benchmark run
+ */
+class State {
+  public:
+    // LIFECYCLE
+    explicit State(uint64_t max_iterations)
+      :max_iterations_(max_iterations),
+       iterations_(0),
+       running_(false),
+       real_(0),
+       cpu_(0),
+       items_(0),
+       bytes_(0)
+      {}
+
+    // OPERATIONS
+    /**
+     * @brief Timing starts with the first call, code before the loop is
+     * setup
+     */
+    bool KeepRunning() {
+        if (iterations_ == 0)
+            ResumeTiming();
+        if (iterations_ < max_iterations_) {
+            ++iterations_;
+            return true;
+        }
+        PauseTiming();
+        return false;
+    }
+
+    void PauseTiming() {
+        if (! running_)
+            return;
+        real_ += std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - real_start_).count();
+        cpu_ += double(std::clock() - cpu_start_) / CLOCKS_PER_SEC;
+        running_ = false;
+    }
+
+    void ResumeTiming() {
+        real_start_ = std::chrono::steady_clock::now();
+        cpu_start_ = std::clock();
+        running_ = true;
+    }
+
+    void SetItemsProcessed(uint64_t items) {
+        items_ = items;
+    }
+
+    void SetBytesProcessed(uint64_t bytes) {
+        bytes_ = bytes;
+    }
+
+    void SetLabel(const std::string& label) {
+        label_ = label;
+    }
+
+    uint64_t iterations() const {
+        return iterations_;
+    }
+
+    double RealSeconds() const {
+        return real_;
+    }
+
+    double CpuSeconds() const {
+        return cpu_;
+    }
+
+    uint64_t Items() const {
+        return items_;
+    }
+
+    uint64_t Bytes() const {
+        return bytes_;
+    }
+
+    const std::string& Label() const {
+        return label_;
+    }
+
+  private:
+    // DATA MEMBERS
+    uint64_t max_iterations_;
+    uint64_t iterations_;
+    bool running_;
+    std::chrono::steady_clock::time_point real_start_;
+    std::clock_t cpu_start_;
+    double real_;
+    double cpu_;
+    uint64_t items_;
+    uint64_t bytes_;
+    std::string label_;
+};
+
+typedef void (*BenchmarkFunction)(State& state);
+
+struct Benchmark {
+    const char* name;
+    BenchmarkFunction function;
+};
+
+inline std::vector<Benchmark>& Benchmarks() {
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+struct Registrar {
+    Registrar(const char* name, BenchmarkFunction function) {
+        Benchmark b = { name, function };
+        Benchmarks().push_back(b);
+    }
+};
+
+#define ETCD_BENCHMARK(function) \
+    static ::etcd::bench::Registrar function##_registrar(#function, function)
+
+/**
+ * @brief Result of one benchmark, times are per iteration
+ */
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double real_ns;
+    double cpu_ns;
+    double items_per_second;
+    double bytes_per_second;
+    std::string label;
+};
+
+namespace internal {
+
+inline std::string JsonEscape(const std::string& value) {
+    std::string out;
+    for (size_t i = 0; i < value.size(); ++i) {
+        unsigned char c = value[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            char u[8];
+            snprintf(u, sizeof(u), "\\u%04x", c);
+            out += u;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+inline void WriteJson(FILE* out,
+                      const char* executable,
+                      const std::vector<Result>& results) {
+    char date[32];
+    std::time_t now = std::time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+    fprintf(out, "{\n  \"context\": {\n");
+    fprintf(out, "    \"date\": \"%s\",\n", date);
+    fprintf(out, "    \"executable\": \"%s\",\n",
+            JsonEscape(executable).c_str());
+    fprintf(out, "    \"num_cpus\": %u,\n",
+            std::thread::hardware_concurrency());
+#ifdef NDEBUG
+    fprintf(out, "    \"library_build_type\": \"release\"\n");
+#else
+    fprintf(out, "    \"library_build_type\": \"debug\"\n");
+#endif
+    fprintf(out, "  },\n  \"benchmarks\": [");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        fprintf(out, "%s\n    {\n", i ? "," : "");
+        fprintf(out, "      \"name\": \"%s\",\n", JsonEscape(r.name).c_str());
+        fprintf(out, "      \"iterations\": %llu,\n",
+                (unsigned long long) r.iterations);
+        fprintf(out, "      \"real_time\": %.3f,\n", r.real_ns);
+        fprintf(out, "      \"cpu_time\": %.3f,\n", r.cpu_ns);
+        if (r.items_per_second > 0)
+            fprintf(out, "      \"items_per_second\": %.3f,\n",
+                    r.items_per_second);
+        if (r.bytes_per_second > 0)
+            fprintf(out, "      \"bytes_per_second\": %.3f,\n",
+                    r.bytes_per_second);
+        if (! r.label.empty())
+            fprintf(out, "      \"label\": \"%s\",\n",
+                    JsonEscape(r.label).c_str());
+        fprintf(out, "      \"time_unit\": \"ns\"\n    }");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+inline void WriteConsole(FILE* out, const Result& r) {
+    fprintf(out, "%-40s %14.1f ns %14.1f ns %12llu",
+            r.name.c_str(), r.real_ns, r.cpu_ns,
+            (unsigned long long) r.iterations);
+    if (r.bytes_per_second > 0)
+        fprintf(out, " %10.1fMB/s", r.bytes_per_second / 1e6);
+    if (r.items_per_second > 0)
+        fprintf(out, " %10.1fk items/s", r.items_per_second / 1e3);
+    if (! r.label.empty())
+        fprintf(out, " %s", r.label.c_str());
+    fputc('\n', out);
+    fflush(out);
+}
+
+inline bool Flag(const char* arg, const char* name, std::string& value) {
+    size_t len = std::strlen(name);
+    if (std::strncmp(arg, name, len) != 0 || arg[len] != '=')
+        return false;
+    value = arg + len + 1;
+    return true;
+}
+
+} // namespace internal
+
+/**
+ * @brief Run one benchmark, growing the iteration count until it ran for
+ * at least min_time seconds
+ */
+inline Result Run(const Benchmark& b, double min_time) {
+    uint64_t iterations = 1;
+    for (;;) {
+        State state(iterations);
+        b.function(state);
+
+        double real = state.RealSeconds();
+        if (real >= min_time || iterations >= 1000000000ULL) {
+            Result r;
+            r.name = b.name;
+            r.iterations = state.iterations();
+            double n = r.iterations ? double(r.iterations) : 1.0;
+            r.real_ns = real * 1e9 / n;
+            r.cpu_ns = state.CpuSeconds() * 1e9 / n;
+            r.items_per_second = real > 0 ? state.Items() / real : 0;
+            r.bytes_per_second = real > 0 ? state.Bytes() / real : 0;
+            r.label = state.Label();
+            return r;
+        }
+
+        // Aim 40% past min_time, at most ten times more iterations
+        double scale = real > 0 ? min_time * 1.4 / real : 10.0;
+        if (scale > 10.0)
+            scale = 10.0;
+        uint64_t next = uint64_t(iterations * scale);
+        iterations = next > iterations ? next : iterations + 1;
+    }
+}
+
+/**
+ * @brief Run the registered benchmarks selected by the command line
+ *
+ * @return process exit code
+ */
+inline int RunBenchmarks(int argc, char* argv[]) {
+    std::string filter = ".";
+    std::string format = "console";
+    std::string out_file;
+    std::string min_time = "0.5";
+    for (int i = 1; i < argc; ++i) {
+        if (! internal::Flag(argv[i], "--benchmark_filter", filter) &&
+            ! internal::Flag(argv[i], "--benchmark_format", format) &&
+            ! internal::Flag(argv[i], "--benchmark_out", out_file) &&
+            ! internal::Flag(argv[i], "--benchmark_min_time", min_time)) {
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    std::regex re;
+    try {
+        re = std::regex(filter);
+    } catch (const std::regex_error& e) {
+        fprintf(stderr, "bad --benchmark_filter: %s\n", e.what());
+        return 1;
+    }
+
+    bool console = format != "json";
+    if (console)
+        fprintf(stdout, "%-40s %17s %17s %12s\n",
+                "Benchmark", "Time", "CPU", "Iterations");
+
+    std::vector<Result> results;
+    for (auto const& b :Benchmarks()) {
+        if (! std::regex_search(b.name, re))
+            continue;
+        results.push_back(Run(b, std::atof(min_time.c_str())));
+        if (console)
+            internal::WriteConsole(stdout, results.back());
+    }
+
+    if (! console)
+        internal::WriteJson(stdout, argv[0], results);
+    if (! out_file.empty()) {
+        FILE* out = fopen(out_file.c_str(), "w");
+        if (! out) {
+            fprintf(stderr, "cannot write %s\n", out_file.c_str());
+            return 1;
+        }
+        internal::WriteJson(out, argv[0], results);
+        fclose(out);
+    }
+    return 0;
+}
+
+} // namespace bench
+} // namespace etcd
+
+#endif // __ETCD_BENCHMARK_HPP_INCLUDED__
@@ -0,0 +1,481 @@
+/*
+ * etcdcpp-bench, a load generator built on etcd::Client and etcd::Watch.
+ *
+ *   etcdcpp-bench --mix=get:80,set:15,cas:5 --keys=10000 --dist=zipfian
+ *                 --value-size=256 --concurrency=16 --watchers=4
+ *                 --duration=30 [--endpoint=host:port]
+ *
+ * Without --endpoint the load runs against an embedded
+ * etcd::test::MockServer, --latency=<us> then adds server side latency.
+ *
+ * Operations:
+ *   get     Get of one key
+ *   set     Set of one key
+ *   cas     read-modify-write: a Get followed by CompareAndSwapIf on the
+ *           modifiedIndex just read, the latency covers both requests. A
+ *           lost race is counted as a conflict, not an error.
+ *   delete  Delete of one key, a missing key is not an error
+ *   getall  recursive Get of the whole key space
+ */
+
+#include "client.hpp"
+#include "mock_server.hpp"
+#include "rapid_reply.hpp"
+#include "request_trace.hpp"
+#include "watch.hpp"
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef etcd::Client<etcd::RapidReply> Client;
+typedef etcd::Watch<etcd::RapidReply> Watch;
+
+enum OpType { OP_GET, OP_SET, OP_CAS, OP_DELETE, OP_GETALL, OP_COUNT };
+
+const char* const kOpNames[OP_COUNT] = {
+    "get", "set", "cas", "delete", "getall"
+};
+
+//------------------------------- OPTIONS ------------------------------------
+
+struct Options {
+    Options()
+      :server("127.0.0.1"),
+       port(0),
+       keys(1000),
+       zipfian(false),
+       theta(0.99),
+       value_size(64),
+       concurrency(4),
+       watchers(0),
+       duration(10),
+       latency(0),
+       prefix("/etcdcpp-bench"),
+       json(false),
+       load(true) {
+        for (size_t i = 0; i < OP_COUNT; ++i)
+            mix[i] = 0;
+        mix[OP_GET] = 80;
+        mix[OP_SET] = 20;
+    }
+
+    std::string server;
+    etcd::Port port;            // 0 runs the embedded server
+    size_t keys;
+    bool zipfian;
+    double theta;
+    size_t value_size;
+    size_t concurrency;
+    size_t watchers;
+    double duration;            // seconds
+    uint64_t latency;           // embedded server latency, microseconds
+    std::string prefix;
+    std::string record;         // trace file of the run, see replay.cpp
+    bool json;
+    bool load;                  // write every key before the run
+    unsigned mix[OP_COUNT];     // weights
+};
+
+void Usage() {
+    fprintf(stderr,
+        "usage: etcdcpp-bench [options]\n"
+        "  --endpoint=host:port   etcd to load, default embedded server\n"
+        "  --latency=us           latency of the embedded server\n"
+        "  --mix=op:w,...         weights of get, set, cas, delete, getall\n"
+        "                         default get:80,set:20\n"
+        "  --keys=n               key space size, default 1000\n"
+        "  --dist=uniform|zipfian[:theta]\n"
+        "  --value-size=bytes     default 64\n"
+        "  --concurrency=n        client threads, default 4\n"
+        "  --watchers=n           watch threads, default 0\n"
+        "  --duration=seconds     default 10\n"
+        "  --prefix=dir           key space directory, default "
+        "/etcdcpp-bench\n"
+        "  --no-load              do not write the key space first\n"
+        "  --record=path          write a request trace of the run\n"
+        "  --json                 report as JSON\n");
+}
+
+bool Value(const char* arg, const char* name, std::string& value) {
+    size_t len = std::strlen(name);
+    if (std::strncmp(arg, name, len) != 0 || arg[len] != '=')
+        return false;
+    value = arg + len + 1;
+    return true;
+}
+
+bool ParseMix(const std::string& text, Options& options) {
+    for (size_t i = 0; i < OP_COUNT; ++i)
+        options.mix[i] = 0;
+
+    std::string::size_type pos = 0;
+    while (pos < text.size()) {
+        std::string::size_type end = text.find(',', pos);
+        if (end == std::string::npos)
+            end = text.size();
+        std::string item = text.substr(pos, end - pos);
+        pos = end + 1;
+
+        std::string::size_type colon = item.find(':');
+        std::string name = item.substr(0, colon);
+        unsigned weight = colon == std::string::npos ? 1 :
+            (unsigned) std::strtoul(item.c_str() + colon + 1, NULL, 10);
+        size_t op = 0;
+        while (op < OP_COUNT && name != kOpNames[op])
+            ++op;
+        if (op == OP_COUNT)
+            return false;
+        options.mix[op] = weight;
+    }
+
+    unsigned total = 0;
+    for (size_t i = 0; i < OP_COUNT; ++i)
+        total += options.mix[i];
+    return total > 0;
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string v;
+        const char* arg = argv[i];
+        if (Value(arg, "--endpoint", v)) {
+            std::string::size_type colon = v.rfind(':');
+            if (colon == std::string::npos)
+                return false;
+            options.server = v.substr(0, colon);
+            options.port = (etcd::Port) std::atoi(v.c_str() + colon + 1);
+        } else if (Value(arg, "--latency", v)) {
+            options.latency = std::strtoull(v.c_str(), NULL, 10);
+        } else if (Value(arg, "--mix", v)) {
+            if (! ParseMix(v, options))
+                return false;
+        } else if (Value(arg, "--keys", v)) {
+            options.keys = std::strtoul(v.c_str(), NULL, 10);
+        } else if (Value(arg, "--dist", v)) {
+            options.zipfian = v.compare(0, 7, "zipfian") == 0;
+            if (! options.zipfian && v != "uniform")
+                return false;
+            if (v.size() > 8 && v[7] == ':')
+                options.theta = std::atof(v.c_str() + 8);
+        } else if (Value(arg, "--value-size", v)) {
+            options.value_size = std::strtoul(v.c_str(), NULL, 10);
+        } else if (Value(arg, "--concurrency", v)) {
+            options.concurrency = std::strtoul(v.c_str(), NULL, 10);
+        } else if (Value(arg, "--watchers", v)) {
+            options.watchers = std::strtoul(v.c_str(), NULL, 10);
+        } else if (Value(arg, "--duration", v)) {
+            options.duration = std::atof(v.c_str());
+        } else if (Value(arg, "--prefix", v)) {
+            options.prefix = v;
+        } else if (Value(arg, "--record", v)) {
+            options.record = v;
+        } else if (std::strcmp(arg, "--no-load") == 0) {
+            options.load = false;
+        } else if (std::strcmp(arg, "--json") == 0) {
+            options.json = true;
+        } else {
+            return false;
+        }
+    }
+    return options.keys > 0 && options.concurrency > 0 &&
+        options.duration > 0 && options.theta > 0 && options.theta != 1.0;
+}
+
+//------------------------------- KEYS ---------------------------------------
+
+/**
+ * @brief Zipfian distribution over [0, n) as in YCSB (Gray et al., "Quickly
+ * generating billion-record synthetic databases"). Rank 0 is the hottest
+ * key, ranks are scattered over the key space by a hash.
+ */
+class Zipfian {
+  public:
+    Zipfian(size_t n, double theta)
+      :n_(n),
+       theta_(theta),
+       zeta_n_(_Zeta(n, theta)),
+       alpha_(1.0 / (1.0 - theta)),
+       eta_((1.0 - std::pow(2.0 / n, 1.0 - theta)) /
+            (1.0 - _Zeta(2, theta) / zeta_n_)) {
+    }
+
+    template <typename Random>
+    size_t operator()(Random& random) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        double uz = u * zeta_n_;
+        size_t rank;
+        if (uz < 1.0)
+            rank = 0;
+        else if (uz < 1.0 + std::pow(0.5, theta_))
+            rank = 1;
+        else
+            rank = (size_t) (n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+        if (rank >= n_)
+            rank = n_ - 1;
+        // FNV-1a, so hot keys do not sit next to each other
+        uint64_t h = 14695981039346656037ULL;
+        for (int i = 0; i < 8; ++i) {
+            h ^= (rank >> (i * 8)) & 0xff;
+            h *= 1099511628211ULL;
+        }
+        return (size_t) (h % n_);
+    }
+
+  private:
+    size_t n_;
+    double theta_;
+    double zeta_n_;
+    double alpha_;
+    double eta_;
+
+    static double _Zeta(size_t n, double theta) {
+        double sum = 0;
+        for (size_t i = 1; i <= n; ++i)
+            sum += 1.0 / std::pow((double) i, theta);
+        return sum;
+    }
+};
+
+//------------------------------- RESULTS ------------------------------------
+
+struct OpStats {
+    OpStats() :errors(0), conflicts(0) {}
+
+    etcd::LatencyHistogram latency;     // microseconds
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> conflicts;
+};
+
+struct Shared {
+    Shared() :stop(false), watch_stop(false), events(0) {}
+
+    OpStats ops[OP_COUNT];
+    std::atomic<bool> stop;
+    std::atomic<bool> watch_stop;
+    std::atomic<uint64_t> events;
+};
+
+std::string KeyName(const Options& options, size_t key) {
+    return options.prefix + "/k" + std::to_string(key);
+}
+
+//------------------------------- WORKERS ------------------------------------
+
+void Worker(const Options& options,
+            const Zipfian* zipfian,
+            unsigned seed,
+            Shared& shared) {
+    Client client(options.server, options.port);
+    std::mt19937_64 random(seed);
+    std::uniform_int_distribution<size_t> uniform(0, options.keys - 1);
+
+    unsigned total = 0;
+    for (size_t i = 0; i < OP_COUNT; ++i)
+        total += options.mix[i];
+    std::uniform_int_distribution<unsigned> pick(0, total - 1);
+
+    std::string value(options.value_size, 'v');
+    while (! shared.stop.load(std::memory_order_relaxed)) {
+        unsigned p = pick(random);
+        size_t op = 0;
+        while (p >= options.mix[op])
+            p -= options.mix[op++];
+
+        std::string key = KeyName(options,
+            zipfian ? (*zipfian)(random) : uniform(random));
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        try {
+            switch (op) {
+              case OP_GET:
+                client.Get(key);
+                break;
+              case OP_SET:
+                client.Set(key, value);
+                break;
+              case OP_CAS: {
+                etcd::Index index = client.Get(key).GetModifiedIndex();
+                client.CompareAndSwapIf(key, value, index);
+                break;
+              }
+              case OP_DELETE:
+                client.Delete(key);
+                break;
+              case OP_GETALL:
+                client.GetAll(options.prefix);
+                break;
+            }
+        } catch (const etcd::ReplyException& e) {
+            if (e.error_code == 101)
+                shared.ops[op].conflicts.fetch_add(1);
+            else if (e.error_code != 100)
+                shared.ops[op].errors.fetch_add(1);
+        } catch (const std::exception&) {
+            shared.ops[op].errors.fetch_add(1);
+        }
+        shared.ops[op].latency.Record(etcd::internal::ElapsedMicros(start));
+    }
+}
+
+void Watcher(const Options& options, size_t key, Shared& shared) {
+    Watch watch(options.server, options.port);
+    std::string name = KeyName(options, key);
+    while (! shared.watch_stop.load()) {
+        try {
+            watch.RunOnce(name, [&](const etcd::RapidReply&) {
+                shared.events.fetch_add(1, std::memory_order_relaxed);
+            });
+        } catch (const std::exception&) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+}
+
+//------------------------------- REPORT -------------------------------------
+
+void Report(const Options& options, Shared& shared, double seconds) {
+    uint64_t total = 0;
+    etcd::HistogramSnapshot snapshots[OP_COUNT];
+    for (size_t i = 0; i < OP_COUNT; ++i) {
+        shared.ops[i].latency.Snapshot(snapshots[i]);
+        total += snapshots[i].count;
+    }
+
+    if (options.json) {
+        printf("{\n  \"duration\": %.3f,\n  \"throughput\": %.1f,\n",
+               seconds, total / seconds);
+        printf("  \"watch_events\": %llu,\n  \"operations\": [",
+               (unsigned long long) shared.events.load());
+        bool first = true;
+        for (size_t i = 0; i < OP_COUNT; ++i) {
+            const etcd::HistogramSnapshot& s = snapshots[i];
+            if (! s.count)
+                continue;
+            printf("%s\n    {\"name\": \"%s\", \"count\": %llu, "
+                   "\"errors\": %llu, \"conflicts\": %llu, "
+                   "\"throughput\": %.1f, \"p50_us\": %llu, "
+                   "\"p99_us\": %llu, \"p999_us\": %llu, \"max_us\": %llu}",
+                   first ? "" : ",", kOpNames[i],
+                   (unsigned long long) s.count,
+                   (unsigned long long) shared.ops[i].errors.load(),
+                   (unsigned long long) shared.ops[i].conflicts.load(),
+                   s.count / seconds,
+                   (unsigned long long) s.Percentile(50),
+                   (unsigned long long) s.Percentile(99),
+                   (unsigned long long) s.Percentile(99.9),
+                   (unsigned long long) s.max);
+            first = false;
+        }
+        printf("\n  ]\n}\n");
+        return;
+    }
+
+    printf("%-8s %10s %8s %9s %12s %10s %10s %10s %10s\n",
+           "op", "count", "errors", "conflicts", "ops/s",
+           "p50(ms)", "p99(ms)", "p999(ms)", "max(ms)");
+    for (size_t i = 0; i < OP_COUNT; ++i) {
+        const etcd::HistogramSnapshot& s = snapshots[i];
+        if (! s.count)
+            continue;
+        printf("%-8s %10llu %8llu %9llu %12.1f %10.3f %10.3f %10.3f %10.3f\n",
+               kOpNames[i], (unsigned long long) s.count,
+               (unsigned long long) shared.ops[i].errors.load(),
+               (unsigned long long) shared.ops[i].conflicts.load(),
+               s.count / seconds,
+               s.Percentile(50) / 1e3, s.Percentile(99) / 1e3,
+               s.Percentile(99.9) / 1e3, s.max / 1e3);
+    }
+    printf("total %llu requests in %.2fs, %.1f ops/s",
+           (unsigned long long) total, seconds, total / seconds);
+    if (options.watchers)
+        printf(", %llu watch events",
+               (unsigned long long) shared.events.load());
+    printf("\n");
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (! ParseOptions(argc, argv, options)) {
+        Usage();
+        return 1;
+    }
+
+    std::unique_ptr<etcd::test::MockServer> mock;
+    if (! options.port) {
+        mock.reset(new etcd::test::MockServer());
+        options.port = mock->GetPort();
+    }
+
+    try {
+        if (options.load) {
+            Client client(options.server, options.port);
+            std::string value(options.value_size, 'v');
+            for (size_t i = 0; i < options.keys; ++i)
+                client.Set(KeyName(options, i), value);
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "cannot load the key space: %s\n", e.what());
+        return 1;
+    }
+    if (mock && options.latency)
+        mock->SetLatency(options.latency);
+
+    std::unique_ptr<Zipfian> zipfian;
+    if (options.zipfian)
+        zipfian.reset(new Zipfian(options.keys, options.theta));
+
+    if (! options.record.empty() &&
+        ! etcd::TraceRecorder::Global().Start(options.record)) {
+        fprintf(stderr, "cannot write the trace %s\n",
+                options.record.c_str());
+        return 1;
+    }
+
+    Shared shared;
+    std::vector<std::thread> watchers;
+    for (size_t i = 0; i < options.watchers; ++i)
+        watchers.push_back(std::thread(Watcher, std::cref(options),
+                                       i % options.keys, std::ref(shared)));
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < options.concurrency; ++i)
+        workers.push_back(std::thread(Worker, std::cref(options),
+                                      zipfian.get(), (unsigned) i + 1,
+                                      std::ref(shared)));
+
+    std::this_thread::sleep_for(
+        std::chrono::duration<double>(options.duration));
+    shared.stop = true;
+    for (auto& w :workers)
+        w.join();
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    etcd::TraceRecorder::Global().Stop();
+    Report(options, shared, seconds);
+    fflush(stdout);
+
+    // Watches cannot be cancelled. The embedded server drops them when it
+    // stops, an external cluster would keep them waiting for a change.
+    shared.watch_stop = true;
+    if (! mock && ! watchers.empty())
+        std::quick_exit(0);
+    if (mock)
+        mock->Stop();
+    for (auto& w :watchers)
+        w.join();
+    return 0;
+}
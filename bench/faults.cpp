@@ -0,0 +1,248 @@
+/*
+ * Goodput and tail latency of etcd::Client under fault profiles. Every
+ * profile runs a get/set load through an etcd::test::FaultProxy in front of
+ * an embedded etcd::test::MockServer.
+ *
+ *   faults [--duration=seconds] [--concurrency=n] [--profile=name] [--json]
+ */
+
+#include "client.hpp"
+#include "fault_proxy.hpp"
+#include "mock_server.hpp"
+#include "rapid_reply.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using etcd::test::Fault;
+using etcd::test::FaultProfile;
+using etcd::test::FaultStep;
+
+typedef etcd::Client<etcd::RapidReply> Client;
+
+struct Scenario {
+    const char* name;
+    FaultProfile profile;
+    std::vector<FaultStep> script;
+};
+
+std::vector<Scenario> Scenarios() {
+    std::vector<Scenario> scenarios;
+    Scenario s;
+
+    s.name = "clean";
+    scenarios.push_back(s);
+
+    s = Scenario();
+    s.name = "latency";
+    s.profile.delay = 1000;
+    s.profile.jitter = 1000;
+    s.profile.tail_probability = 0.01;
+    s.profile.tail_delay = 50000;
+    scenarios.push_back(s);
+
+    s = Scenario();
+    s.name = "stalls";
+    s.profile.stall = 0.01;
+    s.profile.stall_duration = 500000;
+    scenarios.push_back(s);
+
+    s = Scenario();
+    s.name = "resets";
+    s.profile.reset = 0.05;
+    scenarios.push_back(s);
+
+    s = Scenario();
+    s.name = "truncated";
+    s.profile.truncate = 0.05;
+    scenarios.push_back(s);
+
+    s = Scenario();
+    s.name = "empty_replies";
+    s.profile.empty_reply = 0.05;
+    scenarios.push_back(s);
+
+    s = Scenario();
+    s.name = "redirects";
+    s.profile.redirect = 0.10;
+    scenarios.push_back(s);
+
+    // A clean start, an outage refusing every request, then a slow
+    // recovery
+    s = Scenario();
+    s.name = "outage";
+    s.script.push_back(FaultStep(Fault::FAULT_NONE, 2000));
+    s.script.push_back(FaultStep(Fault::FAULT_RESET, 500));
+    s.script.push_back(FaultStep(Fault::FAULT_STALL, 50, 200000));
+    s.profile.delay = 500;
+    scenarios.push_back(s);
+
+    s = Scenario();
+    s.name = "mixed";
+    s.profile.delay = 500;
+    s.profile.jitter = 500;
+    s.profile.tail_probability = 0.005;
+    s.profile.tail_delay = 100000;
+    s.profile.reset = 0.01;
+    s.profile.truncate = 0.01;
+    s.profile.empty_reply = 0.01;
+    s.profile.redirect = 0.02;
+    scenarios.push_back(s);
+
+    return scenarios;
+}
+
+struct Totals {
+    Totals() :errors(0) {}
+
+    etcd::LatencyHistogram ok;      // microseconds, successful requests
+    std::atomic<uint64_t> errors;
+};
+
+void Worker(etcd::Port port, unsigned seed, const std::atomic<bool>& stop,
+            Totals& totals) {
+    Client client("127.0.0.1", port);
+    std::mt19937 random(seed);
+    std::string value(64, 'v');
+    while (! stop.load(std::memory_order_relaxed)) {
+        std::string key = "/faults/k" + std::to_string(random() % 1000);
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        try {
+            if (random() % 5)
+                client.Get(key);
+            else
+                client.Set(key, value);
+            totals.ok.Record(etcd::internal::ElapsedMicros(start));
+        } catch (const etcd::ReplyException& e) {
+            // A missing key is a complete answer
+            if (e.error_code == 100)
+                totals.ok.Record(etcd::internal::ElapsedMicros(start));
+            else
+                totals.errors.fetch_add(1);
+        } catch (const std::exception&) {
+            totals.errors.fetch_add(1);
+        }
+    }
+}
+
+bool Value(const char* arg, const char* name, std::string& value) {
+    size_t len = std::strlen(name);
+    if (std::strncmp(arg, name, len) != 0 || arg[len] != '=')
+        return false;
+    value = arg + len + 1;
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double duration = 5;
+    size_t concurrency = 8;
+    std::string only;
+    bool json = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string v;
+        if (Value(argv[i], "--duration", v)) {
+            duration = std::atof(v.c_str());
+        } else if (Value(argv[i], "--concurrency", v)) {
+            concurrency = std::strtoul(v.c_str(), NULL, 10);
+        } else if (Value(argv[i], "--profile", v)) {
+            only = v;
+        } else if (std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else {
+            fprintf(stderr, "usage: faults [--duration=seconds] "
+                    "[--concurrency=n] [--profile=name] [--json]\n");
+            return 1;
+        }
+    }
+
+    if (json)
+        printf("[");
+    else
+        printf("%-14s %9s %8s %12s %10s %10s %10s  %s\n", "profile", "ok",
+               "errors", "goodput/s", "p50(ms)", "p99(ms)", "p999(ms)",
+               "injected");
+
+    bool first = true;
+    std::vector<Scenario> scenarios = Scenarios();
+    for (size_t i = 0; i < scenarios.size(); ++i) {
+        const Scenario& scenario = scenarios[i];
+        if (! only.empty() && only != scenario.name)
+            continue;
+
+        etcd::test::MockServer server;
+        etcd::test::FaultProxy proxy("127.0.0.1", server.GetPort());
+        proxy.SetProfile(scenario.profile);
+        proxy.Script(scenario.script);
+
+        Totals totals;
+        std::atomic<bool> stop(false);
+        std::vector<std::thread> workers;
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        for (size_t w = 0; w < concurrency; ++w)
+            workers.push_back(std::thread(Worker, proxy.GetPort(),
+                                          (unsigned) w + 1, std::cref(stop),
+                                          std::ref(totals)));
+        std::this_thread::sleep_for(std::chrono::duration<double>(duration));
+        stop = true;
+        for (auto& w :workers)
+            w.join();
+        double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+        etcd::HistogramSnapshot ok;
+        totals.ok.Snapshot(ok);
+        std::string injected;
+        for (size_t f = 1; f < etcd::test::kFaultCount; ++f) {
+            uint64_t n = proxy.Injected(static_cast<Fault>(f));
+            if (! n)
+                continue;
+            if (json)
+                injected += std::string(injected.empty() ? "" : ", ") +
+                    "\"" + etcd::test::FaultName(static_cast<Fault>(f)) +
+                    "\": " + std::to_string(n);
+            else
+                injected += std::string(injected.empty() ? "" : " ") +
+                    etcd::test::FaultName(static_cast<Fault>(f)) + "=" +
+                    std::to_string(n);
+        }
+
+        if (json) {
+            printf("%s\n  {\"profile\": \"%s\", \"ok\": %llu, "
+                   "\"errors\": %llu, \"goodput\": %.1f, \"p50_us\": %llu, "
+                   "\"p99_us\": %llu, \"p999_us\": %llu, "
+                   "\"injected\": {%s}}",
+                   first ? "" : ",", scenario.name,
+                   (unsigned long long) ok.count,
+                   (unsigned long long) totals.errors.load(),
+                   ok.count / seconds,
+                   (unsigned long long) ok.Percentile(50),
+                   (unsigned long long) ok.Percentile(99),
+                   (unsigned long long) ok.Percentile(99.9),
+                   injected.c_str());
+        } else {
+            printf("%-14s %9llu %8llu %12.1f %10.3f %10.3f %10.3f  %s\n",
+                   scenario.name, (unsigned long long) ok.count,
+                   (unsigned long long) totals.errors.load(),
+                   ok.count / seconds, ok.Percentile(50) / 1e3,
+                   ok.Percentile(99) / 1e3, ok.Percentile(99.9) / 1e3,
+                   injected.c_str());
+        }
+        fflush(stdout);
+        first = false;
+    }
+    if (json)
+        printf("\n]\n");
+    return 0;
+}
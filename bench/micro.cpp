@@ -0,0 +1,405 @@
+/*
+ * CPU microbenchmarks of the client's hot paths. Nothing here touches the
+ * network: replies are parsed from payloads shaped like etcd's, and URLs
+ * and request bodies are built the way etcd::Client builds them.
+ *
+ *   micro --benchmark_format=json --benchmark_out=micro.json
+ */
+
+#include "benchmark.hpp"
+#include "client.hpp"
+#include "internal/base64.hpp"
+#include "rapid_reply.hpp"
+#include "v3.hpp"
+
+namespace {
+
+using etcd::bench::DoNotOptimize;
+using etcd::bench::State;
+
+//------------------------------- PAYLOADS -----------------------------------
+
+std::string Node(const std::string& key, const std::string& value,
+                 etcd::Index index) {
+    return "{\"key\":\"" + key + "\",\"value\":\"" + value +
+        "\",\"modifiedIndex\":" + std::to_string(index) +
+        ",\"createdIndex\":" + std::to_string(index) + "}";
+}
+
+const std::string& SmallGet() {
+    static const std::string json =
+        "{\"action\":\"get\",\"node\":" +
+        Node("/config/service/endpoint", "10.0.0.1:8080", 42) + "}";
+    return json;
+}
+
+const std::string& WatchEvent() {
+    static const std::string json =
+        "{\"action\":\"set\",\"node\":" +
+        Node("/config/service/endpoint", "10.0.0.2:8080", 43) +
+        ",\"prevNode\":" +
+        Node("/config/service/endpoint", "10.0.0.1:8080", 42) + "}";
+    return json;
+}
+
+const std::string& ErrorReply() {
+    static const std::string json =
+        "{\"errorCode\":100,\"message\":\"Key not found\","
+        "\"cause\":\"/config/service/missing\",\"index\":42}";
+    return json;
+}
+
+/**
+ * @brief Recursive get of a directory of nodes keys, 100 keys per
+ * subdirectory
+ */
+std::string GetAllPayload(size_t nodes) {
+    std::string json = "{\"action\":\"get\",\"node\":{\"key\":\"/bench\","
+                       "\"dir\":true,\"nodes\":[";
+    etcd::Index index = 1;
+    for (size_t d = 0; d * 100 < nodes; ++d) {
+        std::string dir = "/bench/d" + std::to_string(d);
+        json += d ? ",{" : "{";
+        json += "\"key\":\"" + dir + "\",\"dir\":true,\"nodes\":[";
+        for (size_t k = 0; k < 100 && d * 100 + k < nodes; ++k) {
+            if (k)
+                json += ',';
+            json += Node(dir + "/k" + std::to_string(k),
+                         "value-" + std::to_string(index), index);
+            ++index;
+        }
+        json += "],\"modifiedIndex\":1,\"createdIndex\":1}";
+    }
+    json += "],\"modifiedIndex\":1,\"createdIndex\":1}}";
+    return json;
+}
+
+const std::string& GetAll10k() {
+    static const std::string json = GetAllPayload(10000);
+    return json;
+}
+
+const std::string& GetAll100k() {
+    static const std::string json = GetAllPayload(100000);
+    return json;
+}
+
+//------------------------------- REPLIES ------------------------------------
+
+void Parse(State& state, const std::string& json) {
+    while (state.KeepRunning()) {
+        etcd::RapidReply reply(json);
+        DoNotOptimize(reply);
+    }
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+
+void BM_ReplySmallGet(State& state) {
+    Parse(state, SmallGet());
+}
+ETCD_BENCHMARK(BM_ReplySmallGet);
+
+void BM_ReplyGetAll10k(State& state) {
+    Parse(state, GetAll10k());
+}
+ETCD_BENCHMARK(BM_ReplyGetAll10k);
+
+void BM_ReplyGetAll100k(State& state) {
+    Parse(state, GetAll100k());
+}
+ETCD_BENCHMARK(BM_ReplyGetAll100k);
+
+void BM_ReplyWatchEvent(State& state) {
+    Parse(state, WatchEvent());
+}
+ETCD_BENCHMARK(BM_ReplyWatchEvent);
+
+void BM_ReplyError(State& state) {
+    const std::string& json = ErrorReply();
+    while (state.KeepRunning()) {
+        try {
+            etcd::RapidReply reply(json);
+            DoNotOptimize(reply);
+        } catch (const etcd::ReplyException& e) {
+            DoNotOptimize(e.error_code);
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+ETCD_BENCHMARK(BM_ReplyError);
+
+void Flatten(State& state, const std::string& json, size_t nodes) {
+    etcd::RapidReply reply(json);
+    while (state.KeepRunning()) {
+        etcd::RapidReply::KvPairs pairs;
+        reply.GetAll(pairs);
+        DoNotOptimize(pairs);
+    }
+    state.SetItemsProcessed(state.iterations() * nodes);
+}
+
+void BM_GetAllFlatten10k(State& state) {
+    Flatten(state, GetAll10k(), 10000);
+}
+ETCD_BENCHMARK(BM_GetAllFlatten10k);
+
+void BM_GetAllFlatten100k(State& state) {
+    Flatten(state, GetAll100k(), 100000);
+}
+ETCD_BENCHMARK(BM_GetAllFlatten100k);
+
+void BM_ReplyExceptionWhat(State& state) {
+    etcd::ReplyException e(100, "Key not found", "/config/service/missing");
+    while (state.KeepRunning())
+        DoNotOptimize(e.what());
+}
+ETCD_BENCHMARK(BM_ReplyExceptionWhat);
+
+//------------------------------- URLS ---------------------------------------
+
+const etcd::internal::KeysUrl& Urls() {
+    static const etcd::internal::KeysUrl urls(
+        "http://127.0.0.1:2379/v2/keys/");
+    return urls;
+}
+
+const std::string kKey = "/config/service/endpoint";
+const std::string kValue = "10.0.0.1:8080";
+
+// Set, Get, Delete, SetOrdered, AddDirectory and UpdateDirectoryTtl
+void BM_UrlKey(State& state) {
+    while (state.KeepRunning())
+        DoNotOptimize(Urls().Key(kKey));
+}
+ETCD_BENCHMARK(BM_UrlKey);
+
+void BM_UrlGetAll(State& state) {
+    while (state.KeepRunning())
+        DoNotOptimize(Urls().Recursive(kKey));
+}
+ETCD_BENCHMARK(BM_UrlGetAll);
+
+void BM_UrlGetOrdered(State& state) {
+    while (state.KeepRunning())
+        DoNotOptimize(Urls().Sorted(kKey));
+}
+ETCD_BENCHMARK(BM_UrlGetOrdered);
+
+void BM_UrlDeleteDirectory(State& state) {
+    while (state.KeepRunning())
+        DoNotOptimize(Urls().Directory(kKey, true));
+}
+ETCD_BENCHMARK(BM_UrlDeleteDirectory);
+
+// CompareAndSwapIf and CompareAndDeleteIf share their URLs
+void BM_UrlPrevValue(State& state) {
+    while (state.KeepRunning())
+        DoNotOptimize(Urls().PrevValue(kKey, kValue));
+}
+ETCD_BENCHMARK(BM_UrlPrevValue);
+
+void BM_UrlPrevIndex(State& state) {
+    while (state.KeepRunning())
+        DoNotOptimize(Urls().PrevIndex(kKey, 123456789));
+}
+ETCD_BENCHMARK(BM_UrlPrevIndex);
+
+void BM_UrlPrevExist(State& state) {
+    while (state.KeepRunning())
+        DoNotOptimize(Urls().PrevExist(kKey, false));
+}
+ETCD_BENCHMARK(BM_UrlPrevExist);
+
+//------------------------------- REQUESTS -----------------------------------
+
+void BM_FormBodySet(State& state) {
+    etcd::internal::CurlOptions options = {{"value", kValue}};
+    while (state.KeepRunning())
+        DoNotOptimize(etcd::internal::FormBody(options));
+}
+ETCD_BENCHMARK(BM_FormBodySet);
+
+void BM_FormBodySetTtl(State& state) {
+    etcd::internal::CurlOptions options = {
+        {"value", kValue},
+        {"ttl", "30"},
+    };
+    while (state.KeepRunning())
+        DoNotOptimize(etcd::internal::FormBody(options));
+}
+ETCD_BENCHMARK(BM_FormBodySetTtl);
+
+void BM_FormBodyClearTtl(State& state) {
+    etcd::internal::CurlOptions options = {
+        {"value", kValue},
+        {"ttl", ""},
+        {"prevExist", "true"},
+    };
+    while (state.KeepRunning())
+        DoNotOptimize(etcd::internal::FormBody(options));
+}
+ETCD_BENCHMARK(BM_FormBodyClearTtl);
+
+void BM_UrlEncode(State& state) {
+    etcd::internal::Curl curl;
+    const std::string value = "/config/service name/end&point?x=1;y=ü";
+    while (state.KeepRunning())
+        DoNotOptimize(curl.UrlEncode(value));
+    state.SetBytesProcessed(state.iterations() * value.size());
+}
+ETCD_BENCHMARK(BM_UrlEncode);
+
+void BM_UrlDecode(State& state) {
+    etcd::internal::Curl curl;
+    const std::string value =
+        curl.UrlEncode("/config/service name/end&point?x=1;y=ü");
+    while (state.KeepRunning())
+        DoNotOptimize(curl.UrlDecode(value));
+    state.SetBytesProcessed(state.iterations() * value.size());
+}
+ETCD_BENCHMARK(BM_UrlDecode);
+
+//------------------------------- BASE64 -------------------------------------
+
+// What a codec written without care for speed does, for comparison
+std::string NaiveBase64Encode(const std::string& data) {
+    static const std::string kAlphabet =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < data.size(); i += 3) {
+        uint32_t v = uint32_t((unsigned char) data[i]) << 16;
+        if (i + 1 < data.size())
+            v |= uint32_t((unsigned char) data[i + 1]) << 8;
+        if (i + 2 < data.size())
+            v |= (unsigned char) data[i + 2];
+        out.push_back(kAlphabet[v >> 18]);
+        out.push_back(kAlphabet[(v >> 12) & 0x3f]);
+        out.push_back(i + 1 < data.size() ? kAlphabet[(v >> 6) & 0x3f] : '=');
+        out.push_back(i + 2 < data.size() ? kAlphabet[v & 0x3f] : '=');
+    }
+    return out;
+}
+
+std::string NaiveBase64Decode(const std::string& data) {
+    static const std::string kAlphabet =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    uint32_t bits = 0;
+    int count = 0;
+    for (char c :data) {
+        size_t v = kAlphabet.find(c);
+        if (v == std::string::npos)
+            break;
+        bits = (bits << 6) | uint32_t(v);
+        count += 6;
+        if (count >= 8) {
+            count -= 8;
+            out.push_back(char((bits >> count) & 0xff));
+        }
+    }
+    return out;
+}
+
+const std::string& Bytes4k() {
+    static std::string data;
+    if (data.empty()) {
+        for (size_t i = 0; i < 4096; ++i)
+            data.push_back(char(i * 2654435761u >> 24));
+    }
+    return data;
+}
+
+const std::string& Encoded4k() {
+    static const std::string encoded =
+        etcd::internal::Base64Encode(Bytes4k());
+    return encoded;
+}
+
+void BM_Base64EncodeNaive4k(State& state) {
+    while (state.KeepRunning())
+        DoNotOptimize(NaiveBase64Encode(Bytes4k()));
+    state.SetBytesProcessed(state.iterations() * Bytes4k().size());
+}
+ETCD_BENCHMARK(BM_Base64EncodeNaive4k);
+
+void BM_Base64Encode4k(State& state) {
+    while (state.KeepRunning())
+        DoNotOptimize(etcd::internal::Base64Encode(Bytes4k()));
+    state.SetBytesProcessed(state.iterations() * Bytes4k().size());
+}
+ETCD_BENCHMARK(BM_Base64Encode4k);
+
+void BM_Base64DecodeNaive4k(State& state) {
+    while (state.KeepRunning())
+        DoNotOptimize(NaiveBase64Decode(Encoded4k()));
+    state.SetBytesProcessed(state.iterations() * Encoded4k().size());
+}
+ETCD_BENCHMARK(BM_Base64DecodeNaive4k);
+
+void BM_Base64Decode4k(State& state) {
+    while (state.KeepRunning()) {
+        std::string out;
+        etcd::internal::Base64Decode(Encoded4k(), out);
+        DoNotOptimize(out);
+    }
+    state.SetBytesProcessed(state.iterations() * Encoded4k().size());
+}
+ETCD_BENCHMARK(BM_Base64Decode4k);
+
+// The v3 client decodes over the strings filled by the reply
+void BM_Base64DecodeInPlace4k(State& state) {
+    std::string data;
+    while (state.KeepRunning()) {
+        data = Encoded4k();
+        etcd::internal::Base64DecodeInPlace(data);
+        DoNotOptimize(data);
+    }
+    state.SetBytesProcessed(state.iterations() * Encoded4k().size());
+}
+ETCD_BENCHMARK(BM_Base64DecodeInPlace4k);
+
+/**
+ * @brief v3 range reply of 10k keys with 100 byte values, as sent by the
+ * gateway
+ */
+const std::string& Range10k() {
+    static std::string json;
+    if (json.empty()) {
+        json = "{\"header\":{\"revision\":\"10001\"},\"kvs\":[";
+        std::string value(100, 'v');
+        for (size_t i = 0; i < 10000; ++i) {
+            json += i ? ",{" : "{";
+            json += "\"key\":\"" + etcd::internal::Base64Encode(
+                "/bench/k" + std::to_string(i)) + "\",";
+            json += "\"create_revision\":\"" + std::to_string(i + 2) +
+                "\",\"mod_revision\":\"" + std::to_string(i + 2) +
+                "\",\"version\":\"1\",";
+            json += "\"value\":\"" + etcd::internal::Base64Encode(value) +
+                "\"}";
+        }
+        json += "],\"count\":\"10000\"}";
+    }
+    return json;
+}
+
+// Read the kvs out of a parsed reply and decode them, as V3Client::Range
+void BM_V3RangeDecode10k(State& state) {
+    etcd::RapidReply reply(Range10k());
+    while (state.KeepRunning()) {
+        etcd::v3::RangeResponse range;
+        reply.GetRange(range);
+        for (auto& kv :range.kvs) {
+            etcd::internal::Base64DecodeInPlace(kv.key);
+            etcd::internal::Base64DecodeInPlace(kv.value);
+        }
+        DoNotOptimize(range);
+    }
+    state.SetItemsProcessed(state.iterations() * 10000);
+}
+ETCD_BENCHMARK(BM_V3RangeDecode10k);
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    return etcd::bench::RunBenchmarks(argc, argv);
+}
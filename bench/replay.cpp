@@ -0,0 +1,168 @@
+/*
+ * Replays a trace recorded by etcd::TraceRecorder through the client's
+ * transport and reply parsing, without a server. Every recorded request is
+ * issued again in recorded order through etcd::internal::Curl, which
+ * etcd::TraceReplayer answers with the recorded response, and the response
+ * is parsed by etcd::RapidReply.
+ *
+ *   replay trace.bin [--speed=x] [--iterations=n] [--json]
+ *
+ * --speed=0, the default, answers at once and measures the client alone;
+ * --speed=1 adds the recorded time of every request, --speed=10 a tenth.
+ * Traces come from etcd::TraceRecorder::Global().Start(path) in any
+ * process, or from etcdcpp-bench --record=path.
+ */
+
+#include "client.hpp"
+#include "rapid_reply.hpp"
+#include "request_trace.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace {
+
+bool Value(const char* arg, const char* name, std::string& value) {
+    size_t len = std::strlen(name);
+    if (std::strncmp(arg, name, len) != 0 || arg[len] != '=')
+        return false;
+    value = arg + len + 1;
+    return true;
+}
+
+/**
+ * @brief Options back from a request body built by internal::FormBody.
+ * A field without '=' belongs to the value before it, which held a ';'.
+ */
+etcd::internal::CurlOptions ParseForm(const std::string& body) {
+    etcd::internal::CurlOptions options;
+    etcd::internal::CurlOptions::iterator last = options.end();
+    std::string::size_type pos = 0;
+    while (pos < body.size()) {
+        std::string::size_type end = body.find(';', pos);
+        if (end == std::string::npos)
+            end = body.size();
+        std::string field = body.substr(pos, end - pos);
+        pos = end + 1;
+
+        std::string::size_type eq = field.find('=');
+        if (eq == std::string::npos && last != options.end())
+            last->second += ';' + field;
+        else if (eq != std::string::npos)
+            last = options.insert(std::make_pair(field.substr(0, eq),
+                                                 field.substr(eq + 1))).first;
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string path;
+    double speed = 0;
+    size_t iterations = 1;
+    bool json = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string v;
+        if (Value(argv[i], "--speed", v)) {
+            speed = std::atof(v.c_str());
+        } else if (Value(argv[i], "--iterations", v)) {
+            iterations = std::strtoul(v.c_str(), NULL, 10);
+        } else if (std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (argv[i][0] != '-' && path.empty()) {
+            path = argv[i];
+        } else {
+            path.clear();
+            break;
+        }
+    }
+    if (path.empty() || ! iterations) {
+        fprintf(stderr, "usage: replay trace [--speed=x] [--iterations=n] "
+                "[--json]\n");
+        return 1;
+    }
+
+    etcd::TraceReplayer& replayer = etcd::TraceReplayer::Global();
+    if (! replayer.Load(path)) {
+        fprintf(stderr, "replay: cannot read the trace %s\n", path.c_str());
+        return 1;
+    }
+    const std::vector<etcd::TraceRecord>& records = replayer.GetRecords();
+    replayer.SetSpeed(speed);
+    replayer.Enable(true);
+
+    etcd::internal::Curl curl;
+    etcd::LatencyHistogram latency;     // microseconds per request
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for (size_t n = 0; n < iterations; ++n) {
+        replayer.Rewind();
+        for (size_t i = 0; i < records.size(); ++i) {
+            const etcd::TraceRecord& r = records[i];
+            std::string url = "http://replay" + r.path;
+            curl.EnableHeader(! r.header.empty());
+
+            std::chrono::steady_clock::time_point begin =
+                std::chrono::steady_clock::now();
+            try {
+                std::string body = r.method == "GET" ?
+                    curl.Get(url) :
+                    curl.Set(url, r.method, ParseForm(r.request));
+                bytes += body.size();
+                if (r.header.empty()) {
+                    etcd::RapidReply reply(body);
+                } else {
+                    etcd::RapidReply reply(curl.GetHeader(), body);
+                }
+            } catch (const etcd::ReplyException&) {
+                // An etcd error is a complete answer
+            } catch (const std::exception&) {
+                ++errors;
+            }
+            latency.Record(etcd::internal::ElapsedMicros(begin));
+        }
+    }
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    etcd::HistogramSnapshot s;
+    latency.Snapshot(s);
+    if (json) {
+        printf("{\"records\": %llu, \"iterations\": %llu, "
+               "\"requests\": %llu, \"errors\": %llu, \"missed\": %llu, "
+               "\"seconds\": %.3f, \"requests_per_sec\": %.1f, "
+               "\"mb_per_sec\": %.2f, \"p50_us\": %llu, \"p99_us\": %llu, "
+               "\"p999_us\": %llu, \"max_us\": %llu}\n",
+               (unsigned long long) records.size(),
+               (unsigned long long) iterations,
+               (unsigned long long) s.count,
+               (unsigned long long) errors,
+               (unsigned long long) replayer.Missed(),
+               seconds, s.count / seconds, bytes / seconds / 1e6,
+               (unsigned long long) s.Percentile(50),
+               (unsigned long long) s.Percentile(99),
+               (unsigned long long) s.Percentile(99.9),
+               (unsigned long long) s.max);
+        return 0;
+    }
+
+    printf("%llu records x %llu: %llu requests in %.3fs, %.1f requests/s, "
+           "%.2f MB/s of responses\n",
+           (unsigned long long) records.size(),
+           (unsigned long long) iterations,
+           (unsigned long long) s.count, seconds, s.count / seconds,
+           bytes / seconds / 1e6);
+    printf("per request p50 %.1fus p99 %.1fus p999 %.1fus max %.1fus\n",
+           (double) s.Percentile(50), (double) s.Percentile(99),
+           (double) s.Percentile(99.9), (double) s.max);
+    if (errors || replayer.Missed())
+        printf("%llu failed requests, %llu without a recorded response\n",
+               (unsigned long long) errors,
+               (unsigned long long) replayer.Missed());
+    return 0;
+}
@@ -0,0 +1,546 @@
+/*
+ * Watch fan-out: N watchers, each an etcd::Watch::Run on its own thread,
+ * spread over a set of keys which M writers update. For every number of
+ * watchers the report gives the write-to-callback latency, the events
+ * delivered per second and the resident memory and threads added per
+ * watcher.
+ *
+ *   watch_fanout --watchers=10,100,1000,10000 --writers=4 --keys=10
+ *                --rate=200 --duration=10 [--endpoint=host:port] [--json]
+ *
+ * Latency runs from the moment a writer issues the Set to the moment a
+ * watcher's callback receives the event, so it includes the write itself.
+ * Events coalesced by a resync after an index out of date are reported as
+ * lost.
+ *
+ * Without --endpoint each scale gets a fresh embedded
+ * etcd::test::MockServer. On POSIX systems it runs in a child process so
+ * its threads and memory stay out of the per watcher figures. Memory and
+ * thread counts are read from /proc and are 0 elsewhere.
+ */
+
+#include "client.hpp"
+#include "mock_server.hpp"
+#include "rapid_reply.hpp"
+#include "watch.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+typedef etcd::Client<etcd::RapidReply> Client;
+typedef etcd::Watch<etcd::RapidReply> Watch;
+typedef std::chrono::steady_clock::time_point TimePoint;
+typedef std::vector<std::pair<etcd::Index, TimePoint> > Timeline;
+
+//------------------------------- OPTIONS ------------------------------------
+
+struct Options {
+    Options()
+      :server("127.0.0.1"),
+       port(0),
+       writers(4),
+       keys(10),
+       rate(200),
+       duration(10),
+       prefix("/watch-fanout"),
+       json(false) {
+        scales.push_back(10);
+        scales.push_back(100);
+        scales.push_back(1000);
+        scales.push_back(10000);
+    }
+
+    std::string server;
+    etcd::Port port;            // 0 runs the embedded server
+    std::vector<size_t> scales; // numbers of watchers
+    size_t writers;
+    size_t keys;
+    double rate;                // writes per second of all writers, 0 for
+                                // as fast as possible
+    double duration;            // seconds per scale
+    std::string prefix;
+    bool json;
+};
+
+void Usage() {
+    fprintf(stderr,
+        "usage: watch_fanout [options]\n"
+        "  --endpoint=host:port   etcd to watch, default embedded server\n"
+        "  --watchers=n,...       numbers of watchers, one run each\n"
+        "                         default 10,100,1000,10000\n"
+        "  --writers=n            writer threads, default 4\n"
+        "  --keys=n               watched keys, default 10\n"
+        "  --rate=writes/s        total write rate, 0 unlimited, "
+        "default 200\n"
+        "  --duration=seconds     per scale, default 10\n"
+        "  --prefix=dir           key space directory, default "
+        "/watch-fanout\n"
+        "  --json                 report as JSON\n");
+}
+
+bool Value(const char* arg, const char* name, std::string& value) {
+    size_t len = std::strlen(name);
+    if (std::strncmp(arg, name, len) != 0 || arg[len] != '=')
+        return false;
+    value = arg + len + 1;
+    return true;
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string v;
+        const char* arg = argv[i];
+        if (Value(arg, "--endpoint", v)) {
+            std::string::size_type colon = v.rfind(':');
+            if (colon == std::string::npos)
+                return false;
+            options.server = v.substr(0, colon);
+            options.port = (etcd::Port) std::atoi(v.c_str() + colon + 1);
+        } else if (Value(arg, "--watchers", v)) {
+            options.scales.clear();
+            const char* p = v.c_str();
+            while (*p) {
+                char* end;
+                size_t n = std::strtoul(p, &end, 10);
+                if (end == p || ! n)
+                    return false;
+                options.scales.push_back(n);
+                p = *end == ',' ? end + 1 : end;
+            }
+        } else if (Value(arg, "--writers", v)) {
+            options.writers = std::strtoul(v.c_str(), NULL, 10);
+        } else if (Value(arg, "--keys", v)) {
+            options.keys = std::strtoul(v.c_str(), NULL, 10);
+        } else if (Value(arg, "--rate", v)) {
+            options.rate = std::atof(v.c_str());
+        } else if (Value(arg, "--duration", v)) {
+            options.duration = std::atof(v.c_str());
+        } else if (Value(arg, "--prefix", v)) {
+            options.prefix = v;
+        } else if (std::strcmp(arg, "--json") == 0) {
+            options.json = true;
+        } else {
+            return false;
+        }
+    }
+    // Watches cannot be cancelled, an external cluster would keep the
+    // watchers of a previous scale alive
+    if (options.port && options.scales.size() != 1)
+        return false;
+    return ! options.scales.empty() && options.writers > 0 &&
+        options.keys > 0 && options.duration > 0 && options.rate >= 0;
+}
+
+std::string KeyName(const Options& options, size_t key) {
+    return options.prefix + "/k" + std::to_string(key);
+}
+
+//------------------------------- PROCESS ------------------------------------
+
+struct ResourceUsage {
+    ResourceUsage() :rss_kb(0), threads(0) {}
+
+    uint64_t rss_kb;
+    uint64_t threads;
+};
+
+ResourceUsage ProcessUsage() {
+    ResourceUsage usage;
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            usage.rss_kb = std::strtoull(line.c_str() + 6, NULL, 10);
+        else if (line.compare(0, 8, "Threads:") == 0)
+            usage.threads = std::strtoull(line.c_str() + 8, NULL, 10);
+    }
+    return usage;
+}
+
+void RaiseFileLimit() {
+#ifndef _WIN32
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+        limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+}
+
+/**
+ * @brief The embedded server, in a child process where fork is available
+ */
+class Server {
+  public:
+    Server() :port_(0) {
+#ifdef _WIN32
+        server_.reset(new etcd::test::MockServer());
+        port_ = server_->GetPort();
+#else
+        int ports[2];
+        if (pipe(ports) != 0 || pipe(control_) != 0)
+            throw etcd::ClientException("watch_fanout: pipe failed");
+        fflush(stdout);
+        fflush(stderr);
+        child_ = fork();
+        if (child_ < 0)
+            throw etcd::ClientException("watch_fanout: fork failed");
+        if (child_ == 0) {
+            close(ports[0]);
+            close(control_[1]);
+            etcd::test::MockServer server;
+            etcd::Port port = server.GetPort();
+            if (write(ports[1], &port, sizeof(port)) == sizeof(port)) {
+                // Serve until the parent closes the pipe
+                char c;
+                while (read(control_[0], &c, 1) > 0) {
+                }
+            }
+            server.Stop();
+            _exit(0);
+        }
+        close(ports[1]);
+        close(control_[0]);
+        if (read(ports[0], &port_, sizeof(port_)) != sizeof(port_))
+            port_ = 0;
+        close(ports[0]);
+        if (! port_) {
+            Stop();
+            throw etcd::ClientException("watch_fanout: server failed");
+        }
+#endif
+    }
+
+    ~Server() {
+        Stop();
+    }
+
+    etcd::Port GetPort() const {
+        return port_;
+    }
+
+    void Stop() {
+#ifdef _WIN32
+        server_->Stop();
+#else
+        if (control_[1] < 0)
+            return;
+        close(control_[1]);
+        control_[1] = -1;
+        int status;
+        waitpid(child_, &status, 0);
+#endif
+    }
+
+  private:
+    etcd::Port port_;
+#ifdef _WIN32
+    std::unique_ptr<etcd::test::MockServer> server_;
+#else
+    pid_t child_;
+    int control_[2];
+#endif
+
+    Server(const Server& rhs);
+    void operator=(const Server& rhs);
+};
+
+//------------------------------- WORKERS ------------------------------------
+
+struct WatcherState {
+    WatcherState() :events(0) {}
+
+    std::atomic<uint64_t> events;
+    Timeline received;          // modifiedIndex, callback time
+};
+
+struct WriterState {
+    WriterState() :errors(0) {}
+
+    uint64_t errors;
+    Timeline sent;              // modifiedIndex, time the Set was issued
+};
+
+void Watcher(const Options& options, etcd::Port port, size_t key,
+             etcd::Index from, WatcherState& state) {
+    try {
+        Watch watch(options.server, port);
+        watch.Run(KeyName(options, key), [&](const etcd::RapidReply& r) {
+            TimePoint now = std::chrono::steady_clock::now();
+            try {
+                state.received.push_back(
+                    std::make_pair(r.GetModifiedIndex(), now));
+            } catch (const std::exception&) {
+            }
+            state.events.fetch_add(1, std::memory_order_release);
+        }, from);
+    } catch (const std::exception&) {
+        // The server went away, the run is over
+    }
+}
+
+void Writer(const Options& options, etcd::Port port, unsigned seed,
+            const std::atomic<bool>& stop, WriterState& state) {
+    Client client(options.server, port);
+    std::mt19937_64 random(seed);
+    std::uniform_int_distribution<size_t> pick(0, options.keys - 1);
+    std::chrono::duration<double> interval(
+        options.rate > 0 ? options.writers / options.rate : 0);
+    std::string value(64, 'v');
+
+    TimePoint next = std::chrono::steady_clock::now();
+    while (! stop.load(std::memory_order_relaxed)) {
+        if (interval.count() > 0) {
+            std::this_thread::sleep_until(next);
+            next += std::chrono::duration_cast<
+                std::chrono::steady_clock::duration>(interval);
+        }
+        TimePoint start = std::chrono::steady_clock::now();
+        try {
+            etcd::Index index =
+                client.Set(KeyName(options, pick(random)), value)
+                    .GetModifiedIndex();
+            state.sent.push_back(std::make_pair(index, start));
+        } catch (const std::exception&) {
+            ++state.errors;
+        }
+    }
+}
+
+//------------------------------- RUN ----------------------------------------
+
+struct Result {
+    Result()
+      :watchers(0), writes(0), write_errors(0), expected(0), delivered(0),
+       seconds(0), rss_kb_per_watcher(0), threads_per_watcher(0),
+       ready(true) {}
+
+    size_t watchers;
+    uint64_t writes;
+    uint64_t write_errors;
+    uint64_t expected;          // writes times the watchers of their key
+    uint64_t delivered;
+    double seconds;
+    double rss_kb_per_watcher;
+    double threads_per_watcher;
+    bool ready;                 // every watcher saw the warm up writes
+    etcd::HistogramSnapshot latency;    // microseconds
+};
+
+Result RunScale(const Options& options, size_t watchers) {
+    Result result;
+    result.watchers = watchers;
+
+    std::unique_ptr<Server> server;
+    etcd::Port port = options.port;
+    if (! port) {
+        server.reset(new Server());
+        port = server->GetPort();
+    }
+
+    Client client(options.server, port);
+    std::string value(64, 'v');
+    etcd::Index from = 0;
+    for (size_t k = 0; k < options.keys; ++k)
+        from = client.Set(KeyName(options, k), value).GetModifiedIndex();
+
+    ResourceUsage before = ProcessUsage();
+
+    // Watches start from the index of the last write, so none misses an
+    // event while its thread is still connecting
+    std::vector<std::unique_ptr<WatcherState> > states;
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < watchers; ++w) {
+        states.push_back(std::unique_ptr<WatcherState>(new WatcherState()));
+        threads.push_back(std::thread(Watcher, std::cref(options), port,
+                                      w % options.keys, from,
+                                      std::ref(*states.back())));
+    }
+
+    // Warm up: one write per key, until every watcher has its event back
+    for (size_t k = 0; k < options.keys; ++k)
+        client.Set(KeyName(options, k), value);
+    TimePoint deadline = std::chrono::steady_clock::now() +
+        std::chrono::seconds(60);
+    for (size_t w = 0; w < watchers; ++w) {
+        while (! states[w]->events.load(std::memory_order_acquire)) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                result.ready = false;
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    ResourceUsage after = ProcessUsage();
+    result.rss_kb_per_watcher =
+        after.rss_kb > before.rss_kb ?
+        double(after.rss_kb - before.rss_kb) / watchers : 0;
+    result.threads_per_watcher =
+        after.threads > before.threads ?
+        double(after.threads - before.threads) / watchers : 0;
+
+    std::atomic<bool> stop(false);
+    std::vector<std::unique_ptr<WriterState> > writer_states;
+    std::vector<std::thread> writers;
+    TimePoint start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < options.writers; ++i) {
+        writer_states.push_back(
+            std::unique_ptr<WriterState>(new WriterState()));
+        writers.push_back(std::thread(Writer, std::cref(options), port,
+                                      (unsigned) i + 1, std::cref(stop),
+                                      std::ref(*writer_states.back())));
+    }
+    std::this_thread::sleep_for(
+        std::chrono::duration<double>(options.duration));
+    stop = true;
+    for (auto& w :writers)
+        w.join();
+    result.seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    // Let the watchers drain what is in flight before the server stops
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    if (server) {
+        server->Stop();
+        for (auto& t :threads)
+            t.join();
+    } else {
+        // An external cluster never ends the watches, they die with us
+        for (auto& t :threads)
+            t.detach();
+    }
+
+    // Match every event to the write which caused it
+    std::unordered_map<etcd::Index, TimePoint> sent;
+    for (const auto& state :writer_states) {
+        result.write_errors += state->errors;
+        for (const auto& s :state->sent)
+            sent[s.first] = s.second;
+    }
+    result.writes = sent.size();
+
+    etcd::LatencyHistogram latency;
+    for (const auto& state :states) {
+        for (const auto& r :state->received) {
+            std::unordered_map<etcd::Index, TimePoint>::const_iterator it =
+                sent.find(r.first);
+            if (it == sent.end())
+                continue;
+            ++result.delivered;
+            latency.Record(std::chrono::duration_cast<
+                std::chrono::microseconds>(r.second - it->second).count());
+        }
+    }
+    latency.Snapshot(result.latency);
+
+    // Every watcher of a key expects every write to it, the writers pick
+    // keys uniformly
+    result.expected = result.writes * watchers / options.keys;
+    return result;
+}
+
+//------------------------------- REPORT -------------------------------------
+
+void Report(const Options& options, const Result& r, bool first) {
+    const etcd::HistogramSnapshot& l = r.latency;
+    uint64_t lost = r.expected > r.delivered ? r.expected - r.delivered : 0;
+    if (options.json) {
+        printf("%s\n  {\"watchers\": %llu, \"writers\": %llu, "
+               "\"keys\": %llu, \"writes\": %llu, \"write_errors\": %llu, "
+               "\"events\": %llu, \"lost\": %llu, \"events_per_sec\": %.1f, "
+               "\"p50_us\": %llu, \"p99_us\": %llu, \"p999_us\": %llu, "
+               "\"max_us\": %llu, \"rss_kb_per_watcher\": %.1f, "
+               "\"threads_per_watcher\": %.2f, \"ready\": %s}",
+               first ? "" : ",",
+               (unsigned long long) r.watchers,
+               (unsigned long long) options.writers,
+               (unsigned long long) options.keys,
+               (unsigned long long) r.writes,
+               (unsigned long long) r.write_errors,
+               (unsigned long long) r.delivered,
+               (unsigned long long) lost,
+               r.delivered / r.seconds,
+               (unsigned long long) l.Percentile(50),
+               (unsigned long long) l.Percentile(99),
+               (unsigned long long) l.Percentile(99.9),
+               (unsigned long long) l.max,
+               r.rss_kb_per_watcher, r.threads_per_watcher,
+               r.ready ? "true" : "false");
+        return;
+    }
+
+    printf("%9llu %9llu %10llu %8llu %12.1f %9.3f %9.3f %9.3f %9.3f "
+           "%10.1f %11.2f%s\n",
+           (unsigned long long) r.watchers,
+           (unsigned long long) r.writes,
+           (unsigned long long) r.delivered,
+           (unsigned long long) lost,
+           r.delivered / r.seconds,
+           l.Percentile(50) / 1e3, l.Percentile(99) / 1e3,
+           l.Percentile(99.9) / 1e3, l.max / 1e3,
+           r.rss_kb_per_watcher, r.threads_per_watcher,
+           r.ready ? "" : "  (not every watcher connected)");
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (! ParseOptions(argc, argv, options)) {
+        Usage();
+        return 1;
+    }
+    RaiseFileLimit();
+
+    if (options.json)
+        printf("[");
+    else
+        printf("%9s %9s %10s %8s %12s %9s %9s %9s %9s %10s %11s\n",
+               "watchers", "writes", "events", "lost", "events/s",
+               "p50(ms)", "p99(ms)", "p999(ms)", "max(ms)", "KB/watcher",
+               "thr/watcher");
+
+    bool first = true;
+    for (size_t i = 0; i < options.scales.size(); ++i) {
+        Result result;
+        try {
+            result = RunScale(options, options.scales[i]);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "%llu watchers: %s\n",
+                    (unsigned long long) options.scales[i], e.what());
+            return 1;
+        }
+        Report(options, result, first);
+        fflush(stdout);
+        first = false;
+    }
+    if (options.json)
+        printf("\n]\n");
+
+    // Watches cannot be cancelled, against an external cluster they are
+    // still waiting
+    fflush(stdout);
+    if (options.port)
+        std::quick_exit(0);
+    return 0;
+}
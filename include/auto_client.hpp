@@ -0,0 +1,411 @@
+#ifndef __ETCD_AUTO_CLIENT_HPP_INCLUDED__
+#define __ETCD_AUTO_CLIENT_HPP_INCLUDED__
+
+#include "range_scan.hpp"
+#include <cstdlib>
+#include <map>
+
+namespace etcd {
+
+/**
+ * @brief Whether members of the given version serve the v3 JSON gateway
+ * at /v3/, as etcd::V3Client speaks it: etcd 3.4 and later. Earlier 3.x
+ * releases serve it at /v3alpha/ or /v3beta/ only.
+ *
+ * @param version /version of a member. The cluster version is the lowest
+ * version of the members, it decides when the member reports one.
+ */
+inline bool HasV3Gateway(const VersionInfo& version) {
+    const std::string& v = version.cluster.empty() ? version.server :
+                                                     version.cluster;
+    char* end = NULL;
+    long major = std::strtol(v.c_str(), &end, 10);
+    if (end == v.c_str())
+        return false;
+    long minor = *end == '.' ? std::strtol(end + 1, NULL, 10) : 0;
+    return major > 3 || (major == 3 && minor >= 4);
+}
+
+/**
+ * @brief One client for clusters with and without the v3 API.
+ *
+ * The first operation probes /version of the cluster, once, and picks the
+ * backend: the v3 API when every member serves it, else v2. Key reads and
+ * writes, prefix reads, scans, compare-and-swap and keys with a ttl all go
+ * to that backend, so an application gets v3 ranges, transactions and
+ * leases where the cluster has them, without code changes. v2 and v3 keys
+ * are separate keyspaces in etcd, which is why the key operations are not
+ * split between the two: a key put through this client is always seen by
+ * its reads. Directories, in-order keys, statistics, membership and health
+ * stay with the v2 client, see GetV2Client.
+ *
+ * A probe which fails throws etcd::ClientException and is retried by the
+ * next operation; its result is kept for the life of the client.
+ *
+ *   etcd::AutoClient<etcd::RapidReply> client("10.0.0.1", 2379);
+ *   client.Put("/config/a", "1");
+ *   etcd::v3::KeyValues config = client.GetPrefix("/config/");
+ *
+ * @tparam Reply json reply wrapper, see etcd::Client, etcd::V3Client and
+ * etcd::RangeScan
+ * @tparam Tracer begin/end hooks around every request, see etcd::NullTracer
+ */
+template <typename Reply, typename Tracer = NullTracer>
+class AutoClient {
+  public:
+    // TYPES
+    typedef RangeScan<Reply, Tracer> Scanner;
+
+    // LIFECYCLE
+    AutoClient(const std::string& server, const Port& port);
+
+    explicit AutoClient(const std::shared_ptr<ClusterEndpoints>& endpoints);
+
+    // OPERATIONS
+    /**
+     * @brief Whether the key operations use the v3 API, probes the cluster
+     * on the first call
+     */
+    bool HasV3();
+
+    /**
+     * @brief /version of the cluster the backend was picked from
+     */
+    const VersionInfo& GetVersion();
+
+    /**
+     * @brief Read one key
+     *
+     * @param kv filled in if the key exists. With v2 the revisions are its
+     * created and modified indexes.
+     *
+     * @return false if the key does not exist, or is a v2 directory
+     */
+    bool Get(const std::string& key, v3::KeyValue& kv);
+
+    /**
+     * @brief Set the value of a key
+     *
+     * @param ttl seconds until the key is deleted, 0 for never. With v3
+     * the keys put with the same ttl within a tenth of it share a lease,
+     * granted by the first of them, so a key is deleted between 0.9 and 1
+     * times ttl after its put. The leases are left to expire. Keys kept
+     * alive, or many keys with a ttl each, are cheaper on a lease of
+     * etcd::LeaseManager put through GetV3Client.
+     */
+    void Put(const std::string& key,
+             const std::string& value,
+             TtlValue ttl = 0);
+
+    /**
+     * @brief Delete one key
+     *
+     * @return false if it did not exist
+     */
+    bool Delete(const std::string& key);
+
+    /**
+     * @brief Read every key under prefix. With v2 prefix is a directory,
+     * read directory by directory as by Scan.
+     */
+    v3::KeyValues GetPrefix(const std::string& prefix);
+
+    /**
+     * @brief Page through every key under prefix, see etcd::RangeScan. The
+     * scan has a connection of its own and may outlive the client.
+     */
+    std::unique_ptr<Scanner> Scan(
+        const std::string& prefix,
+        size_t page_size = Scanner::kDefaultPageSize);
+
+    /**
+     * @brief Atomically set key to value if its value is prev_value
+     *
+     * @return false if the key did not have that value
+     */
+    bool CompareAndSwapIf(const std::string& key,
+                          const std::string& value,
+                          const std::string& prev_value);
+
+    /**
+     * @brief Atomically set key to value if it was last modified at
+     * prev_revision, with v2 its modified index, 0 to only create it
+     *
+     * @return false if the key was modified since, or exists for 0
+     */
+    bool CompareAndSwapIf(const std::string& key,
+                          const std::string& value,
+                          v3::Revision prev_revision);
+
+    /**
+     * @brief The v2 client, for the operations v3 does not have
+     */
+    Client<Reply, Tracer>& GetV2Client();
+
+    /**
+     * @brief The v3 client, for transactions and leases, NULL if the
+     * cluster does not serve v3
+     */
+    V3Client<Reply, Tracer>* GetV3Client();
+
+  private:
+    // CONSTANTS
+    static const int kLeaseReuse = 10;  // a lease is shared for ttl / it
+
+    // TYPES
+    typedef std::chrono::steady_clock Clock;
+
+    struct Lease {
+        v3::LeaseId id;
+        Clock::time_point shared_until;
+    };
+
+    // DATA MEMBERS
+    std::string server_;
+    Port port_;
+    std::shared_ptr<ClusterEndpoints> endpoints_;
+    Client<Reply, Tracer> v2_;
+    std::unique_ptr<V3Client<Reply, Tracer> > v3_;
+    bool detected_;
+    VersionInfo version_;
+    std::map<TtlValue, Lease> leases_;  // v3: leases of Put, by ttl
+
+    // LIFECYCLE
+    AutoClient(const AutoClient& rhs);
+    void operator=(const AutoClient& rhs);
+
+    // OPERATIONS
+    void _Detect();
+
+    v3::LeaseId _Lease(TtlValue ttl);
+
+    static bool _Failed(const ReplyException& e);
+};
+
+template <typename Reply, typename Tracer>
+const int AutoClient<Reply, Tracer>::kLeaseReuse;
+
+//------------------------------- LIFECYCLE ----------------------------------
+
+template <typename Reply, typename Tracer> AutoClient<Reply, Tracer>::
+AutoClient(const std::string& server, const Port& port)
+  :server_(server),
+   port_(port),
+   v2_(server, port),
+   detected_(false) {
+}
+
+template <typename Reply, typename Tracer> AutoClient<Reply, Tracer>::
+AutoClient(const std::shared_ptr<ClusterEndpoints>& endpoints)
+  :port_(0),
+   endpoints_(endpoints),
+   v2_(endpoints),
+   detected_(false) {
+}
+
+//------------------------------- OPERATIONS ---------------------------------
+
+template <typename Reply, typename Tracer> bool AutoClient<Reply, Tracer>::
+HasV3() {
+    _Detect();
+    return v3_ != NULL;
+}
+
+template <typename Reply, typename Tracer>
+const VersionInfo& AutoClient<Reply, Tracer>::
+GetVersion() {
+    _Detect();
+    return version_;
+}
+
+template <typename Reply, typename Tracer> bool AutoClient<Reply, Tracer>::
+Get(const std::string& key, v3::KeyValue& kv) {
+    _Detect();
+    if (v3_) {
+        v3::RangeResponse range = v3_->Get(key);
+        if (range.kvs.empty())
+            return false;
+        kv = range.kvs[0];
+        return true;
+    }
+
+    Nodes nodes;
+    try {
+        v2_.Get(key).GetNodes(nodes);
+    } catch (const ReplyException& e) {
+        if (e.error_code != 100)
+            throw;
+        return false;
+    }
+    // A directory is answered with its children
+    std::string path = key.empty() || key[0] != '/' ? '/' + key : key;
+    if (nodes.size() != 1 || nodes[0].dir || nodes[0].key != path)
+        return false;
+    kv = v3::KeyValue();
+    kv.key = nodes[0].key;
+    kv.value = nodes[0].value;
+    kv.create_revision = static_cast<v3::Revision>(nodes[0].created_index);
+    kv.mod_revision = static_cast<v3::Revision>(nodes[0].modified_index);
+    return true;
+}
+
+template <typename Reply, typename Tracer> void AutoClient<Reply, Tracer>::
+Put(const std::string& key, const std::string& value, TtlValue ttl) {
+    _Detect();
+    if (! v3_) {
+        if (ttl)
+            v2_.Set(key, value, ttl);
+        else
+            v2_.Set(key, value);
+        return;
+    }
+    v3::PutOptions options;
+    if (ttl)
+        options.lease = _Lease(ttl);
+    try {
+        v3_->Put(key, value, options);
+    } catch (const ReplyException& e) {
+        // The shared lease was revoked meanwhile, grant another one
+        if (! ttl || e.error_code != 5)
+            throw;
+        leases_.erase(ttl);
+        options.lease = _Lease(ttl);
+        v3_->Put(key, value, options);
+    }
+}
+
+template <typename Reply, typename Tracer> bool AutoClient<Reply, Tracer>::
+Delete(const std::string& key) {
+    _Detect();
+    if (v3_)
+        return v3_->Delete(key).deleted > 0;
+    try {
+        v2_.Delete(key);
+    } catch (const ReplyException& e) {
+        if (e.error_code != 100)
+            throw;
+        return false;
+    }
+    return true;
+}
+
+template <typename Reply, typename Tracer>
+v3::KeyValues AutoClient<Reply, Tracer>::
+GetPrefix(const std::string& prefix) {
+    _Detect();
+    if (v3_)
+        return v3_->GetPrefix(prefix).kvs;
+
+    v3::KeyValues kvs;
+    v3::KeyValues page;
+    std::unique_ptr<Scanner> scan = Scan(prefix);
+    while (scan->Next(page))
+        kvs.insert(kvs.end(), page.begin(), page.end());
+    return kvs;
+}
+
+template <typename Reply, typename Tracer>
+std::unique_ptr<typename AutoClient<Reply, Tracer>::Scanner>
+AutoClient<Reply, Tracer>::
+Scan(const std::string& prefix, size_t page_size) {
+    _Detect();
+    typename Scanner::Api api = v3_ ? Scanner::API_V3 : Scanner::API_V2;
+    if (endpoints_)
+        return std::unique_ptr<Scanner>(
+            new Scanner(endpoints_, prefix, page_size, api));
+    return std::unique_ptr<Scanner>(
+        new Scanner(server_, port_, prefix, page_size, api));
+}
+
+template <typename Reply, typename Tracer> bool AutoClient<Reply, Tracer>::
+CompareAndSwapIf(
+    const std::string& key,
+    const std::string& value,
+    const std::string& prev_value) {
+    _Detect();
+    if (v3_)
+        return v3_->CompareAndSwapIf(key, value, prev_value).succeeded;
+    try {
+        v2_.CompareAndSwapIf(key, value, prev_value);
+    } catch (const ReplyException& e) {
+        if (! _Failed(e))
+            throw;
+        return false;
+    }
+    return true;
+}
+
+template <typename Reply, typename Tracer> bool AutoClient<Reply, Tracer>::
+CompareAndSwapIf(
+    const std::string& key,
+    const std::string& value,
+    v3::Revision prev_revision) {
+    _Detect();
+    if (v3_)
+        return v3_->CompareAndSwapIf(key, value, prev_revision).succeeded;
+    try {
+        if (prev_revision)
+            v2_.CompareAndSwapIf(key, value, static_cast<Index>(prev_revision));
+        else
+            v2_.CompareAndSwapIf(key, value, false);
+    } catch (const ReplyException& e) {
+        if (! _Failed(e))
+            throw;
+        return false;
+    }
+    return true;
+}
+
+template <typename Reply, typename Tracer>
+Client<Reply, Tracer>& AutoClient<Reply, Tracer>::
+GetV2Client() {
+    return v2_;
+}
+
+template <typename Reply, typename Tracer>
+V3Client<Reply, Tracer>* AutoClient<Reply, Tracer>::
+GetV3Client() {
+    _Detect();
+    return v3_.get();
+}
+
+template <typename Reply, typename Tracer> void AutoClient<Reply, Tracer>::
+_Detect() {
+    if (detected_)
+        return;
+    version_ = v2_.Version();
+    if (HasV3Gateway(version_)) {
+        if (endpoints_)
+            v3_.reset(new V3Client<Reply, Tracer>(endpoints_));
+        else
+            v3_.reset(new V3Client<Reply, Tracer>(server_, port_));
+    }
+    detected_ = true;
+}
+
+template <typename Reply, typename Tracer>
+v3::LeaseId AutoClient<Reply, Tracer>::
+_Lease(TtlValue ttl) {
+    // Timed from before the grant, the lease expires no sooner than that
+    Clock::time_point now = Clock::now();
+    typename std::map<TtlValue, Lease>::const_iterator it = leases_.find(ttl);
+    if (it != leases_.end() && now < it->second.shared_until)
+        return it->second.id;
+
+    Lease lease;
+    lease.id = v3_->LeaseGrant(static_cast<int64_t>(ttl)).id;
+    lease.shared_until = now + std::chrono::milliseconds(ttl * 1000) /
+        kLeaseReuse;
+    leases_[ttl] = lease;
+    return lease.id;
+}
+
+template <typename Reply, typename Tracer> bool AutoClient<Reply, Tracer>::
+_Failed(const ReplyException& e) {
+    // Key not found, compare failed, node exist
+    return e.error_code == 100 || e.error_code == 101 || e.error_code == 105;
+}
+
+} // namespace etcd
+
+#endif // __ETCD_AUTO_CLIENT_HPP_INCLUDED__
@@ -1,10 +1,16 @@
 #ifndef __ETCD_CLIENT_HPP_INCLUDED__
 #define __ETCD_CLIENT_HPP_INCLUDED__
 
+#include "health.hpp"
 #include "internal/curl.hpp"
+#include "members.hpp"
+#include "metrics.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace etcd {
 
@@ -87,18 +93,168 @@ typedef uint16_t Port;
 typedef uint64_t Index;
 typedef uint64_t TtlValue;
 
+/**
+ * @brief A node of a v2 directory listing, without its children
+ */
+struct Node {
+    Node()
+      :dir(false),
+       created_index(0),
+       modified_index(0)
+      {}
+
+    std::string key;
+    std::string value;          // empty for a directory
+    bool dir;
+    Index created_index;
+    Index modified_index;
+};
+
+typedef std::vector<Node> Nodes;
+
+/**
+ * @brief How up to date a read has to be
+ */
+struct ReadConsistency {
+    enum Level {
+        LEVEL_LOCAL,        // what the member has applied, the fastest
+        LEVEL_QUORUM,       // linearizable, a raft round trip
+        LEVEL_MIN_INDEX     // local if the member has applied min_index
+    };
+
+    explicit ReadConsistency(Level level = LEVEL_LOCAL, Index min_index = 0)
+      :level(level),
+       min_index(min_index)
+      {}
+
+    /**
+     * @brief Any member answers from its own store, possibly stale
+     */
+    static ReadConsistency Local() {
+        return ReadConsistency(LEVEL_LOCAL);
+    }
+
+    /**
+     * @brief The read goes through the leader and sees every write
+     * acknowledged before it
+     */
+    static ReadConsistency Quorum() {
+        return ReadConsistency(LEVEL_QUORUM);
+    }
+
+    /**
+     * @brief Bounded staleness: the member answers if it has applied index,
+     * e.g. the index of the caller's last write, else the read is repeated
+     * with quorum
+     */
+    static ReadConsistency AtLeast(Index index) {
+        return ReadConsistency(LEVEL_MIN_INDEX, index);
+    }
+
+    Level level;
+    Index min_index;            // LEVEL_MIN_INDEX only
+};
+
+namespace internal {
+
+/**
+ * @brief Builds the v2 keys API URLs used by etcd::Client
+ */
+class KeysUrl {
+  public:
+    // LIFECYCLE
+    explicit KeysUrl(const std::string& prefix = std::string())
+      :prefix_(prefix)
+      {}
+
+    // OPERATIONS
+    const std::string& Prefix() const {
+        return prefix_;
+    }
+
+    std::string Key(const std::string& key) const {
+        return prefix_ + key;
+    }
+
+    std::string Recursive(const std::string& key) const {
+        return _Query(key, "?recursive=true");
+    }
+
+    std::string Quorum(const std::string& key, bool recursive) const {
+        return _Query(key, recursive ? "?recursive=true&quorum=true"
+                                     : "?quorum=true");
+    }
+
+    std::string Sorted(const std::string& dir) const {
+        return _Query(dir, "?recursive=true&sorted=true");
+    }
+
+    std::string Directory(const std::string& dir, bool recursive) const {
+        return _Query(dir, recursive ? "?dir=true&recursive=true"
+                                     : "?dir=true");
+    }
+
+    std::string PrevValue(const std::string& key,
+                          const std::string& prevValue) const {
+        return _Query(key, "?prevValue=") + prevValue;
+    }
+
+    std::string PrevIndex(const std::string& key,
+                          const Index& prevIndex) const {
+        return _Query(key, "?prevIndex=") + std::to_string(prevIndex);
+    }
+
+    std::string PrevExist(const std::string& key, bool prevExist) const {
+        return _Query(key, prevExist ? "?prevExist=true"
+                                     : "?prevExist=false");
+    }
+
+  private:
+    // DATA MEMBERS
+    std::string prefix_;
+
+    // OPERATIONS
+    std::string _Query(const std::string& key, const char* query) const {
+        std::string url;
+        url.reserve(prefix_.size() + key.size() + 32);
+        url += prefix_;
+        url += key;
+        url += query;
+        return url;
+    }
+};
+
+} // namespace internal
+
 /**
  * @brief c++ language binding for an etcd curl client
  *
  * @tparam Reply see rapid_reply.hpp for an example Reply template. It should
  * be constructable using a std::string(json response).
+ * @tparam Tracer begin/end hooks around every request, see etcd::NullTracer
+ * in trace.hpp. The default policy compiles to nothing.
  */
-template <typename Reply>
+template <typename Reply, typename Tracer = NullTracer>
 class Client {
   public:
     // LIFECYCLE
     Client(const std::string& server, const Port& port);
 
+    Client(const std::string& server, const Port& port, const Tracer& tracer);
+
+    /**
+     * @brief Create a client following the endpoints of a cluster. Requests
+     * go to the current endpoint of the set; when one cannot be reached the
+     * set moves on to the next endpoint, for this and every other client.
+     *
+     * @param endpoints endpoint set, see etcd::MemberDiscovery to keep it
+     * up to date
+     */
+    explicit Client(const std::shared_ptr<ClusterEndpoints>& endpoints);
+
+    Client(const std::shared_ptr<ClusterEndpoints>& endpoints,
+           const Tracer& tracer);
+
     // OPERATIONS
 
     /**
@@ -181,6 +337,12 @@ class Client {
      */
     Reply Get(const std::string& key);
 
+    /**
+     * @brief Get the value of a key with the given consistency rather than
+     * the client's, see SetReadConsistency
+     */
+    Reply Get(const std::string& key, const ReadConsistency& consistency);
+
     /**
      * @brief Recursively get all the keys and directory rooted @ key
      *
@@ -190,6 +352,23 @@ class Client {
      */
     Reply GetAll(const std::string& key);
 
+    /**
+     * @brief Recursively get a directory with the given consistency rather
+     * than the client's
+     */
+    Reply GetAll(const std::string& key,
+                 const ReadConsistency& consistency);
+
+    /**
+     * @brief Consistency of Get and GetAll, local by default as with etcd:
+     * the member contacted answers from its store, which may lag behind
+     * the leader. A minimum index is checked against the X-Etcd-Index of
+     * the answer; a member behind it costs a second, quorum read.
+     */
+    void SetReadConsistency(const ReadConsistency& consistency);
+
+    const ReadConsistency& GetReadConsistency() const;
+
     /**
      * @brief enumerate the in-order keys as a sorted list
      *
@@ -320,6 +499,88 @@ class Client {
         const std::string& key,
         const Index& prevIndex);
 
+    /**
+     * @brief Latency and append request counts of the leader to each
+     * follower, from /v2/stats/leader. Requires Reply to implement
+     * void GetLeaderStats(LeaderStats&) const, see etcd::RapidReply.
+     *
+     * @return statistics of the leader. Throws etcd::ClientException when
+     * the member is not the leader, etcd answers 403 then.
+     */
+    LeaderStats GetLeaderStats();
+
+    /**
+     * @brief Raft state, leader and send/receive rates of the member this
+     * client talks to, from /v2/stats/self. Requires Reply to implement
+     * void GetSelfStats(SelfStats&) const.
+     *
+     * @return statistics of the member
+     */
+    SelfStats GetSelfStats();
+
+    /**
+     * @brief Success and failure counters of every key store operation of
+     * the member, from /v2/stats/store. Requires Reply to implement
+     * void GetStoreStats(StoreStats&) const.
+     *
+     * @return statistics of the member's store
+     */
+    StoreStats GetStoreStats();
+
+    /**
+     * @brief Members of the cluster, from /v2/members. Requires Reply to
+     * implement void GetMembers(Members&) const, see etcd::RapidReply.
+     *
+     * @return every member, including the ones not started yet
+     */
+    Members GetMembers();
+
+    /**
+     * @brief Health of the endpoint the next request goes to, from /health.
+     * Probed on the connection of the client's HealthProbe with tight
+     * timeouts and cached, see etcd::HealthProbe. Requires Reply to
+     * implement void GetHealth(HealthStatus&) const.
+     *
+     * @return the health of the endpoint, never throws
+     */
+    HealthStatus Health();
+
+    /**
+     * @brief Server and cluster version of the endpoint the next request
+     * goes to, from /version, probed and cached as Health. Requires Reply
+     * to implement void GetVersion(VersionInfo&) const.
+     *
+     * @return the versions. Throws etcd::ClientException if the endpoint
+     * could not be probed.
+     */
+    VersionInfo Version();
+
+    /**
+     * @brief Share a probe, and its cache, with other clients. Without one
+     * the client creates its own on the first Health or Version.
+     */
+    void SetHealthProbe(const std::shared_ptr<HealthProbe<Reply> >& probe);
+
+    /**
+     * @brief URL of the endpoint the next request goes to, e.g.
+     * "http://10.0.0.1:2379"
+     */
+    const std::string& GetEndpoint();
+
+    /**
+     * @brief Latency histograms of every request made by this client, per
+     * operation type and per endpoint, and its transport counters. Take a
+     * snapshot to read them.
+     *
+     * @return metrics registry of the client
+     */
+    const ClientMetrics& GetMetrics() const;
+
+    /**
+     * @brief Access the tracer policy instance, e.g. to configure it
+     */
+    Tracer& GetTracer();
+
   private:
     // CONSTANTS
     const char *kPutRequest = "PUT";
@@ -330,294 +591,542 @@ class Client {
     const char *kTttl = "ttl";
     const char *kDir = "dir";
     const char *kPrevExist = "prevExist";
-    const char *kPrevIndex = "prevIndex";
-    const char *kPrevValue = "prevValue";
-    const char *kSortedSuffix = "?recursive=true&sorted=true";
+
+    const char *kLeaderStats = "/v2/stats/leader";
+    const char *kSelfStats = "/v2/stats/self";
+    const char *kStoreStats = "/v2/stats/store";
+    const char *kMembers = "/v2/members";
 
     // DATA
     bool enable_header_;
     std::string url_;
-    std::string url_prefix_;
+    internal::KeysUrl urls_;
     std::unique_ptr<internal::Curl> handle_;
+    std::unique_ptr<ClientMetrics> metrics_;
+    PhaseHistograms* endpoint_metrics_;
+    std::shared_ptr<ClusterEndpoints> endpoints_;   // NULL for one server
+    uint64_t endpoints_version_;
+    std::shared_ptr<HealthProbe<Reply> > probe_;    // created on first use
+    ReadConsistency consistency_;
+    Tracer tracer_;
 
     // OPERATIONS
+    void _Init(const std::string& server, const Port& port);
+
+    void _Use(const std::string& url);
+
+    const internal::KeysUrl& _Urls() {
+        if (endpoints_ && endpoints_->Version() != endpoints_version_)
+            _Follow();
+        return urls_;
+    }
+
+    void _Follow();
+
     Reply _GetReply(const std::string& json);
+
+    Reply _GetInfo(const char* path, Operation op);
+
+    Reply _Read(Operation op,
+                const std::string& key,
+                bool recursive,
+                const ReadConsistency& consistency);
+
+    Reply _Perform(Operation op,
+                   const std::string& key,
+                   const std::string& url);
+
+    Reply _Perform(Operation op,
+                   const std::string& key,
+                   const std::string& url,
+                   const char* type,
+                   const internal::CurlOptions& options);
+
+    void _TraceEnd(typename Tracer::Span& span,
+                   Operation op,
+                   const std::string& key,
+                   const std::chrono::steady_clock::time_point& start,
+                   bool performed);
+
+    void _Record(Operation op,
+                 RequestTimings& timings,
+                 const std::chrono::steady_clock::time_point& parse_start);
 };
 
 //------------------------------- LIFECYCLE ----------------------------------
 
-template <typename Reply> Client<Reply>::
+template <typename Reply, typename Tracer> Client<Reply, Tracer>::
 Client(const std::string& server, const Port& port)
 try:
-    handle_(new internal::Curl()) {
-    std::ostringstream ostr;
-    ostr << "http://" << server << ":" << port; 
-    url_ = ostr.str();
-    ostr << "/v2/keys/";
-    url_prefix_ = ostr.str();
+    enable_header_(false),
+    handle_(new internal::Curl()),
+    metrics_(new ClientMetrics("client")),
+    endpoint_metrics_(NULL),
+    endpoints_version_(0),
+    tracer_() {
+    _Init(server, port);
+} catch (const std::exception& e) {
+    throw ClientException(e.what());
+}
+
+template <typename Reply, typename Tracer> Client<Reply, Tracer>::
+Client(const std::string& server, const Port& port, const Tracer& tracer)
+try:
+    enable_header_(false),
+    handle_(new internal::Curl()),
+    metrics_(new ClientMetrics("client")),
+    endpoint_metrics_(NULL),
+    endpoints_version_(0),
+    tracer_(tracer) {
+    _Init(server, port);
+} catch (const std::exception& e) {
+    throw ClientException(e.what());
+}
+
+template <typename Reply, typename Tracer> Client<Reply, Tracer>::
+Client(const std::shared_ptr<ClusterEndpoints>& endpoints)
+try:
+    enable_header_(false),
+    handle_(new internal::Curl()),
+    metrics_(new ClientMetrics("client")),
+    endpoint_metrics_(NULL),
+    endpoints_(endpoints),
+    endpoints_version_(0),
+    tracer_() {
+    _Follow();
+} catch (const std::exception& e) {
+    throw ClientException(e.what());
+}
+
+template <typename Reply, typename Tracer> Client<Reply, Tracer>::
+Client(const std::shared_ptr<ClusterEndpoints>& endpoints,
+       const Tracer& tracer)
+try:
+    enable_header_(false),
+    handle_(new internal::Curl()),
+    metrics_(new ClientMetrics("client")),
+    endpoint_metrics_(NULL),
+    endpoints_(endpoints),
+    endpoints_version_(0),
+    tracer_(tracer) {
+    _Follow();
 } catch (const std::exception& e) {
     throw ClientException(e.what());
 }
 
 //------------------------------- OPERATIONS ---------------------------------
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 Set(const std::string& key, const std::string& value) {
-    std::string ret;
-    try {
-        ret = handle_->Set(url_prefix_ + key, kPutRequest, {{kValue, value}});
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Perform(Operation::OPERATION_SET, key, _Urls().Key(key),
+        kPutRequest, {{kValue, value}});
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 Set(const std::string& key,
     const std::string& value,
     const TtlValue& ttl) {
-    std::string ret;
-    try {
-        ret = handle_->Set(url_prefix_ + key, kPutRequest,
-            {
-                {kValue, value},
-                {kTttl, std::to_string(ttl)},
-            });
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Perform(Operation::OPERATION_SET, key, _Urls().Key(key),
+        kPutRequest,
+        {
+            {kValue, value},
+            {kTttl, std::to_string(ttl)},
+        });
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 ClearTtl(const std::string& key, const std::string& value) {
-    std::string ret;
-    try {
-        ret = handle_->Set(url_prefix_ + key, kPutRequest,
-            {
-                {kValue, value},
-                {kTttl, ""},
-                {kPrevExist, "true"}
-            });
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Perform(Operation::OPERATION_SET, key, _Urls().Key(key),
+        kPutRequest,
+        {
+            {kValue, value},
+            {kTttl, ""},
+            {kPrevExist, "true"}
+        });
 }
 
-template <typename Reply> std::string Client<Reply>::
+template <typename Reply, typename Tracer> std::string Client<Reply, Tracer>::
 UrlEncode(const std::string& value) {
     return handle_->UrlEncode(value);
 }
 
-template <typename Reply> std::string Client<Reply>::
+template <typename Reply, typename Tracer> std::string Client<Reply, Tracer>::
 UrlDecode(const std::string& value) {
     return handle_->UrlDecode(value);
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 SetOrdered(const std::string& dir, const std::string& value) {
-    std::string ret;
-    try {
-        ret = handle_->Set(url_prefix_ + dir,
-                kPostRequest, {{kValue, value}});
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Perform(Operation::OPERATION_SET, dir, _Urls().Key(dir),
+        kPostRequest, {{kValue, value}});
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 Get(const std::string& key) {
-    std::string ret;
-    try {
-        ret = handle_->Get(url_prefix_ + key);
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Read(Operation::OPERATION_GET, key, false, consistency_);
+}
+
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
+Get(const std::string& key, const ReadConsistency& consistency) {
+    return _Read(Operation::OPERATION_GET, key, false, consistency);
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 GetAll(const std::string& key) {
-    std::string ret;
-    try {
-        ret = handle_->Get(url_prefix_ + key + "?recursive=true");;
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Read(Operation::OPERATION_GET_ALL, key, true, consistency_);
+}
+
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
+GetAll(const std::string& key, const ReadConsistency& consistency) {
+    return _Read(Operation::OPERATION_GET_ALL, key, true, consistency);
+}
+
+template <typename Reply, typename Tracer> void Client<Reply, Tracer>::
+SetReadConsistency(const ReadConsistency& consistency) {
+    consistency_ = consistency;
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer>
+const ReadConsistency& Client<Reply, Tracer>::
+GetReadConsistency() const {
+    return consistency_;
+}
+
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 GetOrdered(const std::string& dir) {
-    std::string ret;
-    try {
-        ret = handle_->Get(url_prefix_ + dir + std::string(kSortedSuffix));
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Perform(Operation::OPERATION_GET_ALL, dir,
+        _Urls().Sorted(dir));
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 Delete(const std::string& key) {
-    std::string ret;
-    try {
-        ret = handle_->Set(
-            url_prefix_ + key, kDeleteRequest, {});
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Perform(Operation::OPERATION_DELETE, key, _Urls().Key(key),
+        kDeleteRequest, {});
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 AddDirectory(const std::string& dir) {
-    std::string ret;
-    try {
-        ret = handle_->Set(url_prefix_ + dir, kPutRequest, {{kDir, "true"}});
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Perform(Operation::OPERATION_SET, dir, _Urls().Key(dir),
+        kPutRequest, {{kDir, "true"}});
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 AddDirectory(const std::string& dir, const TtlValue& ttl) {
-    std::string ret;
-    try {
-        ret = handle_->Set(url_prefix_ + dir, kPutRequest,
-            {
-                {kDir, "true"},
-                {kTttl, std::to_string(ttl)},
-            });
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Perform(Operation::OPERATION_SET, dir, _Urls().Key(dir),
+        kPutRequest,
+        {
+            {kDir, "true"},
+            {kTttl, std::to_string(ttl)},
+        });
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 UpdateDirectoryTtl(const std::string& dir, const TtlValue& ttl) {
-    std::string ret;
-    try {
-        ret = handle_->Set(url_prefix_ + dir, kPutRequest,
-            {
-                {kDir, "true"},
-                {kTttl, std::to_string(ttl)},
-                {kPrevExist, "true"}
-            });
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Perform(Operation::OPERATION_SET, dir, _Urls().Key(dir),
+        kPutRequest,
+        {
+            {kDir, "true"},
+            {kTttl, std::to_string(ttl)},
+            {kPrevExist, "true"}
+        });
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 DeleteDirectory(const std::string& dir, bool recursive) {
-    std::ostringstream ostr;
-    ostr << url_prefix_ + dir << "?dir=true";
-    if (recursive)
-        ostr << "&recursive=true";
-
-    std::string ret;
-    try {
-        ret = handle_->Set(ostr.str(), kDeleteRequest, {});
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Perform(Operation::OPERATION_DELETE, dir,
+        _Urls().Directory(dir, recursive),
+        kDeleteRequest, {});
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 CompareAndSwapIf(
     const std::string& key,
     const std::string& value,
     const std::string& prevValue) {
-    std::ostringstream ostr;
-    ostr << url_prefix_ << key << "?" << kPrevValue << "=" << prevValue;
-
-    std::string ret;
-    try {
-        ret = handle_->Set(ostr.str(), kPutRequest, {{kValue, value}});
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Perform(Operation::OPERATION_COMPARE_AND_SWAP, key,
+        _Urls().PrevValue(key, prevValue),
+        kPutRequest, {{kValue, value}});
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 CompareAndSwapIf(
      const std::string& key,
      const std::string& value,
      const Index& prevIndex) {
-    std::ostringstream ostr;
-    ostr << url_prefix_ << key << "?" << kPrevIndex
-         << "=" << std::to_string(prevIndex);
-
-    std::string ret;
-    try {
-        ret = handle_->Set(ostr.str(), kPutRequest, {{kValue, value}});
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Perform(Operation::OPERATION_COMPARE_AND_SWAP, key,
+        _Urls().PrevIndex(key, prevIndex),
+        kPutRequest, {{kValue, value}});
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 CompareAndSwapIf(
      const std::string& key,
      const std::string& value,
      bool prevExist) {
-    std::ostringstream ostr;
-    ostr << url_prefix_ << key << "?" << kPrevExist
-         << "=" << (prevExist ? "true" : "false"); 
-
-    std::string ret;
-    try {
-        ret = handle_->Set(ostr.str(), kPutRequest, {{kValue, value}});
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
-    }
-    return _GetReply(ret);
+    return _Perform(Operation::OPERATION_COMPARE_AND_SWAP, key,
+        _Urls().PrevExist(key, prevExist),
+        kPutRequest, {{kValue, value}});
 }
 
-template <typename Reply> Reply Client<Reply>::
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
 CompareAndDeleteIf(const std::string& key, const std::string& prevValue) {
-    std::ostringstream ostr;
-    ostr << url_prefix_ << key << "?" << kPrevValue << "=" << prevValue;
+    return _Perform(Operation::OPERATION_COMPARE_AND_DELETE, key,
+        _Urls().PrevValue(key, prevValue),
+        kDeleteRequest, {});
+}
 
-    std::string ret;
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
+CompareAndDeleteIf(const std::string& key, const Index& prevIndex) {
+    return _Perform(Operation::OPERATION_COMPARE_AND_DELETE, key,
+        _Urls().PrevIndex(key, prevIndex),
+        kDeleteRequest, {});
+}
+
+template <typename Reply, typename Tracer>
+LeaderStats Client<Reply, Tracer>::
+GetLeaderStats() {
+    LeaderStats stats;
+    _GetInfo(kLeaderStats, Operation::OPERATION_STATS).GetLeaderStats(stats);
+    return stats;
+}
+
+template <typename Reply, typename Tracer>
+SelfStats Client<Reply, Tracer>::
+GetSelfStats() {
+    SelfStats stats;
+    _GetInfo(kSelfStats, Operation::OPERATION_STATS).GetSelfStats(stats);
+    return stats;
+}
+
+template <typename Reply, typename Tracer>
+StoreStats Client<Reply, Tracer>::
+GetStoreStats() {
+    StoreStats stats;
+    _GetInfo(kStoreStats, Operation::OPERATION_STATS).GetStoreStats(stats);
+    return stats;
+}
+
+template <typename Reply, typename Tracer>
+Members Client<Reply, Tracer>::
+GetMembers() {
+    Members members;
+    _GetInfo(kMembers, Operation::OPERATION_MEMBERS).GetMembers(members);
+    return members;
+}
+
+template <typename Reply, typename Tracer>
+HealthStatus Client<Reply, Tracer>::
+Health() {
+    _Urls();
+    if (! probe_)
+        probe_.reset(new HealthProbe<Reply>());
+    return probe_->Health(url_);
+}
+
+template <typename Reply, typename Tracer>
+VersionInfo Client<Reply, Tracer>::
+Version() {
+    _Urls();
+    if (! probe_)
+        probe_.reset(new HealthProbe<Reply>());
+
+    VersionInfo version;
+    std::string error;
+    if (! probe_->Version(url_, version, error))
+        throw ClientException(url_ + "/version: " + error);
+    return version;
+}
+
+template <typename Reply, typename Tracer> void Client<Reply, Tracer>::
+SetHealthProbe(const std::shared_ptr<HealthProbe<Reply> >& probe) {
+    probe_ = probe;
+}
+
+template <typename Reply, typename Tracer>
+const std::string& Client<Reply, Tracer>::
+GetEndpoint() {
+    _Urls();
+    return url_;
+}
+
+template <typename Reply, typename Tracer>
+const ClientMetrics& Client<Reply, Tracer>::
+GetMetrics() const {
+    return *metrics_;
+}
+
+template <typename Reply, typename Tracer> Tracer& Client<Reply, Tracer>::
+GetTracer() {
+    return tracer_;
+}
+
+//------------------------------ OPERATIONS ----------------------------------
+
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
+_GetReply(const std::string& json) {
+    if (enable_header_)
+        return Reply (handle_->GetHeader(), json);
+    return Reply(json);
+}
+
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
+_GetInfo(const char* path, Operation op) {
+    // The stats and members APIs have no etcd error codes, a follower
+    // answers the leader stats with 403 and a JSON message only
+    _Urls();
+    Reply reply = _Perform(op, path, url_ + path);
+    long status = handle_->GetTransferInfo().response_code;
+    if (status >= 400)
+        throw ClientException(std::string(path) + ": HTTP status " +
+                              std::to_string(status));
+    return reply;
+}
+
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
+_Read(
+    Operation op,
+    const std::string& key,
+    bool recursive,
+    const ReadConsistency& consistency) {
+    if (consistency.level == ReadConsistency::LEVEL_QUORUM)
+        return _Perform(op, key, _Urls().Quorum(key, recursive));
+    const std::string url = recursive ? _Urls().Recursive(key)
+                                      : _Urls().Key(key);
+    if (consistency.level == ReadConsistency::LEVEL_LOCAL)
+        return _Perform(op, key, url);
+
+    // The X-Etcd-Index of the member tells how far it has applied, errors
+    // included: a key not found may not have reached it yet
+    handle_->EnableHeader(true);
     try {
-        ret = handle_->Set(ostr.str(), kDeleteRequest, {});
-    } catch (const std::exception& e) {
-        throw ClientException(e.what());
+        Reply reply = _Perform(op, key, url);
+        handle_->EnableHeader(enable_header_);
+        if (handle_->GetEtcdIndex() >= consistency.min_index)
+            return reply;
+    } catch (const ReplyException&) {
+        handle_->EnableHeader(enable_header_);
+        if (handle_->GetEtcdIndex() >= consistency.min_index)
+            throw;
+    } catch (...) {
+        handle_->EnableHeader(enable_header_);
+        throw;
     }
-    return _GetReply(ret);
+    return _Perform(op, key, _Urls().Quorum(key, recursive));
 }
 
-template <typename Reply> Reply Client<Reply>::
-CompareAndDeleteIf(const std::string& key, const Index& prevIndex) {
+template <typename Reply, typename Tracer> void Client<Reply, Tracer>::
+_Init(const std::string& server, const Port& port) {
     std::ostringstream ostr;
-    ostr << url_prefix_ << key << "?" << kPrevIndex
-         << "=" << std::to_string(prevIndex);
+    ostr << "http://" << server << ":" << port; 
+    _Use(ostr.str());
+}
+
+template <typename Reply, typename Tracer> void Client<Reply, Tracer>::
+_Use(const std::string& url) {
+    url_ = url;
+    endpoint_metrics_ = metrics_->Endpoint(url_);
+    urls_ = internal::KeysUrl(url_ + "/v2/keys/");
+}
+
+template <typename Reply, typename Tracer> void Client<Reply, Tracer>::
+_Follow() {
+    std::shared_ptr<const EndpointList> list = endpoints_->GetList();
+    endpoints_version_ = list->version;
+    if (list->Current() != url_)
+        _Use(list->Current());
+}
+
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
+_Perform(Operation op, const std::string& key, const std::string& url) {
+    return _Perform(op, key, url, NULL, internal::CurlOptions());
+}
+
+template <typename Reply, typename Tracer> Reply Client<Reply, Tracer>::
+_Perform(
+    Operation op,
+    const std::string& key,
+    const std::string& url,
+    const char* type,
+    const internal::CurlOptions& options) {
+    internal::InFlightGuard in_flight(*metrics_);
+
+    // Tracer::kEnabled is a compile time constant, with the default policy
+    // none of the tracing code below is emitted.
+    typename Tracer::Span span = typename Tracer::Span();
+    std::chrono::steady_clock::time_point start;
+    if (Tracer::kEnabled) {
+        start = std::chrono::steady_clock::now();
+        span = tracer_.Begin(TraceEvent(op, key, url_));
+    }
 
     std::string ret;
     try {
-        ret = handle_->Set(ostr.str(), kDeleteRequest, {});
+        if (type)
+            ret = handle_->Set(url, type, options);
+        else
+            ret = handle_->Get(url);
     } catch (const std::exception& e) {
+        metrics_->RecordTransportError(internal::CurlErrorCode(e));
+        if (Tracer::kEnabled)
+            _TraceEnd(span, op, key, start, false);
+        // A timeout or a cut reply says nothing about the member, only a
+        // failed connection does
+        if (endpoints_ && internal::IsConnectError(e))
+            endpoints_->MarkFailed(url_);
         throw ClientException(e.what());
     }
-    return _GetReply(ret);
+    metrics_->RecordTransfer(handle_->GetTransferInfo());
+
+    // Parse time is recorded whether or not etcd returned an error, an
+    // error reply is still a complete round trip.
+    RequestTimings timings = handle_->GetTimings();
+    std::chrono::steady_clock::time_point parse_start =
+        std::chrono::steady_clock::now();
+    try {
+        Reply reply = _GetReply(ret);
+        _Record(op, timings, parse_start);
+        if (Tracer::kEnabled)
+            _TraceEnd(span, op, key, start, true);
+        return reply;
+    } catch (const ReplyException& e) {
+        metrics_->RecordEtcdError(e.error_code);
+        _Record(op, timings, parse_start);
+        if (Tracer::kEnabled)
+            _TraceEnd(span, op, key, start, true);
+        throw;
+    } catch (...) {
+        _Record(op, timings, parse_start);
+        if (Tracer::kEnabled)
+            _TraceEnd(span, op, key, start, true);
+        throw;
+    }
 }
 
-//------------------------------ OPERATIONS ----------------------------------
+template <typename Reply, typename Tracer> void Client<Reply, Tracer>::
+_TraceEnd(
+    typename Tracer::Span& span,
+    Operation op,
+    const std::string& key,
+    const std::chrono::steady_clock::time_point& start,
+    bool performed) {
+    TraceEvent event(op, key, url_);
+    if (performed) {
+        const TransferInfo& info = handle_->GetTransferInfo();
+        event.status = info.response_code;
+        event.bytes_sent = info.bytes_sent;
+        event.bytes_received = info.bytes_received;
+    }
+    event.duration = internal::ElapsedMicros(start);
+    tracer_.End(span, event);
+}
 
-template <typename Reply> Reply Client<Reply>::
-_GetReply(const std::string& json) {
-    if (enable_header_)
-        return Reply (handle_->GetHeader(), json);
-    return Reply(json);
+template <typename Reply, typename Tracer> void Client<Reply, Tracer>::
+_Record(
+    Operation op,
+    RequestTimings& timings,
+    const std::chrono::steady_clock::time_point& parse_start) {
+    timings.parse = internal::ElapsedMicros(parse_start);
+    timings.total += timings.parse;
+    metrics_->Record(op, endpoint_metrics_, timings);
 }
 
 } // namespace etcd
@@ -0,0 +1,248 @@
+#ifndef __ETCD_FLIGHT_RECORDER_HPP_INCLUDED__
+#define __ETCD_FLIGHT_RECORDER_HPP_INCLUDED__
+
+#include "metrics.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace etcd {
+
+/**
+ * @brief One request as kept by the FlightRecorder. Strings are truncated
+ * to the size of their buffers and always NUL terminated.
+ */
+struct FlightRecord {
+    // CONSTANTS
+    static const size_t kMethodSize = 8;
+    static const size_t kUrlSize = 256;
+    static const size_t kBodySize = 256;
+
+    uint64_t sequence;
+    uint64_t timestamp;         // microseconds since the epoch
+    char method[kMethodSize];
+    char url[kUrlSize];
+    long status;                // HTTP status, zero if no response was read
+    int curl_code;              // CURLcode of the perform
+    RequestTimings timings;
+    uint64_t body_length;       // length of the full response body
+    char body[kBodySize];
+};
+
+/**
+ * @brief In-memory ring buffer of the last N requests performed by every
+ * client in the process.
+ *
+ * The recorder is off by default and can be switched on and off at run
+ * time. While it is off, the request path pays a single load and branch.
+ * Writers never block each other: every slot is protected by a sequence
+ * number, a writer that finds its slot busy (the ring wrapped around under
+ * heavy concurrency) drops its record, and readers skip slots which are
+ * being written.
+ */
+class FlightRecorder {
+  public:
+    // LIFECYCLE
+    explicit FlightRecorder(size_t capacity = 256)
+      :capacity_(capacity ? capacity : 1),
+       ring_(NULL),
+       enabled_(false),
+       next_(0),
+       error_stream_(NULL) {
+    }
+
+    /**
+     * @brief The recorder used by all etcd::Client and etcd::Watch objects
+     */
+    static FlightRecorder& Global() {
+        static FlightRecorder recorder;
+        return recorder;
+    }
+
+    // OPERATIONS
+
+    /**
+     * @brief Start or stop recording. Memory for the ring is allocated the
+     * first time the recorder is enabled.
+     */
+    void Enable(bool onOff) {
+        if (onOff) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (! slots_) {
+                slots_.reset(new Slot[capacity_]);
+                ring_.store(slots_.get(), std::memory_order_release);
+            }
+        }
+        enabled_.store(onOff, std::memory_order_release);
+    }
+
+    bool IsEnabled() const {
+        return enabled_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Dump the ring to stream whenever a request fails at the
+     * transport level or etcd answers with a 5xx status. NULL disables it.
+     */
+    void SetErrorStream(FILE* stream) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_stream_ = stream;
+    }
+
+    void Record(const char* method,
+                const std::string& url,
+                long status,
+                int curl_code,
+                const RequestTimings& timings,
+                const char* body,
+                size_t body_length);
+
+    /**
+     * @brief Copy the recorded requests, oldest first
+     */
+    void Snapshot(std::vector<FlightRecord>& records) const;
+
+    /**
+     * @brief Write the recorded requests to stream, oldest first
+     */
+    void Dump(FILE* stream) const;
+
+  private:
+    // TYPES
+    struct Slot {
+        Slot() :version(0), record() {
+            record.sequence = ~uint64_t(0);
+        }
+
+        std::atomic<uint64_t> version;  // odd while being written
+        FlightRecord record;
+    };
+
+    // DATA MEMBERS
+    const size_t capacity_;
+    std::unique_ptr<Slot[]> slots_;
+    std::atomic<Slot*> ring_;           // slots_, published by Enable
+    std::atomic<bool> enabled_;
+    std::atomic<uint64_t> next_;
+    FILE* error_stream_;
+    mutable std::mutex mutex_;
+
+    // LIFECYCLE
+    FlightRecorder(const FlightRecorder& rhs);
+    void operator=(const FlightRecorder& rhs);
+
+    // OPERATIONS
+    static void _Copy(char* dst, size_t size, const char* src, size_t len) {
+        if (len >= size)
+            len = size - 1;
+        std::memcpy(dst, src, len);
+        dst[len] = '\0';
+    }
+};
+
+//------------------------------- OPERATIONS ---------------------------------
+
+inline void FlightRecorder::
+Record(
+    const char* method,
+    const std::string& url,
+    long status,
+    int curl_code,
+    const RequestTimings& timings,
+    const char* body,
+    size_t body_length) {
+    uint64_t sequence = next_.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = ring_.load(std::memory_order_relaxed)[sequence % capacity_];
+
+    uint64_t version = slot.version.load(std::memory_order_relaxed);
+    if ((version & 1) ||
+        !slot.version.compare_exchange_strong(version, version + 1,
+                                              std::memory_order_acquire)) {
+        return;     // another writer owns the slot, drop this record
+    }
+
+    FlightRecord& record = slot.record;
+    record.sequence = sequence;
+    record.timestamp = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    _Copy(record.method, FlightRecord::kMethodSize,
+          method, std::strlen(method));
+    _Copy(record.url, FlightRecord::kUrlSize, url.data(), url.size());
+    record.status = status;
+    record.curl_code = curl_code;
+    record.timings = timings;
+    record.body_length = body_length;
+    _Copy(record.body, FlightRecord::kBodySize, body, body_length);
+
+    slot.version.store(version + 2, std::memory_order_release);
+
+    if (curl_code != 0 || status >= 500) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (error_stream_)
+            Dump(error_stream_);
+    }
+}
+
+inline void FlightRecorder::
+Snapshot(std::vector<FlightRecord>& records) const {
+    records.clear();
+    const Slot* ring = ring_.load(std::memory_order_acquire);
+    if (! ring)
+        return;
+
+    uint64_t end = next_.load(std::memory_order_acquire);
+    uint64_t begin = end > capacity_ ? end - capacity_ : 0;
+    for (uint64_t seq = begin; seq < end; ++seq) {
+        const Slot& slot = ring[seq % capacity_];
+        uint64_t before = slot.version.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+        FlightRecord record = slot.record;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.version.load(std::memory_order_relaxed) != before ||
+            record.sequence != seq) {
+            continue;   // overwritten while copying or never written
+        }
+        records.push_back(record);
+    }
+}
+
+inline void FlightRecorder::
+Dump(FILE* stream) const {
+    std::vector<FlightRecord> records;
+    Snapshot(records);
+
+    fprintf(stream, "== etcd flight recorder: %lu requests\n",
+            (unsigned long) records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        const FlightRecord& r = records[i];
+        fprintf(stream,
+                "#%llu %llu.%06llu %s %s status=%ld curl=%d total=%lluus "
+                "dns=%llu connect=%llu tls=%llu first_byte=%llu "
+                "transfer=%llu body(%llu)=",
+                (unsigned long long) r.sequence,
+                (unsigned long long) (r.timestamp / 1000000),
+                (unsigned long long) (r.timestamp % 1000000),
+                r.method, r.url, r.status, r.curl_code,
+                (unsigned long long) r.timings.total,
+                (unsigned long long) r.timings.dns,
+                (unsigned long long) r.timings.connect,
+                (unsigned long long) r.timings.tls,
+                (unsigned long long) r.timings.first_byte,
+                (unsigned long long) r.timings.transfer,
+                (unsigned long long) r.body_length);
+        for (const char* c = r.body; *c; ++c)
+            fputc((*c >= 0x20 && *c < 0x7f) ? *c : '.', stream);
+        fputc('\n', stream);
+    }
+    fflush(stream);
+}
+
+} // namespace etcd
+
+#endif // __ETCD_FLIGHT_RECORDER_HPP_INCLUDED__
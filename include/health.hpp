@@ -0,0 +1,330 @@
+#ifndef __ETCD_HEALTH_HPP_INCLUDED__
+#define __ETCD_HEALTH_HPP_INCLUDED__
+
+#include "internal/curl.hpp"
+#include "metrics.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace etcd {
+
+// ---------------------------- TYPES ---------------------------------------
+
+/**
+ * @brief Result of a /health probe of one member
+ */
+struct HealthStatus {
+    HealthStatus()
+      :healthy(false),
+       status(0),
+       timestamp(0),
+       latency(0)
+      {}
+
+    bool healthy;
+    long status;                // HTTP status, 0 if the member was not reached
+    std::string error;          // why the probe failed, empty if healthy
+    uint64_t timestamp;         // microseconds since the epoch
+    uint64_t latency;           // microseconds
+};
+
+/**
+ * @brief /version of one member
+ */
+struct VersionInfo {
+    std::string server;         // etcdserver, e.g. "2.3.8"
+    std::string cluster;        // etcdcluster, e.g. "2.3.0"
+};
+
+/**
+ * @brief Probes /health and /version of etcd members for failover and
+ * circuit breaking, on connections of its own with tight timeouts.
+ *
+ * Results are cached per endpoint for ttl, failures included, so any
+ * number of callers checking the same member cost one probe per ttl. The
+ * probe is thread safe and is meant to be shared by the clients of a
+ * process, see Client::SetHealthProbe. Each endpoint is probed on its own
+ * connection and without holding the cache, so a member which does not
+ * answer only delays the callers asking about it. Callers arriving while
+ * a probe of the endpoint is in flight wait for its result rather than
+ * sending another one.
+ *
+ * @tparam Reply json reply wrapper implementing GetHealth and GetVersion
+ */
+template <typename Reply>
+class HealthProbe {
+  public:
+    // LIFECYCLE
+    /**
+     * @param ttl how long a result is served from the cache
+     * @param connect_timeout limit of the TCP and TLS connection
+     * @param timeout limit of the whole probe
+     */
+    explicit HealthProbe(
+        const std::chrono::milliseconds& ttl =
+            std::chrono::milliseconds(1000),
+        const std::chrono::milliseconds& connect_timeout =
+            std::chrono::milliseconds(200),
+        const std::chrono::milliseconds& timeout =
+            std::chrono::milliseconds(500));
+
+    // OPERATIONS
+    /**
+     * @brief Health of a member, never throws
+     *
+     * @param url client URL of the member, e.g. "http://10.0.0.1:2379"
+     */
+    HealthStatus Health(const std::string& url);
+
+    /**
+     * @brief Version of a member
+     *
+     * @param url client URL of the member
+     * @param version filled in on success
+     * @param error why the member could not be probed
+     *
+     * @return false if the member could not be probed
+     */
+    bool Version(const std::string& url,
+                 VersionInfo& version,
+                 std::string& error);
+
+    /**
+     * @brief Forget the cached results, the next call probes again
+     */
+    void Invalidate();
+
+    /**
+     * @brief Probes actually sent, all recorded as
+     * etcd::Operation::OPERATION_PROBE
+     */
+    const ClientMetrics& GetMetrics() const;
+
+  private:
+    // TYPES
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry {
+        Entry() :probing(false), health_valid(false), version_valid(false) {}
+
+        std::unique_ptr<internal::Curl> handle;
+        bool probing;           // the handle is in use
+        bool health_valid;
+        Clock::time_point health_at;
+        HealthStatus health;
+        bool version_valid;
+        Clock::time_point version_at;
+        VersionInfo version;
+        std::string version_error;
+    };
+
+    // DATA MEMBERS
+    Clock::duration ttl_;
+    long connect_timeout_;      // milliseconds
+    long timeout_;
+    ClientMetrics metrics_;
+    // An entry outlives Invalidate while it is being probed
+    std::map<std::string, std::shared_ptr<Entry> > cache_;
+    std::mutex mutex_;          // the cache and the entries
+    std::condition_variable probed_;
+
+    // LIFECYCLE
+    HealthProbe(const HealthProbe& rhs);
+    void operator=(const HealthProbe& rhs);
+
+    // OPERATIONS
+    std::shared_ptr<Entry> _Entry(const std::string& url);
+
+    void _Done(Entry& entry);
+
+    bool _Fetch(internal::Curl& handle, const std::string& url,
+                const char* path, std::string& body, std::string& error);
+
+    HealthStatus _ProbeHealth(internal::Curl& handle, const std::string& url);
+
+    void _ProbeVersion(internal::Curl& handle, const std::string& url,
+                       VersionInfo& version, std::string& error);
+};
+
+//------------------------------- LIFECYCLE ----------------------------------
+
+template <typename Reply> HealthProbe<Reply>::
+HealthProbe(
+    const std::chrono::milliseconds& ttl,
+    const std::chrono::milliseconds& connect_timeout,
+    const std::chrono::milliseconds& timeout)
+  :ttl_(ttl),
+   connect_timeout_((long) connect_timeout.count()),
+   timeout_((long) timeout.count()),
+   metrics_("probe") {
+}
+
+//------------------------------- OPERATIONS ---------------------------------
+
+template <typename Reply> HealthStatus HealthProbe<Reply>::
+Health(const std::string& url) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::shared_ptr<Entry> entry = _Entry(url);
+    while (! entry->health_valid || Clock::now() - entry->health_at >= ttl_) {
+        if (! entry->probing) {
+            entry->probing = true;
+            lock.unlock();
+            HealthStatus health;
+            try {
+                health = _ProbeHealth(*entry->handle, url);
+            } catch (...) {
+                lock.lock();
+                _Done(*entry);
+                throw;
+            }
+            lock.lock();
+            entry->health = health;
+            entry->health_at = Clock::now();
+            entry->health_valid = true;
+            _Done(*entry);
+            return health;
+        }
+        probed_.wait(lock);
+    }
+    return entry->health;
+}
+
+template <typename Reply> bool HealthProbe<Reply>::
+Version(const std::string& url, VersionInfo& version, std::string& error) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::shared_ptr<Entry> entry = _Entry(url);
+    while (! entry->version_valid ||
+           Clock::now() - entry->version_at >= ttl_) {
+        if (! entry->probing) {
+            entry->probing = true;
+            lock.unlock();
+            try {
+                _ProbeVersion(*entry->handle, url, version, error);
+            } catch (...) {
+                lock.lock();
+                _Done(*entry);
+                throw;
+            }
+            lock.lock();
+            entry->version = version;
+            entry->version_error = error;
+            entry->version_at = Clock::now();
+            entry->version_valid = true;
+            _Done(*entry);
+            return error.empty();
+        }
+        probed_.wait(lock);
+    }
+
+    version = entry->version;
+    error = entry->version_error;
+    return error.empty();
+}
+
+template <typename Reply> void HealthProbe<Reply>::
+Invalidate() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cache_.clear();
+}
+
+template <typename Reply> const ClientMetrics& HealthProbe<Reply>::
+GetMetrics() const {
+    return metrics_;
+}
+
+template <typename Reply>
+std::shared_ptr<typename HealthProbe<Reply>::Entry> HealthProbe<Reply>::
+_Entry(const std::string& url) {
+    std::shared_ptr<Entry>& entry = cache_[url];
+    if (! entry) {
+        entry = std::make_shared<Entry>();
+        entry->handle.reset(new internal::Curl());
+        entry->handle->SetTimeouts(connect_timeout_, timeout_);
+    }
+    return entry;
+}
+
+template <typename Reply> void HealthProbe<Reply>::
+_Done(Entry& entry) {
+    entry.probing = false;
+    probed_.notify_all();
+}
+
+template <typename Reply> bool HealthProbe<Reply>::
+_Fetch(
+    internal::Curl& handle,
+    const std::string& url,
+    const char* path,
+    std::string& body,
+    std::string& error) {
+    internal::InFlightGuard in_flight(metrics_);
+    try {
+        body = handle.Get(url + path);
+    } catch (const std::exception& e) {
+        metrics_.RecordTransportError(internal::CurlErrorCode(e));
+        error = e.what();
+        return false;
+    }
+    metrics_.RecordTransfer(handle.GetTransferInfo());
+    metrics_.Record(Operation::OPERATION_PROBE, metrics_.Endpoint(url),
+                    handle.GetTimings());
+    return true;
+}
+
+template <typename Reply> HealthStatus HealthProbe<Reply>::
+_ProbeHealth(internal::Curl& handle, const std::string& url) {
+    Clock::time_point start = Clock::now();
+    HealthStatus health;
+    health.timestamp = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    std::string body;
+    if (_Fetch(handle, url, "/health", body, health.error)) {
+        // An unhealthy member answers 503 with a JSON body, a member too
+        // old to know /health answers 404 with plain text
+        health.status = handle.GetTransferInfo().response_code;
+        if (health.status == 200 || health.status == 503) {
+            try {
+                Reply(body).GetHealth(health);
+            } catch (const std::exception& e) {
+                health.healthy = false;
+                health.error = e.what();
+            }
+        }
+        if (! health.healthy && health.error.empty())
+            health.error = "unhealthy, HTTP status " +
+                std::to_string(health.status);
+    }
+    health.latency = internal::ElapsedMicros(start);
+    return health;
+}
+
+template <typename Reply> void HealthProbe<Reply>::
+_ProbeVersion(
+    internal::Curl& handle,
+    const std::string& url,
+    VersionInfo& version,
+    std::string& error) {
+    version = VersionInfo();
+    error.clear();
+    std::string body;
+    if (! _Fetch(handle, url, "/version", body, error))
+        return;
+    long status = handle.GetTransferInfo().response_code;
+    try {
+        if (status != 200)
+            error = "HTTP status " + std::to_string(status);
+        else
+            Reply(body).GetVersion(version);
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+}
+
+} // namespace etcd
+
+#endif // __ETCD_HEALTH_HPP_INCLUDED__
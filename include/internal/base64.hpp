@@ -0,0 +1,384 @@
+#ifndef __ETCD_BASE64_HPP_INCLUDED__
+#define __ETCD_BASE64_HPP_INCLUDED__
+
+#include <cstdint>
+#include <string>
+
+/*
+ * Base64 with the standard alphabet and padding (RFC 4648), as used by the
+ * etcd v3 JSON gateway for the bytes fields: keys, values and range ends.
+ *
+ * Built with AVX2 or SSSE3 enabled (-mavx2, -mssse3, -march=native), whole
+ * blocks of 32 or 16 characters are translated with byte shuffles instead
+ * of a table lookup per character; the scalar loop handles the tail and is
+ * the only code used otherwise. Define ETCD_DISABLE_SIMD to always use it.
+ */
+
+#if !defined(ETCD_DISABLE_SIMD) && defined(__AVX2__)
+#define ETCD_BASE64_AVX2
+#include <immintrin.h>
+#elif !defined(ETCD_DISABLE_SIMD) && defined(__SSSE3__)
+#define ETCD_BASE64_SSSE3
+#include <tmmintrin.h>
+#endif
+
+namespace etcd {
+namespace internal {
+
+#if defined(ETCD_BASE64_AVX2) || defined(ETCD_BASE64_SSSE3)
+
+/*
+ * The shuffle based translation of W. Mula and D. Lemire, "Faster Base64
+ * Encoding and Decoding Using AVX2 Instructions", ACM TOW 2018. Each 128 bit
+ * lane maps 12 bytes to 16 characters and back, the AVX2 versions run two
+ * lanes at once.
+ */
+
+// 16 6-bit indexes, each in a byte, from the 12 bytes at the start of in
+inline __m128i Base64EncodeUnpack(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                           4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+// The characters of 16 indexes: each range of the alphabet is an offset
+inline __m128i Base64EncodeTranslate(__m128i indexes) {
+    const __m128i kOffsets = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+    __m128i range = _mm_subs_epu8(indexes, _mm_set1_epi8(51));
+    __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indexes);
+    range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(kOffsets, range), indexes);
+}
+
+/**
+ * @brief Lookup tables of the decoder: the classes of the low and high
+ * nibbles of a character share a bit when it is outside the alphabet, the
+ * offset taking it to its value depends on the high nibble, '/' aside
+ */
+struct Base64DecodeTables {
+    static __m128i Low() {
+        return _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                             0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    }
+
+    static __m128i High() {
+        return _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                             0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    }
+
+    static __m128i Offsets() {
+        return _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                             0, 0, 0, 0, 0, 0, 0, 0);
+    }
+};
+
+#endif
+
+#if defined(ETCD_BASE64_AVX2)
+
+inline __m256i Base64Broadcast(__m128i table) {
+    return _mm256_broadcastsi128_si256(table);
+}
+
+/**
+ * @brief Encode whole blocks of 24 bytes
+ *
+ * @return number of bytes encoded, a multiple of 3
+ */
+inline size_t Base64EncodeBlocks(const unsigned char* in, size_t size,
+                                 char* out) {
+    const __m256i kShuffle = Base64Broadcast(_mm_set_epi8(
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m256i kOffsets = Base64Broadcast(_mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0));
+
+    // Each lane loads 16 bytes and uses 12 of them
+    size_t i = 0;
+    for (; i + 28 <= size; i += 24, out += 32) {
+        __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(in + i))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12)),
+            1);
+        v = _mm256_shuffle_epi8(v, kShuffle);
+        __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        __m256i indexes = _mm256_or_si256(t1, t3);
+
+        __m256i range = _mm256_subs_epu8(indexes, _mm256_set1_epi8(51));
+        __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indexes);
+        range = _mm256_or_si256(
+            range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+        __m256i chars = _mm256_add_epi8(_mm256_shuffle_epi8(kOffsets, range),
+                                        indexes);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), chars);
+    }
+    return i;
+}
+
+/**
+ * @brief Decode whole blocks of 32 characters, up to the first block
+ * holding a character outside the alphabet. out may be in: no block is
+ * written past the characters read so far.
+ *
+ * @return number of characters decoded, a multiple of 32
+ */
+inline size_t Base64DecodeBlocks(const unsigned char* in, size_t size,
+                                 char* out) {
+    const __m256i kLow = Base64Broadcast(Base64DecodeTables::Low());
+    const __m256i kHigh = Base64Broadcast(Base64DecodeTables::High());
+    const __m256i kOffsets = Base64Broadcast(Base64DecodeTables::Offsets());
+    const __m256i kPack = Base64Broadcast(_mm_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+    // A block stores 32 bytes for 24 decoded ones, the characters left
+    // after it must decode to at least the other 8
+    size_t i = 0;
+    for (; i + 48 <= size; i += 32, out += 24) {
+        __m256i v = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(in + i));
+        __m256i high = _mm256_and_si256(_mm256_srli_epi32(v, 4),
+                                        _mm256_set1_epi8(0x0f));
+        __m256i low = _mm256_and_si256(v, _mm256_set1_epi8(0x0f));
+        if (! _mm256_testz_si256(_mm256_shuffle_epi8(kLow, low),
+                                 _mm256_shuffle_epi8(kHigh, high)))
+            break;
+
+        __m256i slash = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/'));
+        v = _mm256_add_epi8(v, _mm256_shuffle_epi8(
+            kOffsets, _mm256_add_epi8(slash, high)));
+
+        v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, kPack);
+        v = _mm256_permutevar8x32_epi32(
+            v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+    }
+    return i;
+}
+
+#elif defined(ETCD_BASE64_SSSE3)
+
+/**
+ * @brief Encode whole blocks of 12 bytes
+ *
+ * @return number of bytes encoded, a multiple of 3
+ */
+inline size_t Base64EncodeBlocks(const unsigned char* in, size_t size,
+                                 char* out) {
+    // Each block loads 16 bytes and uses 12 of them
+    size_t i = 0;
+    for (; i + 16 <= size; i += 12, out += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                         Base64EncodeTranslate(Base64EncodeUnpack(v)));
+    }
+    return i;
+}
+
+/**
+ * @brief Decode whole blocks of 16 characters, up to the first block
+ * holding a character outside the alphabet. out may be in: no block is
+ * written past the characters read so far.
+ *
+ * @return number of characters decoded, a multiple of 16
+ */
+inline size_t Base64DecodeBlocks(const unsigned char* in, size_t size,
+                                 char* out) {
+    const __m128i kLow = Base64DecodeTables::Low();
+    const __m128i kHigh = Base64DecodeTables::High();
+    const __m128i kOffsets = Base64DecodeTables::Offsets();
+    const __m128i kPack = _mm_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    // A block stores 16 bytes for 12 decoded ones, the characters left
+    // after it must decode to at least the other 4
+    size_t i = 0;
+    for (; i + 24 <= size; i += 16, out += 12) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i high = _mm_and_si128(_mm_srli_epi32(v, 4),
+                                     _mm_set1_epi8(0x0f));
+        __m128i low = _mm_and_si128(v, _mm_set1_epi8(0x0f));
+        __m128i invalid = _mm_and_si128(_mm_shuffle_epi8(kLow, low),
+                                        _mm_shuffle_epi8(kHigh, high));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(invalid, _mm_setzero_si128()))
+            != 0xffff)
+            break;
+
+        __m128i slash = _mm_cmpeq_epi8(v, _mm_set1_epi8('/'));
+        v = _mm_add_epi8(v, _mm_shuffle_epi8(kOffsets,
+                                             _mm_add_epi8(slash, high)));
+
+        v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+        v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                         _mm_shuffle_epi8(v, kPack));
+    }
+    return i;
+}
+
+#else
+
+inline size_t Base64EncodeBlocks(const unsigned char*, size_t, char*) {
+    return 0;
+}
+
+inline size_t Base64DecodeBlocks(const unsigned char*, size_t, char*) {
+    return 0;
+}
+
+#endif
+
+inline size_t Base64EncodedSize(size_t size) {
+    return (size + 2) / 3 * 4;
+}
+
+inline void Base64Encode(const char* data, size_t size, std::string& out) {
+    static const char kAlphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+    size_t start = out.size();
+    out.resize(start + Base64EncodedSize(size));
+    char* o = &out[0] + start;
+
+    size_t i = Base64EncodeBlocks(in, size, o);
+    o += i / 3 * 4;
+    for (; i + 3 <= size; i += 3) {
+        uint32_t v = (uint32_t(in[i]) << 16) | (uint32_t(in[i + 1]) << 8) |
+            in[i + 2];
+        *o++ = kAlphabet[v >> 18];
+        *o++ = kAlphabet[(v >> 12) & 0x3f];
+        *o++ = kAlphabet[(v >> 6) & 0x3f];
+        *o++ = kAlphabet[v & 0x3f];
+    }
+    if (i < size) {
+        uint32_t v = uint32_t(in[i]) << 16;
+        if (i + 1 < size)
+            v |= uint32_t(in[i + 1]) << 8;
+        *o++ = kAlphabet[v >> 18];
+        *o++ = kAlphabet[(v >> 12) & 0x3f];
+        *o++ = i + 1 < size ? kAlphabet[(v >> 6) & 0x3f] : '=';
+        *o++ = '=';
+    }
+}
+
+inline std::string Base64Encode(const std::string& data) {
+    std::string out;
+    Base64Encode(data.data(), data.size(), out);
+    return out;
+}
+
+/**
+ * @brief Decode data into out, which may be data itself. Padding is
+ * optional.
+ *
+ * @param size size of data, then of the decoded bytes written to out
+ *
+ * @return false on a character outside the alphabet or a truncated group,
+ * out is left unspecified then
+ */
+inline bool Base64DecodeTo(const char* data, size_t& size, char* out) {
+    // 64 marks a character outside the alphabet
+    static const unsigned char kValues[256] = {
+        64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+        64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+        64,64,64,64,64,64,64,64,64,64,64,62,64,64,64,63,
+        52,53,54,55,56,57,58,59,60,61,64,64,64,64,64,64,
+        64, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
+        15,16,17,18,19,20,21,22,23,24,25,64,64,64,64,64,
+        64,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
+        41,42,43,44,45,46,47,48,49,50,51,64,64,64,64,64,
+        64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+        64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+        64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+        64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+        64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+        64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+        64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+        64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64
+    };
+
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+    size_t n = size;
+    while (n && in[n - 1] == '=')
+        --n;
+    if (n % 4 == 1)
+        return false;
+    size = n / 4 * 3 + (n % 4 ? n % 4 - 1 : 0);
+
+    // Every group is read before its bytes are written, so decoding in
+    // place never overwrites characters still to be read
+    size_t i = Base64DecodeBlocks(in, n, out);
+    char* o = out + i / 4 * 3;
+    for (; i + 4 <= n; i += 4) {
+        uint32_t a = kValues[in[i]], b = kValues[in[i + 1]];
+        uint32_t c = kValues[in[i + 2]], d = kValues[in[i + 3]];
+        if ((a | b | c | d) & 64)
+            return false;
+        uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+        *o++ = char(v >> 16);
+        *o++ = char((v >> 8) & 0xff);
+        *o++ = char(v & 0xff);
+    }
+    if (i < n) {
+        uint32_t a = kValues[in[i]], b = kValues[in[i + 1]];
+        uint32_t c = i + 2 < n ? kValues[in[i + 2]] : 0;
+        if ((a | b | c) & 64)
+            return false;
+        uint32_t v = (a << 18) | (b << 12) | (c << 6);
+        *o++ = char(v >> 16);
+        if (i + 2 < n)
+            *o++ = char((v >> 8) & 0xff);
+    }
+    return true;
+}
+
+/**
+ * @brief Decode data and append it to out. Padding is optional.
+ *
+ * @return false on a character outside the alphabet or a truncated group,
+ * out is left unspecified then
+ */
+inline bool Base64Decode(const char* data, size_t size, std::string& out) {
+    size_t start = out.size();
+    out.resize(start + size / 4 * 3 + 2);
+    if (! Base64DecodeTo(data, size, &out[0] + start))
+        return false;
+    out.resize(start + size);
+    return true;
+}
+
+inline bool Base64Decode(const std::string& data, std::string& out) {
+    return Base64Decode(data.data(), data.size(), out);
+}
+
+/**
+ * @brief Replace data with its decoded bytes, without another buffer
+ */
+inline bool Base64DecodeInPlace(std::string& data) {
+    if (data.empty())
+        return true;
+    size_t size = data.size();
+    if (! Base64DecodeTo(data.data(), size, &data[0]))
+        return false;
+    data.resize(size);
+    return true;
+}
+
+} // namespace internal
+} // namespace etcd
+
+#endif // __ETCD_BASE64_HPP_INCLUDED__
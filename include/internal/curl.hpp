@@ -1,16 +1,21 @@
 #ifndef __ETCD_CURL_HPP_INCLUDED__
 #define __ETCD_CURL_HPP_INCLUDED__
 
+#include "../flight_recorder.hpp"
+#include "../metrics.hpp"
+#include "../request_trace.hpp"
+#include "probes.hpp"
 #include <curl/curl.h>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <functional>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <string>
 
-//#define DEBUG 1
-//#define CRAZY_VERBOSE 1
-//#define CRAZY_VERBOSE_STREAM stderr
-
 namespace etcd {
 namespace internal {
 
@@ -50,8 +55,17 @@ struct CurlException : public std::runtime_error {
 
 typedef std::map<std::string, std::string> CurlOptions;
 
+inline std::string FormBody(const CurlOptions& options);
+
 class Curl {
   public:
+    // TYPES
+    /**
+     * @brief Receives a streamed response body as it arrives, returns false
+     * to end the transfer
+     */
+    typedef std::function<bool (const char* data, size_t size)> StreamCallback;
+
     // LIFECYCLE
     Curl();
     ~Curl();
@@ -63,23 +77,83 @@ class Curl {
              const std::string& type,
              const CurlOptions& options);
 
+    /**
+     * @brief POST a JSON body, as the etcd v3 gateway expects
+     */
+    std::string PostJson(const std::string& url, const std::string& body);
+
+    /**
+     * @brief POST a JSON body and hand the response body to on_data as it
+     * arrives, for the streams of the v3 gateway. While the stream is idle
+     * on_data is called with no data about once a second, so the caller can
+     * end it. Ending it from on_data is not an error. An exception thrown by
+     * on_data ends the transfer and is rethrown.
+     */
+    void PostStream(const std::string& url,
+                    const std::string& body,
+                    const StreamCallback& on_data);
+
     std::string UrlEncode(const std::string& value);
     std::string UrlDecode(const std::string& value);
 
     void EnableHeader(bool onOff);
 
+    /**
+     * @brief Limit the connection phase and the whole of every request, in
+     * milliseconds. 0 leaves the limit to libcurl, which has none for a
+     * transfer.
+     */
+    void SetTimeouts(long connect_ms, long total_ms);
+
     std::string GetHeader();
 
+    /**
+     * @brief X-Etcd-Index of the last request, headers have to be enabled
+     *
+     * @return the index of the last response carrying the header, 0 if
+     * there was none
+     */
+    uint64_t GetEtcdIndex();
+
+    /**
+     * @brief Transport phases of the last performed request. parse is left
+     * at zero, it is filled in by the caller.
+     */
+    const RequestTimings& GetTimings();
+
+    /**
+     * @brief Status and byte counts of the last performed request. Read
+     * from libcurl on the first call after a request, with the timings, so
+     * a request nobody asks about costs no lookups.
+     */
+    const TransferInfo& GetTransferInfo();
+
     // callback from 'C' functions
     size_t WriteCb(void* buffer_p, size_t size, size_t nmemb) throw();
     size_t HeaderCb(void* buffer_p, size_t size, size_t nmemb) throw();
+    size_t StreamCb(void* buffer_p, size_t size, size_t nmemb) throw();
+    int ProgressCb() throw();
 
   private:
     // DATA MEMBERS
     CURL *handle_;
+    curl_slist *json_headers_;
     std::ostringstream write_stream_;
     std::ostringstream header_stream_;
     bool enable_header_;
+    long connect_timeout_;      // milliseconds, 0 for libcurl's default
+    long timeout_;
+    RequestTimings timings_;
+    TransferInfo info_;
+    long status_;               // HTTP status of the last request
+    bool collected_;            // info_ and timings_ are of the last request
+    FlightRecorder* recorder_;
+    TraceRecorder* trace_;
+    TraceReplayer* replayer_;
+    const StreamCallback* stream_;  // during PostStream only
+    bool stream_ended_;         // by the callback
+    uint64_t stream_bytes_;
+    std::exception_ptr stream_error_;
 
     // LIFECYCLE
     Curl(const Curl& rhs);
@@ -88,6 +162,18 @@ class Curl {
     // OPERATIONS
     void _CheckError(CURLcode err, const std::string& msg);
     void _ResetHandle();
+    void _CollectInfo();
+    void _Record(const char* method,
+                 const std::string& url,
+                 CURLcode err,
+                 const std::string& response);
+    CURLcode _Perform(const char* method,
+                      const std::string& url,
+                      const std::string& request,
+                      std::string& response);
+    CURLcode _Replay(const char* method,
+                     const std::string& url,
+                     const std::string& request);
 
     void _SetCommonOptions(const std::string& url);
 
@@ -95,7 +181,9 @@ class Curl {
 
     void _SetPostOptions(const std::string& url,
                          const std::string& type,
-                         const CurlOptions& options);
+                         const std::string& body);
+
+    void _SetJsonHeader();
 };
 
 extern "C" size_t
@@ -108,19 +196,34 @@ _HeaderCb(void* buffer_p, size_t size, size_t nmemb, internal::Curl* curl_p) {
     return curl_p->HeaderCb(buffer_p, size, nmemb);
 }
 
-#ifdef DEBUG
+extern "C" size_t
+_StreamCb(void* buffer_p, size_t size, size_t nmemb, internal::Curl* curl_p) {
+    return curl_p->StreamCb(buffer_p, size, nmemb);
+}
+
 extern "C" int
-_CurlTrace(CURL *handle, curl_infotype type,
-           char *data, size_t size,
-           void *userp);
-#endif
+_ProgressCb(internal::Curl* curl_p, curl_off_t, curl_off_t, curl_off_t,
+            curl_off_t) {
+    return curl_p->ProgressCb();
+}
 
 //------------------------------- LIFECYCLE ----------------------------------
 
 Curl::
 Curl()
   :handle_(NULL),
-   enable_header_(false) {
+   json_headers_(NULL),
+   enable_header_(false),
+   connect_timeout_(0),
+   timeout_(0),
+   status_(0),
+   collected_(true),
+   recorder_(&FlightRecorder::Global()),
+   trace_(&TraceRecorder::Global()),
+   replayer_(&TraceReplayer::Global()),
+   stream_(NULL),
+   stream_ended_(false),
+   stream_bytes_(0) {
 
     curl_global_init(CURL_GLOBAL_ALL);
     handle_ = curl_easy_init();
@@ -131,6 +234,7 @@ Curl()
 Curl::
 ~Curl() {
     curl_easy_cleanup(handle_);
+    curl_slist_free_all(json_headers_);
 }
 
 //------------------------------- OPERATIONS ---------------------------------
@@ -140,10 +244,16 @@ Get(const std::string& url) {
     _ResetHandle();
     _SetGetOptions(url);
 
-    CURLcode err = curl_easy_perform(handle_);
+    ETCD_PROBE2(request__start, "GET", url.c_str());
+    std::string response;
+    CURLcode err = _Perform("GET", url, std::string(), response);
+    ETCD_PROBE4(request__done, "GET", url.c_str(),
+                status_, (int) err);
+    if (recorder_->IsEnabled())
+        _Record("GET", url, err, response);
     _CheckError(err, "easy perform");
 
-    return write_stream_.str();
+    return response;
 }
 
 std::string Curl::
@@ -152,12 +262,80 @@ Set(const std::string& url,
     const CurlOptions& options) {
 
     _ResetHandle();
-    _SetPostOptions(url, type, options);
+    std::string body (FormBody(options));
+    _SetPostOptions(url, type, body);
+
+    ETCD_PROBE2(request__start, type.c_str(), url.c_str());
+    std::string response;
+    CURLcode err = _Perform(type.c_str(), url, body, response);
+    ETCD_PROBE4(request__done, type.c_str(), url.c_str(),
+                status_, (int) err);
+    if (recorder_->IsEnabled())
+        _Record(type.c_str(), url, err, response);
+    _CheckError(err, "easy perform");
 
-    CURLcode err = curl_easy_perform(handle_);
+    return response;
+}
+
+std::string Curl::
+PostJson(const std::string& url, const std::string& body) {
+    _ResetHandle();
+    _SetPostOptions(url, "POST", body);
+    _SetJsonHeader();
+
+    ETCD_PROBE2(request__start, "POST", url.c_str());
+    std::string response;
+    CURLcode err = _Perform("POST", url, body, response);
+    ETCD_PROBE4(request__done, "POST", url.c_str(),
+                status_, (int) err);
+    if (recorder_->IsEnabled())
+        _Record("POST", url, err, response);
     _CheckError(err, "easy perform");
 
-    return write_stream_.str();
+    return response;
+}
+
+void Curl::
+PostStream(
+    const std::string& url,
+    const std::string& body,
+    const StreamCallback& on_data) {
+    _ResetHandle();
+    _SetPostOptions(url, "POST", body);
+    _SetJsonHeader();
+
+    // A stream lasts as long as the caller wants, only connecting is timed
+    CURLcode err = curl_easy_setopt(handle_, CURLOPT_TIMEOUT_MS, 0L);
+    _CheckError(err, "set timeout");
+    err = curl_easy_setopt(handle_, CURLOPT_WRITEFUNCTION, _StreamCb);
+    _CheckError(err, "set write callback");
+    err = curl_easy_setopt(handle_, CURLOPT_NOPROGRESS, 0L);
+    _CheckError(err, "set no progress");
+    err = curl_easy_setopt(handle_, CURLOPT_XFERINFOFUNCTION, _ProgressCb);
+    _CheckError(err, "set progress callback");
+    err = curl_easy_setopt(handle_, CURLOPT_XFERINFODATA, this);
+    _CheckError(err, "set progress data");
+
+    stream_ = &on_data;
+    stream_ended_ = false;
+    stream_error_ = std::exception_ptr();
+
+    ETCD_PROBE2(request__start, "POST", url.c_str());
+    std::string response;
+    err = _Perform("POST", url, body, response);
+    stream_ = NULL;
+    ETCD_PROBE4(request__done, "POST", url.c_str(),
+                status_, (int) err);
+    if (recorder_->IsEnabled())
+        _Record("POST", url, err, response);
+
+    if (stream_error_)
+        std::rethrow_exception(stream_error_);
+    // A replayed stream comes back whole
+    if (err == CURLE_OK && replayer_->IsEnabled() && ! response.empty())
+        on_data(response.data(), response.size());
+    if (! stream_ended_)
+        _CheckError(err, "easy perform");
 }
 
 std::string Curl::
@@ -183,11 +361,56 @@ EnableHeader(bool onOff) {
     enable_header_ = onOff;
 }
 
+void Curl::
+SetTimeouts(long connect_ms, long total_ms) {
+    connect_timeout_ = connect_ms;
+    timeout_ = total_ms;
+}
+
 std::string Curl::
 GetHeader() {
     return header_stream_.str();
 }
 
+uint64_t Curl::
+GetEtcdIndex() {
+    static const char kLabel[] = "x-etcd-index:";
+    static const size_t kLabelLength = sizeof(kLabel) - 1;
+
+    // Header names are case insensitive. Redirects leave several responses
+    // in the stream, the last one wins.
+    const std::string header = header_stream_.str();
+    uint64_t index = 0;
+    std::string::size_type pos = 0;
+    while (pos < header.size()) {
+        std::string::size_type end = header.find('\n', pos);
+        if (end == std::string::npos)
+            end = header.size();
+        std::string::size_type i = 0;
+        while (i < kLabelLength && pos + i < end &&
+               std::tolower((unsigned char) header[pos + i]) == kLabel[i])
+            ++i;
+        if (i == kLabelLength) {
+            index = std::strtoull(header.c_str() + pos + kLabelLength,
+                                  NULL, 10);
+        }
+        pos = end + 1;
+    }
+    return index;
+}
+
+const RequestTimings& Curl::
+GetTimings() {
+    _CollectInfo();
+    return timings_;
+}
+
+const TransferInfo& Curl::
+GetTransferInfo() {
+    _CollectInfo();
+    return info_;
+}
+
 size_t Curl::
 WriteCb(void* buffer_p, size_t size, size_t nmemb) throw() {
     write_stream_ << std::string ((char*) buffer_p, size * nmemb);
@@ -196,6 +419,34 @@ WriteCb(void* buffer_p, size_t size, size_t nmemb) throw() {
     return size * nmemb;
 }
 
+size_t Curl::
+StreamCb(void* buffer_p, size_t size, size_t nmemb) throw() {
+    size_t n = size * nmemb;
+    stream_bytes_ += n;
+    try {
+        if ((*stream_)((const char*) buffer_p, n))
+            return n;
+        stream_ended_ = true;
+    } catch (...) {
+        stream_error_ = std::current_exception();
+    }
+    return 0;
+}
+
+int Curl::
+ProgressCb() throw() {
+    if (! stream_ || stream_ended_ || stream_error_)
+        return 0;
+    try {
+        if ((*stream_)(NULL, 0))
+            return 0;
+        stream_ended_ = true;
+    } catch (...) {
+        stream_error_ = std::current_exception();
+    }
+    return 1;
+}
+
 size_t Curl::
 HeaderCb(void* buffer_p, size_t size, size_t nmemb) throw() {
     header_stream_ << std::string ((char*) buffer_p, size * nmemb);
@@ -204,6 +455,51 @@ HeaderCb(void* buffer_p, size_t size, size_t nmemb) throw() {
     return size * nmemb;
 }
 
+/**
+ * @brief CURLcode carried by a transport exception, -1 if it has none
+ */
+inline int
+CurlErrorCode(const std::exception& e) {
+    const CurlException* curl_e = dynamic_cast<const CurlException*>(&e);
+    return curl_e ? (int) curl_e->error_code : -1;
+}
+
+/**
+ * @brief Whether a transport exception tells the server could not be
+ * reached at all, rather than that a request on a connection failed
+ */
+inline bool
+IsConnectError(const std::exception& e) {
+    switch (CurlErrorCode(e)) {
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_SSL_CONNECT_ERROR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Request body of a PUT, POST or DELETE, "name=value;" per option
+ */
+inline std::string
+FormBody(const CurlOptions& options) {
+    size_t size = 0;
+    for (auto const& opt :options)
+        size += opt.first.size() + opt.second.size() + 2;
+
+    std::string body;
+    body.reserve(size);
+    for (auto const& opt :options) {
+        body += opt.first;
+        body += '=';
+        body += opt.second;
+        body += ';';
+    }
+    return body;
+}
+
 inline void Curl::
 _CheckError(CURLcode err, const std::string& msg) {
     if (err != CURLE_OK) {
@@ -214,12 +510,148 @@ _CheckError(CURLcode err, const std::string& msg) {
 void Curl::
 _ResetHandle() {
     curl_easy_reset(handle_);
-#ifdef  DEBUG
-    curl_easy_setopt(handle_, CURLOPT_VERBOSE, 1L);
-#ifdef  CRAZY_VERBOSE
-    curl_easy_setopt(handle_, CURLOPT_DEBUGFUNCTION, _CurlTrace);
-#endif
+}
+
+void Curl::
+_CollectInfo() {
+    if (collected_)
+        return;
+    collected_ = true;
+
+    info_ = TransferInfo();
+    info_.response_code = status_;
+
+    long request_size = 0, header_size = 0;
+    curl_easy_getinfo(handle_, CURLINFO_REQUEST_SIZE, &request_size);
+    curl_easy_getinfo(handle_, CURLINFO_HEADER_SIZE, &header_size);
+    info_.bytes_sent = (uint64_t) request_size;
+    info_.bytes_received = (uint64_t) header_size +
+        (uint64_t) write_stream_.tellp() + stream_bytes_;
+
+    long connects = 0, redirects = 0;
+    curl_easy_getinfo(handle_, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(handle_, CURLINFO_REDIRECT_COUNT, &redirects);
+    info_.new_connections = (uint32_t) connects;
+    info_.redirects = (uint32_t) redirects;
+
+    // libcurl reports every timer as the time elapsed since the start of
+    // the transfer, convert them to the duration of each phase.
+#if LIBCURL_VERSION_NUM >= 0x073d00
+    curl_off_t dns = 0, connect = 0, tls = 0, pretransfer = 0;
+    curl_off_t first_byte = 0, total = 0;
+    curl_easy_getinfo(handle_, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(handle_, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(handle_, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(handle_, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+    curl_easy_getinfo(handle_, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+    curl_easy_getinfo(handle_, CURLINFO_TOTAL_TIME_T, &total);
+#else
+    double dns_s = 0, connect_s = 0, tls_s = 0, pretransfer_s = 0;
+    double first_byte_s = 0, total_s = 0;
+    curl_easy_getinfo(handle_, CURLINFO_NAMELOOKUP_TIME, &dns_s);
+    curl_easy_getinfo(handle_, CURLINFO_CONNECT_TIME, &connect_s);
+    curl_easy_getinfo(handle_, CURLINFO_APPCONNECT_TIME, &tls_s);
+    curl_easy_getinfo(handle_, CURLINFO_PRETRANSFER_TIME, &pretransfer_s);
+    curl_easy_getinfo(handle_, CURLINFO_STARTTRANSFER_TIME, &first_byte_s);
+    curl_easy_getinfo(handle_, CURLINFO_TOTAL_TIME, &total_s);
+    long long dns = (long long)(dns_s * 1e6);
+    long long connect = (long long)(connect_s * 1e6);
+    long long tls = (long long)(tls_s * 1e6);
+    long long pretransfer = (long long)(pretransfer_s * 1e6);
+    long long first_byte = (long long)(first_byte_s * 1e6);
+    long long total = (long long)(total_s * 1e6);
 #endif
+    // connect and tls stay at zero when an existing connection is reused
+    if (connect < dns)
+        connect = dns;
+    if (tls < connect)
+        tls = connect;
+    if (pretransfer < tls)
+        pretransfer = tls;
+    if (first_byte < pretransfer)
+        first_byte = pretransfer;
+    if (total < first_byte)
+        total = first_byte;
+
+    timings_ = RequestTimings();
+    timings_.dns = (uint64_t) dns;
+    timings_.connect = (uint64_t) (connect - dns);
+    timings_.tls = (uint64_t) (tls - connect);
+    timings_.first_byte = (uint64_t) (first_byte - tls);
+    timings_.transfer = (uint64_t) (total - first_byte);
+    timings_.total = (uint64_t) total;
+}
+
+void Curl::
+_Record(
+    const char* method,
+    const std::string& url,
+    CURLcode err,
+    const std::string& response) {
+    recorder_->Record(method, url, GetTransferInfo().response_code,
+                      (int) err, GetTimings(), response.data(),
+                      response.size());
+}
+
+CURLcode Curl::
+_Perform(
+    const char* method,
+    const std::string& url,
+    const std::string& request,
+    std::string& response) {
+    if (replayer_->IsEnabled()) {
+        collected_ = true;
+        CURLcode err = _Replay(method, url, request);
+        status_ = info_.response_code;
+        response = write_stream_.str();
+        return err;
+    }
+
+    bool tracing = trace_->IsEnabled();
+    std::chrono::steady_clock::time_point start;
+    if (tracing)
+        start = std::chrono::steady_clock::now();
+
+    CURLcode err = curl_easy_perform(handle_);
+    // The status is read at once for the USDT probes, which evaluate their
+    // arguments whether a tracer is attached or not. The rest is read from
+    // the handle once asked for, see GetTransferInfo.
+    status_ = 0;
+    curl_easy_getinfo(handle_, CURLINFO_RESPONSE_CODE, &status_);
+    collected_ = false;
+    // The body is copied out of the stream once, for the tracer, the
+    // flight recorder and the caller
+    response = write_stream_.str();
+
+    if (tracing) {
+        // The header stream is only cleared and filled with the headers
+        // enabled, otherwise it holds those of an earlier request
+        trace_->Record(start, method, url, request, (int) err,
+                       GetTransferInfo(), GetTimings(),
+                       enable_header_ ? header_stream_.str() : std::string(),
+                       response);
+    }
+    return err;
+}
+
+CURLcode Curl::
+_Replay(
+    const char* method,
+    const std::string& url,
+    const std::string& request) {
+    const TraceRecord* record = replayer_->Next(method, url, request);
+    if (! record) {
+        info_ = TransferInfo();
+        timings_ = RequestTimings();
+        return CURLE_COULDNT_CONNECT;
+    }
+
+    write_stream_ << record->body;
+    if (enable_header_)
+        header_stream_ << record->header;
+    info_ = record->info;
+    timings_ = record->timings;
+    return (CURLcode) record->curl_code;
 }
 
 void Curl::
@@ -236,6 +668,7 @@ _SetCommonOptions(const std::string& url) {
     // Clear write stream
     write_stream_.str("");
     write_stream_.clear();
+    stream_bytes_ = 0;
 
     // Set callback for write
     err = curl_easy_setopt(handle_, CURLOPT_WRITEFUNCTION, _WriteCb);
@@ -261,6 +694,18 @@ _SetCommonOptions(const std::string& url) {
         _CheckError(err, "set header data");
     }
  
+    if (connect_timeout_ || timeout_) {
+        // Timeouts are signalled with SIGALRM unless signals are disabled,
+        // which is not safe in a threaded process
+        err = curl_easy_setopt(handle_, CURLOPT_NOSIGNAL, 1L);
+        _CheckError(err, "set no signal");
+        err = curl_easy_setopt(handle_, CURLOPT_CONNECTTIMEOUT_MS,
+                               connect_timeout_);
+        _CheckError(err, "set connect timeout");
+        err = curl_easy_setopt(handle_, CURLOPT_TIMEOUT_MS, timeout_);
+        _CheckError(err, "set timeout");
+    }
+
     // Set the user agent. Some servers requires this on requests
     err = curl_easy_setopt(handle_, CURLOPT_USERAGENT, "libcurl-agent/1.0");
     _CheckError(err, "set write data");
@@ -275,7 +720,7 @@ void Curl::
 _SetPostOptions(
     const std::string& url,
     const std::string& type,
-    const CurlOptions& options) {
+    const std::string& body) {
 
     CURLcode err;
     err = curl_easy_setopt(handle_, CURLOPT_CUSTOMREQUEST, type.c_str());
@@ -286,87 +731,26 @@ _SetPostOptions(
     err = curl_easy_setopt(handle_, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
     _CheckError(err, "set post redir");
 
-    std::ostringstream ostr;
-    for (auto const& opt :options) {
-        ostr << opt.first << '=' << opt.second << ';';
-    }
-
-    std::string opts (ostr.str());
-    if (! opts.empty()) {
+    if (! body.empty()) {
         err = curl_easy_setopt(handle_, CURLOPT_POST, 1L);
         _CheckError(err, "set post");
-        err = curl_easy_setopt(handle_, CURLOPT_COPYPOSTFIELDS, opts.c_str());
+        err = curl_easy_setopt(handle_, CURLOPT_COPYPOSTFIELDS, body.c_str());
         _CheckError(err, "set copy post fields");
     }
 }
 
-#ifdef CRAZY_VERBOSE
-static
-void dump(const char *text,
-          FILE *stream, unsigned char *ptr, size_t size) {
-  size_t i;
-  size_t c;
-  unsigned int width=0x10;
- 
-  fprintf(stream, "%s, %10.10ld bytes (0x%8.8lx)\n",
-          text, (long)size, (long)size);
- 
-  for(i=0; i<size; i+= width) {
-    fprintf(stream, "%4.4lx: ", (long)i);
- 
-    /* show hex to the left */
-    for(c = 0; c < width; c++) {
-      if(i+c < size)
-        fprintf(stream, "%02x ", ptr[i+c]);
-      else
-        fputs("   ", stream);
+void Curl::
+_SetJsonHeader() {
+    if (! json_headers_) {
+        json_headers_ = curl_slist_append(NULL,
+                                          "Content-Type: application/json");
+        if (! json_headers_)
+            throw CurlUnknownException("failed header list");
     }
- 
-    /* show data on the right */
-    for(c = 0; (c < width) && (i+c < size); c++)
-      fputc((ptr[i+c]>=0x20) && (ptr[i+c]<0x80)?ptr[i+c]:'.', stream);
- 
-    fputc('\n', stream); /* newline */
-  }
-}
- 
-static
-int _CurlTrace(CURL *handle, curl_infotype type,
-             char *data, size_t size,
-             void *userp) {
-  const char *text;
-  (void)handle; /* prevent compiler warning */
- 
-  switch (type) {
-  case CURLINFO_TEXT:
-    fprintf(stderr, "== Info: %s", data);
-  default: /* in case a new one is introduced to shock us */
-    return 0;
- 
-  case CURLINFO_HEADER_OUT:
-    text = "=> Send header";
-    break;
-  case CURLINFO_DATA_OUT:
-    text = "=> Send data";
-    break;
-  case CURLINFO_SSL_DATA_OUT:
-    text = "=> Send SSL data";
-    break;
-  case CURLINFO_HEADER_IN:
-    text = "<= Recv header";
-    break;
-  case CURLINFO_DATA_IN:
-    text = "<= Recv data";
-    break;
-  case CURLINFO_SSL_DATA_IN:
-    text = "<= Recv SSL data";
-    break;
-  }
- 
-  dump(text, CRAZY_VERBOSE_STREAM, (unsigned char *)data, size);
-  return 0;
+    CURLcode err = curl_easy_setopt(handle_, CURLOPT_HTTPHEADER,
+                                    json_headers_);
+    _CheckError(err, "set http header");
 }
-#endif // CRAZY_VERBOSE
 
 } // namespace internal
 } // namespace etcd
@@ -0,0 +1,47 @@
+#ifndef __ETCD_PROBES_HPP_INCLUDED__
+#define __ETCD_PROBES_HPP_INCLUDED__
+
+/*
+ * USDT (user level statically defined tracing) probes of the "etcdcpp"
+ * provider. With systemtap's <sys/sdt.h> available every probe compiles to a
+ * single NOP plus an ELF note, tools like bpftrace or perf patch the NOP
+ * when they attach:
+ *
+ *   bpftrace -e 'usdt:./app:etcdcpp:request__done { @[str(arg1)] = count(); }'
+ *
+ * Probes and arguments:
+ *
+ *   request__start  (const char* method, const char* url)
+ *   request__done   (const char* method, const char* url, long status,
+ *                    int curl_code)
+ *   parse__start    (size_t length)
+ *   parse__done     (size_t length, int etcd_error_code); the error code
+ *                   of an error reply, 0 otherwise, -1 for invalid JSON
+ *   watch__event    (const char* key, uint64_t modified_index)
+ *   watch__resync   (const char* key, uint64_t etcd_index)
+ *
+ * Define ETCD_DISABLE_USDT to compile the probes out, they are also empty
+ * when <sys/sdt.h> cannot be found.
+ */
+
+#if !defined(ETCD_DISABLE_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define ETCD_USDT_ENABLED 1
+#endif
+#endif
+
+#ifdef ETCD_USDT_ENABLED
+#define ETCD_PROBE2(name, a1, a2) \
+    DTRACE_PROBE2(etcdcpp, name, a1, a2)
+#define ETCD_PROBE4(name, a1, a2, a3, a4) \
+    DTRACE_PROBE4(etcdcpp, name, a1, a2, a3, a4)
+#define ETCD_PROBE1(name, a1) \
+    DTRACE_PROBE1(etcdcpp, name, a1)
+#else
+#define ETCD_PROBE1(name, a1) do {} while (0)
+#define ETCD_PROBE2(name, a1, a2) do {} while (0)
+#define ETCD_PROBE4(name, a1, a2, a3, a4) do {} while (0)
+#endif
+
+#endif // __ETCD_PROBES_HPP_INCLUDED__
@@ -0,0 +1,342 @@
+#ifndef __ETCD_LEASE_MANAGER_HPP_INCLUDED__
+#define __ETCD_LEASE_MANAGER_HPP_INCLUDED__
+
+#include "v3_client.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace etcd {
+
+/**
+ * @brief Keeps v3 leases alive from a single thread and connection.
+ *
+ * Any number of keys can be attached to one lease, so liveness costs one
+ * lease per process instead of a TTL refresh per key as with v2. Leases
+ * are renewed a third of their ttl after the last renewal. When a lease is
+ * due, every lease past half of its renewal interval is renewed with it, in
+ * the same request: the gateway takes one keepalive message per lease in a
+ * single stream. A lease the server reports as expired, or which could not
+ * be renewed before its ttl ran out, is dropped and reported to the
+ * callback given to Start.
+ *
+ *   etcd::LeaseManager<etcd::RapidReply> leases("10.0.0.1", 2379);
+ *   leases.Start([](etcd::v3::LeaseId id) { ... });
+ *   etcd::v3::PutOptions options;
+ *   options.lease = leases.Grant(10);
+ *   client.Put("/services/a", "10.0.0.5:80", options);
+ *
+ * @tparam Reply json reply wrapper, see etcd::V3Client
+ * @tparam Tracer begin/end hooks around every request, see etcd::NullTracer
+ */
+template <typename Reply, typename Tracer = NullTracer>
+class LeaseManager {
+  public:
+    // CONSTANTS
+    /**
+     * @brief Delay before retrying a renewal which failed in transport
+     */
+    static const int64_t kRetryMs = 500;
+
+    /**
+     * @brief Limit of a grant or revoke request. A renewal is limited to
+     * the shortest renewal interval of its leases, so a stalled connection
+     * fails it in time to retry before the leases expire.
+     */
+    static const int64_t kTimeoutMs = 5000;
+
+    // TYPES
+    typedef std::function<void (v3::LeaseId id)> Callback;
+
+    // LIFECYCLE
+    LeaseManager(const std::string& server, const Port& port);
+
+    explicit LeaseManager(const std::shared_ptr<ClusterEndpoints>& endpoints);
+
+    ~LeaseManager();
+
+    // OPERATIONS
+    /**
+     * @brief Start renewing the leases from a thread of its own
+     *
+     * @param callback called from the manager's thread with the id of each
+     * lease lost
+     */
+    void Start(const Callback& callback = Callback());
+
+    /**
+     * @brief Stop renewing, waits for a renewal in progress. The leases are
+     * kept and renewed again on the next Start. Called by the destructor.
+     */
+    void Stop();
+
+    /**
+     * @brief Grant a lease and keep it alive
+     *
+     * @param ttl time to live in seconds
+     */
+    v3::LeaseId Grant(int64_t ttl);
+
+    /**
+     * @brief Keep alive a lease granted elsewhere
+     *
+     * @param ttl granted ttl of the lease in seconds
+     */
+    void Add(v3::LeaseId id, int64_t ttl);
+
+    /**
+     * @brief Stop keeping a lease alive, it expires at the end of its ttl
+     */
+    void Remove(v3::LeaseId id);
+
+    /**
+     * @brief Stop keeping a lease alive and revoke it, deleting its keys
+     */
+    void Revoke(v3::LeaseId id);
+
+    /**
+     * @brief Is the lease kept alive by this manager
+     */
+    bool Has(v3::LeaseId id) const;
+
+    size_t Size() const;
+
+    /**
+     * @brief Metrics of the manager's own client, its requests are recorded
+     * as etcd::Operation::OPERATION_LEASE
+     */
+    const ClientMetrics& GetMetrics() const;
+
+  private:
+    // TYPES
+    typedef std::chrono::steady_clock Clock;
+
+    struct Lease {
+        std::chrono::milliseconds interval;     // between two renewals
+        Clock::time_point renew;
+        Clock::time_point expires;
+    };
+
+    // DATA MEMBERS
+    V3Client<Reply, Tracer> client_;
+    std::mutex client_mutex_;   // client_ is used by callers and the thread
+    Callback callback_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::map<v3::LeaseId, Lease> leases_;
+    bool stopping_;
+    std::thread thread_;
+
+    // LIFECYCLE
+    LeaseManager(const LeaseManager& rhs);
+    void operator=(const LeaseManager& rhs);
+
+    // OPERATIONS
+    void _Run();
+    void _Renew(const std::vector<v3::LeaseId>& ids,
+                const std::chrono::milliseconds& timeout);
+};
+
+template <typename Reply, typename Tracer>
+const int64_t LeaseManager<Reply, Tracer>::kRetryMs;
+
+template <typename Reply, typename Tracer>
+const int64_t LeaseManager<Reply, Tracer>::kTimeoutMs;
+
+//------------------------------- LIFECYCLE ----------------------------------
+
+template <typename Reply, typename Tracer> LeaseManager<Reply, Tracer>::
+LeaseManager(const std::string& server, const Port& port)
+  :client_(server, port),
+   stopping_(false) {
+    client_.SetTimeouts(std::chrono::milliseconds(kTimeoutMs),
+                        std::chrono::milliseconds(kTimeoutMs));
+}
+
+template <typename Reply, typename Tracer> LeaseManager<Reply, Tracer>::
+LeaseManager(const std::shared_ptr<ClusterEndpoints>& endpoints)
+  :client_(endpoints),
+   stopping_(false) {
+    client_.SetTimeouts(std::chrono::milliseconds(kTimeoutMs),
+                        std::chrono::milliseconds(kTimeoutMs));
+}
+
+template <typename Reply, typename Tracer> LeaseManager<Reply, Tracer>::
+~LeaseManager() {
+    Stop();
+}
+
+//------------------------------- OPERATIONS ---------------------------------
+
+template <typename Reply, typename Tracer> void LeaseManager<Reply, Tracer>::
+Start(const Callback& callback) {
+    if (thread_.joinable())
+        return;
+    callback_ = callback;
+    stopping_ = false;
+    thread_ = std::thread(&LeaseManager::_Run, this);
+}
+
+template <typename Reply, typename Tracer> void LeaseManager<Reply, Tracer>::
+Stop() {
+    if (! thread_.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+}
+
+template <typename Reply, typename Tracer>
+v3::LeaseId LeaseManager<Reply, Tracer>::
+Grant(int64_t ttl) {
+    v3::LeaseGrantResponse response;
+    {
+        std::lock_guard<std::mutex> lock(client_mutex_);
+        response = client_.LeaseGrant(ttl);
+    }
+    Add(response.id, response.ttl);
+    return response.id;
+}
+
+template <typename Reply, typename Tracer> void LeaseManager<Reply, Tracer>::
+Add(v3::LeaseId id, int64_t ttl) {
+    Clock::time_point now = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Lease& lease = leases_[id];
+        lease.interval = std::chrono::milliseconds(
+            std::max<int64_t>(ttl * 1000 / 3, 1));
+        lease.renew = now + lease.interval;
+        lease.expires = now + std::chrono::seconds(ttl);
+    }
+    wake_.notify_all();
+}
+
+template <typename Reply, typename Tracer> void LeaseManager<Reply, Tracer>::
+Remove(v3::LeaseId id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    leases_.erase(id);
+}
+
+template <typename Reply, typename Tracer> void LeaseManager<Reply, Tracer>::
+Revoke(v3::LeaseId id) {
+    Remove(id);
+    std::lock_guard<std::mutex> lock(client_mutex_);
+    client_.LeaseRevoke(id);
+}
+
+template <typename Reply, typename Tracer> bool LeaseManager<Reply, Tracer>::
+Has(v3::LeaseId id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return leases_.count(id) != 0;
+}
+
+template <typename Reply, typename Tracer> size_t LeaseManager<Reply, Tracer>::
+Size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return leases_.size();
+}
+
+template <typename Reply, typename Tracer>
+const ClientMetrics& LeaseManager<Reply, Tracer>::
+GetMetrics() const {
+    return client_.GetMetrics();
+}
+
+template <typename Reply, typename Tracer> void LeaseManager<Reply, Tracer>::
+_Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (! stopping_) {
+        Clock::time_point next = Clock::time_point::max();
+        for (auto const& lease :leases_)
+            next = std::min(next, lease.second.renew);
+        if (next == Clock::time_point::max())
+            wake_.wait(lock);
+        else
+            wake_.wait_until(lock, next);
+        if (stopping_)
+            break;
+
+        // Renew what is due, and with it every lease past half of its
+        // interval, so leases granted around the same time share requests
+        Clock::time_point now = Clock::now();
+        if (next > now)
+            continue;
+        std::vector<v3::LeaseId> ids;
+        std::chrono::milliseconds timeout(kTimeoutMs);
+        for (auto const& lease :leases_) {
+            if (lease.second.renew <= now + lease.second.interval / 2) {
+                ids.push_back(lease.first);
+                timeout = std::min(timeout, lease.second.interval);
+            }
+        }
+        if (ids.empty())
+            continue;
+
+        lock.unlock();
+        _Renew(ids, timeout);
+        lock.lock();
+    }
+}
+
+template <typename Reply, typename Tracer> void LeaseManager<Reply, Tracer>::
+_Renew(
+    const std::vector<v3::LeaseId>& ids,
+    const std::chrono::milliseconds& timeout) {
+    Clock::time_point sent = Clock::now();
+    std::vector<v3::LeaseKeepAliveResponse> responses;
+    bool failed = false;
+    {
+        // A timeout, as any other error, is a failed renewal, retried
+        // until the leases expire
+        std::lock_guard<std::mutex> lock(client_mutex_);
+        client_.SetTimeouts(timeout, timeout);
+        try {
+            responses = client_.LeaseKeepAlive(ids);
+        } catch (const std::exception&) {
+            failed = true;
+        }
+        client_.SetTimeouts(std::chrono::milliseconds(kTimeoutMs),
+                            std::chrono::milliseconds(kTimeoutMs));
+    }
+
+    std::vector<v3::LeaseId> lost;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Clock::time_point now = Clock::now();
+        for (size_t i = 0; i < ids.size(); ++i) {
+            // Removed while the request was in flight
+            auto it = leases_.find(ids[i]);
+            if (it == leases_.end())
+                continue;
+            Lease& lease = it->second;
+            if (! failed && responses[i].ttl > 0) {
+                lease.interval = std::chrono::milliseconds(
+                    std::max<int64_t>(responses[i].ttl * 1000 / 3, 1));
+                lease.renew = sent + lease.interval;
+                lease.expires = sent + std::chrono::seconds(responses[i].ttl);
+            } else if (failed && now < lease.expires) {
+                lease.renew = std::min(
+                    now + std::chrono::milliseconds(kRetryMs),
+                    lease.expires);
+            } else {
+                lost.push_back(ids[i]);
+                leases_.erase(it);
+            }
+        }
+    }
+    if (callback_) {
+        for (auto id :lost)
+            callback_(id);
+    }
+}
+
+} // namespace etcd
+
+#endif // __ETCD_LEASE_MANAGER_HPP_INCLUDED__
@@ -0,0 +1,225 @@
+#ifndef __ETCD_MEMBER_DISCOVERY_HPP_INCLUDED__
+#define __ETCD_MEMBER_DISCOVERY_HPP_INCLUDED__
+
+#include "client.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace etcd {
+
+/**
+ * @brief Keeps a etcd::ClusterEndpoints in line with the members of the
+ * cluster.
+ *
+ * The discovery reads /v2/members from the current endpoint of the set,
+ * trying the others in turn if it cannot be reached, and replaces the set
+ * with the client URLs of the started members. It refreshes every
+ * interval, and as soon as a client reports a failed endpoint, but no more
+ * often than min_interval.
+ *
+ *   auto endpoints = std::make_shared<etcd::ClusterEndpoints>(
+ *       std::vector<std::string>{"http://10.0.0.1:2379"});
+ *   etcd::MemberDiscovery<etcd::RapidReply> discovery(
+ *       endpoints, std::chrono::seconds(30));
+ *   discovery.Start();
+ *   etcd::Client<etcd::RapidReply> client(endpoints);
+ *
+ * @tparam Reply json reply wrapper implementing GetMembers
+ * @tparam Tracer begin/end hooks around every request, see etcd::NullTracer
+ */
+template <typename Reply, typename Tracer = NullTracer>
+class MemberDiscovery {
+  public:
+    // TYPES
+    typedef std::function<void (const EndpointList& endpoints)> Callback;
+
+    // LIFECYCLE
+    /**
+     * @brief Create a discovery, no request is made before Start or Refresh
+     *
+     * @param endpoints endpoint set to keep up to date, seeded by the caller
+     * @param interval time between two periodic refreshes
+     * @param min_interval shortest time between two refreshes
+     */
+    MemberDiscovery(const std::shared_ptr<ClusterEndpoints>& endpoints,
+                    const std::chrono::milliseconds& interval,
+                    const std::chrono::milliseconds& min_interval =
+                        std::chrono::milliseconds(1000));
+
+    ~MemberDiscovery();
+
+    // OPERATIONS
+    /**
+     * @brief Start refreshing from a thread of its own, at once for the
+     * first time
+     *
+     * @param callback called from the discovery's thread whenever the set
+     * of URLs changed
+     */
+    void Start(const Callback& callback = Callback());
+
+    /**
+     * @brief Stop refreshing, waits for a refresh in progress. Called by
+     * the destructor.
+     */
+    void Stop();
+
+    /**
+     * @brief Read the members now, on the calling thread. Must not be
+     * called while the discovery is started.
+     *
+     * @return false if no endpoint of the set answered. The set is left
+     * unchanged then, as it is when no member has a client URL.
+     */
+    bool Refresh();
+
+    const std::shared_ptr<ClusterEndpoints>& GetEndpoints() const;
+
+    /**
+     * @brief Metrics of the discovery's own client, its requests are
+     * recorded as etcd::Operation::OPERATION_MEMBERS
+     */
+    const ClientMetrics& GetMetrics() const;
+
+  private:
+    // DATA MEMBERS
+    std::shared_ptr<ClusterEndpoints> endpoints_;
+    Client<Reply, Tracer> client_;
+    std::chrono::milliseconds interval_;
+    std::chrono::milliseconds min_interval_;
+    Callback callback_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_;
+    bool failed_;               // a client reported a failed endpoint
+    std::thread thread_;
+
+    // LIFECYCLE
+    MemberDiscovery(const MemberDiscovery& rhs);
+    void operator=(const MemberDiscovery& rhs);
+
+    // OPERATIONS
+    void _Run();
+    void _OnFailure();
+};
+
+//------------------------------- LIFECYCLE ----------------------------------
+
+template <typename Reply, typename Tracer> MemberDiscovery<Reply, Tracer>::
+MemberDiscovery(
+    const std::shared_ptr<ClusterEndpoints>& endpoints,
+    const std::chrono::milliseconds& interval,
+    const std::chrono::milliseconds& min_interval)
+  :endpoints_(endpoints),
+   client_(endpoints),
+   interval_(interval),
+   min_interval_(min_interval),
+   stopping_(false),
+   failed_(false) {
+}
+
+template <typename Reply, typename Tracer> MemberDiscovery<Reply, Tracer>::
+~MemberDiscovery() {
+    Stop();
+}
+
+//------------------------------- OPERATIONS ---------------------------------
+
+template <typename Reply, typename Tracer> void MemberDiscovery<Reply, Tracer>::
+Start(const Callback& callback) {
+    if (thread_.joinable())
+        return;
+    callback_ = callback;
+    stopping_ = false;
+    failed_ = false;
+    endpoints_->SetFailureListener(
+        std::bind(&MemberDiscovery::_OnFailure, this));
+    thread_ = std::thread(&MemberDiscovery::_Run, this);
+}
+
+template <typename Reply, typename Tracer> void MemberDiscovery<Reply, Tracer>::
+Stop() {
+    if (! thread_.joinable())
+        return;
+    endpoints_->SetFailureListener(ClusterEndpoints::FailureListener());
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+}
+
+template <typename Reply, typename Tracer> bool MemberDiscovery<Reply, Tracer>::
+Refresh() {
+    // A failed request moves the set to its next endpoint, so every
+    // endpoint is tried once
+    size_t attempts = endpoints_->GetList()->urls.size();
+    for (size_t i = 0; i < attempts; ++i) {
+        Members members;
+        try {
+            members = client_.GetMembers();
+        } catch (const std::exception&) {
+            continue;
+        }
+
+        std::vector<std::string> urls;
+        for (auto const& member :members)
+            urls.insert(urls.end(), member.client_urls.begin(),
+                        member.client_urls.end());
+        if (endpoints_->Update(urls) && callback_)
+            callback_(*endpoints_->GetList());
+        return true;
+    }
+    return false;
+}
+
+template <typename Reply, typename Tracer>
+const std::shared_ptr<ClusterEndpoints>& MemberDiscovery<Reply, Tracer>::
+GetEndpoints() const {
+    return endpoints_;
+}
+
+template <typename Reply, typename Tracer>
+const ClientMetrics& MemberDiscovery<Reply, Tracer>::
+GetMetrics() const {
+    return client_.GetMetrics();
+}
+
+template <typename Reply, typename Tracer> void MemberDiscovery<Reply, Tracer>::
+_Run() {
+    typedef std::chrono::steady_clock Clock;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (! stopping_) {
+        failed_ = false;
+        lock.unlock();
+        Refresh();
+        Clock::time_point last = Clock::now();
+        lock.lock();
+
+        // Failures reported during the refresh, including its own, wait for
+        // min_interval like any other
+        if (! stopping_)
+            wake_.wait_until(lock, last + min_interval_,
+                             [this] { return stopping_; });
+        wake_.wait_until(lock, last + interval_,
+                         [this] { return stopping_ || failed_; });
+    }
+}
+
+template <typename Reply, typename Tracer> void MemberDiscovery<Reply, Tracer>::
+_OnFailure() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        failed_ = true;
+    }
+    wake_.notify_all();
+}
+
+} // namespace etcd
+
+#endif // __ETCD_MEMBER_DISCOVERY_HPP_INCLUDED__
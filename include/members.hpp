@@ -0,0 +1,203 @@
+#ifndef __ETCD_MEMBERS_HPP_INCLUDED__
+#define __ETCD_MEMBERS_HPP_INCLUDED__
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace etcd {
+
+// ---------------------------- TYPES ---------------------------------------
+
+/**
+ * @brief One member of the cluster, from /v2/members. A member which has
+ * been added but not started yet has no client URLs.
+ */
+struct Member {
+    std::string id;
+    std::string name;
+    std::vector<std::string> peer_urls;
+    std::vector<std::string> client_urls;
+};
+
+typedef std::vector<Member> Members;
+
+/**
+ * @brief Client URLs of the cluster, e.g. "http://10.0.0.1:2379", and the
+ * one requests are sent to. A list is never modified once published.
+ */
+struct EndpointList {
+    EndpointList()
+      :current(0),
+       version(0)
+      {}
+
+    std::vector<std::string> urls;
+    size_t current;             // index in urls
+    uint64_t version;
+
+    const std::string& Current() const {
+        return urls[current];
+    }
+};
+
+/**
+ * @brief The endpoints of one cluster, shared by the clients and watches
+ * talking to it and kept up to date by etcd::MemberDiscovery.
+ *
+ * The list is swapped as a whole: a client picks up a new list before its
+ * next request and a request in flight keeps the URL it started with.
+ * Checking for a new list costs a client one relaxed load. A client which
+ * fails to reach its endpoint calls MarkFailed, which moves every client
+ * on to the next endpoint and asks the discovery to refresh the list.
+ *
+ *   auto endpoints = std::make_shared<etcd::ClusterEndpoints>(
+ *       std::vector<std::string>{"http://10.0.0.1:2379"});
+ *   etcd::Client<etcd::RapidReply> client(endpoints);
+ */
+class ClusterEndpoints {
+  public:
+    // TYPES
+    typedef std::function<void ()> FailureListener;
+
+    // LIFECYCLE
+    /**
+     * @brief Create the set from seed URLs, at least one is required
+     *
+     * @param urls client URLs with scheme and port, without a path
+     */
+    explicit ClusterEndpoints(const std::vector<std::string>& urls)
+      :version_(1),
+       failures_(0) {
+        std::shared_ptr<EndpointList> list(new EndpointList());
+        list->urls = _Normalize(urls);
+        if (list->urls.empty())
+            throw std::invalid_argument("etcd: no endpoint");
+        list->version = 1;
+        list_ = list;
+    }
+
+    // OPERATIONS
+    /**
+     * @brief Changes whenever the list or its current endpoint changes
+     */
+    uint64_t Version() const {
+        return version_.load(std::memory_order_relaxed);
+    }
+
+    std::shared_ptr<const EndpointList> GetList() const {
+        return std::atomic_load(&list_);
+    }
+
+    std::string Current() const {
+        return GetList()->Current();
+    }
+
+    /**
+     * @brief Transport failures reported since the set was created
+     */
+    uint64_t Failures() const {
+        return failures_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Replace the URLs. The current endpoint stays current if it is
+     * still a member.
+     *
+     * @return false if urls is empty or the set already holds these URLs
+     */
+    bool Update(const std::vector<std::string>& urls) {
+        std::vector<std::string> normalized = _Normalize(urls);
+        if (normalized.empty())
+            return false;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::shared_ptr<const EndpointList> old = std::atomic_load(&list_);
+        std::vector<std::string> sorted_old = old->urls;
+        std::vector<std::string> sorted_new = normalized;
+        std::sort(sorted_old.begin(), sorted_old.end());
+        std::sort(sorted_new.begin(), sorted_new.end());
+        if (sorted_old == sorted_new)
+            return false;
+
+        std::shared_ptr<EndpointList> list(new EndpointList());
+        list->urls = normalized;
+        std::vector<std::string>::const_iterator it =
+            std::find(normalized.begin(), normalized.end(), old->Current());
+        if (it != normalized.end())
+            list->current = it - normalized.begin();
+        _Publish(list);
+        return true;
+    }
+
+    /**
+     * @brief Report that url could not be reached. If it is the current
+     * endpoint the next one becomes current. Wakes the failure listener.
+     */
+    void MarkFailed(const std::string& url) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        failures_.fetch_add(1, std::memory_order_relaxed);
+
+        std::shared_ptr<const EndpointList> old = std::atomic_load(&list_);
+        if (old->urls.size() > 1 && old->Current() == url) {
+            std::shared_ptr<EndpointList> list(new EndpointList(*old));
+            list->current = (old->current + 1) % old->urls.size();
+            _Publish(list);
+        }
+        if (listener_)
+            listener_();
+    }
+
+    /**
+     * @brief Called by MarkFailed, with the set locked. A single listener
+     * is kept, pass an empty function to remove it.
+     */
+    void SetFailureListener(const FailureListener& listener) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        listener_ = listener;
+    }
+
+  private:
+    // DATA MEMBERS
+    std::shared_ptr<const EndpointList> list_;  // atomic_load/atomic_store
+    std::atomic<uint64_t> version_;
+    std::atomic<uint64_t> failures_;
+    FailureListener listener_;
+    std::mutex mutex_;                          // writers
+
+    // LIFECYCLE
+    ClusterEndpoints(const ClusterEndpoints& rhs);
+    void operator=(const ClusterEndpoints& rhs);
+
+    // OPERATIONS
+    void _Publish(std::shared_ptr<EndpointList>& list) {
+        list->version = version_.load(std::memory_order_relaxed) + 1;
+        std::atomic_store(&list_, std::shared_ptr<const EndpointList>(list));
+        version_.store(list->version, std::memory_order_release);
+    }
+
+    static std::vector<std::string> _Normalize(
+        const std::vector<std::string>& urls) {
+        std::vector<std::string> normalized;
+        for (auto url :urls) {
+            while (! url.empty() && url[url.size() - 1] == '/')
+                url.erase(url.size() - 1);
+            if (url.empty())
+                continue;
+            if (std::find(normalized.begin(), normalized.end(), url) ==
+                normalized.end())
+                normalized.push_back(url);
+        }
+        return normalized;
+    }
+};
+
+} // namespace etcd
+
+#endif // __ETCD_MEMBERS_HPP_INCLUDED__
@@ -0,0 +1,951 @@
+#ifndef __ETCD_METRICS_HPP_INCLUDED__
+#define __ETCD_METRICS_HPP_INCLUDED__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace etcd {
+
+// ---------------------------- TYPES ---------------------------------------
+
+/**
+ * @brief Operation classes used to bucket per request measurements
+ */
+enum class Operation {
+    OPERATION_GET,
+    OPERATION_GET_ALL,
+    OPERATION_SET,
+    OPERATION_COMPARE_AND_SWAP,
+    OPERATION_COMPARE_AND_DELETE,
+    OPERATION_DELETE,
+    OPERATION_WATCH,
+    OPERATION_STATS,
+    OPERATION_MEMBERS,
+    OPERATION_PROBE,
+    OPERATION_TXN,
+    OPERATION_LEASE,
+    OPERATION_UNKNOWN
+};
+
+const size_t kOperationCount =
+    static_cast<size_t>(Operation::OPERATION_UNKNOWN) + 1;
+
+inline const char* OperationName(Operation op) {
+    static const char* const kNames[kOperationCount] = {
+        "get",
+        "get_all",
+        "set",
+        "compare_and_swap",
+        "compare_and_delete",
+        "delete",
+        "watch",
+        "stats",
+        "members",
+        "probe",
+        "txn",
+        "lease",
+        "unknown"
+    };
+    return kNames[static_cast<size_t>(op)];
+}
+
+/**
+ * @brief Phases of a single request. Transport phases come from libcurl's
+ * timers, parse is the time spent constructing the Reply.
+ */
+enum class Phase {
+    PHASE_DNS,
+    PHASE_CONNECT,
+    PHASE_TLS,
+    PHASE_FIRST_BYTE,
+    PHASE_TRANSFER,
+    PHASE_PARSE,
+    PHASE_TOTAL
+};
+
+const size_t kPhaseCount = static_cast<size_t>(Phase::PHASE_TOTAL) + 1;
+
+inline const char* PhaseName(Phase phase) {
+    static const char* const kNames[kPhaseCount] = {
+        "dns",
+        "connect",
+        "tls",
+        "first_byte",
+        "transfer",
+        "parse",
+        "total"
+    };
+    return kNames[static_cast<size_t>(phase)];
+}
+
+/**
+ * @brief Break down of a request in microseconds. Every field holds the
+ * duration of its own phase, not the cumulative time since the start.
+ */
+struct RequestTimings {
+    RequestTimings()
+      :dns(0), connect(0), tls(0), first_byte(0),
+       transfer(0), parse(0), total(0)
+      {}
+
+    uint64_t Get(Phase phase) const {
+        switch (phase) {
+        case Phase::PHASE_DNS:        return dns;
+        case Phase::PHASE_CONNECT:    return connect;
+        case Phase::PHASE_TLS:        return tls;
+        case Phase::PHASE_FIRST_BYTE: return first_byte;
+        case Phase::PHASE_TRANSFER:   return transfer;
+        case Phase::PHASE_PARSE:      return parse;
+        case Phase::PHASE_TOTAL:      return total;
+        }
+        return 0;
+    }
+
+    uint64_t dns;
+    uint64_t connect;
+    uint64_t tls;
+    uint64_t first_byte;
+    uint64_t transfer;
+    uint64_t parse;
+    uint64_t total;
+};
+
+/**
+ * @brief Transfer level details of a performed request
+ */
+struct TransferInfo {
+    TransferInfo()
+      :response_code(0),
+       bytes_sent(0),
+       bytes_received(0),
+       new_connections(0),
+       redirects(0)
+      {}
+
+    long response_code;
+    uint64_t bytes_sent;        // request line, headers and body
+    uint64_t bytes_received;    // response headers and body
+    uint32_t new_connections;   // zero when an existing one was reused
+    uint32_t redirects;
+};
+
+//------------------------------- HISTOGRAM ----------------------------------
+
+/**
+ * @brief Copy of a LatencyHistogram taken at one point in time
+ */
+struct HistogramSnapshot {
+    HistogramSnapshot()
+      :count(0), sum(0), max(0)
+      {}
+
+    /**
+     * @brief Estimate a percentile from the bucket counts
+     *
+     * @param q percentile in the range [0, 100]
+     *
+     * @return upper bound in microseconds of the bucket holding q
+     */
+    uint64_t Percentile(double q) const;
+
+    uint64_t Mean() const {
+        return count ? sum / count : 0;
+    }
+
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    std::vector<uint64_t> buckets;
+};
+
+/**
+ * @brief HDR style log-linear histogram of microsecond values.
+ *
+ * Every power of two is split into kSubBuckets linear buckets which keeps
+ * the relative error under 1 / kSubBuckets. Recording is wait free (relaxed
+ * atomics only) and a snapshot is a plain copy of the bucket array, so it is
+ * cheap enough to be taken every second from a reporting thread.
+ */
+class LatencyHistogram {
+  public:
+    // CONSTANTS
+    static const unsigned kSubBucketBits = 4;
+    static const unsigned kSubBuckets = 1u << kSubBucketBits;
+    static const unsigned kMaxBits = 36;    // ~19 hours in microseconds
+    static const size_t kBucketCount =
+        2 * kSubBuckets + (kMaxBits - kSubBucketBits - 1) * kSubBuckets;
+
+    // LIFECYCLE
+    LatencyHistogram()
+      :count_(0), sum_(0), max_(0) {
+        for (size_t i = 0; i < kBucketCount; ++i)
+            buckets_[i].store(0, std::memory_order_relaxed);
+    }
+
+    // OPERATIONS
+    void Record(uint64_t value) {
+        buckets_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (value > max &&
+               !max_.compare_exchange_weak(max, value,
+                                           std::memory_order_relaxed)) {
+        }
+    }
+
+    /**
+     * @brief Cumulative counts at fixed upper bounds, e.g. to expose the
+     * histogram with coarser buckets. Reads the buckets without copying them.
+     *
+     * @param bounds ascending upper bounds in microseconds
+     * @param n number of bounds
+     * @param counts receives n counts of values <= the matching bound
+     */
+    void Cumulative(const uint64_t* bounds, size_t n, uint64_t* counts) const {
+        uint64_t seen = 0;
+        size_t b = 0;
+        for (size_t i = 0; i < kBucketCount && b < n; ++i) {
+            while (b < n && BucketUpperBound(i) > bounds[b])
+                counts[b++] = seen;
+            seen += buckets_[i].load(std::memory_order_relaxed);
+        }
+        while (b < n)
+            counts[b++] = seen;
+    }
+
+    uint64_t Count() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Sum() const {
+        return sum_.load(std::memory_order_relaxed);
+    }
+
+    void Snapshot(HistogramSnapshot& snapshot) const {
+        snapshot.buckets.resize(kBucketCount);
+        for (size_t i = 0; i < kBucketCount; ++i)
+            snapshot.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        snapshot.count = count_.load(std::memory_order_relaxed);
+        snapshot.sum = sum_.load(std::memory_order_relaxed);
+        snapshot.max = max_.load(std::memory_order_relaxed);
+    }
+
+    static size_t BucketIndex(uint64_t value) {
+        if (value < 2 * kSubBuckets)
+            return static_cast<size_t>(value);
+
+        unsigned msb = _Msb(value);
+        if (msb >= kMaxBits)
+            return kBucketCount - 1;
+
+        unsigned shift = msb - kSubBucketBits;
+        return 2 * kSubBuckets + (msb - kSubBucketBits - 1) * kSubBuckets +
+            static_cast<size_t>((value >> shift) - kSubBuckets);
+    }
+
+    /**
+     * @brief Largest value which still falls into bucket
+     */
+    static uint64_t BucketUpperBound(size_t bucket) {
+        if (bucket < 2 * kSubBuckets)
+            return bucket;
+
+        size_t rel = bucket - 2 * kSubBuckets;
+        unsigned msb = static_cast<unsigned>(rel / kSubBuckets) +
+            kSubBucketBits + 1;
+        uint64_t sub = rel % kSubBuckets + kSubBuckets;
+        unsigned shift = msb - kSubBucketBits;
+        return ((sub + 1) << shift) - 1;
+    }
+
+  private:
+    // DATA MEMBERS
+    std::atomic<uint64_t> buckets_[kBucketCount];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+
+    // LIFECYCLE
+    LatencyHistogram(const LatencyHistogram& rhs);
+    void operator=(const LatencyHistogram& rhs);
+
+    // OPERATIONS
+    static unsigned _Msb(uint64_t value) {
+        unsigned msb = 0;
+        while (value >>= 1)
+            ++msb;
+        return msb;
+    }
+};
+
+inline uint64_t HistogramSnapshot::
+Percentile(double q) const {
+    if (! count)
+        return 0;
+
+    uint64_t rank = static_cast<uint64_t>(q / 100.0 * count + 0.5);
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            uint64_t bound = LatencyHistogram::BucketUpperBound(i);
+            return bound < max ? bound : max;
+        }
+    }
+    return max;
+}
+
+struct PhaseSnapshot {
+    HistogramSnapshot phases[kPhaseCount];
+
+    const HistogramSnapshot& operator[](Phase phase) const {
+        return phases[static_cast<size_t>(phase)];
+    }
+};
+
+/**
+ * @brief One histogram per request phase
+ */
+class PhaseHistograms {
+  public:
+    PhaseHistograms() {}
+
+    void Record(const RequestTimings& timings) {
+        for (size_t i = 0; i < kPhaseCount; ++i)
+            phases_[i].Record(timings.Get(static_cast<Phase>(i)));
+    }
+
+    void Snapshot(PhaseSnapshot& snapshot) const {
+        for (size_t i = 0; i < kPhaseCount; ++i)
+            phases_[i].Snapshot(snapshot.phases[i]);
+    }
+
+    const LatencyHistogram& operator[](Phase phase) const {
+        return phases_[static_cast<size_t>(phase)];
+    }
+
+  private:
+    LatencyHistogram phases_[kPhaseCount];
+};
+
+//------------------------------- COUNTERS -----------------------------------
+
+enum class Counter {
+    COUNTER_REQUESTS,
+    COUNTER_NEW_CONNECTIONS,
+    COUNTER_REUSED_CONNECTIONS,
+    COUNTER_REDIRECTS,
+    COUNTER_BYTES_SENT,
+    COUNTER_BYTES_RECEIVED,
+    COUNTER_TRANSPORT_ERRORS,
+    COUNTER_ETCD_ERRORS
+};
+
+const size_t kCounterCount =
+    static_cast<size_t>(Counter::COUNTER_ETCD_ERRORS) + 1;
+
+inline const char* CounterName(Counter counter) {
+    static const char* const kNames[kCounterCount] = {
+        "requests",
+        "new_connections",
+        "reused_connections",
+        "redirects",
+        "bytes_sent",
+        "bytes_received",
+        "transport_errors",
+        "etcd_errors"
+    };
+    return kNames[static_cast<size_t>(counter)];
+}
+
+struct TransportSnapshot {
+    TransportSnapshot() {
+        for (size_t i = 0; i < kCounterCount; ++i)
+            counters[i] = 0;
+    }
+
+    uint64_t operator[](Counter counter) const {
+        return counters[static_cast<size_t>(counter)];
+    }
+
+    uint64_t counters[kCounterCount];
+    std::map<int, uint64_t> curl_errors;    // CURLcode -> count, -1 unknown
+    std::map<int, uint64_t> etcd_errors;    // etcd errorCode -> count
+};
+
+/**
+ * @brief Monotonic transport counters of a client.
+ *
+ * Counters are sharded: a thread always adds to the shard picked by its id,
+ * so concurrent requests from different threads do not fight over the same
+ * cache lines. A client is mostly used from one thread at a time, there are
+ * as many shards as cores up to kMaxShards, 1.8 KB each. A snapshot sums
+ * all shards.
+ */
+class TransportCounters {
+  public:
+    // CONSTANTS
+    static const size_t kMaxShards = 4;
+    static const size_t kCurlCodes = 128;       // last slot counts the rest
+    static const size_t kEtcdCodes = 5 * 16 + 1;
+
+    // LIFECYCLE
+    TransportCounters()
+      :shard_count_(_ShardCount()),
+       shards_(new Shard[shard_count_]) {
+        for (size_t s = 0; s < shard_count_; ++s) {
+            Shard& shard = shards_[s];
+            for (size_t i = 0; i < kCounterCount; ++i)
+                shard.counters[i].store(0, std::memory_order_relaxed);
+            for (size_t i = 0; i < kCurlCodes; ++i)
+                shard.curl_errors[i].store(0, std::memory_order_relaxed);
+            for (size_t i = 0; i < kEtcdCodes; ++i)
+                shard.etcd_errors[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // OPERATIONS
+    void Add(Counter counter, uint64_t value) {
+        _Shard().counters[static_cast<size_t>(counter)].fetch_add(
+            value, std::memory_order_relaxed);
+    }
+
+    void RecordTransfer(const TransferInfo& info) {
+        Shard& shard = _Shard();
+        _Add(shard, Counter::COUNTER_REQUESTS, 1);
+        if (info.new_connections)
+            _Add(shard, Counter::COUNTER_NEW_CONNECTIONS,
+                 info.new_connections);
+        else
+            _Add(shard, Counter::COUNTER_REUSED_CONNECTIONS, 1);
+        if (info.redirects)
+            _Add(shard, Counter::COUNTER_REDIRECTS, info.redirects);
+        _Add(shard, Counter::COUNTER_BYTES_SENT, info.bytes_sent);
+        _Add(shard, Counter::COUNTER_BYTES_RECEIVED, info.bytes_received);
+    }
+
+    void RecordTransportError(int curl_code) {
+        Shard& shard = _Shard();
+        _Add(shard, Counter::COUNTER_REQUESTS, 1);
+        _Add(shard, Counter::COUNTER_TRANSPORT_ERRORS, 1);
+        size_t slot = (curl_code >= 0 && curl_code < (int) kCurlCodes - 1) ?
+            (size_t) curl_code : kCurlCodes - 1;
+        shard.curl_errors[slot].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void RecordEtcdError(int error_code) {
+        Shard& shard = _Shard();
+        _Add(shard, Counter::COUNTER_ETCD_ERRORS, 1);
+        shard.etcd_errors[_EtcdSlot(error_code)].fetch_add(
+            1, std::memory_order_relaxed);
+    }
+
+    void Snapshot(TransportSnapshot& snapshot) const;
+
+  private:
+    // TYPES
+    struct Shard {
+        std::atomic<uint64_t> counters[kCounterCount];
+        std::atomic<uint64_t> curl_errors[kCurlCodes];
+        std::atomic<uint64_t> etcd_errors[kEtcdCodes];
+        char padding[64];       // keep neighbouring shards off our lines
+    };
+
+    // DATA MEMBERS
+    size_t shard_count_;
+    std::unique_ptr<Shard[]> shards_;
+
+    // LIFECYCLE
+    TransportCounters(const TransportCounters& rhs);
+    void operator=(const TransportCounters& rhs);
+
+    // OPERATIONS
+    Shard& _Shard() {
+        static const std::hash<std::thread::id> hasher = {};
+        return shards_[hasher(std::this_thread::get_id()) % shard_count_];
+    }
+
+    static size_t _ShardCount() {
+        size_t cores = std::thread::hardware_concurrency();
+        if (cores == 0)
+            return 1;
+        if (cores > kMaxShards)
+            return kMaxShards;
+        return cores;
+    }
+
+    static void _Add(Shard& shard, Counter counter, uint64_t value) {
+        shard.counters[static_cast<size_t>(counter)].fetch_add(
+            value, std::memory_order_relaxed);
+    }
+
+    // etcd error codes are grouped by hundreds (1xx command, 2xx post form,
+    // 3xx raft, 4xx etcd, 5xx internal) with few codes per group.
+    static size_t _EtcdSlot(int code) {
+        int group = code / 100;
+        int index = code % 100;
+        if (group < 1 || group > 5 || index < 0 || index >= 16)
+            return kEtcdCodes - 1;
+        return (size_t) ((group - 1) * 16 + index);
+    }
+
+    static int _EtcdCode(size_t slot) {
+        if (slot == kEtcdCodes - 1)
+            return -1;
+        return (int) ((slot / 16 + 1) * 100 + slot % 16);
+    }
+};
+
+inline void TransportCounters::
+Snapshot(TransportSnapshot& snapshot) const {
+    snapshot = TransportSnapshot();
+    for (size_t s = 0; s < shard_count_; ++s) {
+        const Shard& shard = shards_[s];
+        for (size_t i = 0; i < kCounterCount; ++i)
+            snapshot.counters[i] +=
+                shard.counters[i].load(std::memory_order_relaxed);
+        for (size_t i = 0; i < kCurlCodes; ++i) {
+            uint64_t n = shard.curl_errors[i].load(std::memory_order_relaxed);
+            if (n)
+                snapshot.curl_errors[i == kCurlCodes - 1 ? -1 : (int) i] += n;
+        }
+        for (size_t i = 0; i < kEtcdCodes; ++i) {
+            uint64_t n = shard.etcd_errors[i].load(std::memory_order_relaxed);
+            if (n)
+                snapshot.etcd_errors[_EtcdCode(i)] += n;
+        }
+    }
+}
+
+//------------------------------- WATCH --------------------------------------
+
+struct WatchSnapshot {
+    WatchSnapshot()
+      :etcd_index(0), delivered_index(0), lag(0), max_lag(0),
+       events(0), resyncs(0)
+      {}
+
+    uint64_t etcd_index;        // last X-Etcd-Index seen
+    uint64_t delivered_index;   // modifiedIndex of the last delivered event
+    uint64_t lag;               // etcd_index - delivered_index
+    uint64_t max_lag;
+    uint64_t events;
+    uint64_t resyncs;           // index out of date (401) recoveries
+    HistogramSnapshot delivery;
+};
+
+/**
+ * @brief How far behind the cluster a watch is.
+ *
+ * The lag is the number of etcd indexes between the cluster's X-Etcd-Index
+ * and the last delivered modifiedIndex. etcd v2 only keeps the last 1000
+ * events, a watch whose lag approaches that window is about to fall out of
+ * the history and resync. The delivery histogram measures the time from the
+ * watch response reaching the client to the callback returning, parsing
+ * and the consumer included; v2 does not tell the commit time of an event.
+ */
+class WatchMetrics {
+  public:
+    // LIFECYCLE
+    WatchMetrics()
+      :etcd_index_(0), delivered_index_(0), lag_(0), max_lag_(0),
+       events_(0), resyncs_(0)
+      {}
+
+    // OPERATIONS
+    /**
+     * @brief The index only moves forward, a long-poll answers with the
+     * X-Etcd-Index of the moment it was started.
+     */
+    void RecordEtcdIndex(uint64_t index) {
+        uint64_t current = etcd_index_.load(std::memory_order_relaxed);
+        while (index > current &&
+               !etcd_index_.compare_exchange_weak(current, index,
+                                                  std::memory_order_relaxed))
+            ;
+    }
+
+    /**
+     * @return the lag after delivering modified_index
+     */
+    uint64_t RecordDelivery(uint64_t modified_index, uint64_t latency) {
+        delivered_index_.store(modified_index, std::memory_order_relaxed);
+        events_.fetch_add(1, std::memory_order_relaxed);
+        delivery_.Record(latency);
+        return _UpdateLag();
+    }
+
+    /**
+     * @brief The watch restarted from index after falling out of the event
+     * history
+     *
+     * @return the lag after the resync
+     */
+    uint64_t RecordResync(uint64_t index) {
+        resyncs_.fetch_add(1, std::memory_order_relaxed);
+        RecordEtcdIndex(index);
+        delivered_index_.store(index, std::memory_order_relaxed);
+        return _UpdateLag();
+    }
+
+    uint64_t Lag() const {
+        return lag_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t EtcdIndex() const {
+        return etcd_index_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Events() const {
+        return events_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Resyncs() const {
+        return resyncs_.load(std::memory_order_relaxed);
+    }
+
+    const LatencyHistogram& Delivery() const {
+        return delivery_;
+    }
+
+    void Snapshot(WatchSnapshot& snapshot) const {
+        snapshot.etcd_index = EtcdIndex();
+        snapshot.delivered_index =
+            delivered_index_.load(std::memory_order_relaxed);
+        snapshot.lag = Lag();
+        snapshot.max_lag = max_lag_.load(std::memory_order_relaxed);
+        snapshot.events = Events();
+        snapshot.resyncs = Resyncs();
+        delivery_.Snapshot(snapshot.delivery);
+    }
+
+  private:
+    // DATA MEMBERS
+    std::atomic<uint64_t> etcd_index_;
+    std::atomic<uint64_t> delivered_index_;
+    std::atomic<uint64_t> lag_;
+    std::atomic<uint64_t> max_lag_;
+    std::atomic<uint64_t> events_;
+    std::atomic<uint64_t> resyncs_;
+    LatencyHistogram delivery_;
+
+    // OPERATIONS
+    uint64_t _UpdateLag() {
+        uint64_t etcd = etcd_index_.load(std::memory_order_relaxed);
+        uint64_t delivered = delivered_index_.load(std::memory_order_relaxed);
+        uint64_t lag = etcd > delivered ? etcd - delivered : 0;
+        lag_.store(lag, std::memory_order_relaxed);
+        if (lag > max_lag_.load(std::memory_order_relaxed))
+            max_lag_.store(lag, std::memory_order_relaxed);
+        return lag;
+    }
+};
+
+//------------------------------- REGISTRY -----------------------------------
+
+struct MetricsSnapshot {
+    MetricsSnapshot()
+      :in_flight(0)
+      {}
+
+    PhaseSnapshot operations[kOperationCount];
+    std::map<std::string, PhaseSnapshot> endpoints;
+    TransportSnapshot transport;
+    int64_t in_flight;
+    WatchSnapshot watch;        // only filled for watches
+
+    const PhaseSnapshot& operator[](Operation op) const {
+        return operations[static_cast<size_t>(op)];
+    }
+};
+
+class ClientMetrics;
+
+/**
+ * @brief Process wide list of the live ClientMetrics, used by exporters such
+ * as RenderPrometheus. Only construction, destruction and exporting take
+ * the lock, never the request path.
+ */
+class MetricsRegistry {
+  public:
+    static MetricsRegistry& Global() {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    uint64_t Register(const ClientMetrics* metrics) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.push_back(metrics);
+        return ++last_id_;
+    }
+
+    void Unregister(const ClientMetrics* metrics) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            if (entries_[i] == metrics) {
+                entries_.erase(entries_.begin() + i);
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief Call f(const ClientMetrics&) for every registered object. The
+     * registry is locked during the walk, f must not create or destroy
+     * clients.
+     */
+    template <typename F>
+    void ForEach(F f) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < entries_.size(); ++i)
+            f(*entries_[i]);
+    }
+
+  private:
+    // DATA MEMBERS
+    std::vector<const ClientMetrics*> entries_;
+    uint64_t last_id_;
+    mutable std::mutex mutex_;
+
+    // LIFECYCLE
+    MetricsRegistry() :last_id_(0) {}
+    MetricsRegistry(const MetricsRegistry& rhs);
+    void operator=(const MetricsRegistry& rhs);
+};
+
+/**
+ * @brief Latency histograms of a client, bucketed per operation type and per
+ * endpoint, its transport counters and in-flight gauge.
+ *
+ * The histograms of an operation, about 30 KB, are created when it is first
+ * recorded: a client only pays for the operations it performs, a watch for
+ * its long-polls. Endpoint histograms are created by the owner when it
+ * learns about an endpoint, the request path only records into them. Every
+ * object is listed in MetricsRegistry::Global() during its lifetime.
+ */
+class ClientMetrics {
+  public:
+    // LIFECYCLE
+    /**
+     * @param kind static string naming the owner, e.g. "client" or "watch"
+     */
+    explicit ClientMetrics(const char* kind = "client")
+      :kind_(kind),
+       in_flight_(0),
+       watch_view_(NULL),
+       id_(0) {
+        for (size_t i = 0; i < kOperationCount; ++i)
+            operations_[i].store(NULL, std::memory_order_relaxed);
+        id_ = MetricsRegistry::Global().Register(this);
+    }
+
+    ~ClientMetrics() {
+        MetricsRegistry::Global().Unregister(this);
+        for (size_t i = 0; i < kOperationCount; ++i)
+            delete operations_[i].load(std::memory_order_relaxed);
+    }
+
+    // OPERATIONS
+    void BeginRequest() {
+        in_flight_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void EndRequest() {
+        in_flight_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    int64_t InFlight() const {
+        return in_flight_.load(std::memory_order_relaxed);
+    }
+
+    const char* Kind() const {
+        return kind_;
+    }
+
+    /**
+     * @brief Watch lag metrics, created on first use by the owning watch
+     *
+     * @return NULL for owners which are not watches
+     */
+    WatchMetrics* Watch() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (! watch_) {
+            watch_.reset(new WatchMetrics());
+            watch_view_.store(watch_.get(), std::memory_order_release);
+        }
+        return watch_.get();
+    }
+
+    const WatchMetrics* Watch() const {
+        return watch_view_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Process unique id, used to tell clients apart in exports
+     */
+    uint64_t Id() const {
+        return id_;
+    }
+
+    void Record(Operation op,
+                PhaseHistograms* endpoint,
+                const RequestTimings& timings) {
+        _Operation(op).Record(timings);
+        if (endpoint)
+            endpoint->Record(timings);
+    }
+
+    /**
+     * @brief Find or create the histograms of an endpoint. The returned
+     * pointer is valid for the lifetime of this object.
+     */
+    PhaseHistograms* Endpoint(const std::string& endpoint) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::unique_ptr<PhaseHistograms>& slot = endpoints_[endpoint];
+        if (! slot)
+            slot.reset(new PhaseHistograms());
+        return slot.get();
+    }
+
+    void RecordTransfer(const TransferInfo& info) {
+        counters_.RecordTransfer(info);
+    }
+
+    void RecordTransportError(int curl_code) {
+        counters_.RecordTransportError(curl_code);
+    }
+
+    void RecordEtcdError(int error_code) {
+        counters_.RecordEtcdError(error_code);
+    }
+
+    /**
+     * @brief Histograms of op, empty ones if it was never recorded
+     */
+    const PhaseHistograms& operator[](Operation op) const {
+        static const PhaseHistograms empty;
+        const PhaseHistograms* histograms =
+            operations_[static_cast<size_t>(op)].load(
+                std::memory_order_acquire);
+        return histograms ? *histograms : empty;
+    }
+
+    const TransportCounters& Counters() const {
+        return counters_;
+    }
+
+    /**
+     * @brief Call f(const std::string&, const PhaseHistograms&) for every
+     * endpoint, with the endpoint list locked.
+     */
+    template <typename F>
+    void ForEachEndpoint(F f) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto const& ep :endpoints_)
+            f(ep.first, *ep.second);
+    }
+
+    void Snapshot(MetricsSnapshot& snapshot) const {
+        for (size_t i = 0; i < kOperationCount; ++i) {
+            const PhaseHistograms* histograms =
+                operations_[i].load(std::memory_order_acquire);
+            if (histograms)
+                histograms->Snapshot(snapshot.operations[i]);
+            else
+                snapshot.operations[i] = PhaseSnapshot();
+        }
+        counters_.Snapshot(snapshot.transport);
+        snapshot.in_flight = InFlight();
+        if (const WatchMetrics* watch = Watch())
+            watch->Snapshot(snapshot.watch);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto const& ep :endpoints_)
+            ep.second->Snapshot(snapshot.endpoints[ep.first]);
+    }
+
+  private:
+    // DATA MEMBERS
+    const char* kind_;
+    std::atomic<PhaseHistograms*> operations_[kOperationCount];
+    TransportCounters counters_;
+    std::atomic<int64_t> in_flight_;
+    std::unique_ptr<WatchMetrics> watch_;
+    std::atomic<WatchMetrics*> watch_view_;     // watch_, published
+    std::map<std::string, std::unique_ptr<PhaseHistograms> > endpoints_;
+    uint64_t id_;
+    mutable std::mutex mutex_;
+
+    // LIFECYCLE
+    ClientMetrics(const ClientMetrics& rhs);
+    void operator=(const ClientMetrics& rhs);
+
+    // OPERATIONS
+    PhaseHistograms& _Operation(Operation op) {
+        std::atomic<PhaseHistograms*>& slot =
+            operations_[static_cast<size_t>(op)];
+        PhaseHistograms* histograms = slot.load(std::memory_order_acquire);
+        if (histograms)
+            return *histograms;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        histograms = slot.load(std::memory_order_relaxed);
+        if (! histograms) {
+            histograms = new PhaseHistograms();
+            slot.store(histograms, std::memory_order_release);
+        }
+        return *histograms;
+    }
+};
+
+//------------------------------- HELPERS ------------------------------------
+
+namespace internal {
+
+/**
+ * @brief Keeps a request counted in ClientMetrics::InFlight() until the
+ * scope is left, whichever way.
+ */
+class InFlightGuard {
+  public:
+    explicit InFlightGuard(ClientMetrics& metrics)
+      :metrics_(metrics) {
+        metrics_.BeginRequest();
+    }
+
+    ~InFlightGuard() {
+        metrics_.EndRequest();
+    }
+
+  private:
+    ClientMetrics& metrics_;
+
+    InFlightGuard(const InFlightGuard& rhs);
+    void operator=(const InFlightGuard& rhs);
+};
+
+inline uint64_t ElapsedMicros(
+    const std::chrono::steady_clock::time_point& start) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+}
+
+} // namespace internal
+
+} // namespace etcd
+
+#endif // __ETCD_METRICS_HPP_INCLUDED__
@@ -0,0 +1,318 @@
+#ifndef __ETCD_PROMETHEUS_HPP_INCLUDED__
+#define __ETCD_PROMETHEUS_HPP_INCLUDED__
+
+#include "metrics.hpp"
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace etcd {
+namespace internal {
+
+/**
+ * @brief Appends text to a caller provided buffer. Output beyond the buffer
+ * is dropped but still counted, like snprintf.
+ */
+class TextBuffer {
+  public:
+    TextBuffer(char* buffer, size_t size)
+      :buffer_(buffer),
+       size_(size),
+       length_(0) {
+    }
+
+    void Append(const char* text) {
+        Append(text, std::strlen(text));
+    }
+
+    void Append(const char* text, size_t len) {
+        if (length_ < size_) {
+            size_t n = size_ - length_ > len ? len : size_ - length_;
+            std::memcpy(buffer_ + length_, text, n);
+        }
+        length_ += len;
+    }
+
+    void Printf(const char* format, ...) {
+        char line[256];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        if (n > 0)
+            Append(line, (size_t) n < sizeof(line) ? (size_t) n
+                                                    : sizeof(line) - 1);
+    }
+
+    /**
+     * @brief NUL terminate the output, truncating it if needed
+     *
+     * @return length of the complete output without the terminator
+     */
+    size_t Finish() {
+        if (size_)
+            buffer_[length_ < size_ ? length_ : size_ - 1] = '\0';
+        return length_;
+    }
+
+  private:
+    char* buffer_;
+    size_t size_;
+    size_t length_;
+};
+
+/**
+ * @brief Transport counters of one client, detached from the client
+ */
+struct CounterRow {
+    const char* kind;
+    uint64_t id;
+    TransportSnapshot snapshot;
+};
+
+/**
+ * @brief Writes the series of the metric families
+ */
+class PrometheusWriter {
+  public:
+    explicit PrometheusWriter(TextBuffer& out)
+      :out_(out) {
+    }
+
+    void Family(const char* name, const char* type, const char* help) {
+        out_.Printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    }
+
+    void Labels(const ClientMetrics& m) {
+        Labels(m.Kind(), m.Id());
+    }
+
+    void Labels(const char* kind, uint64_t id) {
+        out_.Printf("kind=\"%s\",client=\"%llu\"",
+                    kind, (unsigned long long) id);
+    }
+
+    void Value(const char* name, const CounterRow& row,
+               const char* extra, uint64_t value) {
+        out_.Printf("%s{", name);
+        Labels(row.kind, row.id);
+        if (extra)
+            out_.Append(extra);
+        out_.Printf("} %llu\n", (unsigned long long) value);
+    }
+
+    void Histogram(const char* name,
+                   const ClientMetrics& m,
+                   const std::string& extra,
+                   const LatencyHistogram& h) {
+        static const uint64_t kBounds[] = {
+            100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+            100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+            ~uint64_t(0)
+        };
+        static const size_t kCount = sizeof(kBounds) / sizeof(kBounds[0]);
+
+        uint64_t counts[kCount];
+        h.Cumulative(kBounds, kCount, counts);
+        if (! counts[kCount - 1])
+            return;
+
+        for (size_t i = 0; i < kCount; ++i) {
+            out_.Printf("%s_bucket{", name);
+            Labels(m);
+            out_.Append(extra.data(), extra.size());
+            if (i == kCount - 1)
+                out_.Append(",le=\"+Inf\"");
+            else
+                out_.Printf(",le=\"%g\"", kBounds[i] / 1e6);
+            out_.Printf("} %llu\n", (unsigned long long) counts[i]);
+        }
+        out_.Printf("%s_sum{", name);
+        Labels(m);
+        out_.Append(extra.data(), extra.size());
+        out_.Printf("} %.6f\n", h.Sum() / 1e6);
+        out_.Printf("%s_count{", name);
+        Labels(m);
+        out_.Append(extra.data(), extra.size());
+        out_.Printf("} %llu\n", (unsigned long long) counts[kCount - 1]);
+    }
+
+  private:
+    TextBuffer& out_;
+};
+
+} // namespace internal
+
+/**
+ * @brief Render the metrics of every live etcd::Client and etcd::Watch in
+ * the Prometheus text exposition format (version 0.0.4).
+ *
+ * The request path is not locked while rendering, histograms and counters
+ * are read with relaxed atomic loads. Series of operations which never ran
+ * are left out.
+ *
+ * @param buffer caller provided output buffer, always NUL terminated
+ * @param size size of buffer in bytes
+ *
+ * @return length of the complete exposition. If it is >= size the output was
+ * truncated and the call can be repeated with a larger buffer.
+ */
+inline size_t RenderPrometheus(char* buffer, size_t size) {
+    internal::TextBuffer out(buffer, size);
+    internal::PrometheusWriter w(out);
+    MetricsRegistry& registry = MetricsRegistry::Global();
+
+    w.Family("etcd_client_request_duration_seconds", "histogram",
+             "Request latency per operation and phase.");
+    registry.ForEach([&](const ClientMetrics& m) {
+        for (size_t op = 0; op < kOperationCount; ++op) {
+            for (size_t phase = 0; phase < kPhaseCount; ++phase) {
+                std::string extra(",operation=\"");
+                extra += OperationName(static_cast<Operation>(op));
+                extra += "\",phase=\"";
+                extra += PhaseName(static_cast<Phase>(phase));
+                extra += "\"";
+                w.Histogram("etcd_client_request_duration_seconds", m, extra,
+                    m[static_cast<Operation>(op)][static_cast<Phase>(phase)]);
+            }
+        }
+    });
+
+    w.Family("etcd_client_endpoint_request_duration_seconds", "histogram",
+             "Total request latency per endpoint.");
+    registry.ForEach([&](const ClientMetrics& m) {
+        m.ForEachEndpoint([&](const std::string& endpoint,
+                              const PhaseHistograms& h) {
+            std::string extra(",endpoint=\"");
+            for (size_t i = 0; i < endpoint.size(); ++i) {
+                char c = endpoint[i];
+                if (c == '\\' || c == '"')
+                    extra += '\\';
+                extra += c;
+            }
+            extra += "\"";
+            w.Histogram("etcd_client_endpoint_request_duration_seconds", m,
+                        extra, h[Phase::PHASE_TOTAL]);
+        });
+    });
+
+    w.Family("etcd_client_requests_in_flight", "gauge",
+             "Requests currently being performed.");
+    registry.ForEach([&](const ClientMetrics& m) {
+        out.Append("etcd_client_requests_in_flight{");
+        w.Labels(m);
+        out.Printf("} %lld\n", (long long) m.InFlight());
+    });
+
+    // One snapshot per client serves all counter families, it is small
+    // next to the histograms. Clients may go away once the registry is
+    // unlocked, only their labels are kept.
+    std::vector<internal::CounterRow> rows;
+    registry.ForEach([&](const ClientMetrics& m) {
+        rows.push_back(internal::CounterRow());
+        rows.back().kind = m.Kind();
+        rows.back().id = m.Id();
+        m.Counters().Snapshot(rows.back().snapshot);
+    });
+
+    w.Family("etcd_client_requests_total", "counter",
+             "Requests performed, including failed ones.");
+    for (size_t i = 0; i < rows.size(); ++i)
+        w.Value("etcd_client_requests_total", rows[i], NULL,
+                rows[i].snapshot[Counter::COUNTER_REQUESTS]);
+
+    w.Family("etcd_client_connections_total", "counter",
+             "Requests by connection state, state=\"new\" counts reconnects.");
+    for (size_t i = 0; i < rows.size(); ++i) {
+        w.Value("etcd_client_connections_total", rows[i], ",state=\"new\"",
+                rows[i].snapshot[Counter::COUNTER_NEW_CONNECTIONS]);
+        w.Value("etcd_client_connections_total", rows[i], ",state=\"reused\"",
+                rows[i].snapshot[Counter::COUNTER_REUSED_CONNECTIONS]);
+    }
+
+    w.Family("etcd_client_redirects_total", "counter",
+             "HTTP redirects followed.");
+    for (size_t i = 0; i < rows.size(); ++i)
+        w.Value("etcd_client_redirects_total", rows[i], NULL,
+                rows[i].snapshot[Counter::COUNTER_REDIRECTS]);
+
+    w.Family("etcd_client_sent_bytes_total", "counter",
+             "Bytes sent, headers included.");
+    for (size_t i = 0; i < rows.size(); ++i)
+        w.Value("etcd_client_sent_bytes_total", rows[i], NULL,
+                rows[i].snapshot[Counter::COUNTER_BYTES_SENT]);
+
+    w.Family("etcd_client_received_bytes_total", "counter",
+             "Bytes received, headers included.");
+    for (size_t i = 0; i < rows.size(); ++i)
+        w.Value("etcd_client_received_bytes_total", rows[i], NULL,
+                rows[i].snapshot[Counter::COUNTER_BYTES_RECEIVED]);
+
+    w.Family("etcd_client_transport_errors_total", "counter",
+             "Failed transfers by CURLcode.");
+    for (size_t i = 0; i < rows.size(); ++i) {
+        for (auto const& e :rows[i].snapshot.curl_errors) {
+            char label[32];
+            snprintf(label, sizeof(label), ",code=\"%d\"", e.first);
+            w.Value("etcd_client_transport_errors_total", rows[i], label,
+                    e.second);
+        }
+    }
+
+    w.Family("etcd_client_etcd_errors_total", "counter",
+             "Error replies by etcd errorCode.");
+    for (size_t i = 0; i < rows.size(); ++i) {
+        for (auto const& e :rows[i].snapshot.etcd_errors) {
+            char label[32];
+            snprintf(label, sizeof(label), ",code=\"%d\"", e.first);
+            w.Value("etcd_client_etcd_errors_total", rows[i], label,
+                    e.second);
+        }
+    }
+
+    w.Family("etcd_watch_index_lag", "gauge",
+             "Indexes between X-Etcd-Index and the last delivered event.");
+    registry.ForEach([&](const ClientMetrics& m) {
+        if (const WatchMetrics* watch = m.Watch()) {
+            out.Append("etcd_watch_index_lag{");
+            w.Labels(m);
+            out.Printf("} %llu\n", (unsigned long long) watch->Lag());
+        }
+    });
+
+    w.Family("etcd_watch_events_total", "counter",
+             "Events delivered to watch callbacks.");
+    registry.ForEach([&](const ClientMetrics& m) {
+        if (const WatchMetrics* watch = m.Watch()) {
+            out.Append("etcd_watch_events_total{");
+            w.Labels(m);
+            out.Printf("} %llu\n", (unsigned long long) watch->Events());
+        }
+    });
+
+    w.Family("etcd_watch_resyncs_total", "counter",
+             "Watches restarted after falling out of the event history.");
+    registry.ForEach([&](const ClientMetrics& m) {
+        if (const WatchMetrics* watch = m.Watch()) {
+            out.Append("etcd_watch_resyncs_total{");
+            w.Labels(m);
+            out.Printf("} %llu\n", (unsigned long long) watch->Resyncs());
+        }
+    });
+
+    w.Family("etcd_watch_delivery_seconds", "histogram",
+             "Time from a watch response to its callback returning.");
+    registry.ForEach([&](const ClientMetrics& m) {
+        if (const WatchMetrics* watch = m.Watch())
+            w.Histogram("etcd_watch_delivery_seconds", m, std::string(),
+                        watch->Delivery());
+    });
+
+    return out.Finish();
+}
+
+} // namespace etcd
+
+#endif // __ETCD_PROMETHEUS_HPP_INCLUDED__
@@ -0,0 +1,323 @@
+#ifndef __ETCD_RANGE_SCAN_HPP_INCLUDED__
+#define __ETCD_RANGE_SCAN_HPP_INCLUDED__
+
+#include "v3_client.hpp"
+#include <algorithm>
+#include <future>
+
+namespace etcd {
+
+/**
+ * @brief Pages through every key under a prefix in bounded memory.
+ *
+ * A v2 GetAll or a v3 range without a limit returns the whole subtree in one
+ * response; a scan holds one page at a time, plus the next one, fetched
+ * while the caller works through the current one.
+ *
+ * With API_V3 each page is a range read of page_size keys, continuing after
+ * the last key of the previous page, and every page is read at the revision
+ * of the first one, so the scan sees the keyspace as it was when it started.
+ * If that revision is compacted before the scan ends, Next throws an
+ * etcd::ReplyException with code 11.
+ *
+ * With API_V2, for clusters without v3, prefix is a directory. The v2 API
+ * cannot page within a directory: each directory is listed on its own, in
+ * depth first order, and its keys are handed out page_size at a time, so
+ * memory is bounded by the largest directory rather than the subtree.
+ * Listings are not taken at one index. The revisions of the keys are their
+ * v2 created and modified indexes.
+ *
+ *   etcd::RangeScan<etcd::RapidReply> scan("10.0.0.1", 2379, "/services/");
+ *   etcd::v3::KeyValues page;
+ *   while (scan.Next(page)) {
+ *       for (auto& kv :page)
+ *           ...
+ *   }
+ *
+ * @tparam Reply json reply wrapper, see etcd::V3Client, and implementing
+ * GetNodes for API_V2
+ * @tparam Tracer begin/end hooks around every request, see etcd::NullTracer
+ */
+template <typename Reply, typename Tracer = NullTracer>
+class RangeScan {
+  public:
+    // CONSTANTS
+    static const size_t kDefaultPageSize = 1000;
+
+    // TYPES
+    enum Api {
+        API_V3,
+        API_V2
+    };
+
+    // LIFECYCLE
+    RangeScan(const std::string& server,
+              const Port& port,
+              const std::string& prefix,
+              size_t page_size = kDefaultPageSize,
+              Api api = API_V3);
+
+    RangeScan(const std::shared_ptr<ClusterEndpoints>& endpoints,
+              const std::string& prefix,
+              size_t page_size = kDefaultPageSize,
+              Api api = API_V3);
+
+    /**
+     * @brief Waits for a page being fetched
+     */
+    ~RangeScan();
+
+    // OPERATIONS
+    /**
+     * @brief Hand out the next page and start fetching the one after it
+     *
+     * @param page replaced by up to page_size keys, in key order within
+     * each page and across the pages of API_V3
+     *
+     * @return false once every key has been handed out, page is empty then
+     */
+    bool Next(v3::KeyValues& page);
+
+    /**
+     * @brief Revision every API_V3 page is read at, once the first one has
+     * been fetched. 0 with API_V2.
+     */
+    v3::Revision GetRevision() const;
+
+    /**
+     * @brief Metrics of the scan's own client: pages are recorded as
+     * OPERATION_GET_ALL with API_V3, directory listings as OPERATION_GET
+     * with API_V2
+     */
+    const ClientMetrics& GetMetrics() const;
+
+  private:
+    // TYPES
+    struct Page {
+        Page() :revision(0), last(false) {}
+
+        v3::KeyValues kvs;
+        v3::Revision revision;  // read at
+        bool last;              // nothing after it
+    };
+
+    // DATA MEMBERS
+    Api api_;
+    size_t page_size_;
+    std::unique_ptr<V3Client<Reply, Tracer> > v3_;
+    std::unique_ptr<Client<Reply, Tracer> > v2_;
+    std::future<Page> next_;    // page being fetched
+    bool done_;
+    v3::Revision revision_;
+
+    // The cursor, only touched by the fetch in flight
+    std::string key_;           // API_V3: first key of the next page
+    std::string range_end_;
+    v3::Revision pinned_;       // API_V3: revision of the first page
+    std::vector<std::string> dirs_;     // API_V2: directories to list
+    v3::KeyValues listed_;      // API_V2: keys listed, not handed out yet
+    size_t listed_pos_;
+
+    // LIFECYCLE
+    RangeScan(const RangeScan& rhs);
+    void operator=(const RangeScan& rhs);
+
+    // OPERATIONS
+    void _Init(const std::string& prefix);
+
+    Page _Fetch();
+
+    Page _FetchV3();
+
+    Page _FetchV2();
+
+    void _List(const std::string& dir);
+};
+
+template <typename Reply, typename Tracer>
+const size_t RangeScan<Reply, Tracer>::kDefaultPageSize;
+
+//------------------------------- LIFECYCLE ----------------------------------
+
+template <typename Reply, typename Tracer> RangeScan<Reply, Tracer>::
+RangeScan(
+    const std::string& server,
+    const Port& port,
+    const std::string& prefix,
+    size_t page_size,
+    Api api)
+  :api_(api),
+   page_size_(std::max<size_t>(page_size, 1)),
+   done_(false),
+   revision_(0),
+   pinned_(0),
+   listed_pos_(0) {
+    if (api_ == API_V3)
+        v3_.reset(new V3Client<Reply, Tracer>(server, port));
+    else
+        v2_.reset(new Client<Reply, Tracer>(server, port));
+    _Init(prefix);
+}
+
+template <typename Reply, typename Tracer> RangeScan<Reply, Tracer>::
+RangeScan(
+    const std::shared_ptr<ClusterEndpoints>& endpoints,
+    const std::string& prefix,
+    size_t page_size,
+    Api api)
+  :api_(api),
+   page_size_(std::max<size_t>(page_size, 1)),
+   done_(false),
+   revision_(0),
+   pinned_(0),
+   listed_pos_(0) {
+    if (api_ == API_V3)
+        v3_.reset(new V3Client<Reply, Tracer>(endpoints));
+    else
+        v2_.reset(new Client<Reply, Tracer>(endpoints));
+    _Init(prefix);
+}
+
+template <typename Reply, typename Tracer> RangeScan<Reply, Tracer>::
+~RangeScan() {
+    if (next_.valid())
+        next_.wait();
+}
+
+//------------------------------- OPERATIONS ---------------------------------
+
+template <typename Reply, typename Tracer> bool RangeScan<Reply, Tracer>::
+Next(v3::KeyValues& page) {
+    page.clear();
+    if (done_)
+        return false;
+    if (! next_.valid())
+        next_ = std::async(std::launch::async, &RangeScan::_Fetch, this);
+
+    Page fetched;
+    try {
+        fetched = next_.get();
+    } catch (...) {
+        done_ = true;
+        throw;
+    }
+    revision_ = fetched.revision;
+    if (fetched.last)
+        done_ = true;
+    else
+        next_ = std::async(std::launch::async, &RangeScan::_Fetch, this);
+    page.swap(fetched.kvs);
+    return ! page.empty();
+}
+
+template <typename Reply, typename Tracer>
+v3::Revision RangeScan<Reply, Tracer>::
+GetRevision() const {
+    return revision_;
+}
+
+template <typename Reply, typename Tracer>
+const ClientMetrics& RangeScan<Reply, Tracer>::
+GetMetrics() const {
+    return v3_ ? v3_->GetMetrics() : v2_->GetMetrics();
+}
+
+template <typename Reply, typename Tracer> void RangeScan<Reply, Tracer>::
+_Init(const std::string& prefix) {
+    if (api_ == API_V2) {
+        dirs_.push_back(prefix);
+        return;
+    }
+    // etcd needs a key, "\0" with range_end "\0" is every key
+    range_end_ = v3::PrefixEnd(prefix);
+    key_ = prefix.empty() ? std::string(1, '\0') : prefix;
+}
+
+template <typename Reply, typename Tracer>
+typename RangeScan<Reply, Tracer>::Page RangeScan<Reply, Tracer>::
+_Fetch() {
+    return api_ == API_V3 ? _FetchV3() : _FetchV2();
+}
+
+template <typename Reply, typename Tracer>
+typename RangeScan<Reply, Tracer>::Page RangeScan<Reply, Tracer>::
+_FetchV3() {
+    v3::RangeOptions options;
+    options.range_end = range_end_;
+    options.limit = static_cast<int64_t>(page_size_);
+    options.revision = pinned_;
+    v3::RangeResponse range = v3_->Range(key_, options);
+    if (! pinned_)
+        pinned_ = range.header.revision;
+
+    // The next page starts right after the last key of this one
+    Page page;
+    page.revision = pinned_;
+    page.last = ! range.more || range.kvs.empty();
+    if (! range.kvs.empty())
+        key_ = range.kvs.back().key + '\0';
+    page.kvs.swap(range.kvs);
+    return page;
+}
+
+template <typename Reply, typename Tracer>
+typename RangeScan<Reply, Tracer>::Page RangeScan<Reply, Tracer>::
+_FetchV2() {
+    Page page;
+    while (page.kvs.size() < page_size_) {
+        if (listed_pos_ < listed_.size()) {
+            size_t n = std::min(page_size_ - page.kvs.size(),
+                                listed_.size() - listed_pos_);
+            page.kvs.insert(page.kvs.end(),
+                            listed_.begin() + listed_pos_,
+                            listed_.begin() + listed_pos_ + n);
+            listed_pos_ += n;
+            continue;
+        }
+        if (dirs_.empty())
+            break;
+        std::string dir = dirs_.back();
+        dirs_.pop_back();
+        _List(dir);
+    }
+    page.last = listed_pos_ == listed_.size() && dirs_.empty();
+    return page;
+}
+
+template <typename Reply, typename Tracer> void RangeScan<Reply, Tracer>::
+_List(const std::string& dir) {
+    listed_.clear();
+    listed_pos_ = 0;
+
+    Nodes nodes;
+    try {
+        v2_->Get(dir).GetNodes(nodes);
+    } catch (const ReplyException& e) {
+        // Removed since its parent was listed
+        if (e.error_code != 100)
+            throw;
+        return;
+    }
+    std::sort(nodes.begin(), nodes.end(),
+              [](const Node& a, const Node& b) { return a.key < b.key; });
+
+    // Subdirectories come after the keys of dir, in key order
+    for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+        if (it->dir)
+            dirs_.push_back(it->key);
+    }
+    for (auto& node :nodes) {
+        if (node.dir)
+            continue;
+        v3::KeyValue kv;
+        kv.key.swap(node.key);
+        kv.value.swap(node.value);
+        kv.create_revision = static_cast<v3::Revision>(node.created_index);
+        kv.mod_revision = static_cast<v3::Revision>(node.modified_index);
+        listed_.push_back(kv);
+    }
+}
+
+} // namespace etcd
+
+#endif // __ETCD_RANGE_SCAN_HPP_INCLUDED__
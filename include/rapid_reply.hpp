@@ -29,6 +29,8 @@
 
 #include <iostream>
 #include "client.hpp"
+#include "internal/probes.hpp"
+#include "v3.hpp"
 
 // JSON PARSER INCLUDES
 #include <rapidjson/document.h>
@@ -77,6 +79,27 @@ class RapidReply {
         return _GetAll(document_[kNode], kvPairs);
     }
 
+    /**
+     * @brief The children of the directory in the reply, or the key itself
+     */
+    void GetNodes(etcd::Nodes& nodes) const {
+        nodes.clear();
+        if (! document_.HasMember(kNode))
+            return;
+        const rapidjson::Value& node = document_[kNode];
+        if (! _Bool(node, kDir)) {
+            nodes.resize(1);
+            _GetNode(node, nodes[0]);
+            return;
+        }
+        if (! _Has(node, kNodes) || ! node[kNodes].IsArray())
+            return;
+        const rapidjson::Value& children = node[kNodes];
+        nodes.resize(children.Size());
+        for (rapidjson::SizeType i = 0; i < children.Size(); ++i)
+            _GetNode(children[i], nodes[i]);
+    }
+
     etcd::Action GetAction() {
         if (! document_.HasMember(kAction)) {
 			return etcd::Action::ACTION_UNKNOWN;
@@ -96,16 +119,235 @@ class RapidReply {
         return document_[kNode][kModifiedIndex].GetUint64();
     }
 
+    void GetLeaderStats(etcd::LeaderStats& stats) const {
+        stats = etcd::LeaderStats();
+        if (! document_.IsObject())
+            return;
+        stats.leader = _String(document_, "leader");
+        if (! _Has(document_, "followers") ||
+            ! document_["followers"].IsObject())
+            return;
+
+        const rapidjson::Value& followers = document_["followers"];
+        for (rapidjson::Value::ConstMemberIterator it =
+                 followers.MemberBegin(); it != followers.MemberEnd(); ++it) {
+            if (! it->value.IsObject())
+                continue;
+            etcd::FollowerStats& f = stats.followers[it->name.GetString()];
+            if (_Has(it->value, "counts")) {
+                const rapidjson::Value& counts = it->value["counts"];
+                f.counts.fail = _Uint64(counts, "fail");
+                f.counts.success = _Uint64(counts, "success");
+            }
+            if (_Has(it->value, "latency")) {
+                const rapidjson::Value& latency = it->value["latency"];
+                f.latency.average = _Double(latency, "average");
+                f.latency.current = _Double(latency, "current");
+                f.latency.maximum = _Double(latency, "maximum");
+                f.latency.minimum = _Double(latency, "minimum");
+                f.latency.standard_deviation =
+                    _Double(latency, "standardDeviation");
+            }
+        }
+    }
+
+    void GetSelfStats(etcd::SelfStats& stats) const {
+        stats = etcd::SelfStats();
+        if (! document_.IsObject())
+            return;
+        stats.id = _String(document_, "id");
+        stats.name = _String(document_, "name");
+        stats.state = _String(document_, "state");
+        stats.start_time = _String(document_, "startTime");
+        if (_Has(document_, "leaderInfo")) {
+            const rapidjson::Value& info = document_["leaderInfo"];
+            stats.leader_info.leader = _String(info, "leader");
+            stats.leader_info.start_time = _String(info, "startTime");
+            stats.leader_info.uptime = _String(info, "uptime");
+        }
+        stats.recv_append_request_count =
+            _Uint64(document_, "recvAppendRequestCnt");
+        stats.recv_bandwidth_rate = _Double(document_, "recvBandwidthRate");
+        stats.recv_pkg_rate = _Double(document_, "recvPkgRate");
+        stats.send_append_request_count =
+            _Uint64(document_, "sendAppendRequestCnt");
+        stats.send_bandwidth_rate = _Double(document_, "sendBandwidthRate");
+        stats.send_pkg_rate = _Double(document_, "sendPkgRate");
+    }
+
+    void GetStoreStats(etcd::StoreStats& stats) const {
+        stats = etcd::StoreStats();
+        if (! document_.IsObject())
+            return;
+        stats.compare_and_delete_fail =
+            _Uint64(document_, "compareAndDeleteFail");
+        stats.compare_and_delete_success =
+            _Uint64(document_, "compareAndDeleteSuccess");
+        stats.compare_and_swap_fail = _Uint64(document_, "compareAndSwapFail");
+        stats.compare_and_swap_success =
+            _Uint64(document_, "compareAndSwapSuccess");
+        stats.create_fail = _Uint64(document_, "createFail");
+        stats.create_success = _Uint64(document_, "createSuccess");
+        stats.delete_fail = _Uint64(document_, "deleteFail");
+        stats.delete_success = _Uint64(document_, "deleteSuccess");
+        stats.expire_count = _Uint64(document_, "expireCount");
+        stats.gets_fail = _Uint64(document_, "getsFail");
+        stats.gets_success = _Uint64(document_, "getsSuccess");
+        stats.sets_fail = _Uint64(document_, "setsFail");
+        stats.sets_success = _Uint64(document_, "setsSuccess");
+        stats.update_fail = _Uint64(document_, "updateFail");
+        stats.update_success = _Uint64(document_, "updateSuccess");
+        stats.watchers = _Uint64(document_, "watchers");
+    }
+
+    void GetMembers(etcd::Members& members) const {
+        members.clear();
+        if (! _Has(document_, "members") || ! document_["members"].IsArray())
+            return;
+
+        const rapidjson::Value& list = document_["members"];
+        members.reserve(list.Size());
+        for (rapidjson::SizeType i = 0; i < list.Size(); ++i) {
+            if (! list[i].IsObject())
+                continue;
+            members.push_back(etcd::Member());
+            etcd::Member& m = members.back();
+            m.id = _String(list[i], "id");
+            m.name = _String(list[i], "name");
+            _Strings(list[i], "peerURLs", m.peer_urls);
+            _Strings(list[i], "clientURLs", m.client_urls);
+        }
+    }
+
+    void GetHealth(etcd::HealthStatus& health) const {
+        // etcd 2 answers {"health": "true"}, later releases may send a bool
+        health.healthy = false;
+        if (! _Has(document_, "health"))
+            return;
+        const rapidjson::Value& value = document_["health"];
+        health.healthy = value.IsBool() ? value.GetBool() :
+            value.IsString() && std::string(value.GetString()) == "true";
+        std::string reason = _String(document_, "reason");
+        if (! reason.empty())
+            health.error = reason;
+    }
+
+    void GetVersion(etcd::VersionInfo& version) const {
+        version.server = _String(document_, "etcdserver");
+        version.cluster = _String(document_, "etcdcluster");
+    }
+
+    // v3 gateway replies. Keys and values are left base64 encoded, int64
+    // fields are sent as JSON strings.
+    void GetRange(etcd::v3::RangeResponse& response) const {
+        _GetRange(document_, response);
+    }
+
+    void GetPut(etcd::v3::PutResponse& response) const {
+        _GetPut(document_, response);
+    }
+
+    void GetDeleteRange(etcd::v3::DeleteRangeResponse& response) const {
+        _GetDeleteRange(document_, response);
+    }
+
+    void GetResponseHeader(etcd::v3::ResponseHeader& header) const {
+        header = etcd::v3::ResponseHeader();
+        _GetHeader(document_, header);
+    }
+
+    void GetLeaseGrant(etcd::v3::LeaseGrantResponse& response) const {
+        response = etcd::v3::LeaseGrantResponse();
+        _GetHeader(document_, response.header);
+        response.id = _Int64(document_, "ID");
+        response.ttl = _Int64(document_, "TTL");
+    }
+
+    // One message of the keepalive stream, wrapped in "result"
+    void GetLeaseKeepAlive(etcd::v3::LeaseKeepAliveResponse& response) const {
+        response = etcd::v3::LeaseKeepAliveResponse();
+        const rapidjson::Value& v = _Has(document_, "result") ?
+            document_["result"] : document_;
+        _GetHeader(v, response.header);
+        response.id = _Int64(v, "ID");
+        response.ttl = _Int64(v, "TTL");
+    }
+
+    void GetLeaseTimeToLive(
+            etcd::v3::LeaseTimeToLiveResponse& response) const {
+        response = etcd::v3::LeaseTimeToLiveResponse();
+        _GetHeader(document_, response.header);
+        response.id = _Int64(document_, "ID");
+        response.ttl = _Has(document_, "TTL") ?
+            _Int64(document_, "TTL") : -1;
+        response.granted_ttl = _Int64(document_, "grantedTTL");
+        _Strings(document_, "keys", response.keys);
+    }
+
+    // One message of a watch stream, wrapped in "result"
+    void GetWatch(etcd::v3::WatchResponse& response) const {
+        response = etcd::v3::WatchResponse();
+        const rapidjson::Value& v = _Has(document_, "result") ?
+            document_["result"] : document_;
+        _GetHeader(v, response.header);
+        response.watch_id = _Int64(v, "watch_id");
+        response.created = _Bool(v, "created");
+        response.canceled = _Bool(v, "canceled");
+        response.compact_revision = _Int64(v, "compact_revision");
+        response.cancel_reason = _String(v, "cancel_reason");
+        if (! _Has(v, "events") || ! v["events"].IsArray())
+            return;
+        const rapidjson::Value& events = v["events"];
+        response.events.resize(events.Size());
+        for (rapidjson::SizeType i = 0; i < events.Size(); ++i) {
+            etcd::v3::Event& e = response.events[i];
+            if (_String(events[i], "type") == "DELETE")
+                e.type = etcd::v3::Event::EVENT_DELETE;
+            if (_Has(events[i], "kv"))
+                _GetKv(events[i]["kv"], e.kv);
+            if (_Has(events[i], "prev_kv")) {
+                e.has_prev_kv = true;
+                _GetKv(events[i]["prev_kv"], e.prev_kv);
+            }
+        }
+    }
+
+    void GetTxn(etcd::v3::TxnResponse& response) const {
+        response = etcd::v3::TxnResponse();
+        _GetHeader(document_, response.header);
+        response.succeeded = _Bool(document_, "succeeded");
+        if (! _Has(document_, "responses") ||
+            ! document_["responses"].IsArray())
+            return;
+        const rapidjson::Value& array = document_["responses"];
+        response.responses.resize(array.Size());
+        for (rapidjson::SizeType i = 0; i < array.Size(); ++i) {
+            etcd::v3::OpResponse& r = response.responses[i];
+            if (_Has(array[i], "response_put")) {
+                r.type = etcd::v3::Op::OP_PUT;
+                _GetPut(array[i]["response_put"], r.put);
+            } else if (_Has(array[i], "response_delete_range")) {
+                r.type = etcd::v3::Op::OP_DELETE_RANGE;
+                _GetDeleteRange(array[i]["response_delete_range"],
+                                r.delete_range);
+            } else if (_Has(array[i], "response_range")) {
+                _GetRange(array[i]["response_range"], r.range);
+            }
+        }
+    }
+
   private:
     // TYPES
     typedef etcd::ResponseActionMap::const_iterator CAM_II;
 
     // CONSTANTS
     const char *kErrorCode ="errorCode";
+    const char *kCode = "code";
     const char *kMessage = "message";
     const char *kCause ="cause";
     const char *kNode = "node";
     const char *kModifiedIndex = "modifiedIndex";
+    const char *kCreatedIndex = "createdIndex";
     const char *kNodes = "nodes";
     const char *kDir = "dir";
     const char *kKey = "key";
@@ -119,16 +361,158 @@ class RapidReply {
 
     // OPERATIONS
     void _CheckError() { 
+        if (! document_.IsObject())
+            return;
         if (document_.HasMember(kErrorCode)) {
             throw etcd::ReplyException(document_[kErrorCode].GetInt(),
                     document_[kMessage].GetString(),
                     document_[kCause].GetString());
         }
+        // v3 gateway errors carry a gRPC status code instead, nested in
+        // "error" when they end a stream
+        if (document_.HasMember(kCode) && document_[kCode].IsInt()) {
+            throw etcd::ReplyException(document_[kCode].GetInt(),
+                    _String(document_, kMessage),
+                    _String(document_, "error"));
+        }
+        if (document_.HasMember("error") && document_["error"].IsObject()) {
+            const rapidjson::Value& error = document_["error"];
+            throw etcd::ReplyException(
+                    static_cast<int>(_Int64(error, "grpc_code")),
+                    _String(error, kMessage), _String(error, kMessage));
+        }
     }
 
     void _Parse(const std::string& json) {
+        ETCD_PROBE1(parse__start, json.size());
         document_.Parse(json.c_str());
-        _CheckError();
+        try {
+            _CheckError();
+        } catch (const etcd::ReplyException& e) {
+            ETCD_PROBE2(parse__done, json.size(), e.error_code);
+            throw;
+        }
+        ETCD_PROBE2(parse__done, json.size(),
+                    document_.HasParseError() ? -1 : 0);
+    }
+
+    // Stats and members fields missing from a reply, e.g. of an older
+    // etcd, read as zero or empty
+    static bool _Has(const rapidjson::Value& v, const char* name) {
+        return v.IsObject() && v.HasMember(name);
+    }
+
+    static std::string _String(const rapidjson::Value& v, const char* name) {
+        return _Has(v, name) && v[name].IsString() ?
+            v[name].GetString() : std::string();
+    }
+
+    static uint64_t _Uint64(const rapidjson::Value& v, const char* name) {
+        if (! _Has(v, name) || ! v[name].IsNumber())
+            return 0;
+        return v[name].IsUint64() ?
+            v[name].GetUint64() : static_cast<uint64_t>(v[name].GetDouble());
+    }
+
+    static double _Double(const rapidjson::Value& v, const char* name) {
+        return _Has(v, name) && v[name].IsNumber() ?
+            v[name].GetDouble() : 0;
+    }
+
+    static bool _Bool(const rapidjson::Value& v, const char* name) {
+        return _Has(v, name) && v[name].IsBool() && v[name].GetBool();
+    }
+
+    static void _GetRange(const rapidjson::Value& v,
+                          etcd::v3::RangeResponse& response) {
+        response = etcd::v3::RangeResponse();
+        _GetHeader(v, response.header);
+        _GetKvs(v, "kvs", response.kvs);
+        response.more = _Bool(v, "more");
+        response.count = _Int64(v, "count");
+    }
+
+    static void _GetPut(const rapidjson::Value& v,
+                        etcd::v3::PutResponse& response) {
+        response = etcd::v3::PutResponse();
+        _GetHeader(v, response.header);
+        if (_Has(v, "prev_kv")) {
+            response.has_prev_kv = true;
+            _GetKv(v["prev_kv"], response.prev_kv);
+        }
+    }
+
+    static void _GetDeleteRange(const rapidjson::Value& v,
+                                etcd::v3::DeleteRangeResponse& response) {
+        response = etcd::v3::DeleteRangeResponse();
+        _GetHeader(v, response.header);
+        response.deleted = _Int64(v, "deleted");
+        _GetKvs(v, "prev_kvs", response.prev_kvs);
+    }
+
+    static int64_t _Int64(const rapidjson::Value& v, const char* name) {
+        if (! _Has(v, name))
+            return 0;
+        const rapidjson::Value& value = v[name];
+        if (value.IsString())
+            return std::strtoll(value.GetString(), NULL, 10);
+        return value.IsInt64() ? value.GetInt64() : 0;
+    }
+
+    static void _GetHeader(const rapidjson::Value& v,
+                           etcd::v3::ResponseHeader& header) {
+        if (! _Has(v, "header"))
+            return;
+        const rapidjson::Value& h = v["header"];
+        header.cluster_id = (uint64_t) _Uint64String(h, "cluster_id");
+        header.member_id = (uint64_t) _Uint64String(h, "member_id");
+        header.revision = _Int64(h, "revision");
+        header.raft_term = (uint64_t) _Uint64String(h, "raft_term");
+    }
+
+    static uint64_t _Uint64String(const rapidjson::Value& v,
+                                  const char* name) {
+        if (_Has(v, name) && v[name].IsString())
+            return std::strtoull(v[name].GetString(), NULL, 10);
+        return _Uint64(v, name);
+    }
+
+    static void _GetKv(const rapidjson::Value& v, etcd::v3::KeyValue& kv) {
+        kv.key = _String(v, "key");
+        kv.value = _String(v, "value");
+        kv.create_revision = _Int64(v, "create_revision");
+        kv.mod_revision = _Int64(v, "mod_revision");
+        kv.version = _Int64(v, "version");
+        kv.lease = _Int64(v, "lease");
+    }
+
+    static void _GetKvs(const rapidjson::Value& v, const char* name,
+                        etcd::v3::KeyValues& kvs) {
+        if (! _Has(v, name) || ! v[name].IsArray())
+            return;
+        const rapidjson::Value& array = v[name];
+        kvs.resize(array.Size());
+        for (rapidjson::SizeType i = 0; i < array.Size(); ++i)
+            _GetKv(array[i], kvs[i]);
+    }
+
+    static void _Strings(const rapidjson::Value& v, const char* name,
+                         std::vector<std::string>& strings) {
+        if (! _Has(v, name) || ! v[name].IsArray())
+            return;
+        const rapidjson::Value& array = v[name];
+        for (rapidjson::SizeType i = 0; i < array.Size(); ++i) {
+            if (array[i].IsString())
+                strings.push_back(array[i].GetString());
+        }
+    }
+
+    void _GetNode(const rapidjson::Value& v, etcd::Node& node) const {
+        node.key = _String(v, kKey);
+        node.value = _String(v, kValue);
+        node.dir = _Bool(v, kDir);
+        node.created_index = _Uint64(v, kCreatedIndex);
+        node.modified_index = _Uint64(v, kModifiedIndex);
     }
 
     void _GetAll(const rapidjson::Value& doc, KvPairs& kvPairs) {
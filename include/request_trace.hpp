@@ -0,0 +1,531 @@
+#ifndef __ETCD_REQUEST_TRACE_HPP_INCLUDED__
+#define __ETCD_REQUEST_TRACE_HPP_INCLUDED__
+
+#include "metrics.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace etcd {
+
+/**
+ * @brief One request and its response as kept in a trace file
+ */
+struct TraceRecord {
+    TraceRecord() :offset(0), curl_code(0) {}
+
+    uint64_t offset;            // microseconds from the start of the trace
+                                // to the start of the request
+    std::string method;
+    std::string path;           // URL without scheme, host and port
+    std::string request;        // request body
+    int curl_code;              // CURLcode of the perform
+    TransferInfo info;
+    RequestTimings timings;     // parse is always zero
+    std::string header;         // response headers, empty unless enabled
+    std::string body;           // response body
+};
+
+namespace internal {
+
+/**
+ * @brief Trace file encoding: the magic followed by records, every integer
+ * as a LEB128 varint and every string as its varint length and its bytes
+ */
+class TraceCodec {
+  public:
+    // CONSTANTS
+    static const char* Magic() {
+        return "ETCDTRC1";
+    }
+
+    static const size_t kMagicSize = 8;
+
+    // OPERATIONS
+    static void Encode(const TraceRecord& r, std::string& out) {
+        _Put(out, r.offset);
+        _Put(out, r.method);
+        _Put(out, r.path);
+        _Put(out, r.request);
+        _Put(out, (uint64_t) r.curl_code);
+        _Put(out, (uint64_t) r.info.response_code);
+        _Put(out, r.info.bytes_sent);
+        _Put(out, r.info.bytes_received);
+        _Put(out, r.info.new_connections);
+        _Put(out, r.info.redirects);
+        _Put(out, r.timings.dns);
+        _Put(out, r.timings.connect);
+        _Put(out, r.timings.tls);
+        _Put(out, r.timings.first_byte);
+        _Put(out, r.timings.transfer);
+        _Put(out, r.timings.total);
+        _Put(out, r.header);
+        _Put(out, r.body);
+    }
+
+    /**
+     * @return false at the end of data or on a truncated record
+     */
+    static bool Decode(const std::string& in, size_t& pos, TraceRecord& r) {
+        uint64_t curl_code, status, connections, redirects;
+        if (! (_Get(in, pos, r.offset) &&
+               _Get(in, pos, r.method) &&
+               _Get(in, pos, r.path) &&
+               _Get(in, pos, r.request) &&
+               _Get(in, pos, curl_code) &&
+               _Get(in, pos, status) &&
+               _Get(in, pos, r.info.bytes_sent) &&
+               _Get(in, pos, r.info.bytes_received) &&
+               _Get(in, pos, connections) &&
+               _Get(in, pos, redirects) &&
+               _Get(in, pos, r.timings.dns) &&
+               _Get(in, pos, r.timings.connect) &&
+               _Get(in, pos, r.timings.tls) &&
+               _Get(in, pos, r.timings.first_byte) &&
+               _Get(in, pos, r.timings.transfer) &&
+               _Get(in, pos, r.timings.total) &&
+               _Get(in, pos, r.header) &&
+               _Get(in, pos, r.body)))
+            return false;
+        r.curl_code = (int) curl_code;
+        r.info.response_code = (long) status;
+        r.info.new_connections = (uint32_t) connections;
+        r.info.redirects = (uint32_t) redirects;
+        return true;
+    }
+
+  private:
+    static void _Put(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out += (char) ((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        out += (char) value;
+    }
+
+    static void _Put(std::string& out, const std::string& value) {
+        _Put(out, (uint64_t) value.size());
+        out += value;
+    }
+
+    static bool _Get(const std::string& in, size_t& pos, uint64_t& value) {
+        value = 0;
+        for (unsigned shift = 0; pos < in.size() && shift < 64; shift += 7) {
+            unsigned char byte = (unsigned char) in[pos++];
+            value |= (uint64_t) (byte & 0x7f) << shift;
+            if (! (byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    static bool _Get(const std::string& in, size_t& pos, std::string& value) {
+        uint64_t size;
+        if (! _Get(in, pos, size) || size > in.size() - pos)
+            return false;
+        value.assign(in, pos, (size_t) size);
+        pos += (size_t) size;
+        return true;
+    }
+};
+
+/**
+ * @brief The path and query of url, url itself if it has no scheme
+ */
+inline std::string TracePath(const std::string& url) {
+    std::string::size_type scheme = url.find("://");
+    if (scheme == std::string::npos)
+        return url;
+    std::string::size_type path = url.find('/', scheme + 3);
+    return path == std::string::npos ? "/" : url.substr(path);
+}
+
+} // namespace internal
+
+//------------------------------- RECORDER -----------------------------------
+
+/**
+ * @brief Writes every request performed by the clients of the process, with
+ * its response and timings, to a trace file which TraceReplayer serves
+ * back.
+ *
+ * The recorder is off until Start. While it is off, the request path pays a
+ * single load and branch. Records are appended under a lock in completion
+ * order, their offsets are taken when the requests start.
+ */
+class TraceRecorder {
+  public:
+    // LIFECYCLE
+    TraceRecorder()
+      :file_(NULL),
+       enabled_(false),
+       records_(0) {
+    }
+
+    ~TraceRecorder() {
+        Stop();
+    }
+
+    /**
+     * @brief The recorder used by all etcd::Client and etcd::Watch objects
+     */
+    static TraceRecorder& Global() {
+        static TraceRecorder recorder;
+        return recorder;
+    }
+
+    // OPERATIONS
+
+    /**
+     * @brief Start a new trace in path, replacing the file. A trace being
+     * recorded is closed first.
+     *
+     * @return false if path cannot be written
+     */
+    bool Start(const std::string& path) {
+        Stop();
+        std::lock_guard<std::mutex> lock(mutex_);
+        file_ = std::fopen(path.c_str(), "wb");
+        if (! file_)
+            return false;
+        std::fwrite(internal::TraceCodec::Magic(), 1,
+                    internal::TraceCodec::kMagicSize, file_);
+        start_ = std::chrono::steady_clock::now();
+        records_ = 0;
+        enabled_.store(true, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Stop recording and close the trace file
+     */
+    void Stop() {
+        enabled_.store(false, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (file_) {
+            std::fclose(file_);
+            file_ = NULL;
+        }
+    }
+
+    bool IsEnabled() const {
+        return enabled_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Number of records written to the current trace
+     */
+    uint64_t Records() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return records_;
+    }
+
+    void Record(const std::chrono::steady_clock::time_point& start,
+                const char* method,
+                const std::string& url,
+                const std::string& request,
+                int curl_code,
+                const TransferInfo& info,
+                const RequestTimings& timings,
+                const std::string& header,
+                const std::string& body);
+
+  private:
+    // DATA MEMBERS
+    FILE* file_;
+    std::atomic<bool> enabled_;
+    std::chrono::steady_clock::time_point start_;
+    uint64_t records_;
+    std::string buffer_;
+    mutable std::mutex mutex_;
+
+    // LIFECYCLE
+    TraceRecorder(const TraceRecorder& rhs);
+    void operator=(const TraceRecorder& rhs);
+};
+
+inline void TraceRecorder::
+Record(
+    const std::chrono::steady_clock::time_point& start,
+    const char* method,
+    const std::string& url,
+    const std::string& request,
+    int curl_code,
+    const TransferInfo& info,
+    const RequestTimings& timings,
+    const std::string& header,
+    const std::string& body) {
+    TraceRecord record;
+    record.method = method;
+    record.path = internal::TracePath(url);
+    record.request = request;
+    record.curl_code = curl_code;
+    record.info = info;
+    record.timings = timings;
+    record.timings.parse = 0;
+    record.header = header;
+    record.body = body;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (! file_)
+        return;
+    record.offset = start > start_ ?
+        (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+            start - start_).count() : 0;
+    buffer_.clear();
+    internal::TraceCodec::Encode(record, buffer_);
+    std::fwrite(buffer_.data(), 1, buffer_.size(), file_);
+    ++records_;
+}
+
+//------------------------------- REPLAYER -----------------------------------
+
+/**
+ * @brief Serves the responses of a trace file to the clients of the
+ * process instead of the network.
+ *
+ * While the replayer is enabled, every request is answered with the next
+ * recorded response to the same method, path and body, in recorded order,
+ * with its status, headers, body and timings, bit for bit. A request
+ * without a recorded response fails as if the server could not be
+ * reached. The host and port of the clients do not matter.
+ *
+ * With a speed set, replay keeps the schedule of the trace: the clock of
+ * the replay starts at its first request, and every response is held until
+ * the time it completed at in the trace divided by the speed, and for at
+ * least its recorded latency divided by the speed. Clients issuing their
+ * requests ahead of the trace are slowed down to it, gaps between the
+ * recorded requests included.
+ *
+ * Load must not be called while the replayer is enabled.
+ */
+class TraceReplayer {
+  public:
+    // LIFECYCLE
+    TraceReplayer()
+      :enabled_(false),
+       speed_(0),
+       loop_(false),
+       missed_(0),
+       first_(0),
+       period_(0),
+       started_(false) {
+    }
+
+    /**
+     * @brief The replayer used by all etcd::Client and etcd::Watch objects
+     */
+    static TraceReplayer& Global() {
+        static TraceReplayer replayer;
+        return replayer;
+    }
+
+    // OPERATIONS
+
+    /**
+     * @brief Read the trace in path, replacing the loaded one
+     *
+     * @return false if path cannot be read or is not a trace
+     */
+    bool Load(const std::string& path);
+
+    /**
+     * @brief Records of the loaded trace, in recorded order
+     */
+    const std::vector<TraceRecord>& GetRecords() const {
+        return records_;
+    }
+
+    /**
+     * @brief Answer requests from the trace instead of the network
+     */
+    void Enable(bool onOff) {
+        enabled_.store(onOff, std::memory_order_release);
+    }
+
+    bool IsEnabled() const {
+        return enabled_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Pace of the responses: 0 answers at once, 1 keeps the recorded
+     * schedule and latencies, 10 runs ten times as fast
+     */
+    void SetSpeed(double speed) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        speed_ = speed > 0 ? speed : 0;
+    }
+
+    /**
+     * @brief Start over at the first response of a request once all of its
+     * responses were served, to replay a trace several times
+     */
+    void SetLoop(bool onOff) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        loop_ = onOff;
+    }
+
+    /**
+     * @brief Serve every response again from the first one, the schedule
+     * starts over at the next request
+     */
+    void Rewind() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& q :queues_) {
+            q.second.next = 0;
+            q.second.passes = 0;
+        }
+        missed_ = 0;
+        started_ = false;
+    }
+
+    /**
+     * @brief Number of requests which found no recorded response
+     */
+    uint64_t Missed() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return missed_;
+    }
+
+    /**
+     * @brief The response to a request, once it is due on the schedule of
+     * the trace
+     *
+     * @return NULL if the trace holds no more responses to the request
+     */
+    const TraceRecord* Next(const char* method,
+                            const std::string& url,
+                            const std::string& request);
+
+  private:
+    // TYPES
+    struct Queue {
+        Queue() :next(0), passes(0) {}
+
+        std::vector<size_t> records;
+        size_t next;
+        uint64_t passes;        // times the queue started over with loop
+    };
+
+    // DATA MEMBERS
+    std::vector<TraceRecord> records_;
+    std::map<std::string, Queue> queues_;   // method, path and body
+    std::atomic<bool> enabled_;
+    double speed_;
+    bool loop_;
+    uint64_t missed_;
+    uint64_t first_;            // offset of the first request
+    uint64_t period_;           // microseconds from it to the last response
+    bool started_;
+    std::chrono::steady_clock::time_point epoch_;
+    mutable std::mutex mutex_;
+
+    // LIFECYCLE
+    TraceReplayer(const TraceReplayer& rhs);
+    void operator=(const TraceReplayer& rhs);
+
+    // OPERATIONS
+    static std::string _Key(const std::string& method,
+                            const std::string& path,
+                            const std::string& request) {
+        return method + ' ' + path + '\n' + request;
+    }
+};
+
+inline bool TraceReplayer::
+Load(const std::string& path) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (! file)
+        return false;
+    std::string data;
+    char chunk[65536];
+    size_t n;
+    while ((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+        data.append(chunk, n);
+    std::fclose(file);
+
+    const size_t kMagicSize = internal::TraceCodec::kMagicSize;
+    if (data.size() < kMagicSize ||
+        data.compare(0, kMagicSize, internal::TraceCodec::Magic()) != 0)
+        return false;
+
+    std::vector<TraceRecord> records;
+    size_t pos = kMagicSize;
+    TraceRecord record;
+    while (internal::TraceCodec::Decode(data, pos, record))
+        records.push_back(record);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    records_.swap(records);
+    queues_.clear();
+    first_ = 0;
+    period_ = 0;
+    for (size_t i = 0; i < records_.size(); ++i) {
+        const TraceRecord& r = records_[i];
+        queues_[_Key(r.method, r.path, r.request)].records.push_back(i);
+        if (i == 0 || r.offset < first_)
+            first_ = r.offset;
+    }
+    for (size_t i = 0; i < records_.size(); ++i) {
+        const TraceRecord& r = records_[i];
+        period_ = std::max(period_, r.offset - first_ + r.timings.total);
+    }
+    missed_ = 0;
+    started_ = false;
+    return true;
+}
+
+inline const TraceRecord* TraceReplayer::
+Next(const char* method, const std::string& url, const std::string& request) {
+    typedef std::chrono::steady_clock Clock;
+    const TraceRecord* record = NULL;
+    double speed;
+    Clock::time_point now = Clock::now();
+    Clock::time_point due = now;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        speed = speed_;
+        if (! started_) {
+            epoch_ = now;
+            started_ = true;
+        }
+        std::map<std::string, Queue>::iterator it =
+            queues_.find(_Key(method, internal::TracePath(url), request));
+        if (it != queues_.end()) {
+            Queue& q = it->second;
+            if (q.next == q.records.size() && loop_) {
+                q.next = 0;
+                ++q.passes;
+            }
+            if (q.next < q.records.size())
+                record = &records_[q.records[q.next++]];
+            // Every pass of a looping queue is scheduled a trace later
+            if (record && speed > 0) {
+                uint64_t done = q.passes * period_ + record->offset - first_ +
+                    record->timings.total;
+                due = epoch_ + std::chrono::microseconds(
+                    (uint64_t) (done / speed));
+            }
+        }
+        if (! record)
+            ++missed_;
+    }
+
+    if (record && speed > 0) {
+        Clock::time_point served = now + std::chrono::microseconds(
+            (uint64_t) (record->timings.total / speed));
+        std::this_thread::sleep_until(std::max(due, served));
+    }
+    return record;
+}
+
+} // namespace etcd
+
+#endif // __ETCD_REQUEST_TRACE_HPP_INCLUDED__
@@ -0,0 +1,142 @@
+#ifndef __ETCD_STATS_HPP_INCLUDED__
+#define __ETCD_STATS_HPP_INCLUDED__
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace etcd {
+
+// ---------------------------- TYPES ---------------------------------------
+
+/**
+ * @brief Raft append requests from the leader to one follower
+ */
+struct FollowerCounts {
+    FollowerCounts()
+      :fail(0),
+       success(0)
+      {}
+
+    uint64_t fail;
+    uint64_t success;
+};
+
+/**
+ * @brief Round trip of the leader's append requests to one follower, in
+ * milliseconds
+ */
+struct FollowerLatency {
+    FollowerLatency()
+      :average(0),
+       current(0),
+       maximum(0),
+       minimum(0),
+       standard_deviation(0)
+      {}
+
+    double average;
+    double current;
+    double maximum;
+    double minimum;
+    double standard_deviation;
+};
+
+struct FollowerStats {
+    FollowerCounts counts;
+    FollowerLatency latency;
+};
+
+/**
+ * @brief /v2/stats/leader, only the leader of the cluster answers it
+ */
+struct LeaderStats {
+    std::string leader;                                 // member id
+    std::map<std::string, FollowerStats> followers;     // by member id
+};
+
+/**
+ * @brief The leader as seen by one member
+ */
+struct LeaderInfo {
+    std::string leader;         // member id
+    std::string start_time;     // RFC 3339, when it became the leader
+    std::string uptime;         // Go duration, e.g. "10m59.322358947s"
+};
+
+/**
+ * @brief /v2/stats/self, answered by every member about itself. Rates are
+ * per second, bandwidth rates in bytes.
+ */
+struct SelfStats {
+    SelfStats()
+      :recv_append_request_count(0),
+       recv_bandwidth_rate(0),
+       recv_pkg_rate(0),
+       send_append_request_count(0),
+       send_bandwidth_rate(0),
+       send_pkg_rate(0)
+      {}
+
+    std::string id;
+    std::string name;
+    std::string state;          // StateLeader, StateFollower, StateCandidate
+    std::string start_time;     // RFC 3339
+    LeaderInfo leader_info;
+    uint64_t recv_append_request_count;
+    double recv_bandwidth_rate;
+    double recv_pkg_rate;
+    uint64_t send_append_request_count;
+    double send_bandwidth_rate;
+    double send_pkg_rate;
+
+    bool IsLeader() const {
+        return state == "StateLeader";
+    }
+};
+
+/**
+ * @brief /v2/stats/store, operation counters of the member's key store
+ * since it started. watchers is the number of watches open right now.
+ */
+struct StoreStats {
+    StoreStats()
+      :compare_and_delete_fail(0),
+       compare_and_delete_success(0),
+       compare_and_swap_fail(0),
+       compare_and_swap_success(0),
+       create_fail(0),
+       create_success(0),
+       delete_fail(0),
+       delete_success(0),
+       expire_count(0),
+       gets_fail(0),
+       gets_success(0),
+       sets_fail(0),
+       sets_success(0),
+       update_fail(0),
+       update_success(0),
+       watchers(0)
+      {}
+
+    uint64_t compare_and_delete_fail;
+    uint64_t compare_and_delete_success;
+    uint64_t compare_and_swap_fail;
+    uint64_t compare_and_swap_success;
+    uint64_t create_fail;
+    uint64_t create_success;
+    uint64_t delete_fail;
+    uint64_t delete_success;
+    uint64_t expire_count;
+    uint64_t gets_fail;
+    uint64_t gets_success;
+    uint64_t sets_fail;
+    uint64_t sets_success;
+    uint64_t update_fail;
+    uint64_t update_success;
+    uint64_t watchers;
+};
+
+} // namespace etcd
+
+#endif // __ETCD_STATS_HPP_INCLUDED__
@@ -0,0 +1,268 @@
+#ifndef __ETCD_STATS_POLLER_HPP_INCLUDED__
+#define __ETCD_STATS_POLLER_HPP_INCLUDED__
+
+#include "client.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace etcd {
+
+/**
+ * @brief Statistics of one member read at one point in time
+ */
+struct StatsSample {
+    StatsSample()
+      :timestamp(0),
+       duration(0),
+       sources(0)
+      {}
+
+    uint64_t timestamp;         // microseconds since the epoch
+    uint64_t duration;          // microseconds spent reading the stats
+    unsigned sources;           // StatsPoller::kSelf... read successfully
+    SelfStats self;
+    LeaderStats leader;         // only read while the member leads
+    StoreStats store;
+    std::string error;          // what the last failed read threw
+
+    bool IsLeader() const {
+        return self.IsLeader();
+    }
+};
+
+/**
+ * @brief Samples the stats API of one member periodically from a thread of
+ * its own.
+ *
+ * The poller owns its client, so sampling never contends with the
+ * application's requests, and keeps its connection alive between samples.
+ * Leader stats are only requested while the self stats report the member
+ * as leader; a follower would answer them with 403. The latest sample can
+ * be read at any time, or pushed to a callback as soon as it is taken.
+ *
+ *   etcd::StatsPoller<etcd::RapidReply> poller("127.0.0.1", 2379,
+ *                                              std::chrono::seconds(10));
+ *   poller.Start([](const etcd::StatsSample& s) { ... });
+ *
+ * @tparam Reply json reply wrapper implementing GetSelfStats,
+ * GetLeaderStats and GetStoreStats
+ * @tparam Tracer begin/end hooks around every request, see etcd::NullTracer
+ */
+template <typename Reply, typename Tracer = NullTracer>
+class StatsPoller {
+  public:
+    // CONSTANTS
+    static const unsigned kSelf = 1;
+    static const unsigned kLeader = 2;
+    static const unsigned kStore = 4;
+    static const unsigned kAll = kSelf | kLeader | kStore;
+
+    // TYPES
+    typedef std::function<void (const StatsSample& sample)> Callback;
+
+    // LIFECYCLE
+    /**
+     * @brief Create a poller, no request is made before Start or Poll
+     *
+     * @param server etcd client URL without the port
+     * @param port etcd client port
+     * @param interval time between the start of two samples
+     * @param sources which stats to read, kLeader reads the self stats too
+     */
+    StatsPoller(const std::string& server,
+                const Port& port,
+                const std::chrono::milliseconds& interval,
+                unsigned sources = kAll);
+
+    ~StatsPoller();
+
+    // OPERATIONS
+    /**
+     * @brief Start sampling every interval, at once for the first time
+     *
+     * @param callback called from the poller's thread with every sample
+     */
+    void Start(const Callback& callback = Callback());
+
+    /**
+     * @brief Stop sampling, waits for a sample in progress. Called by the
+     * destructor.
+     */
+    void Stop();
+
+    /**
+     * @brief Take a sample now, on the calling thread. Must not be called
+     * while the poller is started.
+     *
+     * @return false if any of the sources could not be read
+     */
+    bool Poll(StatsSample& sample);
+
+    /**
+     * @brief Copy the latest sample taken by the poller's thread
+     *
+     * @return false if no sample has been taken yet
+     */
+    bool GetSample(StatsSample& sample) const;
+
+    /**
+     * @brief Metrics of the poller's own client, its requests are recorded
+     * as etcd::Operation::OPERATION_STATS
+     */
+    const ClientMetrics& GetMetrics() const;
+
+  private:
+    // DATA MEMBERS
+    Client<Reply, Tracer> client_;
+    std::chrono::milliseconds interval_;
+    unsigned sources_;
+    Callback callback_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable stop_;
+    bool stopping_;
+    bool sampled_;
+    StatsSample latest_;
+    std::thread thread_;
+
+    // LIFECYCLE
+    StatsPoller(const StatsPoller& rhs);
+    void operator=(const StatsPoller& rhs);
+
+    // OPERATIONS
+    void _Run();
+};
+
+//------------------------------- LIFECYCLE ----------------------------------
+
+template <typename Reply, typename Tracer> StatsPoller<Reply, Tracer>::
+StatsPoller(
+    const std::string& server,
+    const Port& port,
+    const std::chrono::milliseconds& interval,
+    unsigned sources)
+  :client_(server, port),
+   interval_(interval),
+   sources_(sources),
+   stopping_(false),
+   sampled_(false) {
+}
+
+template <typename Reply, typename Tracer> StatsPoller<Reply, Tracer>::
+~StatsPoller() {
+    Stop();
+}
+
+//------------------------------- OPERATIONS ---------------------------------
+
+template <typename Reply, typename Tracer> void StatsPoller<Reply, Tracer>::
+Start(const Callback& callback) {
+    if (thread_.joinable())
+        return;
+    callback_ = callback;
+    stopping_ = false;
+    thread_ = std::thread(&StatsPoller::_Run, this);
+}
+
+template <typename Reply, typename Tracer> void StatsPoller<Reply, Tracer>::
+Stop() {
+    if (! thread_.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    stop_.notify_all();
+    thread_.join();
+}
+
+template <typename Reply, typename Tracer> bool StatsPoller<Reply, Tracer>::
+Poll(StatsSample& sample) {
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    sample.timestamp = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    sample.sources = 0;
+    sample.error.clear();
+
+    // Every source is read even if another one failed
+    unsigned failed = 0;
+    if (sources_ & (kSelf | kLeader)) {
+        try {
+            sample.self = client_.GetSelfStats();
+            sample.sources |= kSelf;
+        } catch (const std::exception& e) {
+            sample.self = SelfStats();
+            sample.error = e.what();
+            failed |= kSelf;
+        }
+    }
+    sample.leader = LeaderStats();
+    if ((sources_ & kLeader) && sample.self.IsLeader()) {
+        try {
+            sample.leader = client_.GetLeaderStats();
+            sample.sources |= kLeader;
+        } catch (const std::exception& e) {
+            sample.error = e.what();
+            failed |= kLeader;
+        }
+    }
+    if (sources_ & kStore) {
+        try {
+            sample.store = client_.GetStoreStats();
+            sample.sources |= kStore;
+        } catch (const std::exception& e) {
+            sample.store = StoreStats();
+            sample.error = e.what();
+            failed |= kStore;
+        }
+    }
+
+    sample.duration = internal::ElapsedMicros(start);
+    return ! failed;
+}
+
+template <typename Reply, typename Tracer> bool StatsPoller<Reply, Tracer>::
+GetSample(StatsSample& sample) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (! sampled_)
+        return false;
+    sample = latest_;
+    return true;
+}
+
+template <typename Reply, typename Tracer>
+const ClientMetrics& StatsPoller<Reply, Tracer>::
+GetMetrics() const {
+    return client_.GetMetrics();
+}
+
+template <typename Reply, typename Tracer> void StatsPoller<Reply, Tracer>::
+_Run() {
+    StatsSample sample;
+    std::chrono::steady_clock::time_point next =
+        std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (! stopping_) {
+        lock.unlock();
+        Poll(sample);
+        if (callback_)
+            callback_(sample);
+        lock.lock();
+        latest_ = sample;
+        sampled_ = true;
+
+        // A slow sample delays the next one instead of queueing several
+        next = std::max(next + interval_, std::chrono::steady_clock::now());
+        stop_.wait_until(lock, next, [this] { return stopping_; });
+    }
+}
+
+} // namespace etcd
+
+#endif // __ETCD_STATS_POLLER_HPP_INCLUDED__
@@ -0,0 +1,69 @@
+#ifndef __ETCD_TRACE_HPP_INCLUDED__
+#define __ETCD_TRACE_HPP_INCLUDED__
+
+#include "metrics.hpp"
+#include <cstdint>
+#include <string>
+
+namespace etcd {
+
+/**
+ * @brief Description of a request handed to the tracer hooks. The strings
+ * are borrowed from the client and are only valid during the hook call.
+ */
+struct TraceEvent {
+    TraceEvent(Operation operation,
+               const std::string& key,
+               const std::string& endpoint)
+      :operation(operation),
+       key(key),
+       endpoint(endpoint),
+       status(0),
+       bytes_sent(0),
+       bytes_received(0),
+       duration(0)
+      {}
+
+    Operation operation;
+    const std::string& key;
+    const std::string& endpoint;
+    long status;                // HTTP status, zero if no response was read
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t duration;          // microseconds, only set for End
+
+  private:
+    void operator=(const TraceEvent& rhs);
+};
+
+/**
+ * @brief Default tracer policy of etcd::Client and etcd::Watch.
+ *
+ * A tracer policy has to provide:
+ *
+ *  - static const bool kEnabled; when false the client does not even read
+ *    the clock, the hooks and the code feeding them are compiled out.
+ *  - typedef Span; a cheap value returned by Begin and handed back to End,
+ *    e.g. a span id of the user's tracer.
+ *  - Span Begin(const TraceEvent& event);
+ *  - void End(Span& span, const TraceEvent& event);
+ *
+ * Hooks are called on the thread performing the request, they must not
+ * throw. Neither the client nor the event allocate on behalf of the hooks.
+ */
+struct NullTracer {
+    static const bool kEnabled = false;
+
+    typedef int Span;
+
+    Span Begin(const TraceEvent&) {
+        return Span();
+    }
+
+    void End(Span&, const TraceEvent&) {
+    }
+};
+
+} // namespace etcd
+
+#endif // __ETCD_TRACE_HPP_INCLUDED__
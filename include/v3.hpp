@@ -0,0 +1,449 @@
+#ifndef __ETCD_V3_HPP_INCLUDED__
+#define __ETCD_V3_HPP_INCLUDED__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace etcd {
+namespace v3 {
+
+// ---------------------------- TYPES ---------------------------------------
+
+typedef int64_t Revision;
+typedef int64_t LeaseId;
+
+/**
+ * @brief Header of every v3 response
+ */
+struct ResponseHeader {
+    ResponseHeader()
+      :cluster_id(0),
+       member_id(0),
+       revision(0),
+       raft_term(0)
+      {}
+
+    uint64_t cluster_id;
+    uint64_t member_id;
+    Revision revision;          // revision of the store when it answered
+    uint64_t raft_term;
+};
+
+/**
+ * @brief A key and its value, both raw bytes
+ */
+struct KeyValue {
+    KeyValue()
+      :create_revision(0),
+       mod_revision(0),
+       version(0),
+       lease(0)
+      {}
+
+    std::string key;
+    std::string value;          // empty for keys only reads
+    Revision create_revision;
+    Revision mod_revision;
+    int64_t version;            // number of changes since creation
+    LeaseId lease;              // 0 without a lease
+};
+
+typedef std::vector<KeyValue> KeyValues;
+
+/**
+ * @brief Options of a range read. With an empty range_end a single key is
+ * read; "\0" reads every key >= key, see PrefixEnd for prefix scans.
+ */
+struct RangeOptions {
+    RangeOptions()
+      :limit(0),
+       revision(0),
+       keys_only(false),
+       count_only(false),
+       serializable(false)
+      {}
+
+    std::string range_end;
+    int64_t limit;              // 0 for no limit
+    Revision revision;          // 0 for the latest revision
+    bool keys_only;             // leave the values out
+    bool count_only;            // only count the keys in range
+    bool serializable;          // answered by the member, maybe stale
+};
+
+struct RangeResponse {
+    RangeResponse()
+      :more(false),
+       count(0)
+      {}
+
+    ResponseHeader header;
+    KeyValues kvs;
+    bool more;                  // more keys are in range than limit
+    int64_t count;              // keys in range, limit left aside
+};
+
+struct PutOptions {
+    PutOptions()
+      :lease(0),
+       prev_kv(false)
+      {}
+
+    LeaseId lease;              // attach the key to a lease, 0 for none
+    bool prev_kv;               // return the previous key-value pair
+};
+
+struct PutResponse {
+    PutResponse()
+      :has_prev_kv(false)
+      {}
+
+    ResponseHeader header;
+    bool has_prev_kv;
+    KeyValue prev_kv;
+};
+
+struct DeleteRangeResponse {
+    DeleteRangeResponse()
+      :deleted(0)
+      {}
+
+    ResponseHeader header;
+    int64_t deleted;
+    KeyValues prev_kvs;         // only filled when asked for
+};
+
+/**
+ * @brief Default --max-txn-ops of etcd, the most operations a transaction
+ * may hold in each of its branches
+ */
+const size_t kMaxTxnOps = 128;
+
+/**
+ * @brief A condition of a transaction on one key. A missing key has version,
+ * create and mod revisions and lease 0, and fails every value comparison.
+ */
+struct Compare {
+    enum Target {
+        TARGET_VERSION,
+        TARGET_CREATE,
+        TARGET_MOD,
+        TARGET_VALUE,
+        TARGET_LEASE
+    };
+
+    enum Result {
+        RESULT_EQUAL,
+        RESULT_GREATER,
+        RESULT_LESS,
+        RESULT_NOT_EQUAL
+    };
+
+    Compare()
+      :target(TARGET_VERSION),
+       result(RESULT_EQUAL),
+       number(0)
+      {}
+
+    Target target;
+    Result result;
+    std::string key;
+    std::string value;          // TARGET_VALUE
+    int64_t number;             // any other target
+
+    static Compare Value(const std::string& key, Result result,
+                         const std::string& value) {
+        Compare c;
+        c.target = TARGET_VALUE;
+        c.result = result;
+        c.key = key;
+        c.value = value;
+        return c;
+    }
+
+    /**
+     * @brief Version(key, RESULT_EQUAL, 0) holds if the key does not exist
+     */
+    static Compare Version(const std::string& key, Result result,
+                           int64_t version) {
+        return _Number(TARGET_VERSION, key, result, version);
+    }
+
+    static Compare CreateRevision(const std::string& key, Result result,
+                                  Revision revision) {
+        return _Number(TARGET_CREATE, key, result, revision);
+    }
+
+    static Compare ModRevision(const std::string& key, Result result,
+                               Revision revision) {
+        return _Number(TARGET_MOD, key, result, revision);
+    }
+
+    static Compare Lease(const std::string& key, Result result,
+                         LeaseId lease) {
+        return _Number(TARGET_LEASE, key, result, lease);
+    }
+
+  private:
+    static Compare _Number(Target target, const std::string& key,
+                           Result result, int64_t number) {
+        Compare c;
+        c.target = target;
+        c.result = result;
+        c.key = key;
+        c.number = number;
+        return c;
+    }
+};
+
+/**
+ * @brief One operation of a transaction
+ */
+struct Op {
+    enum Type {
+        OP_RANGE,
+        OP_PUT,
+        OP_DELETE_RANGE
+    };
+
+    Op()
+      :type(OP_RANGE),
+       prev_kv(false)
+      {}
+
+    Type type;
+    std::string key;
+    std::string value;          // OP_PUT
+    RangeOptions range;         // OP_RANGE, range_end for OP_DELETE_RANGE too
+    PutOptions put;             // OP_PUT
+    bool prev_kv;               // OP_DELETE_RANGE
+
+    static Op Get(const std::string& key,
+                  const RangeOptions& options = RangeOptions()) {
+        Op op;
+        op.key = key;
+        op.range = options;
+        return op;
+    }
+
+    static Op Put(const std::string& key, const std::string& value,
+                  const PutOptions& options = PutOptions()) {
+        Op op;
+        op.type = OP_PUT;
+        op.key = key;
+        op.value = value;
+        op.put = options;
+        return op;
+    }
+
+    static Op Delete(const std::string& key,
+                     const std::string& range_end = std::string(),
+                     bool prev_kv = false) {
+        Op op;
+        op.type = OP_DELETE_RANGE;
+        op.key = key;
+        op.range.range_end = range_end;
+        op.prev_kv = prev_kv;
+        return op;
+    }
+};
+
+typedef std::vector<Op> Ops;
+
+/**
+ * @brief An atomic transaction: if every comparison holds the success
+ * operations are applied, else the failure ones, in one revision.
+ *
+ *   etcd::v3::Txn txn;
+ *   txn.If(Compare::Value("/lock", Compare::RESULT_EQUAL, "free"))
+ *      .Then(Op::Put("/lock", "taken"))
+ *      .Else(Op::Get("/lock"));
+ */
+struct Txn {
+    std::vector<Compare> compare;
+    Ops success;
+    Ops failure;
+
+    Txn& If(const Compare& c) {
+        compare.push_back(c);
+        return *this;
+    }
+
+    Txn& Then(const Op& op) {
+        success.push_back(op);
+        return *this;
+    }
+
+    Txn& Else(const Op& op) {
+        failure.push_back(op);
+        return *this;
+    }
+};
+
+/**
+ * @brief Result of one operation, the member matching type is set
+ */
+struct OpResponse {
+    OpResponse()
+      :type(Op::OP_RANGE)
+      {}
+
+    Op::Type type;
+    RangeResponse range;
+    PutResponse put;
+    DeleteRangeResponse delete_range;
+};
+
+struct TxnResponse {
+    TxnResponse()
+      :succeeded(false)
+      {}
+
+    ResponseHeader header;
+    bool succeeded;             // the comparisons held
+    std::vector<OpResponse> responses;  // of the branch taken, in order
+};
+
+struct LeaseGrantResponse {
+    LeaseGrantResponse()
+      :id(0),
+       ttl(0)
+      {}
+
+    ResponseHeader header;
+    LeaseId id;
+    int64_t ttl;                // seconds, as granted by the server
+};
+
+struct LeaseKeepAliveResponse {
+    LeaseKeepAliveResponse()
+      :id(0),
+       ttl(0)
+      {}
+
+    ResponseHeader header;
+    LeaseId id;
+    int64_t ttl;                // seconds left, 0 if the lease has expired
+};
+
+struct LeaseTimeToLiveResponse {
+    LeaseTimeToLiveResponse()
+      :id(0),
+       ttl(-1),
+       granted_ttl(0)
+      {}
+
+    ResponseHeader header;
+    LeaseId id;
+    int64_t ttl;                // seconds left, -1 if the lease has expired
+    int64_t granted_ttl;
+    std::vector<std::string> keys;  // attached keys, when asked for
+};
+
+typedef int64_t WatchId;
+
+/**
+ * @brief A change to a key. A delete carries the key and its mod_revision
+ * only.
+ */
+struct Event {
+    enum Type {
+        EVENT_PUT,
+        EVENT_DELETE
+    };
+
+    Event()
+      :type(EVENT_PUT),
+       has_prev_kv(false)
+      {}
+
+    Type type;
+    KeyValue kv;
+    bool has_prev_kv;
+    KeyValue prev_kv;           // with WatchOptions::prev_kv
+};
+
+typedef std::vector<Event> Events;
+
+struct WatchOptions {
+    WatchOptions()
+      :start_revision(0),
+       prev_kv(false),
+       progress_notify(false)
+      {}
+
+    std::string range_end;      // as for RangeOptions
+    Revision start_revision;    // 0 for the changes after the current one
+    bool prev_kv;               // events carry the previous key-value pair
+    bool progress_notify;       // periodic notifications while idle
+};
+
+/**
+ * @brief One message of a watch stream, as sent by the server
+ */
+struct WatchResponse {
+    WatchResponse()
+      :watch_id(0),
+       created(false),
+       canceled(false),
+       compact_revision(0)
+      {}
+
+    ResponseHeader header;
+    WatchId watch_id;
+    bool created;
+    bool canceled;
+    Revision compact_revision;  // set with canceled if history was lost
+    std::string cancel_reason;
+    Events events;
+};
+
+/**
+ * @brief What a watch callback is given
+ */
+struct WatchUpdate {
+    enum Kind {
+        UPDATE_EVENTS,          // changes, in revision order
+        UPDATE_PROGRESS,        // no change up to revision
+        UPDATE_RESYNC,          // history lost, kvs is the range at revision
+        UPDATE_CANCELED         // the server canceled the watch, for reason
+    };
+
+    WatchUpdate()
+      :kind(UPDATE_EVENTS),
+       watch_id(0),
+       revision(0)
+      {}
+
+    Kind kind;
+    WatchId watch_id;
+    Revision revision;          // every change up to it has been delivered
+    Events events;
+    KeyValues kvs;
+    std::string reason;
+};
+
+// ---------------------------- HELPERS -------------------------------------
+
+/**
+ * @brief range_end matching every key starting with prefix: the prefix with
+ * its last byte below 0xff incremented. "\0", every key, if there is none.
+ */
+inline std::string PrefixEnd(const std::string& prefix) {
+    std::string end = prefix;
+    while (! end.empty()) {
+        unsigned char last = static_cast<unsigned char>(end[end.size() - 1]);
+        if (last < 0xff) {
+            end[end.size() - 1] = static_cast<char>(last + 1);
+            return end;
+        }
+        end.erase(end.size() - 1);
+    }
+    return std::string(1, '\0');
+}
+
+} // namespace v3
+} // namespace etcd
+
+#endif // __ETCD_V3_HPP_INCLUDED__
@@ -0,0 +1,952 @@
+#ifndef __ETCD_V3_CLIENT_HPP_INCLUDED__
+#define __ETCD_V3_CLIENT_HPP_INCLUDED__
+
+#include "client.hpp"
+#include "internal/base64.hpp"
+#include "v3.hpp"
+#include <set>
+
+namespace etcd {
+
+namespace internal {
+
+/**
+ * @brief Builds the JSON body of a v3 gateway request. Bytes fields are
+ * base64 encoded, so no string needs escaping.
+ */
+class V3Body {
+  public:
+    // LIFECYCLE
+    V3Body()
+      :body_("{")
+      {}
+
+    // OPERATIONS
+    void Bytes(const char* name, const std::string& value) {
+        _Name(name);
+        body_ += '"';
+        Base64Encode(value.data(), value.size(), body_);
+        body_ += '"';
+    }
+
+    void Int(const char* name, int64_t value) {
+        _Name(name);
+        body_ += std::to_string(value);
+    }
+
+    void Bool(const char* name, bool value) {
+        _Name(name);
+        body_ += value ? "true" : "false";
+    }
+
+    /**
+     * @brief Add a nested object or array, already serialized
+     */
+    void Raw(const char* name, const std::string& json) {
+        _Name(name);
+        body_ += json;
+    }
+
+    const std::string& Close() {
+        body_ += '}';
+        return body_;
+    }
+
+  private:
+    std::string body_;
+
+    void _Name(const char* name) {
+        if (body_.size() > 1)
+            body_ += ',';
+        body_ += '"';
+        body_ += name;
+        body_ += "\":";
+    }
+};
+
+} // namespace internal
+
+/**
+ * @brief c++ language binding for the etcd v3 API, over the JSON gateway
+ * of etcd (/v3/...) and the same curl transport as etcd::Client.
+ *
+ * Keys and values are raw bytes in and out, base64 is dealt with inside.
+ * Range reads with range_end, limit, keys_only and count_only let a large
+ * keyspace be scanned or counted at a fraction of the cost of a v2
+ * recursive GetAll. Transactions apply guarded updates and batches of
+ * writes atomically, in one round trip each.
+ *
+ * @tparam Reply json reply wrapper implementing GetRange, GetPut,
+ * GetDeleteRange, GetTxn, GetResponseHeader and the GetLease* readers, see
+ * etcd::RapidReply. Keys and values are handed over base64 encoded, as they
+ * are in the reply, and decoded by the client.
+ * @tparam Tracer begin/end hooks around every request, see etcd::NullTracer
+ */
+template <typename Reply, typename Tracer = NullTracer>
+class V3Client {
+  public:
+    // LIFECYCLE
+    V3Client(const std::string& server, const Port& port);
+
+    V3Client(const std::string& server, const Port& port,
+             const Tracer& tracer);
+
+    /**
+     * @brief Create a client following the endpoints of a cluster, as
+     * etcd::Client does
+     */
+    explicit V3Client(const std::shared_ptr<ClusterEndpoints>& endpoints);
+
+    V3Client(const std::shared_ptr<ClusterEndpoints>& endpoints,
+             const Tracer& tracer);
+
+    // OPERATIONS
+    /**
+     * @brief Read one key
+     *
+     * @return kvs is empty if the key does not exist
+     */
+    v3::RangeResponse Get(const std::string& key);
+
+    /**
+     * @brief Read every key starting with prefix, in key order
+     *
+     * @param options limit, revision, keys_only and count_only apply,
+     * range_end is set by the call
+     */
+    v3::RangeResponse GetPrefix(
+        const std::string& prefix,
+        const v3::RangeOptions& options = v3::RangeOptions());
+
+    /**
+     * @brief Read the keys in [key, options.range_end)
+     */
+    v3::RangeResponse Range(const std::string& key,
+                            const v3::RangeOptions& options);
+
+    /**
+     * @brief Set the value of a key
+     */
+    v3::PutResponse Put(const std::string& key,
+                        const std::string& value,
+                        const v3::PutOptions& options = v3::PutOptions());
+
+    /**
+     * @brief Delete one key
+     */
+    v3::DeleteRangeResponse Delete(const std::string& key,
+                                   bool prev_kv = false);
+
+    /**
+     * @brief Delete every key starting with prefix
+     */
+    v3::DeleteRangeResponse DeletePrefix(const std::string& prefix,
+                                         bool prev_kv = false);
+
+    /**
+     * @brief Delete the keys in [key, range_end)
+     */
+    v3::DeleteRangeResponse DeleteRange(const std::string& key,
+                                        const std::string& range_end,
+                                        bool prev_kv = false);
+
+    /**
+     * @brief Apply a transaction in one round trip
+     *
+     * @return the branch taken and the result of each of its operations
+     */
+    v3::TxnResponse Txn(const v3::Txn& txn);
+
+    /**
+     * @brief Atomically set key to value if its value is prev_value. On
+     * failure the only response is a read of the key, to retry from without
+     * another round trip.
+     */
+    v3::TxnResponse CompareAndSwapIf(const std::string& key,
+                                     const std::string& value,
+                                     const std::string& prev_value);
+
+    /**
+     * @brief Atomically set key to value if it was last modified at
+     * prev_revision, 0 to only create it. Fails as the other overload.
+     */
+    v3::TxnResponse CompareAndSwapIf(const std::string& key,
+                                     const std::string& value,
+                                     v3::Revision prev_revision);
+
+    /**
+     * @brief Apply puts, deletes and reads in as few transactions as
+     * possible: each holds up to max_ops operations, the limit set by
+     * --max-txn-ops on the servers. Operations are applied in order. Each
+     * transaction is atomic, the batch as a whole is not: on an error the
+     * transactions before it have been applied.
+     *
+     * A key put or deleted twice starts a new transaction, as etcd rejects
+     * a transaction writing the same key twice. Overlapping delete ranges
+     * are not detected.
+     *
+     * @return one response per transaction, in order
+     */
+    std::vector<v3::TxnResponse> Apply(const v3::Ops& ops,
+                                       size_t max_ops = v3::kMaxTxnOps);
+
+    /**
+     * @brief Grant a lease, keys put with its id are deleted when it expires
+     *
+     * @param ttl time to live in seconds
+     * @param id id to give the lease, 0 lets the server choose
+     */
+    v3::LeaseGrantResponse LeaseGrant(int64_t ttl, v3::LeaseId id = 0);
+
+    /**
+     * @brief Revoke a lease and delete the keys attached to it
+     */
+    v3::ResponseHeader LeaseRevoke(v3::LeaseId id);
+
+    /**
+     * @brief Renew a lease for its granted ttl
+     *
+     * @return ttl is 0 if the lease had already expired
+     */
+    v3::LeaseKeepAliveResponse LeaseKeepAlive(v3::LeaseId id);
+
+    /**
+     * @brief Renew many leases in a single request, one message per lease
+     * in one stream of the gateway
+     *
+     * @return a response per lease, in the order of ids
+     */
+    std::vector<v3::LeaseKeepAliveResponse> LeaseKeepAlive(
+        const std::vector<v3::LeaseId>& ids);
+
+    /**
+     * @brief Time left on a lease, and optionally the keys attached to it
+     */
+    v3::LeaseTimeToLiveResponse LeaseTimeToLive(v3::LeaseId id,
+                                                bool keys = false);
+
+    /**
+     * @brief URL of the endpoint the next request goes to
+     */
+    const std::string& GetEndpoint();
+
+    /**
+     * @brief Consistency of the range reads, quorum by default as with
+     * etcd: reads are linearizable, at the cost of a round trip of the
+     * member to the leader. Local reads are serializable, answered by the
+     * member alone, as is a read with options.serializable. A minimum index
+     * is checked against the revision of a serializable read; a member
+     * behind it costs a second, linearizable read. Reads in transactions
+     * are not affected.
+     */
+    void SetReadConsistency(const ReadConsistency& consistency);
+
+    const ReadConsistency& GetReadConsistency() const;
+
+    /**
+     * @brief Limit the connection and the whole of every request, 0 for no
+     * limit, the default. A request over its limit throws
+     * etcd::ClientException.
+     */
+    void SetTimeouts(const std::chrono::milliseconds& connect_timeout,
+                     const std::chrono::milliseconds& timeout);
+
+    /**
+     * @brief Latency histograms of every request made by this client. Range
+     * reads of one key are recorded as OPERATION_GET, of a range as
+     * OPERATION_GET_ALL, transactions as OPERATION_TXN and lease requests
+     * as OPERATION_LEASE.
+     */
+    const ClientMetrics& GetMetrics() const;
+
+    /**
+     * @brief Access the tracer policy instance, e.g. to configure it
+     */
+    Tracer& GetTracer();
+
+  private:
+    // CONSTANTS
+    const char *kRange = "/v3/kv/range";
+    const char *kPut = "/v3/kv/put";
+    const char *kDeleteRange = "/v3/kv/deleterange";
+    const char *kTxn = "/v3/kv/txn";
+    const char *kLeaseGrant = "/v3/lease/grant";
+    const char *kLeaseRevoke = "/v3/lease/revoke";
+    const char *kLeaseKeepAlive = "/v3/lease/keepalive";
+    const char *kLeaseTimeToLive = "/v3/lease/timetolive";
+
+    // DATA MEMBERS
+    std::string url_;
+    std::unique_ptr<internal::Curl> handle_;
+    std::unique_ptr<ClientMetrics> metrics_;
+    PhaseHistograms* endpoint_metrics_;
+    std::shared_ptr<ClusterEndpoints> endpoints_;   // NULL for one server
+    uint64_t endpoints_version_;
+    ReadConsistency consistency_;
+    Tracer tracer_;
+
+    // LIFECYCLE
+    V3Client(const V3Client& rhs);
+    void operator=(const V3Client& rhs);
+
+    // OPERATIONS
+    void _Init(const std::string& server, const Port& port);
+
+    void _Use(const std::string& url);
+
+    void _Follow();
+
+    v3::RangeResponse _Range(const std::string& key,
+                             const v3::RangeOptions& options);
+
+    /**
+     * @brief POST body to path and hand the reply to read. A streamed reply
+     * is a reply per line, each handed to read in turn.
+     */
+    template <typename Read>
+    void _Post(Operation op,
+               const std::string& key,
+               const char* path,
+               const std::string& body,
+               bool stream,
+               const Read& read);
+
+    void _Decode(v3::KeyValue& kv);
+
+    void _Decode(v3::TxnResponse& response);
+
+    static void _RangeBody(const std::string& key,
+                           const v3::RangeOptions& options,
+                           internal::V3Body& body);
+
+    static void _PutBody(const std::string& key,
+                         const std::string& value,
+                         const v3::PutOptions& options,
+                         internal::V3Body& body);
+
+    static void _DeleteBody(const std::string& key,
+                            const std::string& range_end,
+                            bool prev_kv,
+                            internal::V3Body& body);
+
+    static std::string _OpsJson(const v3::Ops& ops);
+
+    static std::string _CompareJson(const std::vector<v3::Compare>& compare);
+
+    void _TraceEnd(typename Tracer::Span& span,
+                   Operation op,
+                   const std::string& key,
+                   const std::chrono::steady_clock::time_point& start,
+                   bool performed);
+};
+
+//------------------------------- LIFECYCLE ----------------------------------
+
+template <typename Reply, typename Tracer> V3Client<Reply, Tracer>::
+V3Client(const std::string& server, const Port& port)
+try:
+    handle_(new internal::Curl()),
+    metrics_(new ClientMetrics("v3")),
+    endpoint_metrics_(NULL),
+    endpoints_version_(0),
+    consistency_(ReadConsistency::Quorum()),
+    tracer_() {
+    _Init(server, port);
+} catch (const std::exception& e) {
+    throw ClientException(e.what());
+}
+
+template <typename Reply, typename Tracer> V3Client<Reply, Tracer>::
+V3Client(const std::string& server, const Port& port, const Tracer& tracer)
+try:
+    handle_(new internal::Curl()),
+    metrics_(new ClientMetrics("v3")),
+    endpoint_metrics_(NULL),
+    endpoints_version_(0),
+    consistency_(ReadConsistency::Quorum()),
+    tracer_(tracer) {
+    _Init(server, port);
+} catch (const std::exception& e) {
+    throw ClientException(e.what());
+}
+
+template <typename Reply, typename Tracer> V3Client<Reply, Tracer>::
+V3Client(const std::shared_ptr<ClusterEndpoints>& endpoints)
+try:
+    handle_(new internal::Curl()),
+    metrics_(new ClientMetrics("v3")),
+    endpoint_metrics_(NULL),
+    endpoints_(endpoints),
+    endpoints_version_(0),
+    consistency_(ReadConsistency::Quorum()),
+    tracer_() {
+    _Follow();
+} catch (const std::exception& e) {
+    throw ClientException(e.what());
+}
+
+template <typename Reply, typename Tracer> V3Client<Reply, Tracer>::
+V3Client(const std::shared_ptr<ClusterEndpoints>& endpoints,
+         const Tracer& tracer)
+try:
+    handle_(new internal::Curl()),
+    metrics_(new ClientMetrics("v3")),
+    endpoint_metrics_(NULL),
+    endpoints_(endpoints),
+    endpoints_version_(0),
+    consistency_(ReadConsistency::Quorum()),
+    tracer_(tracer) {
+    _Follow();
+} catch (const std::exception& e) {
+    throw ClientException(e.what());
+}
+
+//------------------------------- OPERATIONS ---------------------------------
+
+template <typename Reply, typename Tracer>
+v3::RangeResponse V3Client<Reply, Tracer>::
+Get(const std::string& key) {
+    return Range(key, v3::RangeOptions());
+}
+
+template <typename Reply, typename Tracer>
+v3::RangeResponse V3Client<Reply, Tracer>::
+GetPrefix(const std::string& prefix, const v3::RangeOptions& options) {
+    v3::RangeOptions prefix_options = options;
+    prefix_options.range_end = v3::PrefixEnd(prefix);
+    return Range(prefix, prefix_options);
+}
+
+template <typename Reply, typename Tracer>
+v3::RangeResponse V3Client<Reply, Tracer>::
+Range(const std::string& key, const v3::RangeOptions& options) {
+    if (consistency_.level == ReadConsistency::LEVEL_QUORUM ||
+        options.serializable)
+        return _Range(key, options);
+
+    v3::RangeOptions local = options;
+    local.serializable = true;
+    v3::RangeResponse response = _Range(key, local);
+    if (consistency_.level == ReadConsistency::LEVEL_LOCAL ||
+        response.header.revision >=
+            static_cast<v3::Revision>(consistency_.min_index))
+        return response;
+    // The member is behind
+    return _Range(key, options);
+}
+
+template <typename Reply, typename Tracer>
+v3::PutResponse V3Client<Reply, Tracer>::
+Put(const std::string& key,
+    const std::string& value,
+    const v3::PutOptions& options) {
+    internal::V3Body body;
+    _PutBody(key, value, options, body);
+
+    v3::PutResponse response;
+    _Post(Operation::OPERATION_SET, key, kPut, body.Close(), false,
+          [&response](const Reply& reply) { reply.GetPut(response); });
+    if (response.has_prev_kv)
+        _Decode(response.prev_kv);
+    return response;
+}
+
+template <typename Reply, typename Tracer>
+v3::DeleteRangeResponse V3Client<Reply, Tracer>::
+Delete(const std::string& key, bool prev_kv) {
+    return DeleteRange(key, std::string(), prev_kv);
+}
+
+template <typename Reply, typename Tracer>
+v3::DeleteRangeResponse V3Client<Reply, Tracer>::
+DeletePrefix(const std::string& prefix, bool prev_kv) {
+    return DeleteRange(prefix, v3::PrefixEnd(prefix), prev_kv);
+}
+
+template <typename Reply, typename Tracer>
+v3::DeleteRangeResponse V3Client<Reply, Tracer>::
+DeleteRange(
+    const std::string& key,
+    const std::string& range_end,
+    bool prev_kv) {
+    internal::V3Body body;
+    _DeleteBody(key, range_end, prev_kv, body);
+
+    v3::DeleteRangeResponse response;
+    _Post(Operation::OPERATION_DELETE, key, kDeleteRange, body.Close(),
+          false, [&response](const Reply& reply) {
+              reply.GetDeleteRange(response);
+          });
+    for (auto& kv :response.prev_kvs)
+        _Decode(kv);
+    return response;
+}
+
+template <typename Reply, typename Tracer>
+v3::TxnResponse V3Client<Reply, Tracer>::
+Txn(const v3::Txn& txn) {
+    internal::V3Body body;
+    if (! txn.compare.empty())
+        body.Raw("compare", _CompareJson(txn.compare));
+    if (! txn.success.empty())
+        body.Raw("success", _OpsJson(txn.success));
+    if (! txn.failure.empty())
+        body.Raw("failure", _OpsJson(txn.failure));
+
+    const std::string& key = ! txn.compare.empty() ? txn.compare[0].key :
+        ! txn.success.empty() ? txn.success[0].key : std::string();
+    v3::TxnResponse response;
+    _Post(Operation::OPERATION_TXN, key, kTxn, body.Close(), false,
+          [&response](const Reply& reply) { reply.GetTxn(response); });
+    _Decode(response);
+    return response;
+}
+
+template <typename Reply, typename Tracer>
+v3::TxnResponse V3Client<Reply, Tracer>::
+CompareAndSwapIf(
+    const std::string& key,
+    const std::string& value,
+    const std::string& prev_value) {
+    v3::Txn txn;
+    txn.If(v3::Compare::Value(key, v3::Compare::RESULT_EQUAL, prev_value))
+       .Then(v3::Op::Put(key, value))
+       .Else(v3::Op::Get(key));
+    return Txn(txn);
+}
+
+template <typename Reply, typename Tracer>
+v3::TxnResponse V3Client<Reply, Tracer>::
+CompareAndSwapIf(
+    const std::string& key,
+    const std::string& value,
+    v3::Revision prev_revision) {
+    v3::Txn txn;
+    txn.If(v3::Compare::ModRevision(key, v3::Compare::RESULT_EQUAL,
+                                    prev_revision))
+       .Then(v3::Op::Put(key, value))
+       .Else(v3::Op::Get(key));
+    return Txn(txn);
+}
+
+template <typename Reply, typename Tracer>
+std::vector<v3::TxnResponse> V3Client<Reply, Tracer>::
+Apply(const v3::Ops& ops, size_t max_ops) {
+    if (max_ops == 0)
+        throw ClientException("v3: max_ops must be positive");
+
+    std::vector<v3::TxnResponse> responses;
+    v3::Txn txn;
+    std::set<std::string> written;
+    for (const auto& op :ops) {
+        bool write = op.type != v3::Op::OP_RANGE;
+        if (txn.success.size() == max_ops ||
+            (write && written.count(op.key))) {
+            responses.push_back(Txn(txn));
+            txn.success.clear();
+            written.clear();
+        }
+        txn.success.push_back(op);
+        if (write)
+            written.insert(op.key);
+    }
+    if (! txn.success.empty())
+        responses.push_back(Txn(txn));
+    return responses;
+}
+
+template <typename Reply, typename Tracer>
+v3::LeaseGrantResponse V3Client<Reply, Tracer>::
+LeaseGrant(int64_t ttl, v3::LeaseId id) {
+    internal::V3Body body;
+    body.Int("TTL", ttl);
+    if (id)
+        body.Int("ID", id);
+
+    v3::LeaseGrantResponse response;
+    _Post(Operation::OPERATION_LEASE, std::to_string(id), kLeaseGrant,
+          body.Close(), false, [&response](const Reply& reply) {
+              reply.GetLeaseGrant(response);
+          });
+    return response;
+}
+
+template <typename Reply, typename Tracer>
+v3::ResponseHeader V3Client<Reply, Tracer>::
+LeaseRevoke(v3::LeaseId id) {
+    internal::V3Body body;
+    body.Int("ID", id);
+
+    v3::ResponseHeader header;
+    _Post(Operation::OPERATION_LEASE, std::to_string(id), kLeaseRevoke,
+          body.Close(), false, [&header](const Reply& reply) {
+              reply.GetResponseHeader(header);
+          });
+    return header;
+}
+
+template <typename Reply, typename Tracer>
+v3::LeaseKeepAliveResponse V3Client<Reply, Tracer>::
+LeaseKeepAlive(v3::LeaseId id) {
+    std::vector<v3::LeaseKeepAliveResponse> responses =
+        LeaseKeepAlive(std::vector<v3::LeaseId>(1, id));
+    return responses[0];
+}
+
+template <typename Reply, typename Tracer>
+std::vector<v3::LeaseKeepAliveResponse> V3Client<Reply, Tracer>::
+LeaseKeepAlive(const std::vector<v3::LeaseId>& ids) {
+    std::vector<v3::LeaseKeepAliveResponse> responses;
+    if (ids.empty())
+        return responses;
+
+    // The gateway reads the body as a stream of requests and answers each
+    // on a line of its own, in order
+    std::string body;
+    for (auto id :ids) {
+        internal::V3Body request;
+        request.Int("ID", id);
+        body += request.Close();
+        body += '\n';
+    }
+
+    responses.reserve(ids.size());
+    _Post(Operation::OPERATION_LEASE, std::to_string(ids[0]),
+          kLeaseKeepAlive, body, true, [&responses](const Reply& reply) {
+              responses.push_back(v3::LeaseKeepAliveResponse());
+              reply.GetLeaseKeepAlive(responses.back());
+          });
+    if (responses.size() != ids.size())
+        throw ClientException("v3: lease keepalive stream ended early");
+    return responses;
+}
+
+template <typename Reply, typename Tracer>
+v3::LeaseTimeToLiveResponse V3Client<Reply, Tracer>::
+LeaseTimeToLive(v3::LeaseId id, bool keys) {
+    internal::V3Body body;
+    body.Int("ID", id);
+    if (keys)
+        body.Bool("keys", true);
+
+    v3::LeaseTimeToLiveResponse response;
+    _Post(Operation::OPERATION_LEASE, std::to_string(id), kLeaseTimeToLive,
+          body.Close(), false, [&response](const Reply& reply) {
+              reply.GetLeaseTimeToLive(response);
+          });
+    for (auto& key :response.keys) {
+        if (! internal::Base64DecodeInPlace(key))
+            throw ClientException("v3: invalid base64 in reply");
+    }
+    return response;
+}
+
+template <typename Reply, typename Tracer>
+const std::string& V3Client<Reply, Tracer>::
+GetEndpoint() {
+    if (endpoints_ && endpoints_->Version() != endpoints_version_)
+        _Follow();
+    return url_;
+}
+
+template <typename Reply, typename Tracer> void V3Client<Reply, Tracer>::
+SetReadConsistency(const ReadConsistency& consistency) {
+    consistency_ = consistency;
+}
+
+template <typename Reply, typename Tracer>
+const ReadConsistency& V3Client<Reply, Tracer>::
+GetReadConsistency() const {
+    return consistency_;
+}
+
+template <typename Reply, typename Tracer> void V3Client<Reply, Tracer>::
+SetTimeouts(
+    const std::chrono::milliseconds& connect_timeout,
+    const std::chrono::milliseconds& timeout) {
+    handle_->SetTimeouts((long) connect_timeout.count(),
+                         (long) timeout.count());
+}
+
+template <typename Reply, typename Tracer>
+const ClientMetrics& V3Client<Reply, Tracer>::
+GetMetrics() const {
+    return *metrics_;
+}
+
+template <typename Reply, typename Tracer> Tracer& V3Client<Reply, Tracer>::
+GetTracer() {
+    return tracer_;
+}
+
+//------------------------------ OPERATIONS ----------------------------------
+
+template <typename Reply, typename Tracer> void V3Client<Reply, Tracer>::
+_Init(const std::string& server, const Port& port) {
+    std::ostringstream ostr;
+    ostr << "http://" << server << ":" << port;
+    _Use(ostr.str());
+}
+
+template <typename Reply, typename Tracer> void V3Client<Reply, Tracer>::
+_Use(const std::string& url) {
+    url_ = url;
+    endpoint_metrics_ = metrics_->Endpoint(url_);
+}
+
+template <typename Reply, typename Tracer> void V3Client<Reply, Tracer>::
+_Follow() {
+    std::shared_ptr<const EndpointList> list = endpoints_->GetList();
+    endpoints_version_ = list->version;
+    if (list->Current() != url_)
+        _Use(list->Current());
+}
+
+template <typename Reply, typename Tracer>
+v3::RangeResponse V3Client<Reply, Tracer>::
+_Range(const std::string& key, const v3::RangeOptions& options) {
+    internal::V3Body body;
+    _RangeBody(key, options, body);
+
+    Operation op = options.range_end.empty() ?
+        Operation::OPERATION_GET : Operation::OPERATION_GET_ALL;
+    v3::RangeResponse response;
+    _Post(op, key, kRange, body.Close(), false,
+          [&response](const Reply& reply) { reply.GetRange(response); });
+    for (auto& kv :response.kvs)
+        _Decode(kv);
+    return response;
+}
+
+template <typename Reply, typename Tracer>
+template <typename Read>
+void V3Client<Reply, Tracer>::
+_Post(
+    Operation op,
+    const std::string& key,
+    const char* path,
+    const std::string& body,
+    bool stream,
+    const Read& read) {
+    if (endpoints_ && endpoints_->Version() != endpoints_version_)
+        _Follow();
+    internal::InFlightGuard in_flight(*metrics_);
+
+    typename Tracer::Span span = typename Tracer::Span();
+    std::chrono::steady_clock::time_point start;
+    if (Tracer::kEnabled) {
+        start = std::chrono::steady_clock::now();
+        span = tracer_.Begin(TraceEvent(op, key, url_));
+    }
+
+    std::string ret;
+    try {
+        ret = handle_->PostJson(url_ + path, body);
+    } catch (const std::exception& e) {
+        metrics_->RecordTransportError(internal::CurlErrorCode(e));
+        if (Tracer::kEnabled)
+            _TraceEnd(span, op, key, start, false);
+        // A timeout, such as a lease renewal bounded by its interval, or a
+        // cut reply says nothing about the member, only a failed
+        // connection does
+        if (endpoints_ && internal::IsConnectError(e))
+            endpoints_->MarkFailed(url_);
+        throw ClientException(e.what());
+    }
+    const TransferInfo& info = handle_->GetTransferInfo();
+    metrics_->RecordTransfer(info);
+
+    RequestTimings timings = handle_->GetTimings();
+    std::chrono::steady_clock::time_point parse_start =
+        std::chrono::steady_clock::now();
+    try {
+        // The gateway answers errors with a JSON status the reply throws
+        // on, anything else above 400 comes from a server without it.
+        // Streams are newline delimited and end in an error object if the
+        // server fails midway.
+        if (stream && info.response_code < 400) {
+            for (size_t pos = 0; pos < ret.size(); ) {
+                size_t end = ret.find('\n', pos);
+                if (end == std::string::npos)
+                    end = ret.size();
+                if (end > pos) {
+                    Reply reply(ret.substr(pos, end - pos));
+                    read(reply);
+                }
+                pos = end + 1;
+            }
+        } else {
+            Reply reply(ret);
+            if (info.response_code >= 400)
+                throw ClientException(std::string(path) + ": HTTP status " +
+                                      std::to_string(info.response_code));
+            read(reply);
+        }
+        timings.parse = internal::ElapsedMicros(parse_start);
+        timings.total += timings.parse;
+        metrics_->Record(op, endpoint_metrics_, timings);
+        if (Tracer::kEnabled)
+            _TraceEnd(span, op, key, start, true);
+    } catch (const ReplyException& e) {
+        metrics_->RecordEtcdError(e.error_code);
+        timings.parse = internal::ElapsedMicros(parse_start);
+        timings.total += timings.parse;
+        metrics_->Record(op, endpoint_metrics_, timings);
+        if (Tracer::kEnabled)
+            _TraceEnd(span, op, key, start, true);
+        throw;
+    } catch (...) {
+        timings.parse = internal::ElapsedMicros(parse_start);
+        timings.total += timings.parse;
+        metrics_->Record(op, endpoint_metrics_, timings);
+        if (Tracer::kEnabled)
+            _TraceEnd(span, op, key, start, true);
+        throw;
+    }
+}
+
+template <typename Reply, typename Tracer> void V3Client<Reply, Tracer>::
+_Decode(v3::KeyValue& kv) {
+    // The reply filled the strings with base64, decode over it
+    if (! internal::Base64DecodeInPlace(kv.key) ||
+        ! internal::Base64DecodeInPlace(kv.value))
+        throw ClientException("v3: invalid base64 in reply");
+}
+
+template <typename Reply, typename Tracer> void V3Client<Reply, Tracer>::
+_Decode(v3::TxnResponse& response) {
+    for (auto& r :response.responses) {
+        for (auto& kv :r.range.kvs)
+            _Decode(kv);
+        if (r.put.has_prev_kv)
+            _Decode(r.put.prev_kv);
+        for (auto& kv :r.delete_range.prev_kvs)
+            _Decode(kv);
+    }
+}
+
+template <typename Reply, typename Tracer> void V3Client<Reply, Tracer>::
+_RangeBody(
+    const std::string& key,
+    const v3::RangeOptions& options,
+    internal::V3Body& body) {
+    body.Bytes("key", key);
+    if (! options.range_end.empty())
+        body.Bytes("range_end", options.range_end);
+    if (options.limit)
+        body.Int("limit", options.limit);
+    if (options.revision)
+        body.Int("revision", options.revision);
+    if (options.keys_only)
+        body.Bool("keys_only", true);
+    if (options.count_only)
+        body.Bool("count_only", true);
+    if (options.serializable)
+        body.Bool("serializable", true);
+}
+
+template <typename Reply, typename Tracer> void V3Client<Reply, Tracer>::
+_PutBody(
+    const std::string& key,
+    const std::string& value,
+    const v3::PutOptions& options,
+    internal::V3Body& body) {
+    body.Bytes("key", key);
+    body.Bytes("value", value);
+    if (options.lease)
+        body.Int("lease", options.lease);
+    if (options.prev_kv)
+        body.Bool("prev_kv", true);
+}
+
+template <typename Reply, typename Tracer> void V3Client<Reply, Tracer>::
+_DeleteBody(
+    const std::string& key,
+    const std::string& range_end,
+    bool prev_kv,
+    internal::V3Body& body) {
+    body.Bytes("key", key);
+    if (! range_end.empty())
+        body.Bytes("range_end", range_end);
+    if (prev_kv)
+        body.Bool("prev_kv", true);
+}
+
+template <typename Reply, typename Tracer>
+std::string V3Client<Reply, Tracer>::
+_OpsJson(const v3::Ops& ops) {
+    std::string json = "[";
+    for (const auto& op :ops) {
+        if (json.size() > 1)
+            json += ',';
+        internal::V3Body body, request;
+        switch (op.type) {
+          case v3::Op::OP_RANGE:
+            _RangeBody(op.key, op.range, body);
+            request.Raw("request_range", body.Close());
+            break;
+          case v3::Op::OP_PUT:
+            _PutBody(op.key, op.value, op.put, body);
+            request.Raw("request_put", body.Close());
+            break;
+          case v3::Op::OP_DELETE_RANGE:
+            _DeleteBody(op.key, op.range.range_end, op.prev_kv, body);
+            request.Raw("request_delete_range", body.Close());
+            break;
+        }
+        json += request.Close();
+    }
+    return json + "]";
+}
+
+template <typename Reply, typename Tracer>
+std::string V3Client<Reply, Tracer>::
+_CompareJson(const std::vector<v3::Compare>& compare) {
+    static const char* const kTargets[] = {
+        "VERSION", "CREATE", "MOD", "VALUE", "LEASE"
+    };
+    static const char* const kFields[] = {
+        "version", "create_revision", "mod_revision", "value", "lease"
+    };
+    static const char* const kResults[] = {
+        "EQUAL", "GREATER", "LESS", "NOT_EQUAL"
+    };
+
+    std::string json = "[";
+    for (const auto& c :compare) {
+        if (json.size() > 1)
+            json += ',';
+        internal::V3Body body;
+        body.Raw("result", std::string("\"") + kResults[c.result] + "\"");
+        body.Raw("target", std::string("\"") + kTargets[c.target] + "\"");
+        body.Bytes("key", c.key);
+        if (c.target == v3::Compare::TARGET_VALUE)
+            body.Bytes(kFields[c.target], c.value);
+        else
+            body.Int(kFields[c.target], c.number);
+        json += body.Close();
+    }
+    return json + "]";
+}
+
+template <typename Reply, typename Tracer> void V3Client<Reply, Tracer>::
+_TraceEnd(
+    typename Tracer::Span& span,
+    Operation op,
+    const std::string& key,
+    const std::chrono::steady_clock::time_point& start,
+    bool performed) {
+    TraceEvent event(op, key, url_);
+    if (performed) {
+        const TransferInfo& info = handle_->GetTransferInfo();
+        event.status = info.response_code;
+        event.bytes_sent = info.bytes_sent;
+        event.bytes_received = info.bytes_received;
+    }
+    event.duration = internal::ElapsedMicros(start);
+    tracer_.End(span, event);
+}
+
+} // namespace etcd
+
+#endif // __ETCD_V3_CLIENT_HPP_INCLUDED__
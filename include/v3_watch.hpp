@@ -0,0 +1,622 @@
+#ifndef __ETCD_V3_WATCH_HPP_INCLUDED__
+#define __ETCD_V3_WATCH_HPP_INCLUDED__
+
+#include "v3_client.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace etcd {
+
+/**
+ * @brief Watches v3 keys and ranges over a single stream of the gateway.
+ *
+ * Every watch shares one POST to /v3/watch: its body holds a create request
+ * per watch, and the server keeps the response open, sending a message per
+ * line as changes are made. Unlike the v2 long-poll, which costs a request
+ * per event and can miss changes between two polls, the stream delivers
+ * every change in revision order. Adding or canceling a watch restarts the
+ * stream, as does a transport error, on the next endpoint of the cluster:
+ * each watch resumes from the revision after the last one delivered, so no
+ * change is lost or delivered twice. A watch whose next revision has been
+ * compacted away is resynced: its callback is given the range as of the
+ * compacted revision and the watch resumes from there.
+ *
+ *   etcd::V3Watch<etcd::RapidReply> watch("10.0.0.1", 2379);
+ *   watch.AddPrefix("/services/", etcd::v3::WatchOptions(),
+ *                   [](const etcd::v3::WatchUpdate& update) { ... });
+ *   watch.Start();
+ *
+ * @tparam Reply json reply wrapper implementing GetWatch and the readers
+ * used by etcd::V3Client, see etcd::RapidReply
+ * @tparam Tracer begin/end hooks around every request, see etcd::NullTracer
+ */
+template <typename Reply, typename Tracer = NullTracer>
+class V3Watch {
+  public:
+    // CONSTANTS
+    /**
+     * @brief Delay before reopening a stream which failed or was closed by
+     * the server
+     */
+    static const int64_t kRetryMs = 500;
+
+    // TYPES
+    /**
+     * @brief Called from the watch's thread, must not throw
+     */
+    typedef std::function<void (const v3::WatchUpdate& update)> Callback;
+
+    // LIFECYCLE
+    V3Watch(const std::string& server, const Port& port);
+
+    explicit V3Watch(const std::shared_ptr<ClusterEndpoints>& endpoints);
+
+    ~V3Watch();
+
+    // OPERATIONS
+    /**
+     * @brief Watch a key, or the keys in [key, options.range_end)
+     *
+     * @param options start_revision 0 watches the changes made once the
+     * server has created the watch, which takes up to a second while the
+     * stream is idle: give a start_revision to miss nothing
+     * @param callback given the changes, progress notifications, resyncs
+     * and the cancellation of the watch by the server
+     *
+     * @return id of the watch, in every update given to callback
+     */
+    v3::WatchId Add(const std::string& key,
+                    const v3::WatchOptions& options,
+                    const Callback& callback);
+
+    /**
+     * @brief Watch every key starting with prefix, range_end is set by the
+     * call
+     */
+    v3::WatchId AddPrefix(const std::string& prefix,
+                          const v3::WatchOptions& options,
+                          const Callback& callback);
+
+    /**
+     * @brief Stop a watch, its callback is not called once Cancel returns
+     * unless it is called from the watch's thread
+     */
+    void Cancel(v3::WatchId id);
+
+    /**
+     * @brief Open the stream from a thread of its own
+     */
+    void Start();
+
+    /**
+     * @brief Close the stream. The watches are kept and resume from their
+     * revision on the next Start. Called by the destructor.
+     */
+    void Stop();
+
+    /**
+     * @brief Revision up to which every change of a watch has been
+     * delivered, 0 for an unknown watch or one not created yet
+     */
+    v3::Revision GetRevision(v3::WatchId id) const;
+
+    size_t Size() const;
+
+    /**
+     * @brief Latency histograms of the streams (OPERATION_WATCH).
+     * GetMetrics().Watch() holds the lag in revisions, the delivery latency
+     * and the number of resyncs.
+     */
+    const ClientMetrics& GetMetrics() const;
+
+    /**
+     * @brief Access the tracer policy instance, e.g. to configure it
+     */
+    Tracer& GetTracer();
+
+  private:
+    // CONSTANTS
+    const char *kWatch = "/v3/watch";
+
+    // TYPES
+    typedef std::chrono::steady_clock Clock;
+
+    struct Watcher {
+        std::string key;
+        v3::WatchOptions options;
+        Callback callback;
+        v3::Revision next;      // first revision not delivered, 0 if unknown
+        v3::Revision resync;    // compacted revision to resync at, or 0
+    };
+
+    // DATA MEMBERS
+    std::unique_ptr<internal::Curl> handle_;
+    std::string endpoint_;
+    std::unique_ptr<ClientMetrics> metrics_;
+    PhaseHistograms* endpoint_metrics_;
+    WatchMetrics* watch_metrics_;
+    std::shared_ptr<ClusterEndpoints> endpoints_;   // NULL for one server
+    uint64_t endpoints_version_;
+    Tracer tracer_;
+    V3Client<Reply, Tracer> client_;    // resync reads
+    std::string buffer_;                // partial line of the stream
+    Clock::time_point received_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::map<v3::WatchId, Watcher> watchers_;
+    v3::WatchId next_id_;
+    uint64_t generation_;       // bumped when the stream must be reopened
+    bool stopping_;
+    std::thread thread_;
+
+    // LIFECYCLE
+    V3Watch(const V3Watch& rhs);
+    void operator=(const V3Watch& rhs);
+
+    // OPERATIONS
+    void _Init(const std::string& server, const Port& port);
+
+    void _Use(const std::string& url);
+
+    void _Follow();
+
+    void _Run();
+
+    void _Stream(const std::string& body, uint64_t generation);
+
+    bool _OnData(const char* data, size_t size, uint64_t generation);
+
+    void _Dispatch(const Reply& reply);
+
+    void _Resync(v3::WatchId id);
+
+    std::string _Body() const;
+
+    static void _Decode(v3::KeyValue& kv);
+
+    void _TraceEnd(typename Tracer::Span& span,
+                   const std::chrono::steady_clock::time_point& start,
+                   bool performed);
+};
+
+template <typename Reply, typename Tracer>
+const int64_t V3Watch<Reply, Tracer>::kRetryMs;
+
+//------------------------------- LIFECYCLE ----------------------------------
+
+template <typename Reply, typename Tracer> V3Watch<Reply, Tracer>::
+V3Watch(const std::string& server, const Port& port)
+try:
+    handle_(new internal::Curl()),
+    metrics_(new ClientMetrics("v3-watch")),
+    endpoint_metrics_(NULL),
+    watch_metrics_(NULL),
+    endpoints_version_(0),
+    tracer_(),
+    client_(server, port),
+    next_id_(1),
+    generation_(0),
+    stopping_(false) {
+    _Init(server, port);
+} catch (const std::exception& e) {
+    throw ClientException(e.what());
+}
+
+template <typename Reply, typename Tracer> V3Watch<Reply, Tracer>::
+V3Watch(const std::shared_ptr<ClusterEndpoints>& endpoints)
+try:
+    handle_(new internal::Curl()),
+    metrics_(new ClientMetrics("v3-watch")),
+    endpoint_metrics_(NULL),
+    watch_metrics_(NULL),
+    endpoints_(endpoints),
+    endpoints_version_(0),
+    tracer_(),
+    client_(endpoints),
+    next_id_(1),
+    generation_(0),
+    stopping_(false) {
+    _Init(std::string(), 0);
+} catch (const std::exception& e) {
+    throw ClientException(e.what());
+}
+
+template <typename Reply, typename Tracer> V3Watch<Reply, Tracer>::
+~V3Watch() {
+    Stop();
+}
+
+//------------------------------- OPERATIONS ---------------------------------
+
+template <typename Reply, typename Tracer>
+v3::WatchId V3Watch<Reply, Tracer>::
+Add(const std::string& key,
+    const v3::WatchOptions& options,
+    const Callback& callback) {
+    v3::WatchId id;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        id = next_id_++;
+        Watcher& w = watchers_[id];
+        w.key = key;
+        w.options = options;
+        w.callback = callback;
+        w.next = options.start_revision;
+        w.resync = 0;
+        ++generation_;
+    }
+    wake_.notify_all();
+    return id;
+}
+
+template <typename Reply, typename Tracer>
+v3::WatchId V3Watch<Reply, Tracer>::
+AddPrefix(
+    const std::string& prefix,
+    const v3::WatchOptions& options,
+    const Callback& callback) {
+    v3::WatchOptions prefix_options = options;
+    prefix_options.range_end = v3::PrefixEnd(prefix);
+    return Add(prefix, prefix_options, callback);
+}
+
+template <typename Reply, typename Tracer> void V3Watch<Reply, Tracer>::
+Cancel(v3::WatchId id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (watchers_.erase(id))
+        ++generation_;
+}
+
+template <typename Reply, typename Tracer> void V3Watch<Reply, Tracer>::
+Start() {
+    if (thread_.joinable())
+        return;
+    stopping_ = false;
+    thread_ = std::thread(&V3Watch::_Run, this);
+}
+
+template <typename Reply, typename Tracer> void V3Watch<Reply, Tracer>::
+Stop() {
+    if (! thread_.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+}
+
+template <typename Reply, typename Tracer>
+v3::Revision V3Watch<Reply, Tracer>::
+GetRevision(v3::WatchId id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = watchers_.find(id);
+    return it == watchers_.end() || ! it->second.next ?
+        0 : it->second.next - 1;
+}
+
+template <typename Reply, typename Tracer> size_t V3Watch<Reply, Tracer>::
+Size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return watchers_.size();
+}
+
+template <typename Reply, typename Tracer>
+const ClientMetrics& V3Watch<Reply, Tracer>::
+GetMetrics() const {
+    return *metrics_;
+}
+
+template <typename Reply, typename Tracer> Tracer& V3Watch<Reply, Tracer>::
+GetTracer() {
+    return tracer_;
+}
+
+//------------------------------ OPERATIONS ----------------------------------
+
+template <typename Reply, typename Tracer> void V3Watch<Reply, Tracer>::
+_Init(const std::string& server, const Port& port) {
+    watch_metrics_ = metrics_->Watch();
+    if (endpoints_) {
+        _Follow();
+    } else {
+        std::ostringstream ostr;
+        ostr << "http://" << server << ":" << port;
+        _Use(ostr.str());
+    }
+}
+
+template <typename Reply, typename Tracer> void V3Watch<Reply, Tracer>::
+_Use(const std::string& url) {
+    endpoint_ = url;
+    endpoint_metrics_ = metrics_->Endpoint(endpoint_);
+}
+
+template <typename Reply, typename Tracer> void V3Watch<Reply, Tracer>::
+_Follow() {
+    if (! endpoints_ || endpoints_->Version() == endpoints_version_)
+        return;
+    std::shared_ptr<const EndpointList> list = endpoints_->GetList();
+    endpoints_version_ = list->version;
+    if (list->Current() != endpoint_)
+        _Use(list->Current());
+}
+
+template <typename Reply, typename Tracer> void V3Watch<Reply, Tracer>::
+_Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (! stopping_) {
+        if (watchers_.empty()) {
+            wake_.wait(lock);
+            continue;
+        }
+
+        // Watches which lost their history are read again before the
+        // stream resumes them
+        std::vector<v3::WatchId> resyncs;
+        for (auto const& w :watchers_) {
+            if (w.second.resync)
+                resyncs.push_back(w.first);
+        }
+        bool failed = false;
+        if (! resyncs.empty()) {
+            lock.unlock();
+            try {
+                for (auto id :resyncs)
+                    _Resync(id);
+            } catch (const std::exception&) {
+                failed = true;
+            }
+            lock.lock();
+        }
+
+        if (! failed) {
+            std::string body = _Body();
+            uint64_t generation = generation_;
+            lock.unlock();
+            try {
+                _Stream(body, generation);
+            } catch (const std::exception&) {
+                failed = true;
+            }
+            lock.lock();
+            // Ended on purpose, to reopen it with the watches as they are
+            if (! failed && generation != generation_)
+                continue;
+        }
+
+        // Failed, or closed by the server
+        wake_.wait_for(lock, std::chrono::milliseconds(kRetryMs),
+                       [this]() { return stopping_; });
+    }
+}
+
+template <typename Reply, typename Tracer> void V3Watch<Reply, Tracer>::
+_Stream(const std::string& body, uint64_t generation) {
+    _Follow();
+    internal::InFlightGuard in_flight(*metrics_);
+
+    typename Tracer::Span span = typename Tracer::Span();
+    std::chrono::steady_clock::time_point start;
+    if (Tracer::kEnabled) {
+        start = std::chrono::steady_clock::now();
+        span = tracer_.Begin(TraceEvent(Operation::OPERATION_WATCH,
+                                        std::string(), endpoint_));
+    }
+
+    buffer_.clear();
+    bool performed = false;
+    try {
+        handle_->PostStream(endpoint_ + kWatch, body,
+            [this, generation, &performed](const char* data, size_t size) {
+                performed = true;
+                return _OnData(data, size, generation);
+            });
+    } catch (const ReplyException& e) {
+        // An error message of the gateway, in the stream
+        metrics_->RecordEtcdError(e.error_code);
+        metrics_->RecordTransfer(handle_->GetTransferInfo());
+        metrics_->Record(Operation::OPERATION_WATCH, endpoint_metrics_,
+                         handle_->GetTimings());
+        if (Tracer::kEnabled)
+            _TraceEnd(span, start, true);
+        throw;
+    } catch (const std::exception& e) {
+        metrics_->RecordTransportError(internal::CurlErrorCode(e));
+        if (Tracer::kEnabled)
+            _TraceEnd(span, start, performed);
+        // A stream ended by a proxy, a timeout or an exception of a
+        // callback says nothing about the member, only a failed connection
+        // does
+        if (endpoints_ && internal::IsConnectError(e))
+            endpoints_->MarkFailed(endpoint_);
+        throw ClientException(e.what());
+    }
+    metrics_->RecordTransfer(handle_->GetTransferInfo());
+    metrics_->Record(Operation::OPERATION_WATCH, endpoint_metrics_,
+                     handle_->GetTimings());
+    if (Tracer::kEnabled)
+        _TraceEnd(span, start, true);
+}
+
+template <typename Reply, typename Tracer> bool V3Watch<Reply, Tracer>::
+_OnData(const char* data, size_t size, uint64_t generation) {
+    // Messages are newline delimited and may span several reads
+    if (data) {
+        received_ = Clock::now();
+        buffer_.append(data, size);
+        size_t pos = 0;
+        for (size_t end; (end = buffer_.find('\n', pos)) != std::string::npos;
+             pos = end + 1) {
+            if (end > pos)
+                _Dispatch(Reply(buffer_.substr(pos, end - pos)));
+        }
+        buffer_.erase(0, pos);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ! stopping_ && generation == generation_;
+}
+
+template <typename Reply, typename Tracer> void V3Watch<Reply, Tracer>::
+_Dispatch(const Reply& reply) {
+    v3::WatchResponse response;
+    reply.GetWatch(response);
+    for (auto& e :response.events) {
+        _Decode(e.kv);
+        if (e.has_prev_kv)
+            _Decode(e.prev_kv);
+    }
+    watch_metrics_->RecordEtcdIndex(response.header.revision);
+
+    v3::WatchUpdate update;
+    update.watch_id = response.watch_id;
+    Callback callback;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = watchers_.find(response.watch_id);
+        // Canceled while the stream was open
+        if (it == watchers_.end())
+            return;
+        Watcher& w = it->second;
+
+        if (response.canceled && response.compact_revision) {
+            w.resync = response.compact_revision;
+            ++generation_;
+            return;
+        }
+        if (response.canceled) {
+            update.kind = v3::WatchUpdate::UPDATE_CANCELED;
+            update.revision = w.next ? w.next - 1 : 0;
+            update.reason = response.cancel_reason;
+            callback = w.callback;
+            watchers_.erase(it);
+        } else if (response.created) {
+            // The watch starts after the revision it was created at
+            if (! w.next)
+                w.next = response.header.revision + 1;
+            return;
+        } else if (response.events.empty()) {
+            update.kind = v3::WatchUpdate::UPDATE_PROGRESS;
+            w.next = std::max(w.next, response.header.revision + 1);
+            update.revision = w.next - 1;
+            callback = w.callback;
+        } else {
+            update.events.swap(response.events);
+            update.revision = update.events.back().kv.mod_revision;
+            w.next = update.revision + 1;
+            callback = w.callback;
+        }
+    }
+
+    if (callback)
+        callback(update);
+    if (update.kind == v3::WatchUpdate::UPDATE_EVENTS) {
+        watch_metrics_->RecordDelivery(update.revision,
+                                       internal::ElapsedMicros(received_));
+    }
+}
+
+template <typename Reply, typename Tracer> void V3Watch<Reply, Tracer>::
+_Resync(v3::WatchId id) {
+    std::string key;
+    v3::RangeOptions options;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = watchers_.find(id);
+        if (it == watchers_.end())
+            return;
+        key = it->second.key;
+        options.range_end = it->second.options.range_end;
+        options.revision = it->second.resync;
+    }
+
+    v3::RangeResponse range;
+    try {
+        range = client_.Range(key, options);
+    } catch (const ReplyException& e) {
+        // Compacted again meanwhile, the latest revision will do
+        if (e.error_code != 11)
+            throw;
+        options.revision = 0;
+        range = client_.Range(key, options);
+        options.revision = range.header.revision;
+    }
+
+    v3::WatchUpdate update;
+    update.kind = v3::WatchUpdate::UPDATE_RESYNC;
+    update.watch_id = id;
+    update.revision = options.revision;
+    update.kvs.swap(range.kvs);
+    Callback callback;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = watchers_.find(id);
+        if (it == watchers_.end())
+            return;
+        it->second.next = options.revision + 1;
+        it->second.resync = 0;
+        callback = it->second.callback;
+    }
+    watch_metrics_->RecordResync(options.revision);
+    if (callback)
+        callback(update);
+}
+
+template <typename Reply, typename Tracer>
+std::string V3Watch<Reply, Tracer>::
+_Body() const {
+    // A create request per line, ids chosen by the client so they survive
+    // a restart of the stream
+    std::string body;
+    for (auto const& w :watchers_) {
+        internal::V3Body create;
+        create.Bytes("key", w.second.key);
+        if (! w.second.options.range_end.empty())
+            create.Bytes("range_end", w.second.options.range_end);
+        if (w.second.next)
+            create.Int("start_revision", w.second.next);
+        create.Int("watch_id", w.first);
+        if (w.second.options.prev_kv)
+            create.Bool("prev_kv", true);
+        if (w.second.options.progress_notify)
+            create.Bool("progress_notify", true);
+
+        internal::V3Body request;
+        request.Raw("create_request", create.Close());
+        body += request.Close();
+        body += '\n';
+    }
+    return body;
+}
+
+template <typename Reply, typename Tracer> void V3Watch<Reply, Tracer>::
+_Decode(v3::KeyValue& kv) {
+    if (! internal::Base64DecodeInPlace(kv.key) ||
+        ! internal::Base64DecodeInPlace(kv.value))
+        throw ClientException("v3: invalid base64 in watch event");
+}
+
+template <typename Reply, typename Tracer> void V3Watch<Reply, Tracer>::
+_TraceEnd(
+    typename Tracer::Span& span,
+    const std::chrono::steady_clock::time_point& start,
+    bool performed) {
+    TraceEvent event(Operation::OPERATION_WATCH, std::string(), endpoint_);
+    if (performed) {
+        const TransferInfo& info = handle_->GetTransferInfo();
+        event.status = info.response_code;
+        event.bytes_sent = info.bytes_sent;
+        event.bytes_received = info.bytes_received;
+    }
+    event.duration = internal::ElapsedMicros(start);
+    tracer_.End(span, event);
+}
+
+} // namespace etcd
+
+#endif // __ETCD_V3_WATCH_HPP_INCLUDED__
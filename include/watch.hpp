@@ -2,6 +2,8 @@
 #define __ETCD_WATCH_HPP_INCLUDED__
 
 #include "client.hpp"
+#include "internal/probes.hpp"
+#include <functional>
 
 #ifndef MAX_FAILURES
 #define MAX_FAILURES 5
@@ -13,12 +15,15 @@ namespace etcd {
  * @brief A watch abstraction for monitoring a key or directory
  *
  * @tparam Reply json reply wrapper
+ * @tparam Tracer begin/end hooks around every request, see etcd::NullTracer
  */
-template <typename Reply>
+template <typename Reply, typename Tracer = NullTracer>
 class Watch {
   public:
     // TYPES
     typedef std::function <void (const Reply& r)> Callback;
+    typedef std::function <void (const std::string& key,
+                                 const Index& lag)> LagAlert;
    
     // LIFECYCLE
     /**
@@ -29,6 +34,27 @@ class Watch {
      */
     Watch(const std::string& server, const Port& port);
 
+    /**
+     * @brief Create a etcd::Watch object reporting to a tracer
+     *
+     * @param server etcd client URL without the port
+     * @param port etcd client port
+     * @param tracer tracer policy instance receiving the request hooks
+     */
+    Watch(const std::string& server, const Port& port, const Tracer& tracer);
+
+    /**
+     * @brief Create a etcd::Watch object following the endpoints of a
+     * cluster. Run moves on to the next endpoint of the set when the
+     * current one cannot be reached, and resumes from the last index.
+     *
+     * @param endpoints endpoint set shared with the clients of the cluster
+     */
+    explicit Watch(const std::shared_ptr<ClusterEndpoints>& endpoints);
+
+    Watch(const std::shared_ptr<ClusterEndpoints>& endpoints,
+          const Tracer& tracer);
+
     /**
      * @brief Start the watch on a specific key or directory
      *
@@ -72,94 +98,208 @@ class Watch {
              Callback callback,
              const Index& prevIndex = 0);
 
+    /**
+     * @brief Call alert when the lag of the watch, the number of indexes
+     * between the cluster's X-Etcd-Index and the last delivered
+     * modifiedIndex, reaches threshold.
+     *
+     * The alert is edge triggered: it fires once when the lag crosses the
+     * threshold and is re-armed when the lag drops below it again. It is
+     * invoked on the watching thread, after the callback. etcd v2 keeps the
+     * last 1000 events, a threshold well below that catches slow consumers
+     * before they have to resync.
+     *
+     * @param threshold lag at which the alert fires, 0 disables the alert
+     * @param alert hook receiving the watched key and the lag
+     */
+    void SetLagAlert(const Index& threshold, LagAlert alert);
+
+    /**
+     * @brief Latency histograms of the watch long-polls (OPERATION_WATCH) and
+     * of the GETs issued to resync after an index out of date
+     * (OPERATION_GET). GetMetrics().Watch() holds the lag, the delivery
+     * latency and the number of resyncs.
+     *
+     * @return metrics registry of the watch
+     */
+    const ClientMetrics& GetMetrics() const;
+
+    /**
+     * @brief Access the tracer policy instance, e.g. to configure it
+     */
+    Tracer& GetTracer();
+
   private:
     // DATA MEMBERS
+    std::unique_ptr<internal::Curl> handle_;
     Index prev_index_;
     std::string url_prefix_;
-    std::unique_ptr<internal::Curl> handle_;
+    std::string endpoint_;
+    std::unique_ptr<ClientMetrics> metrics_;
+    PhaseHistograms* endpoint_metrics_;
+    WatchMetrics* watch_metrics_;
+    std::chrono::steady_clock::time_point received_;
+    Index lag_threshold_;
+    LagAlert lag_alert_;
+    bool lag_alerted_;
+    std::shared_ptr<ClusterEndpoints> endpoints_;   // NULL for one server
+    uint64_t endpoints_version_;
+    Tracer tracer_;
+
+    // OPERATIONS
+    void _Init(const std::string& server, const Port& port);
+
+    void _Use(const std::string& url);
+
+    bool _Follow();
+
+    Reply _Fetch(Operation op, const std::string& key, const std::string& url);
+
+    void _Delivered(const std::string& key, Index index);
+
+    bool _Resync(const std::string& key, Callback& callback);
+
+    void _CheckLag(const std::string& key, uint64_t lag);
+
+    void _TraceEnd(typename Tracer::Span& span,
+                   Operation op,
+                   const std::string& key,
+                   const std::chrono::steady_clock::time_point& start,
+                   bool performed);
 };
 
 //------------------------------- LIFECYCLE ----------------------------------
 
-template <typename Reply> Watch<Reply>::
+template <typename Reply, typename Tracer> Watch<Reply, Tracer>::
 Watch(const std::string& server, const Port& port)
 try:
     handle_(new internal::Curl()),
-    prev_index_(0) {
-    std::ostringstream ostr;
-    ostr << "http://" << server << ":" << port << "/v2/keys";
-    url_prefix_ = ostr.str();
+    prev_index_(0),
+    metrics_(new ClientMetrics("watch")),
+    endpoint_metrics_(NULL),
+    watch_metrics_(NULL),
+    lag_threshold_(0),
+    lag_alerted_(false),
+    endpoints_version_(0),
+    tracer_() {
+    _Init(server, port);
+} catch (const std::exception& e) {
+    throw ClientException(e.what());
+}
+
+template <typename Reply, typename Tracer> Watch<Reply, Tracer>::
+Watch(const std::string& server, const Port& port, const Tracer& tracer)
+try:
+    handle_(new internal::Curl()),
+    prev_index_(0),
+    metrics_(new ClientMetrics("watch")),
+    endpoint_metrics_(NULL),
+    watch_metrics_(NULL),
+    lag_threshold_(0),
+    lag_alerted_(false),
+    endpoints_version_(0),
+    tracer_(tracer) {
+    _Init(server, port);
+} catch (const std::exception& e) {
+    throw ClientException(e.what());
+}
+
+template <typename Reply, typename Tracer> Watch<Reply, Tracer>::
+Watch(const std::shared_ptr<ClusterEndpoints>& endpoints)
+try:
+    handle_(new internal::Curl()),
+    prev_index_(0),
+    metrics_(new ClientMetrics("watch")),
+    endpoint_metrics_(NULL),
+    watch_metrics_(NULL),
+    lag_threshold_(0),
+    lag_alerted_(false),
+    endpoints_(endpoints),
+    endpoints_version_(0),
+    tracer_() {
+    _Init(std::string(), 0);
+} catch (const std::exception& e) {
+    throw ClientException(e.what());
+}
+
+template <typename Reply, typename Tracer> Watch<Reply, Tracer>::
+Watch(const std::shared_ptr<ClusterEndpoints>& endpoints,
+      const Tracer& tracer)
+try:
+    handle_(new internal::Curl()),
+    prev_index_(0),
+    metrics_(new ClientMetrics("watch")),
+    endpoint_metrics_(NULL),
+    watch_metrics_(NULL),
+    lag_threshold_(0),
+    lag_alerted_(false),
+    endpoints_(endpoints),
+    endpoints_version_(0),
+    tracer_(tracer) {
+    _Init(std::string(), 0);
 } catch (const std::exception& e) {
     throw ClientException(e.what());
 }
 
 //------------------------------- OPERATIONS ---------------------------------
 
-template <typename Reply> void Watch<Reply>::
+template <typename Reply, typename Tracer> void Watch<Reply, Tracer>::
 Run(const std::string& key, Watch::Callback callback, const Index& prevIndex) {
-    const std::string watch_url_base = url_prefix_ + key + "?wait=true";
-    const std::string wait_url_base = watch_url_base + "&waitIndex=";
+    _Follow();
+    std::string watch_url_base = url_prefix_ + key + "?wait=true";
+    std::string wait_url_base = watch_url_base + "&waitIndex=";
 
     std::string watch_url = watch_url_base;
 
     if (prevIndex) {
         prev_index_ = prevIndex;
-        watch_url += std::to_string(prev_index_ + 1);
+        watch_url = wait_url_base + std::to_string(prev_index_ + 1);
     } else if (prev_index_) {
-        watch_url += std::to_string(prev_index_ + 1);
+        watch_url = wait_url_base + std::to_string(prev_index_ + 1);
     }
 
     int max_failures = MAX_FAILURES;
 
     while (max_failures) {
+        // Another client or the member discovery changed the endpoint
+        if (_Follow()) {
+            watch_url_base = url_prefix_ + key + "?wait=true";
+            wait_url_base = watch_url_base + "&waitIndex=";
+            watch_url = prev_index_ ?
+                wait_url_base + std::to_string(prev_index_ + 1) :
+                watch_url_base;
+        }
+
+        // Only failures of the watch count, what the callback throws
+        // reaches the caller
+        bool in_callback = false;
         try {
-            // Watch for a change
-            std::string ret = handle_->Get(watch_url);
+            // Watch for a change and construct a reply
+            Reply r = _Fetch(Operation::OPERATION_WATCH, key, watch_url);
+            Index index = r.GetModifiedIndex();
 
-            // Construct a reply and invoke the callback
-            Reply r(ret);
+            // Invoke the callback and update the prevIndex and the watch url
+            in_callback = true;
             callback(r);
-
-            // Update the prevIndex and the watch url
-            prev_index_ = r.get_modified_index();
+            in_callback = false;
+            _Delivered(key, index);
             watch_url = wait_url_base + std::to_string(prev_index_ + 1);
 
             // reset failures on a successful watch response
             max_failures = MAX_FAILURES;
 
         } catch (const ReplyException& e) {
-            if (e.error_code == 401) {
-                // We got an index out of date.
-                try {
-                // Enable curl headers
-                handle_->EnableHeader(true);
-
-                // Get the current state and call back
-                std::string ret = handle_->Get(url_prefix_ + key);
-                Reply r(ret);
-                callback(r);
-
-                // Get the new index from the curl header and start a watch
-                std::istringstream stream(handle_->GetHeader());
-                std::string etcd_index_label("X-Etcd-Index: ");
-                std::string::size_type len = etcd_index_label.length();
-                std::string line;
-                std::string::size_type pos;
-                while (std::getline(stream, line)) {
-                    if ((pos = line.find(etcd_index_label) != std::string::npos))
-                    {
-                        prev_index_ = std::stoi(line.substr(pos+len-1));
-                        break;
-                    }
-                }
-                handle_->EnableHeader(false);
+            if (in_callback)
+                throw;
+            // We got an index out of date.
+            if (e.error_code == 401 && _Resync(key, callback))
                 watch_url = wait_url_base + std::to_string(prev_index_ + 1);
-                } catch (...) {}
-            }
             max_failures--; // still consider as a failure
         } catch (const std::exception& e) {
-            // Possibly timed out and we didn't get a previous index
-            // ToDo check timout options for libcurl
+            if (in_callback)
+                throw;
+            // Possibly timed out and we didn't get a previous index, an
+            // endpoint which cannot be reached is marked by _Fetch
             max_failures--;
         }
     }
@@ -169,12 +309,13 @@ Run(const std::string& key, Watch::Callback callback, const Index& prevIndex) {
     return;
 }
 
-template <typename Reply> void Watch<Reply>::
+template <typename Reply, typename Tracer> void Watch<Reply, Tracer>::
 RunOnce(
     const std::string& key,
     Watch::Callback callback,
     const Index& prevIndex) {
 
+    _Follow();
     const std::string watch_url_base = url_prefix_ + key + "?wait=true";
     const std::string wait_url_base = watch_url_base + "&waitIndex=";
 
@@ -182,55 +323,210 @@ RunOnce(
 
     if (prevIndex) {
         prev_index_ = prevIndex;
-        watch_url += std::to_string(prev_index_ + 1);
+        watch_url = wait_url_base + std::to_string(prev_index_ + 1);
     } else if (prev_index_) {
-        watch_url += std::to_string(prev_index_ + 1);
+        watch_url = wait_url_base + std::to_string(prev_index_ + 1);
     }
 
+    bool in_callback = false;
     try {
-        // Watch for a change
-        std::string ret = handle_->Get(watch_url);
+        // Watch for a change and construct a reply
+        Reply r = _Fetch(Operation::OPERATION_WATCH, key, watch_url);
+        Index index = r.GetModifiedIndex();
 
-        // Construct a reply and invoke the callback
-        Reply r(ret);
+        // Invoke the callback and store the modifiedIndex
+        in_callback = true;
         callback(r);
-
-        // Update the prevIndex and the watch url
-        prev_index_ = r.get_modified_index();
-        watch_url = wait_url_base + std::to_string(prev_index_ + 1);
+        in_callback = false;
+        _Delivered(key, index);
 
     } catch (const ReplyException& e) {
-        if (e.error_code == 401) {
-            // We got an index out of date.
-            try {
-            // Enable curl headers
-            handle_->EnableHeader(true);
+        if (in_callback)
+            throw;
+        // We got an index out of date.
+        if (e.error_code == 401)
+            _Resync(key, callback);
+    } catch (const std::exception& e) {
+        if (in_callback)
+            throw;
+        throw ClientException("failed with" + std::string (e.what()));
+    }
+}
 
-            // Get the current state and call back
-            std::string ret = handle_->Get(url_prefix_ + key);
-            Reply r(ret);
-            callback(r);
+template <typename Reply, typename Tracer> void Watch<Reply, Tracer>::
+SetLagAlert(const Index& threshold, Watch::LagAlert alert) {
+    lag_threshold_ = threshold;
+    lag_alert_ = alert;
+    lag_alerted_ = false;
+}
 
-            // Get the new index from the curl header and start a watch
-            std::istringstream stream(handle_->GetHeader());
-            std::string etcd_index_label("X-Etcd-Index: ");
-            std::string::size_type len = etcd_index_label.length();
-            std::string line;
-            std::string::size_type pos;
-            while (std::getline(stream, line)) {
-                if ((pos = line.find(etcd_index_label) != std::string::npos))
-                {
-                    prev_index_ = std::stoi(line.substr(pos+len-1));
-                    break;
-                }
-            }
-            handle_->EnableHeader(false);
-            watch_url = wait_url_base + std::to_string(prev_index_ + 1);
-            } catch (...) {}
-        }
+template <typename Reply, typename Tracer>
+const ClientMetrics& Watch<Reply, Tracer>::
+GetMetrics() const {
+    return *metrics_;
+}
+
+template <typename Reply, typename Tracer> Tracer& Watch<Reply, Tracer>::
+GetTracer() {
+    return tracer_;
+}
+
+//------------------------------ OPERATIONS ----------------------------------
+
+template <typename Reply, typename Tracer> void Watch<Reply, Tracer>::
+_Init(const std::string& server, const Port& port) {
+    watch_metrics_ = metrics_->Watch();
+    if (endpoints_) {
+        _Follow();
+    } else {
+        std::ostringstream ostr;
+        ostr << "http://" << server << ":" << port;
+        _Use(ostr.str());
+    }
+
+    // X-Etcd-Index feeds the lag and restarts the watch after a resync
+    handle_->EnableHeader(true);
+}
+
+template <typename Reply, typename Tracer> void Watch<Reply, Tracer>::
+_Use(const std::string& url) {
+    endpoint_ = url;
+    endpoint_metrics_ = metrics_->Endpoint(endpoint_);
+    url_prefix_ = endpoint_ + "/v2/keys";
+}
+
+template <typename Reply, typename Tracer> bool Watch<Reply, Tracer>::
+_Follow() {
+    if (! endpoints_ || endpoints_->Version() == endpoints_version_)
+        return false;
+    std::shared_ptr<const EndpointList> list = endpoints_->GetList();
+    endpoints_version_ = list->version;
+    if (list->Current() == endpoint_)
+        return false;
+    _Use(list->Current());
+    return true;
+}
+
+template <typename Reply, typename Tracer> Reply Watch<Reply, Tracer>::
+_Fetch(Operation op, const std::string& key, const std::string& url) {
+    internal::InFlightGuard in_flight(*metrics_);
+
+    typename Tracer::Span span = typename Tracer::Span();
+    std::chrono::steady_clock::time_point start;
+    if (Tracer::kEnabled) {
+        start = std::chrono::steady_clock::now();
+        span = tracer_.Begin(TraceEvent(op, key, endpoint_));
+    }
+
+    std::string ret;
+    try {
+        ret = handle_->Get(url);
     } catch (const std::exception& e) {
-        throw ClientException("failed with" + std::string (e.what()));
+        metrics_->RecordTransportError(internal::CurlErrorCode(e));
+        if (Tracer::kEnabled)
+            _TraceEnd(span, op, key, start, false);
+        // An idle long-poll ended by a proxy or the server, or a timeout,
+        // says nothing about the member, only a failed connection does
+        if (endpoints_ && internal::IsConnectError(e))
+            endpoints_->MarkFailed(endpoint_);
+        throw;
+    }
+    received_ = std::chrono::steady_clock::now();
+    metrics_->RecordTransfer(handle_->GetTransferInfo());
+    watch_metrics_->RecordEtcdIndex(handle_->GetEtcdIndex());
+
+    RequestTimings timings = handle_->GetTimings();
+    std::chrono::steady_clock::time_point parse_start =
+        std::chrono::steady_clock::now();
+    try {
+        Reply r(ret);
+        timings.parse = internal::ElapsedMicros(parse_start);
+        timings.total += timings.parse;
+        metrics_->Record(op, endpoint_metrics_, timings);
+        if (Tracer::kEnabled)
+            _TraceEnd(span, op, key, start, true);
+        return r;
+    } catch (const ReplyException& e) {
+        metrics_->RecordEtcdError(e.error_code);
+        timings.parse = internal::ElapsedMicros(parse_start);
+        timings.total += timings.parse;
+        metrics_->Record(op, endpoint_metrics_, timings);
+        if (Tracer::kEnabled)
+            _TraceEnd(span, op, key, start, true);
+        throw;
+    } catch (...) {
+        timings.parse = internal::ElapsedMicros(parse_start);
+        timings.total += timings.parse;
+        metrics_->Record(op, endpoint_metrics_, timings);
+        if (Tracer::kEnabled)
+            _TraceEnd(span, op, key, start, true);
+        throw;
+    }
+}
+
+template <typename Reply, typename Tracer> void Watch<Reply, Tracer>::
+_Delivered(const std::string& key, Index index) {
+    // etcd v2 does not tell when an event was committed, the delivery
+    // latency runs from its response being received to the callback
+    // returning, so a slow consumer shows
+    uint64_t latency = internal::ElapsedMicros(received_);
+    prev_index_ = index;
+    ETCD_PROBE2(watch__event, key.c_str(), prev_index_);
+    _CheckLag(key, watch_metrics_->RecordDelivery(prev_index_, latency));
+}
+
+template <typename Reply, typename Tracer> bool Watch<Reply, Tracer>::
+_Resync(const std::string& key, Watch::Callback& callback) {
+    // Get the current state and call back, a failed GET leaves the watch
+    // to retry
+    bool in_callback = false;
+    try {
+        Reply r = _Fetch(Operation::OPERATION_GET, key, url_prefix_ + key);
+        in_callback = true;
+        callback(r);
+    } catch (const std::exception&) {
+        if (in_callback)
+            throw;
+        return false;
+    }
+
+    // Start the next watch from the index in the header of the GET
+    Index index = handle_->GetEtcdIndex();
+    if (index)
+        prev_index_ = index;
+    ETCD_PROBE2(watch__resync, key.c_str(), prev_index_);
+    _CheckLag(key, watch_metrics_->RecordResync(prev_index_));
+    return true;
+}
+
+template <typename Reply, typename Tracer> void Watch<Reply, Tracer>::
+_CheckLag(const std::string& key, uint64_t lag) {
+    if (! lag_threshold_ || ! lag_alert_)
+        return;
+    if (lag < lag_threshold_) {
+        lag_alerted_ = false;
+    } else if (! lag_alerted_) {
+        lag_alerted_ = true;
+        lag_alert_(key, lag);
+    }
+}
+
+template <typename Reply, typename Tracer> void Watch<Reply, Tracer>::
+_TraceEnd(
+    typename Tracer::Span& span,
+    Operation op,
+    const std::string& key,
+    const std::chrono::steady_clock::time_point& start,
+    bool performed) {
+    TraceEvent event(op, key, endpoint_);
+    if (performed) {
+        const TransferInfo& info = handle_->GetTransferInfo();
+        event.status = info.response_code;
+        event.bytes_sent = info.bytes_sent;
+        event.bytes_received = info.bytes_received;
     }
+    event.duration = internal::ElapsedMicros(start);
+    tracer_.End(span, event);
 }
 
 } // namespace etcd
@@ -0,0 +1,251 @@
+/*
+ * Allocation budgets of the client's hot paths. Every case runs against an
+ * embedded etcd::test::MockServer, counts the heap allocations and bytes of
+ * one call in steady state and fails when either exceeds its budget.
+ *
+ *   allocations [--calibrate] [--filter=substring]
+ *
+ * The counters are per thread, the server's own allocations are not seen.
+ * Only operator new is replaced, so libcurl's mallocs are not counted,
+ * including the strings curl_easy_escape returns to the client: they vary
+ * with the version and build of libcurl and the budgets should not.
+ *
+ * The cases use IndexReply, which parses without allocating, so their
+ * budgets cover the client's own allocations. Allocation budgets are the
+ * measured counts and byte budgets hold kByteSlack over the measured
+ * bytes, less than one more string built on the request path, so such a
+ * regression fails the run. --calibrate prints the measured numbers as a
+ * budget table after a change which legitimately moves them.
+ */
+
+#include "client.hpp"
+#include "mock_server.hpp"
+#include "watch.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+//------------------------------- COUNTERS -----------------------------------
+
+namespace {
+
+thread_local bool counting = false;
+thread_local uint64_t allocations = 0;
+thread_local uint64_t allocated = 0;
+
+inline void Count(size_t size) {
+    if (counting) {
+        ++allocations;
+        allocated += size;
+    }
+}
+
+} // namespace
+
+void* operator new(std::size_t size) {
+    Count(size);
+    void* p = std::malloc(size ? size : 1);
+    if (! p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    Count(size);
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept {
+    return operator new(size, tag);
+}
+
+// operator new above is malloc, which GCC 11 and later cannot see
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+//------------------------------- REPLY --------------------------------------
+
+/**
+ * @brief Reply wrapper which reads the modifiedIndex of the node in place,
+ * keeping the JSON library out of the client's budgets
+ */
+class IndexReply {
+  public:
+    explicit IndexReply(const std::string& json)
+      :index_(_Parse(json)) {
+    }
+
+    IndexReply(const std::string& header, const std::string& json)
+      :index_(_Parse(json)) {
+        (void) header;
+    }
+
+    etcd::Index GetModifiedIndex() const {
+        return index_;
+    }
+
+  private:
+    etcd::Index index_;
+
+    static etcd::Index _Parse(const std::string& json) {
+        static const char kField[] = "\"modifiedIndex\":";
+        const char* p = std::strstr(json.c_str(), kField);
+        return p ? std::strtoull(p + sizeof(kField) - 1, NULL, 10) : 0;
+    }
+};
+
+typedef etcd::Client<IndexReply> Client;
+typedef etcd::Watch<IndexReply> Watch;
+
+//------------------------------- CASES --------------------------------------
+
+struct Budget {
+    uint64_t allocations;
+    uint64_t bytes;
+};
+
+struct Case {
+    const char* name;
+    Budget budget;                  // per call
+    std::function<void()> call;
+};
+
+const size_t kWarmup = 20;
+const size_t kIterations = 200;
+const uint64_t kByteSlack = 256;
+
+/**
+ * @brief Allocations and bytes of one call, rounded up
+ */
+Budget Measure(const std::function<void()>& call) {
+    for (size_t i = 0; i < kWarmup; ++i)
+        call();
+
+    allocations = 0;
+    allocated = 0;
+    counting = true;
+    for (size_t i = 0; i < kIterations; ++i)
+        call();
+    counting = false;
+
+    Budget used;
+    used.allocations = (allocations + kIterations - 1) / kIterations;
+    used.bytes = (allocated + kIterations - 1) / kIterations;
+    return used;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bool calibrate = false;
+    std::string filter;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--calibrate") == 0) {
+            calibrate = true;
+        } else if (std::strncmp(argv[i], "--filter=", 9) == 0) {
+            filter = argv[i] + 9;
+        } else {
+            fprintf(stderr,
+                    "usage: allocations [--calibrate] [--filter=substring]\n");
+            return 2;
+        }
+    }
+
+    etcd::test::MockServer server;
+    Client client("127.0.0.1", server.GetPort());
+    Watch watch("127.0.0.1", server.GetPort());
+
+    const std::string key = "/alloc/key";
+    const std::string value(64, 'v');
+    client.Set(key, value);
+    for (size_t i = 0; i < 100; ++i)
+        client.Set("/alloc/dir100/k" + std::to_string(i), value);
+    for (size_t i = 0; i < 1000; ++i)
+        client.Set("/alloc/dir1000/k" + std::to_string(i), value);
+    const std::string watched = "/alloc/watched";
+    etcd::Index event = client.Set(watched, value).GetModifiedIndex();
+
+    std::vector<Case> cases;
+    // Measured with libstdc++ on 64-bit Linux
+    cases.push_back(Case{"Client::Get", {6, 444 + kByteSlack}, [&] {
+        client.Get(key);
+    }});
+    cases.push_back(Case{"Client::Set", {12, 1076 + kByteSlack}, [&] {
+        client.Set(key, value);
+    }});
+    cases.push_back(Case{"Client::GetAll/100", {5, 28280 + kByteSlack}, [&] {
+        client.GetAll("/alloc/dir100");
+    }});
+    cases.push_back(Case{"Client::GetAll/1000", {13, 288531 + kByteSlack},
+                         [&] {
+        client.GetAll("/alloc/dir1000");
+    }});
+    // The set of watched stays in the 1000 event history through the cases
+    // before this one, the long-poll returns at once
+    cases.push_back(Case{"Watch::RunOnce/event", {16, 957 + kByteSlack},
+                         [&] {
+        watch.RunOnce(watched, [](const IndexReply&) {}, event - 1);
+    }});
+
+    int failures = 0;
+    if (! calibrate)
+        printf("%-24s %12s %12s %12s %12s\n", "case", "allocs",
+               "budget", "bytes", "budget");
+    for (size_t i = 0; i < cases.size(); ++i) {
+        const Case& c = cases[i];
+        if (! filter.empty() && std::string(c.name).find(filter) ==
+            std::string::npos)
+            continue;
+
+        Budget used = Measure(c.call);
+        if (calibrate) {
+            printf("%-24s {%llu, %llu}\n", c.name,
+                   (unsigned long long) used.allocations,
+                   (unsigned long long) used.bytes);
+            continue;
+        }
+        bool over = used.allocations > c.budget.allocations ||
+            used.bytes > c.budget.bytes;
+        printf("%-24s %12llu %12llu %12llu %12llu%s\n", c.name,
+               (unsigned long long) used.allocations,
+               (unsigned long long) c.budget.allocations,
+               (unsigned long long) used.bytes,
+               (unsigned long long) c.budget.bytes,
+               over ? "  OVER BUDGET" : "");
+        if (over)
+            ++failures;
+    }
+
+    server.Stop();
+    if (failures)
+        fprintf(stderr, "%d case(s) over their allocation budget\n",
+                failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,415 @@
+#ifndef __ETCD_FAULT_PROXY_HPP_INCLUDED__
+#define __ETCD_FAULT_PROXY_HPP_INCLUDED__
+
+#include "http.hpp"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace etcd {
+namespace test {
+
+enum class Fault {
+    FAULT_NONE,
+    FAULT_DELAY,            // hold the request before forwarding it
+    FAULT_STALL,            // hold the response of the server
+    FAULT_RESET,            // reset the connection instead of answering
+    FAULT_TRUNCATE,         // send half of the response, then close
+    FAULT_EMPTY_REPLY,      // close the connection without a reply
+    FAULT_REDIRECT          // answer 307 to the redirect target
+};
+
+static const size_t kFaultCount = 7;
+
+inline const char* FaultName(Fault fault) {
+    static const char* const kNames[kFaultCount] = {
+        "none", "delay", "stall", "reset", "truncate", "empty_reply",
+        "redirect"
+    };
+    return kNames[static_cast<size_t>(fault)];
+}
+
+/**
+ * @brief Apply fault to the next requests requests. duration is the delay
+ * of FAULT_DELAY and FAULT_STALL in microseconds.
+ */
+struct FaultStep {
+    FaultStep(Fault fault, uint64_t requests = 1, uint64_t duration = 0)
+      :fault(fault),
+       requests(requests),
+       duration(duration)
+      {}
+
+    Fault fault;
+    uint64_t requests;
+    uint64_t duration;
+};
+
+/**
+ * @brief Faults drawn at random for every request once the script has run
+ * out. Durations are in microseconds, probabilities between 0 and 1.
+ */
+struct FaultProfile {
+    FaultProfile()
+      :delay(0), jitter(0), tail_probability(0), tail_delay(0),
+       stall(0), stall_duration(0),
+       reset(0), truncate(0), empty_reply(0), redirect(0)
+      {}
+
+    // Latency of every request: delay plus a uniform jitter, plus
+    // tail_delay for a tail_probability share of the requests
+    uint64_t delay;
+    uint64_t jitter;
+    double tail_probability;
+    uint64_t tail_delay;
+
+    double stall;
+    uint64_t stall_duration;
+
+    double reset;
+    double truncate;
+    double empty_reply;
+    double redirect;
+};
+
+/**
+ * @brief HTTP proxy on 127.0.0.1 injecting faults between etcd::Client or
+ * etcd::Watch and a server, e.g. etcd::test::MockServer.
+ *
+ * Every client connection gets its own connection to the server, requests
+ * are forwarded one at a time. The fault of a request is taken from the
+ * script first, in arrival order across all connections, then drawn from
+ * the profile.
+ *
+ *   etcd::test::MockServer server;
+ *   etcd::test::FaultProxy proxy("127.0.0.1", server.GetPort());
+ *   proxy.Script({FaultStep(Fault::FAULT_EMPTY_REPLY, 3)});
+ *   etcd::Watch<etcd::RapidReply> watch("127.0.0.1", proxy.GetPort());
+ */
+class FaultProxy {
+  public:
+    // LIFECYCLE
+    /**
+     * @param host server to forward to
+     * @param port port of the server
+     * @param listen_port port to listen on, 0 picks a free one
+     */
+    FaultProxy(const std::string& host,
+               const Port& port,
+               const Port& listen_port = 0);
+
+    ~FaultProxy();
+
+    // OPERATIONS
+    Port GetPort() const;
+
+    void SetProfile(const FaultProfile& profile);
+
+    /**
+     * @brief Replace the steps which have not run yet
+     */
+    void Script(const std::vector<FaultStep>& steps);
+
+    /**
+     * @brief Where FAULT_REDIRECT sends the client, by default the server
+     */
+    void SetRedirectTarget(const std::string& host, const Port& port);
+
+    /**
+     * @brief Number of requests which received fault
+     */
+    uint64_t Injected(Fault fault) const;
+
+    /**
+     * @brief Number of requests received
+     */
+    uint64_t Requests() const;
+
+    /**
+     * @brief Stop proxying and close every connection. Called by the
+     * destructor.
+     */
+    void Stop();
+
+  private:
+    // TYPES
+    struct Decision {
+        Decision() :fault(Fault::FAULT_NONE), delay(0), stall(0) {}
+
+        Fault fault;
+        uint64_t delay;
+        uint64_t stall;
+    };
+
+    // DATA MEMBERS
+    std::string host_;
+    Port port_;
+    std::string redirect_;      // scheme, host and port
+    Socket listener_;
+    Port listen_port_;
+    std::thread acceptor_;
+    std::vector<std::thread> workers_;
+    std::set<Socket> sockets_;
+    bool stopping_;
+
+    FaultProfile profile_;
+    std::deque<FaultStep> script_;
+    std::mt19937_64 random_;
+    std::atomic<uint64_t> requests_;
+    std::atomic<uint64_t> injected_[kFaultCount];
+
+    mutable std::mutex mutex_;
+
+    // LIFECYCLE
+    FaultProxy(const FaultProxy& rhs);
+    void operator=(const FaultProxy& rhs);
+
+    // OPERATIONS
+    void _Accept();
+    void _Serve(Socket client);
+    Decision _Decide();
+    bool _Track(Socket s);
+    void _Close(Socket s, bool reset);
+};
+
+//------------------------------- LIFECYCLE ----------------------------------
+
+inline FaultProxy::
+FaultProxy(const std::string& host, const Port& port, const Port& listen_port)
+  :host_(host),
+   port_(port),
+   listener_(kInvalidSocket),
+   listen_port_(listen_port),
+   stopping_(false),
+   random_(listen_port + 1),
+   requests_(0) {
+    for (size_t i = 0; i < kFaultCount; ++i)
+        injected_[i].store(0);
+    SetRedirectTarget(host, port);
+    listener_ = Listen(listen_port_);
+    acceptor_ = std::thread(&FaultProxy::_Accept, this);
+}
+
+inline FaultProxy::
+~FaultProxy() {
+    Stop();
+}
+
+//------------------------------- OPERATIONS ---------------------------------
+
+inline Port FaultProxy::
+GetPort() const {
+    return listen_port_;
+}
+
+inline void FaultProxy::
+SetProfile(const FaultProfile& profile) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    profile_ = profile;
+}
+
+inline void FaultProxy::
+Script(const std::vector<FaultStep>& steps) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    script_.assign(steps.begin(), steps.end());
+}
+
+inline void FaultProxy::
+SetRedirectTarget(const std::string& host, const Port& port) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    redirect_ = "http://" + host + ":" + std::to_string(port);
+}
+
+inline uint64_t FaultProxy::
+Injected(Fault fault) const {
+    return injected_[static_cast<size_t>(fault)].load();
+}
+
+inline uint64_t FaultProxy::
+Requests() const {
+    return requests_.load();
+}
+
+inline void FaultProxy::
+Stop() {
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_)
+            return;
+        stopping_ = true;
+        ShutdownSocket(listener_);
+        for (auto s :sockets_)
+            ShutdownSocket(s);
+    }
+
+    acceptor_.join();
+    CloseSocket(listener_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        workers.swap(workers_);
+    }
+    for (auto& w :workers)
+        w.join();
+}
+
+//------------------------------ CONNECTIONS ---------------------------------
+
+inline void FaultProxy::
+_Accept() {
+    for (;;) {
+        Socket s = accept(listener_, NULL, NULL);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            if (s != kInvalidSocket)
+                CloseSocket(s);
+            return;
+        }
+        if (s == kInvalidSocket)
+            continue;
+
+        SetNoDelay(s);
+        sockets_.insert(s);
+        workers_.push_back(std::thread(&FaultProxy::_Serve, this, s));
+    }
+}
+
+inline void FaultProxy::
+_Serve(Socket client) {
+    Socket server = kInvalidSocket;
+    std::string client_buffer;
+    std::string server_buffer;
+    HttpMessage request;
+    HttpMessage response;
+    bool reset = false;
+
+    while (ReadHttpMessage(client, client_buffer, request, false)) {
+        requests_.fetch_add(1);
+        Decision d = _Decide();
+        injected_[static_cast<size_t>(d.fault)].fetch_add(1);
+
+        if (d.fault == Fault::FAULT_RESET) {
+            reset = true;
+            break;
+        }
+        if (d.fault == Fault::FAULT_EMPTY_REPLY)
+            break;
+        if (d.fault == Fault::FAULT_REDIRECT) {
+            std::string location;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                location = redirect_ + request.target;
+            }
+            if (! SendAll(client, "HTTP/1.1 307 Temporary Redirect\r\n"
+                                  "Location: " + location + "\r\n"
+                                  "Content-Length: 0\r\n\r\n"))
+                break;
+            continue;
+        }
+
+        if (d.delay)
+            std::this_thread::sleep_for(std::chrono::microseconds(d.delay));
+
+        if (server == kInvalidSocket) {
+            server = Connect(host_, port_);
+            if (server == kInvalidSocket || ! _Track(server)) {
+                if (server != kInvalidSocket)
+                    CloseSocket(server);
+                server = kInvalidSocket;
+                break;
+            }
+        }
+        if (! SendAll(server, request.raw) ||
+            ! ReadHttpMessage(server, server_buffer, response, true))
+            break;
+
+        if (d.stall)
+            std::this_thread::sleep_for(std::chrono::microseconds(d.stall));
+
+        if (d.fault == Fault::FAULT_TRUNCATE) {
+            SendAll(client, response.raw.substr(
+                0, response.head.size() +
+                   (response.raw.size() - response.head.size()) / 2));
+            break;
+        }
+        if (! SendAll(client, response.raw) || request.close ||
+            response.close)
+            break;
+    }
+
+    if (server != kInvalidSocket)
+        _Close(server, false);
+    _Close(client, reset);
+}
+
+inline FaultProxy::Decision FaultProxy::
+_Decide() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Decision d;
+    if (! script_.empty()) {
+        FaultStep& step = script_.front();
+        d.fault = step.fault;
+        if (d.fault == Fault::FAULT_DELAY)
+            d.delay = step.duration;
+        else if (d.fault == Fault::FAULT_STALL)
+            d.stall = step.duration;
+        if (--step.requests == 0)
+            script_.pop_front();
+        return d;
+    }
+
+    const FaultProfile& p = profile_;
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    d.delay = p.delay;
+    if (p.jitter)
+        d.delay += random_() % (p.jitter + 1);
+    if (p.tail_probability > 0 && unit(random_) < p.tail_probability)
+        d.delay += p.tail_delay;
+    if (d.delay)
+        d.fault = Fault::FAULT_DELAY;
+
+    double u = unit(random_);
+    if ((u -= p.reset) < 0) {
+        d.fault = Fault::FAULT_RESET;
+    } else if ((u -= p.empty_reply) < 0) {
+        d.fault = Fault::FAULT_EMPTY_REPLY;
+    } else if ((u -= p.truncate) < 0) {
+        d.fault = Fault::FAULT_TRUNCATE;
+    } else if ((u -= p.redirect) < 0) {
+        d.fault = Fault::FAULT_REDIRECT;
+    } else if ((u -= p.stall) < 0) {
+        d.fault = Fault::FAULT_STALL;
+        d.stall = p.stall_duration;
+    }
+    return d;
+}
+
+inline bool FaultProxy::
+_Track(Socket s) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_)
+        return false;
+    sockets_.insert(s);
+    return true;
+}
+
+inline void FaultProxy::
+_Close(Socket s, bool reset) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sockets_.erase(s);
+    if (reset)
+        ResetSocket(s);
+    else
+        CloseSocket(s);
+}
+
+} // namespace test
+} // namespace etcd
+
+#endif // __ETCD_FAULT_PROXY_HPP_INCLUDED__
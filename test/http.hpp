@@ -0,0 +1,313 @@
+#ifndef __ETCD_TEST_HTTP_HPP_INCLUDED__
+#define __ETCD_TEST_HTTP_HPP_INCLUDED__
+
+#include "client.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <map>
+#include <string>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Blocking sockets and HTTP/1.1 message framing shared by the test servers.
+ * Loopback only, no TLS.
+ */
+
+namespace etcd {
+namespace test {
+
+#ifdef _WIN32
+typedef SOCKET Socket;
+static const Socket kInvalidSocket = INVALID_SOCKET;
+inline void CloseSocket(Socket s) { closesocket(s); }
+inline void ShutdownSocket(Socket s) { shutdown(s, SD_BOTH); }
+#else
+typedef int Socket;
+static const Socket kInvalidSocket = -1;
+inline void CloseSocket(Socket s) { close(s); }
+inline void ShutdownSocket(Socket s) { shutdown(s, SHUT_RDWR); }
+#endif
+
+inline void SocketStartup() {
+#ifdef _WIN32
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+}
+
+inline void SetNoDelay(Socket s) {
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*) &on, sizeof(on));
+}
+
+/**
+ * @brief Close with a TCP reset instead of an orderly shutdown
+ */
+inline void ResetSocket(Socket s) {
+    linger l;
+    l.l_onoff = 1;
+    l.l_linger = 0;
+    setsockopt(s, SOL_SOCKET, SO_LINGER, (const char*) &l, sizeof(l));
+    CloseSocket(s);
+}
+
+/**
+ * @brief Listen on 127.0.0.1
+ *
+ * @param port port to listen on, 0 picks a free one, receives the port
+ *
+ * @return the listening socket, throws etcd::ClientException on failure
+ */
+inline Socket Listen(Port& port) {
+    SocketStartup();
+    Socket s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == kInvalidSocket)
+        throw ClientException("test server: socket failed");
+
+    int on = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*) &on, sizeof(on));
+
+    sockaddr_in addr = sockaddr_in();
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    socklen_t len = sizeof(addr);
+    if (bind(s, (sockaddr*) &addr, sizeof(addr)) != 0 ||
+        listen(s, 128) != 0 ||
+        getsockname(s, (sockaddr*) &addr, &len) != 0) {
+        CloseSocket(s);
+        throw ClientException("test server: cannot listen on port " +
+                              std::to_string(port));
+    }
+    port = ntohs(addr.sin_port);
+    return s;
+}
+
+/**
+ * @return a connected socket, kInvalidSocket on failure
+ */
+inline Socket Connect(const std::string& host, const Port& port) {
+    SocketStartup();
+    addrinfo hints = addrinfo();
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = NULL;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                    &result) != 0)
+        return kInvalidSocket;
+
+    Socket s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s != kInvalidSocket &&
+        connect(s, result->ai_addr, (int) result->ai_addrlen) != 0) {
+        CloseSocket(s);
+        s = kInvalidSocket;
+    }
+    freeaddrinfo(result);
+    if (s != kInvalidSocket)
+        SetNoDelay(s);
+    return s;
+}
+
+inline bool SendAll(Socket s, const std::string& data) {
+    // A peer gone away must fail the send, not raise SIGPIPE
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    size_t sent = 0;
+    while (sent < data.size()) {
+        int n = send(s, data.data() + sent, (int) (data.size() - sent),
+                     flags);
+        if (n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+/**
+ * @brief Has the peer closed the connection, without blocking. Data waiting
+ * to be read is left in place.
+ */
+inline bool PeerClosed(Socket s) {
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(s, &readable);
+    timeval none = {0, 0};
+    if (select((int) s + 1, &readable, NULL, NULL, &none) <= 0)
+        return false;
+    char c;
+    return recv(s, &c, 1, MSG_PEEK) <= 0;
+}
+
+/**
+ * @brief A request or response as read from the wire
+ */
+struct HttpMessage {
+    HttpMessage() :status(0), close(false) {}
+
+    std::string method;         // requests
+    std::string target;
+    int status;                 // responses
+    std::map<std::string, std::string> headers;     // lower case names
+    std::string head;           // start line and headers, as received
+    std::string body;           // without the chunked framing
+    std::string raw;            // the complete message, as received
+    bool close;                 // Connection: close
+};
+
+namespace internal {
+
+inline bool Fill(Socket s, std::string& buffer) {
+    char chunk[4096];
+    int n = recv(s, chunk, sizeof(chunk), 0);
+    if (n <= 0)
+        return false;
+    buffer.append(chunk, n);
+    return true;
+}
+
+inline bool ReadChunked(Socket s, std::string& buffer, size_t& pos,
+                        std::string& body) {
+    for (;;) {
+        std::string::size_type eol;
+        while ((eol = buffer.find("\r\n", pos)) == std::string::npos) {
+            if (! Fill(s, buffer))
+                return false;
+        }
+        size_t size = std::strtoul(buffer.c_str() + pos, NULL, 16);
+        pos = eol + 2;
+        while (buffer.size() < pos + size + 2) {
+            if (! Fill(s, buffer))
+                return false;
+        }
+        body.append(buffer, pos, size);
+        pos += size + 2;
+        if (! size)
+            return true;    // trailers are not supported
+    }
+}
+
+} // namespace internal
+
+/**
+ * @brief Read one message from s. Bytes read past its end stay in buffer
+ * for the next call.
+ *
+ * A request announcing "Expect: 100-continue" is answered with
+ * "100 Continue" before its body is read. Responses may be framed by
+ * Content-Length, chunked, or by the end of the connection; interim 1xx
+ * responses are skipped.
+ *
+ * @param response true to read a response, false for a request
+ *
+ * @return false if the connection closed before the message was complete
+ */
+inline bool ReadHttpMessage(Socket s, std::string& buffer, HttpMessage& m,
+                            bool response) {
+    std::string::size_type end;
+    while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+        if (! internal::Fill(s, buffer))
+            return false;
+    }
+
+    m = HttpMessage();
+    m.head = buffer.substr(0, end + 4);
+    std::string::size_type eol = m.head.find("\r\n");
+    std::string start = m.head.substr(0, eol);
+    std::string::size_type sp1 = start.find(' ');
+    std::string::size_type sp2 = start.find(' ', sp1 + 1);
+    if (sp1 == std::string::npos)
+        return false;
+    if (response) {
+        m.status = std::atoi(start.c_str() + sp1 + 1);
+    } else {
+        if (sp2 == std::string::npos)
+            return false;
+        m.method = start.substr(0, sp1);
+        m.target = start.substr(sp1 + 1, sp2 - sp1 - 1);
+    }
+
+    std::string::size_type pos = eol + 2;
+    while (pos < end) {
+        eol = m.head.find("\r\n", pos);
+        std::string line = m.head.substr(pos, eol - pos);
+        pos = eol + 2;
+        std::string::size_type colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        std::string name = line.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        std::string value = line.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(' '));
+        m.headers[name] = value;
+    }
+    auto header = [&](const char* name) -> std::string {
+        std::map<std::string, std::string>::const_iterator it =
+            m.headers.find(name);
+        return it == m.headers.end() ? std::string() : it->second;
+    };
+    m.close = header("connection") == "close";
+
+    size_t body_start = end + 4;
+    if (response && m.status >= 100 && m.status < 200) {
+        buffer.erase(0, body_start);
+        return ReadHttpMessage(s, buffer, m, response);
+    }
+
+    std::string length = header("content-length");
+    if (response && length.empty() &&
+        header("transfer-encoding") == "chunked") {
+        size_t body_end = body_start;
+        if (! internal::ReadChunked(s, buffer, body_end, m.body))
+            return false;
+        m.raw = buffer.substr(0, body_end);
+        buffer.erase(0, body_end);
+        return true;
+    }
+
+    size_t size = std::strtoul(length.c_str(), NULL, 10);
+    if (response && length.empty() && m.status != 204 && m.status != 304) {
+        // Delimited by the end of the connection
+        while (internal::Fill(s, buffer)) {
+        }
+        size = buffer.size() - body_start;
+        m.close = true;
+    }
+
+    if (! response && header("expect") == "100-continue" &&
+        buffer.size() < body_start + size &&
+        ! SendAll(s, "HTTP/1.1 100 Continue\r\n\r\n"))
+        return false;
+    while (buffer.size() < body_start + size) {
+        if (! internal::Fill(s, buffer))
+            return false;
+    }
+
+    m.body = buffer.substr(body_start, size);
+    m.raw = buffer.substr(0, body_start + size);
+    buffer.erase(0, body_start + size);
+    return true;
+}
+
+} // namespace test
+} // namespace etcd
+
+#endif // __ETCD_TEST_HTTP_HPP_INCLUDED__
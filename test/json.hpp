@@ -0,0 +1,229 @@
+#ifndef __ETCD_TEST_JSON_HPP_INCLUDED__
+#define __ETCD_TEST_JSON_HPP_INCLUDED__
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Minimal JSON reader for the request bodies of the v3 gateway, as received
+ * by the mock server. Numbers keep their text so int64 values survive.
+ */
+
+namespace etcd {
+namespace test {
+
+struct Json {
+    enum Type {
+        JSON_NULL,
+        JSON_BOOL,
+        JSON_NUMBER,
+        JSON_STRING,
+        JSON_ARRAY,
+        JSON_OBJECT
+    };
+
+    Json() :type(JSON_NULL), boolean(false) {}
+
+    Type type;
+    bool boolean;
+    std::string text;           // strings, and numbers as written
+    std::vector<Json> items;    // arrays
+    std::vector<std::pair<std::string, Json> > members;     // objects
+
+    const Json* Find(const std::string& name) const {
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (members[i].first == name)
+                return &members[i].second;
+        }
+        return NULL;
+    }
+
+    std::string String(const std::string& name) const {
+        const Json* v = Find(name);
+        return v && v->type == JSON_STRING ? v->text : std::string();
+    }
+
+    /**
+     * @brief int64 fields may be sent as numbers or as strings
+     */
+    int64_t Int(const std::string& name) const {
+        const Json* v = Find(name);
+        if (! v || (v->type != JSON_NUMBER && v->type != JSON_STRING))
+            return 0;
+        return std::strtoll(v->text.c_str(), NULL, 10);
+    }
+
+    bool Bool(const std::string& name) const {
+        const Json* v = Find(name);
+        return v && v->type == JSON_BOOL && v->boolean;
+    }
+
+    /**
+     * @return false if text is not a single valid JSON value
+     */
+    static bool Parse(const std::string& text, Json& out) {
+        size_t pos = 0;
+        if (! _Value(text, pos, out, 0))
+            return false;
+        _Space(text, pos);
+        return pos == text.size();
+    }
+
+  private:
+    static void _Space(const std::string& s, size_t& pos) {
+        while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' ||
+                                  s[pos] == '\n' || s[pos] == '\r'))
+            ++pos;
+    }
+
+    static bool _Literal(const std::string& s, size_t& pos, const char* word) {
+        std::string w(word);
+        if (s.compare(pos, w.size(), w) != 0)
+            return false;
+        pos += w.size();
+        return true;
+    }
+
+    static bool _String(const std::string& s, size_t& pos, std::string& out) {
+        if (pos >= s.size() || s[pos] != '"')
+            return false;
+        ++pos;
+        out.clear();
+        while (pos < s.size() && s[pos] != '"') {
+            char c = s[pos++];
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos >= s.size())
+                return false;
+            c = s[pos++];
+            switch (c) {
+              case 'b': out += '\b'; break;
+              case 'f': out += '\f'; break;
+              case 'n': out += '\n'; break;
+              case 'r': out += '\r'; break;
+              case 't': out += '\t'; break;
+              case 'u': {
+                // Bodies are base64 and ASCII, code points above 0x7f are
+                // not expected and are encoded as UTF-8 without surrogates
+                if (pos + 4 > s.size())
+                    return false;
+                unsigned long cp = std::strtoul(s.substr(pos, 4).c_str(),
+                                                NULL, 16);
+                pos += 4;
+                if (cp < 0x80) {
+                    out += char(cp);
+                } else if (cp < 0x800) {
+                    out += char(0xc0 | (cp >> 6));
+                    out += char(0x80 | (cp & 0x3f));
+                } else {
+                    out += char(0xe0 | (cp >> 12));
+                    out += char(0x80 | ((cp >> 6) & 0x3f));
+                    out += char(0x80 | (cp & 0x3f));
+                }
+                break;
+              }
+              default: out += c; break;
+            }
+        }
+        if (pos >= s.size())
+            return false;
+        ++pos;
+        return true;
+    }
+
+    static bool _Value(const std::string& s, size_t& pos, Json& out,
+                       int depth) {
+        if (depth > 64)
+            return false;
+        _Space(s, pos);
+        if (pos >= s.size())
+            return false;
+
+        out = Json();
+        char c = s[pos];
+        if (c == '{') {
+            out.type = JSON_OBJECT;
+            ++pos;
+            _Space(s, pos);
+            if (pos < s.size() && s[pos] == '}') {
+                ++pos;
+                return true;
+            }
+            for (;;) {
+                _Space(s, pos);
+                std::pair<std::string, Json> member;
+                if (! _String(s, pos, member.first))
+                    return false;
+                _Space(s, pos);
+                if (pos >= s.size() || s[pos++] != ':')
+                    return false;
+                if (! _Value(s, pos, member.second, depth + 1))
+                    return false;
+                out.members.push_back(member);
+                _Space(s, pos);
+                if (pos < s.size() && s[pos] == ',') {
+                    ++pos;
+                    continue;
+                }
+                return pos < s.size() && s[pos++] == '}';
+            }
+        }
+        if (c == '[') {
+            out.type = JSON_ARRAY;
+            ++pos;
+            _Space(s, pos);
+            if (pos < s.size() && s[pos] == ']') {
+                ++pos;
+                return true;
+            }
+            for (;;) {
+                out.items.push_back(Json());
+                if (! _Value(s, pos, out.items.back(), depth + 1))
+                    return false;
+                _Space(s, pos);
+                if (pos < s.size() && s[pos] == ',') {
+                    ++pos;
+                    continue;
+                }
+                return pos < s.size() && s[pos++] == ']';
+            }
+        }
+        if (c == '"') {
+            out.type = JSON_STRING;
+            return _String(s, pos, out.text);
+        }
+        if (_Literal(s, pos, "true")) {
+            out.type = JSON_BOOL;
+            out.boolean = true;
+            return true;
+        }
+        if (_Literal(s, pos, "false")) {
+            out.type = JSON_BOOL;
+            return true;
+        }
+        if (_Literal(s, pos, "null"))
+            return true;
+
+        size_t start = pos;
+        while (pos < s.size() && (std::isdigit((unsigned char) s[pos]) ||
+               s[pos] == '-' || s[pos] == '+' || s[pos] == '.' ||
+               s[pos] == 'e' || s[pos] == 'E'))
+            ++pos;
+        if (pos == start)
+            return false;
+        out.type = JSON_NUMBER;
+        out.text = s.substr(start, pos - start);
+        return true;
+    }
+};
+
+} // namespace test
+} // namespace etcd
+
+#endif // __ETCD_TEST_JSON_HPP_INCLUDED__
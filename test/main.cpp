@@ -1,4 +1,5 @@
 ﻿#include "client.hpp"
+#include "mock_server.hpp"
 #include "rapid_reply.hpp"
 #include <iconv/iconv.h>
 
@@ -68,16 +69,28 @@ std::string UTF8ToGBK(const char *str)
 	return ret;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
-	etcd::Client<etcd::RapidReply> client("172.16.1.10", 2379);
+	// Run against an embedded server unless an endpoint is given
+	std::unique_ptr<etcd::test::MockServer> mock;
+	std::string server = "127.0.0.1";
+	etcd::Port port = 0;
+	if (argc > 2) {
+		server = argv[1];
+		port = (etcd::Port) atoi(argv[2]);
+	} else {
+		mock.reset(new etcd::test::MockServer());
+		port = mock->GetPort();
+	}
+
+	etcd::Client<etcd::RapidReply> client(server, port);
 	std::string a = GBKToUTF8("你好");
 	
 	etcd::RapidReply reply = client.Set("/message", a.c_str());
-	etcd::RapidReply reply2 = client.Get("/message1");
+	etcd::RapidReply reply2 = client.Get("/message");
 	etcd::RapidReply::KvPairs result;
 	reply2.GetAll(result);
-	std::string b = UTF8ToGBK(result["/message1"].c_str());
+	std::string b = UTF8ToGBK(result["/message"].c_str());
 
 	return 0;
 }
\ No newline at end of file
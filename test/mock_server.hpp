@@ -0,0 +1,1271 @@
+#ifndef __ETCD_MOCK_SERVER_HPP_INCLUDED__
+#define __ETCD_MOCK_SERVER_HPP_INCLUDED__
+
+#include "http.hpp"
+#include "mock_v3.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace etcd {
+namespace test {
+
+/**
+ * @brief In-process etcd v2 server for tests and benchmarks.
+ *
+ * Implements the part of the v2 keys API used by etcd::Client and
+ * etcd::Watch on 127.0.0.1: get (recursive, sorted), set, in-order POST,
+ * TTLs and expiry, directories, hidden nodes, prevValue/prevIndex/prevExist,
+ * wait/waitIndex over a 1000 event history including the 401 once the
+ * history has been cleared, and the X-Etcd-Index header. It also answers
+ * /v2/stats/self, /v2/stats/leader and /v2/stats/store as the leader of a
+ * single member cluster, with store counters of the requests it served,
+ * /v2/members with the client URLs set by SetClientUrls, and /health and
+ * /version. POSTs to /v3/ are answered by a MockV3Store, a v3 keyspace
+ * independent of the v2 one, as through the etcd JSON gateway. A POST to
+ * /v3/watch is answered with a chunked stream which stays open until the
+ * client goes away, a message per line.
+ *
+ * Each connection is served by its own thread with HTTP/1.1 keep-alive, so
+ * connection reuse behaves as with a real etcd. SetLatency adds a delay to
+ * every response, to measure client features against a slow cluster.
+ *
+ *   etcd::test::MockServer server;
+ *   etcd::Client<etcd::RapidReply> client("127.0.0.1", server.GetPort());
+ */
+class MockServer {
+  public:
+    // CONSTANTS
+    static const size_t kHistorySize = 1000;
+
+    // LIFECYCLE
+    /**
+     * @brief Start listening on 127.0.0.1
+     *
+     * @param port port to listen on, 0 picks a free one
+     */
+    explicit MockServer(const Port& port = 0);
+
+    ~MockServer();
+
+    // OPERATIONS
+    /**
+     * @brief Port the server is listening on
+     */
+    Port GetPort() const;
+
+    /**
+     * @brief Current etcd index, the index of the last change
+     */
+    Index GetIndex() const;
+
+    /**
+     * @brief Delay every response by delay plus a uniformly distributed
+     * jitter, both in microseconds. Wait requests are delayed once the event
+     * arrived.
+     */
+    void SetLatency(uint64_t delay, uint64_t jitter = 0);
+
+    /**
+     * @brief Client URLs listed by /v2/members, one member per URL. By
+     * default the server lists itself only. An empty URL stands for a
+     * member which has not been started yet.
+     */
+    void SetClientUrls(const std::vector<std::string>& urls);
+
+    /**
+     * @brief Answer /health with {"health": "false"} and 503 when false,
+     * as a member which lost its quorum. Keys requests are still served.
+     */
+    void SetHealthy(bool healthy);
+
+    /**
+     * @brief Versions answered by /version, "2.3.8" and "2.3.0" by
+     * default. The v3 API is served whatever the version.
+     */
+    void SetVersion(const std::string& server, const std::string& cluster);
+
+    /**
+     * @brief Interval of the progress notifications sent to the v3 watches
+     * asking for them, 10 minutes by default as in etcd
+     */
+    void SetProgressInterval(std::chrono::milliseconds interval);
+
+    /**
+     * @brief Stop serving, pending waits and open connections are closed
+     * without a reply. Called by the destructor.
+     */
+    void Stop();
+
+  private:
+    // TYPES
+    typedef std::chrono::steady_clock Clock;
+    typedef std::map<std::string, std::string> Params;
+
+    struct Node {
+        Node() :dir(false), created(0), modified(0), ttl(false) {}
+
+        std::string value;
+        bool dir;
+        Index created;
+        Index modified;
+        bool ttl;
+        Clock::time_point expires;
+    };
+
+    struct Event {
+        Index index;
+        std::string key;
+        bool dir;
+        std::string json;           // complete response body
+    };
+
+    struct Request {
+        std::string method;
+        std::string path;
+        Params params;
+        std::string body;
+        bool close;
+    };
+
+    struct Response {
+        Response() :status(200), index(0), drop(false) {}
+
+        int status;
+        std::string body;
+        Index index;
+        bool drop;                  // close the connection without a reply
+    };
+
+    // A blocked wait, woken only by the events it matches. since is the
+    // first index it has not looked at, moved past the events it sleeps
+    // through so the history trimming them is not an error for it.
+    struct Waiter {
+        std::string key;
+        bool recursive;
+        Index since;
+        std::condition_variable changed;
+    };
+
+    // DATA MEMBERS
+    Socket listener_;
+    Port port_;
+    std::thread acceptor_;
+    std::vector<std::thread> workers_;
+    std::set<Socket> connections_;
+    bool stopping_;
+
+    std::map<std::string, Node> nodes_;
+    std::deque<Event> history_;
+    bool history_cleared_;
+    Index index_;
+    Clock::time_point next_expiry_; // earliest TTL, max() without TTLs
+    Clock::time_point started_;
+    std::string start_time_;        // RFC 3339
+    std::map<std::string, uint64_t> store_stats_;
+    std::vector<std::string> client_urls_;
+    bool healthy_;
+    std::string server_version_;
+    std::string cluster_version_;
+    MockV3Store v3_;
+    std::condition_variable v3_changed_;   // wakes the watch streams
+    std::chrono::milliseconds progress_interval_;
+    uint64_t delay_;
+    uint64_t jitter_;
+
+    mutable std::mutex mutex_;
+    std::set<Waiter*> waiters_;
+
+    // LIFECYCLE
+    MockServer(const MockServer& rhs);
+    void operator=(const MockServer& rhs);
+
+    // OPERATIONS
+    void _Accept();
+    void _Serve(Socket s);
+    bool _ReadRequest(Socket s, std::string& buffer, Request& request);
+    void _StreamWatch(Socket s, const Request& request);
+
+    Response _Handle(const Request& request);
+    Response _Get(const std::string& key, const Params& params);
+    Response _Wait(const std::string& key, const Params& params,
+                   std::unique_lock<std::mutex>& lock);
+    Response _Set(const std::string& key, const Params& params);
+    Response _Create(const std::string& dir, const Params& params);
+    Response _Delete(const std::string& key, const Params& params);
+    Response _Stats(const std::string& name);
+    Response _Members() const;
+    void _Count(const Request& request, const Response& response);
+
+    Response _Error(int code, const std::string& cause) const;
+    std::string _Store(const std::string& key, Node& node,
+                       const std::string& action, const Node* prev,
+                       const std::string& prev_json);
+    bool _MakeParents(const std::string& key, Response& error);
+    void _RemoveTree(const std::string& key);
+    bool _HasChildren(const std::string& key) const;
+    void _Expire();
+    void _Publish(Index index, const std::string& key, bool dir,
+                  const std::string& json);
+    void _WakeAll();
+    bool _Matches(const Event& event, const std::string& key,
+                  bool recursive) const;
+
+    std::string _NodeJson(const std::string& key, const Node& node,
+                          bool children, bool recursive) const;
+    std::string _RemovedJson(const std::string& key, const Node& prev) const;
+    static std::string _Escape(const std::string& value);
+    static std::string _Decode(const std::string& value);
+    static std::string _CleanKey(const std::string& key);
+    static std::string _Parent(const std::string& key);
+    static bool _IsHidden(const std::string& key);
+    static bool _IsBelow(const std::string& key, const std::string& dir);
+    static void _ParseParams(const std::string& text, Params& params);
+    static const char* _Reason(int status);
+};
+
+//------------------------------- LIFECYCLE ----------------------------------
+
+inline MockServer::
+MockServer(const Port& port)
+  :listener_(kInvalidSocket),
+   port_(0),
+   stopping_(false),
+   history_cleared_(false),
+   index_(0),
+   next_expiry_(Clock::time_point::max()),
+   started_(Clock::now()),
+   healthy_(true),
+   server_version_("2.3.8"),
+   cluster_version_("2.3.0"),
+   progress_interval_(std::chrono::minutes(10)),
+   delay_(0),
+   jitter_(0) {
+    Node root;
+    root.dir = true;
+    nodes_["/"] = root;
+
+    char now[32];
+    std::time_t t = std::time(NULL);
+    std::strftime(now, sizeof(now), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&t));
+    start_time_ = now;
+
+    port_ = port;
+    listener_ = Listen(port_);
+    client_urls_.push_back("http://127.0.0.1:" + std::to_string(port_));
+    acceptor_ = std::thread(&MockServer::_Accept, this);
+}
+
+inline MockServer::
+~MockServer() {
+    Stop();
+}
+
+//------------------------------- OPERATIONS ---------------------------------
+
+inline Port MockServer::
+GetPort() const {
+    return port_;
+}
+
+inline Index MockServer::
+GetIndex() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_;
+}
+
+inline void MockServer::
+SetLatency(uint64_t delay, uint64_t jitter) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    delay_ = delay;
+    jitter_ = jitter;
+}
+
+inline void MockServer::
+SetClientUrls(const std::vector<std::string>& urls) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    client_urls_ = urls;
+}
+
+inline void MockServer::
+SetHealthy(bool healthy) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    healthy_ = healthy;
+}
+
+inline void MockServer::
+SetVersion(const std::string& server, const std::string& cluster) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    server_version_ = server;
+    cluster_version_ = cluster;
+}
+
+inline void MockServer::
+SetProgressInterval(std::chrono::milliseconds interval) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    progress_interval_ = interval;
+}
+
+inline void MockServer::
+Stop() {
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_)
+            return;
+        stopping_ = true;
+        ShutdownSocket(listener_);
+        for (auto s :connections_)
+            ShutdownSocket(s);
+        workers.swap(workers_);
+        _WakeAll();
+        v3_changed_.notify_all();
+    }
+
+    acceptor_.join();
+    CloseSocket(listener_);
+    {
+        // _Accept may have started a last worker before it saw stopping_
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& w :workers_)
+            workers.push_back(std::move(w));
+        workers_.clear();
+    }
+    for (auto& w :workers)
+        w.join();
+}
+
+//------------------------------ CONNECTIONS ---------------------------------
+
+inline void MockServer::
+_Accept() {
+    for (;;) {
+        Socket s = accept(listener_, NULL, NULL);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            if (s != kInvalidSocket)
+                CloseSocket(s);
+            return;
+        }
+        if (s == kInvalidSocket)
+            continue;
+
+        SetNoDelay(s);
+        connections_.insert(s);
+        workers_.push_back(std::thread(&MockServer::_Serve, this, s));
+    }
+}
+
+inline void MockServer::
+_Serve(Socket s) {
+    std::minstd_rand random(static_cast<unsigned>(s) + 1);
+    std::string buffer;
+    Request request;
+
+    while (_ReadRequest(s, buffer, request)) {
+        if (request.method == "POST" && request.path == "/v3/watch") {
+            _StreamWatch(s, request);
+            break;
+        }
+        Response response = _Handle(request);
+        if (response.drop)
+            break;
+
+        uint64_t delay, jitter;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            delay = delay_;
+            jitter = jitter_;
+        }
+        if (jitter)
+            delay += random() % (jitter + 1);
+        if (delay)
+            std::this_thread::sleep_for(std::chrono::microseconds(delay));
+
+        std::string out = "HTTP/1.1 " + std::to_string(response.status) +
+            " " + _Reason(response.status) + "\r\n";
+        out += "Content-Type: application/json\r\n";
+        out += "X-Etcd-Index: " + std::to_string(response.index) + "\r\n";
+        out += "Content-Length: " + std::to_string(response.body.size());
+        out += request.close ? "\r\nConnection: close\r\n\r\n" : "\r\n\r\n";
+        out += response.body;
+        if (! SendAll(s, out) || request.close)
+            break;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    connections_.erase(s);
+    CloseSocket(s);
+}
+
+inline bool MockServer::
+_ReadRequest(Socket s, std::string& buffer, Request& request) {
+    HttpMessage m;
+    if (! ReadHttpMessage(s, buffer, m, false))
+        return false;
+
+    request.method = m.method;
+    request.close = m.close;
+    request.body = m.body;
+    request.params.clear();
+    std::string::size_type query = m.target.find('?');
+    request.path = _Decode(m.target.substr(0, query));
+    if (query != std::string::npos)
+        _ParseParams(m.target.substr(query + 1), request.params);
+    // Form values take precedence over the query, as in etcd
+    _ParseParams(m.body, request.params);
+    return true;
+}
+
+inline void MockServer::
+_StreamWatch(Socket s, const Request& request) {
+    std::string out = "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json\r\n"
+        "Transfer-Encoding: chunked\r\n\r\n";
+    std::vector<MockV3Store::Watcher> watchers;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::string messages = v3_.WatchStart(request.body, watchers);
+    Clock::time_point progress = Clock::now() + progress_interval_;
+    while (! stopping_) {
+        if (! messages.empty()) {
+            char size[20];
+            std::snprintf(size, sizeof(size), "%zx\r\n", messages.size());
+            out += size + messages + "\r\n";
+        }
+        // Nothing is sent under the lock, a slow reader must not stall
+        // the server
+        lock.unlock();
+        bool open = (out.empty() || SendAll(s, out)) && ! PeerClosed(s);
+        out.clear();
+        lock.lock();
+        if (! open)
+            break;
+
+        // Changes wake the stream, lease expiries are polled for
+        v3_changed_.wait_until(lock, std::min(
+            progress, Clock::now() + std::chrono::milliseconds(100)));
+        if (stopping_)
+            break;
+        messages = v3_.WatchPoll(watchers);
+        if (Clock::now() >= progress) {
+            messages += v3_.WatchProgress(watchers);
+            progress = Clock::now() + progress_interval_;
+        }
+    }
+}
+
+//------------------------------- KEYS API -----------------------------------
+
+inline MockServer::Response MockServer::
+_Handle(const Request& request) {
+    static const std::string kPrefix = "/v2/keys";
+    static const std::string kStats = "/v2/stats/";
+    static const std::string kV3 = "/v3/";
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopping_) {
+        Response response;
+        response.drop = true;
+        return response;
+    }
+    if (request.method == "GET" &&
+        request.path.compare(0, kStats.size(), kStats) == 0) {
+        _Expire();
+        return _Stats(request.path.substr(kStats.size()));
+    }
+    if (request.method == "GET" && request.path == "/v2/members")
+        return _Members();
+    if (request.method == "POST" &&
+        request.path.compare(0, kV3.size(), kV3) == 0) {
+        MockV3Store::Result result = v3_.Handle(request.path, request.body);
+        v3_changed_.notify_all();
+        Response response;
+        response.status = result.status;
+        response.body = result.body;
+        response.index = index_;
+        return response;
+    }
+    if (request.method == "GET" && request.path == "/health") {
+        Response response;
+        response.status = healthy_ ? 200 : 503;
+        response.body = healthy_ ? "{\"health\": \"true\"}" :
+                                   "{\"health\": \"false\"}";
+        return response;
+    }
+    if (request.method == "GET" && request.path == "/version") {
+        Response response;
+        response.body = "{\"etcdserver\":\"" + server_version_ +
+                        "\",\"etcdcluster\":\"" + cluster_version_ + "\"}";
+        return response;
+    }
+    if (request.path.compare(0, kPrefix.size(), kPrefix) != 0) {
+        Response response;
+        response.status = 404;
+        response.body = "404 page not found\n";
+        response.index = index_;
+        return response;
+    }
+
+    _Expire();
+    std::string key = _CleanKey(request.path.substr(kPrefix.size()));
+    if (request.method == "GET") {
+        Params::const_iterator wait = request.params.find("wait");
+        if (wait != request.params.end() && wait->second == "true")
+            return _Wait(key, request.params, lock);
+    }
+
+    Response response;
+    if (request.method == "GET") {
+        response = _Get(key, request.params);
+    } else if (request.method == "PUT") {
+        response = _Set(key, request.params);
+    } else if (request.method == "POST") {
+        response = _Create(key, request.params);
+    } else if (request.method == "DELETE") {
+        response = _Delete(key, request.params);
+    } else {
+        response.status = 405;
+        response.index = index_;
+        return response;
+    }
+    _Count(request, response);
+    return response;
+}
+
+inline MockServer::Response MockServer::
+_Get(const std::string& key, const Params& params) {
+    std::map<std::string, Node>::const_iterator it = nodes_.find(key);
+    if (it == nodes_.end())
+        return _Error(100, key);
+
+    Params::const_iterator recursive = params.find("recursive");
+    Response response;
+    response.index = index_;
+    response.body = "{\"action\":\"get\",\"node\":" +
+        _NodeJson(key, it->second, true,
+                  recursive != params.end() && recursive->second == "true") +
+        "}";
+    return response;
+}
+
+inline MockServer::Response MockServer::
+_Wait(const std::string& key,
+      const Params& params,
+      std::unique_lock<std::mutex>& lock) {
+    Params::const_iterator it = params.find("recursive");
+    bool recursive = it != params.end() && it->second == "true";
+
+    Waiter waiter;
+    waiter.key = key;
+    waiter.recursive = recursive;
+    waiter.since = index_ + 1;
+    it = params.find("waitIndex");
+    if (it != params.end()) {
+        char* end = NULL;
+        waiter.since = std::strtoull(it->second.c_str(), &end, 10);
+        if (it->second.empty() || *end)
+            return _Error(203, "invalid value for waitIndex");
+    }
+    waiters_.insert(&waiter);
+    struct Unregister {
+        ~Unregister() { waiters.erase(waiter); }
+        std::set<Waiter*>& waiters;
+        Waiter* waiter;
+    } unregister = {waiters_, &waiter};
+
+    Response response;
+    response.index = index_;
+    for (;;) {
+        if (history_cleared_ && waiter.since < history_.front().index) {
+            return _Error(401, "the requested history has been cleared [" +
+                std::to_string(history_.front().index) + "/" +
+                std::to_string(waiter.since) + "]");
+        }
+        // The history is ordered by index, only events from since on are
+        // looked at
+        std::deque<Event>::const_iterator event = std::lower_bound(
+            history_.begin(), history_.end(), waiter.since,
+            [](const Event& e, Index i) { return e.index < i; });
+        for (; event != history_.end(); ++event) {
+            if (_Matches(*event, key, recursive)) {
+                response.body = event->json;
+                return response;
+            }
+        }
+        if (! history_.empty())
+            waiter.since = std::max(waiter.since,
+                                    history_.back().index + 1);
+
+        // Wake up for the next TTL to expire while nothing else happens
+        if (next_expiry_ == Clock::time_point::max())
+            waiter.changed.wait(lock);
+        else
+            waiter.changed.wait_until(lock, next_expiry_);
+        if (stopping_) {
+            response.drop = true;
+            return response;
+        }
+        _Expire();
+    }
+}
+
+inline MockServer::Response MockServer::
+_Set(const std::string& key, const Params& params) {
+    if (key == "/")
+        return _Error(107, "/");
+
+    Params::const_iterator it;
+    bool dir = (it = params.find("dir")) != params.end() &&
+        it->second == "true";
+    std::string value;
+    bool has_value = (it = params.find("value")) != params.end();
+    if (has_value)
+        value = it->second;
+    if (dir && ! value.empty())
+        return _Error(210, "value and dir");
+
+    Node node;
+    node.dir = dir;
+    node.value = value;
+    if ((it = params.find("ttl")) != params.end() && ! it->second.empty()) {
+        char* end = NULL;
+        long long ttl = std::strtoll(it->second.c_str(), &end, 10);
+        if (*end || ttl < 0)
+            return _Error(209, "");
+        node.ttl = true;
+        node.expires = Clock::now() + std::chrono::seconds(ttl);
+        if (node.expires < next_expiry_) {
+            // Waiters sleep until the previous expiry
+            next_expiry_ = node.expires;
+            _WakeAll();
+        }
+    }
+
+    bool has_prev_value = (it = params.find("prevValue")) != params.end();
+    std::string prev_value = has_prev_value ? it->second : std::string();
+    if (has_prev_value && prev_value.empty())
+        return _Error(201, "prevValue is Required in POST form");
+
+    Index prev_index = 0;
+    if ((it = params.find("prevIndex")) != params.end()) {
+        char* end = NULL;
+        prev_index = std::strtoull(it->second.c_str(), &end, 10);
+        if (it->second.empty() || *end)
+            return _Error(203, "");
+    }
+
+    int prev_exist = -1;
+    if ((it = params.find("prevExist")) != params.end()) {
+        if (it->second == "true")
+            prev_exist = 1;
+        else if (it->second == "false")
+            prev_exist = 0;
+        else
+            return _Error(210, "invalid value for prevExist");
+    }
+
+    std::map<std::string, Node>::iterator found = nodes_.find(key);
+    const bool exists = found != nodes_.end();
+    std::string action = "set";
+
+    if (has_prev_value || prev_index) {
+        if (! exists)
+            return _Error(100, key);
+        if (found->second.dir)
+            return _Error(102, key);
+        std::string cause;
+        if (has_prev_value && prev_value != found->second.value)
+            cause += "[" + prev_value + " != " + found->second.value + "]";
+        if (prev_index && prev_index != found->second.modified) {
+            cause += (cause.empty() ? "[" : " [") +
+                std::to_string(prev_index) + " != " +
+                std::to_string(found->second.modified) + "]";
+        }
+        if (! cause.empty())
+            return _Error(101, cause);
+        action = "compareAndSwap";
+    } else if (prev_exist == 1) {
+        if (! exists)
+            return _Error(100, key);
+        if (found->second.dir != dir)
+            return _Error(found->second.dir ? 102 : 104, key);
+        action = "update";
+    } else if (prev_exist == 0) {
+        if (exists)
+            return _Error(105, key);
+        action = "create";
+    } else if (exists && (found->second.dir || dir)) {
+        return _Error(102, key);
+    }
+
+    Response response;
+    if (! exists && ! _MakeParents(key, response))
+        return response;
+
+    std::string prev_json;
+    Node prev;
+    if (exists) {
+        prev = found->second;
+        prev_json = _NodeJson(key, prev, false, false);
+        node.created = prev.created;
+        if (action == "update" && dir) {
+            // Updating a directory only changes its TTL
+            node.value.clear();
+        } else if (action == "update" && ! has_value) {
+            node.value = prev.value;
+        }
+    }
+
+    response.status = exists ? 200 : 201;
+    response.body = _Store(key, node, action, exists ? &prev : NULL,
+                           prev_json);
+    response.index = index_;
+    return response;
+}
+
+inline MockServer::Response MockServer::
+_Create(const std::string& dir, const Params& params) {
+    // In-order keys are named after the index which creates them
+    char name[32];
+    snprintf(name, sizeof(name), "%020llu",
+             (unsigned long long) (index_ + 1));
+    std::string key = (dir == "/" ? dir : dir + "/") + name;
+
+    std::map<std::string, Node>::const_iterator it = nodes_.find(dir);
+    if (it != nodes_.end() && ! it->second.dir)
+        return _Error(104, dir);
+
+    Params create(params);
+    create["prevExist"] = "false";
+    create.erase("prevValue");
+    create.erase("prevIndex");
+    return _Set(key, create);
+}
+
+inline MockServer::Response MockServer::
+_Delete(const std::string& key, const Params& params) {
+    if (key == "/")
+        return _Error(107, "/");
+
+    Params::const_iterator it;
+    bool dir = (it = params.find("dir")) != params.end() &&
+        it->second == "true";
+    bool recursive = (it = params.find("recursive")) != params.end() &&
+        it->second == "true";
+    bool has_prev_value = (it = params.find("prevValue")) != params.end();
+    std::string prev_value = has_prev_value ? it->second : std::string();
+    Index prev_index = 0;
+    if ((it = params.find("prevIndex")) != params.end()) {
+        char* end = NULL;
+        prev_index = std::strtoull(it->second.c_str(), &end, 10);
+        if (it->second.empty() || *end)
+            return _Error(203, "");
+    }
+
+    std::map<std::string, Node>::iterator found = nodes_.find(key);
+    if (found == nodes_.end())
+        return _Error(100, key);
+
+    Node prev = found->second;
+    std::string action = "delete";
+    if (has_prev_value || prev_index) {
+        if (prev.dir)
+            return _Error(102, key);
+        std::string cause;
+        if (has_prev_value && prev_value != prev.value)
+            cause += "[" + prev_value + " != " + prev.value + "]";
+        if (prev_index && prev_index != prev.modified) {
+            cause += (cause.empty() ? "[" : " [") +
+                std::to_string(prev_index) + " != " +
+                std::to_string(prev.modified) + "]";
+        }
+        if (! cause.empty())
+            return _Error(101, cause);
+        action = "compareAndDelete";
+    } else if (prev.dir) {
+        if (! dir && ! recursive)
+            return _Error(102, key);
+        if (! recursive && _HasChildren(key))
+            return _Error(108, key);
+    }
+
+    std::string prev_json = _NodeJson(key, prev, false, false);
+    _RemoveTree(key);
+
+    ++index_;
+    std::string json = "{\"action\":\"" + action + "\",\"node\":" +
+        _RemovedJson(key, prev) + ",\"prevNode\":" + prev_json + "}";
+    _Publish(index_, key, prev.dir, json);
+
+    Response response;
+    response.body = json;
+    response.index = index_;
+    return response;
+}
+
+//------------------------------- STATS API ----------------------------------
+
+inline MockServer::Response MockServer::
+_Stats(const std::string& name) {
+    static const char kId[] = "8e9e05c52164694d";
+    static const char* const kStoreStats[] = {
+        "compareAndDeleteFail", "compareAndDeleteSuccess",
+        "compareAndSwapFail", "compareAndSwapSuccess",
+        "createFail", "createSuccess", "deleteFail", "deleteSuccess",
+        "expireCount", "getsFail", "getsSuccess", "setsFail", "setsSuccess",
+        "updateFail", "updateSuccess"
+    };
+
+    Response response;
+    response.index = index_;
+    if (name == "self") {
+        long long uptime = std::chrono::duration_cast<std::chrono::seconds>(
+            Clock::now() - started_).count();
+        response.body = std::string("{\"name\":\"default\",\"id\":\"") +
+            kId + "\",\"state\":\"StateLeader\",\"startTime\":\"" +
+            start_time_ + "\",\"leaderInfo\":{\"leader\":\"" + kId +
+            "\",\"uptime\":\"" + std::to_string(uptime) +
+            "s\",\"startTime\":\"" + start_time_ +
+            "\"},\"recvAppendRequestCnt\":0,\"sendAppendRequestCnt\":0}";
+    } else if (name == "leader") {
+        response.body = std::string("{\"leader\":\"") + kId +
+            "\",\"followers\":{}}";
+    } else if (name == "store") {
+        response.body = "{";
+        for (size_t i = 0; i < sizeof(kStoreStats) / sizeof(kStoreStats[0]);
+             ++i) {
+            std::map<std::string, uint64_t>::const_iterator it =
+                store_stats_.find(kStoreStats[i]);
+            response.body += std::string("\"") + kStoreStats[i] + "\":" +
+                std::to_string(it == store_stats_.end() ? 0 : it->second) +
+                ",";
+        }
+        response.body += "\"watchers\":" + std::to_string(waiters_.size()) +
+            "}";
+    } else {
+        response.status = 404;
+        response.body = "404 page not found\n";
+    }
+    return response;
+}
+
+inline MockServer::Response MockServer::
+_Members() const {
+    Response response;
+    response.index = index_;
+    response.body = "{\"members\":[";
+    for (size_t i = 0; i < client_urls_.size(); ++i) {
+        char id[17];
+        snprintf(id, sizeof(id), "%016llx",
+                      0x8e9e05c52164694dULL + (unsigned long long) i);
+        if (i)
+            response.body += ",";
+        response.body += std::string("{\"id\":\"") + id + "\",\"name\":\"";
+        if (! client_urls_[i].empty())
+            response.body += "member" + std::to_string(i);
+        response.body += "\",\"peerURLs\":[\"http://127.0.0.1:" +
+            std::to_string(2380 + i) + "\"],\"clientURLs\":[";
+        if (! client_urls_[i].empty())
+            response.body += "\"" + _Escape(client_urls_[i]) + "\"";
+        response.body += "]}";
+    }
+    response.body += "]}";
+    return response;
+}
+
+inline void MockServer::
+_Count(const Request& request, const Response& response) {
+    const Params& params = request.params;
+    bool compare = params.count("prevValue") || params.count("prevIndex");
+    Params::const_iterator exist = params.find("prevExist");
+
+    std::string name;
+    if (request.method == "GET")
+        name = "gets";
+    else if (request.method == "POST")
+        name = "create";
+    else if (request.method == "DELETE")
+        name = compare ? "compareAndDelete" : "delete";
+    else if (compare)
+        name = "compareAndSwap";
+    else if (exist != params.end())
+        name = exist->second == "true" ? "update" : "create";
+    else
+        name = "sets";
+    ++store_stats_[name + (response.status < 400 ? "Success" : "Fail")];
+}
+
+//------------------------------- STORE --------------------------------------
+
+inline MockServer::Response MockServer::
+_Error(int code, const std::string& cause) const {
+    const char* message = "Unknown error";
+    int status = 400;
+    switch (code) {
+      case 100: message = "Key not found"; status = 404; break;
+      case 101: message = "Compare failed"; status = 412; break;
+      case 102: message = "Not a file"; status = 403; break;
+      case 104: message = "Not a directory"; status = 403; break;
+      case 105: message = "Key already exists"; status = 412; break;
+      case 107: message = "Root is read only"; status = 403; break;
+      case 108: message = "Directory not empty"; status = 403; break;
+      case 201: message = "PrevValue is Required in POST form"; break;
+      case 203: message = "The given index in POST form is not a number";
+        break;
+      case 209: message = "The given TTL in POST form is not a number";
+        break;
+      case 210: message = "Invalid field"; break;
+      case 401: message = "The event in requested index is outdated and "
+                          "cleared"; break;
+    }
+
+    Response response;
+    response.status = status;
+    response.index = index_;
+    response.body = "{\"errorCode\":" + std::to_string(code) +
+        ",\"message\":\"" + message + "\",\"cause\":\"" + _Escape(cause) +
+        "\",\"index\":" + std::to_string(index_) + "}";
+    return response;
+}
+
+inline std::string MockServer::
+_Store(
+    const std::string& key,
+    Node& node,
+    const std::string& action,
+    const Node* prev,
+    const std::string& prev_json) {
+    node.modified = ++index_;
+    if (! prev)
+        node.created = node.modified;
+    nodes_[key] = node;
+
+    std::string json = "{\"action\":\"" + action + "\",\"node\":" +
+        _NodeJson(key, node, false, false);
+    if (prev)
+        json += ",\"prevNode\":" + prev_json;
+    json += "}";
+    _Publish(index_, key, node.dir, json);
+    return json;
+}
+
+inline bool MockServer::
+_MakeParents(const std::string& key, Response& error) {
+    std::vector<std::string> missing;
+    for (std::string parent = _Parent(key); ; parent = _Parent(parent)) {
+        std::map<std::string, Node>::const_iterator it = nodes_.find(parent);
+        if (it != nodes_.end()) {
+            if (! it->second.dir) {
+                error = _Error(104, parent);
+                return false;
+            }
+            break;
+        }
+        missing.push_back(parent);
+    }
+
+    // Implicitly created directories share the index of the change
+    for (size_t i = missing.size(); i > 0; --i) {
+        Node dir;
+        dir.dir = true;
+        dir.created = dir.modified = index_ + 1;
+        nodes_[missing[i - 1]] = dir;
+    }
+    return true;
+}
+
+inline void MockServer::
+_RemoveTree(const std::string& key) {
+    nodes_.erase(key);
+    std::string prefix = key + "/";
+    std::map<std::string, Node>::iterator it = nodes_.lower_bound(prefix);
+    while (it != nodes_.end() &&
+           it->first.compare(0, prefix.size(), prefix) == 0) {
+        it = nodes_.erase(it);
+    }
+}
+
+inline bool MockServer::
+_HasChildren(const std::string& key) const {
+    std::string prefix = key == "/" ? key : key + "/";
+    std::map<std::string, Node>::const_iterator it =
+        nodes_.upper_bound(prefix);
+    return it != nodes_.end() &&
+        it->first.compare(0, prefix.size(), prefix) == 0;
+}
+
+inline void MockServer::
+_Expire() {
+    Clock::time_point now = Clock::now();
+    if (now < next_expiry_)
+        return;
+
+    std::vector<std::string> expired;
+    next_expiry_ = Clock::time_point::max();
+    for (auto const& n :nodes_) {
+        if (! n.second.ttl)
+            continue;
+        if (n.second.expires <= now)
+            expired.push_back(n.first);
+        else
+            next_expiry_ = std::min(next_expiry_, n.second.expires);
+    }
+
+    for (size_t i = 0; i < expired.size(); ++i) {
+        std::map<std::string, Node>::iterator it = nodes_.find(expired[i]);
+        if (it == nodes_.end())
+            continue;       // went away with an expired parent
+
+        Node prev = it->second;
+        std::string prev_json = _NodeJson(expired[i], prev, false, false);
+        _RemoveTree(expired[i]);
+
+        ++index_;
+        ++store_stats_["expireCount"];
+        _Publish(index_, expired[i], prev.dir,
+                 "{\"action\":\"expire\",\"node\":" +
+                 _RemovedJson(expired[i], prev) + ",\"prevNode\":" +
+                 prev_json + "}");
+    }
+}
+
+inline void MockServer::
+_Publish(
+    Index index,
+    const std::string& key,
+    bool dir,
+    const std::string& json) {
+    Event event;
+    event.index = index;
+    event.key = key;
+    event.dir = dir;
+    event.json = json;
+    history_.push_back(event);
+    if (history_.size() > kHistorySize) {
+        history_.pop_front();
+        history_cleared_ = true;
+    }
+    for (auto w :waiters_) {
+        if (_Matches(event, w->key, w->recursive))
+            w->changed.notify_one();
+        else if (w->since == index)
+            w->since = index + 1;
+    }
+}
+
+inline void MockServer::
+_WakeAll() {
+    for (auto w :waiters_)
+        w->changed.notify_one();
+}
+
+inline bool MockServer::
+_Matches(const Event& event, const std::string& key, bool recursive) const {
+    if (event.key == key)
+        return true;
+    // Changes below the key for recursive watches, and the removal of a
+    // directory for watches on its children
+    if (recursive && _IsBelow(event.key, key))
+        return true;
+    return event.dir && _IsBelow(key, event.key);
+}
+
+//------------------------------- FORMAT -------------------------------------
+
+inline std::string MockServer::
+_NodeJson(
+    const std::string& key,
+    const Node& node,
+    bool children,
+    bool recursive) const {
+    std::string json = "{";
+    if (key != "/")
+        json += "\"key\":\"" + _Escape(key) + "\",";
+    if (node.dir)
+        json += "\"dir\":true,";
+    else
+        json += "\"value\":\"" + _Escape(node.value) + "\",";
+
+    if (node.ttl) {
+        Clock::duration left = node.expires - Clock::now();
+        std::chrono::system_clock::time_point at =
+            std::chrono::system_clock::now() +
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                left);
+        std::time_t t = std::chrono::system_clock::to_time_t(at);
+        std::tm tm;
+#ifdef _WIN32
+        gmtime_s(&tm, &t);
+#else
+        gmtime_r(&t, &tm);
+#endif
+        char expiration[40];
+        strftime(expiration, sizeof(expiration), "%Y-%m-%dT%H:%M:%SZ", &tm);
+        long long ttl = (long long) std::chrono::duration_cast<
+            std::chrono::seconds>(left + std::chrono::milliseconds(999))
+            .count();
+        json += "\"expiration\":\"" + std::string(expiration) +
+            "\",\"ttl\":" + std::to_string(ttl > 0 ? ttl : 1) + ",";
+    }
+
+    if (node.dir && children) {
+        std::string nodes;
+        std::string prefix = key == "/" ? key : key + "/";
+        std::map<std::string, Node>::const_iterator it =
+            nodes_.upper_bound(prefix);
+        for (; it != nodes_.end() &&
+               it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+            if (it->first.find('/', prefix.size()) != std::string::npos ||
+                _IsHidden(it->first))
+                continue;   // grandchildren come with their directory
+            if (! nodes.empty())
+                nodes += ',';
+            nodes += _NodeJson(it->first, it->second, recursive, recursive);
+        }
+        if (! nodes.empty())
+            json += "\"nodes\":[" + nodes + "],";
+    }
+
+    if (key == "/") {
+        json.erase(json.size() - 1);
+        return json + "}";
+    }
+    return json + "\"modifiedIndex\":" + std::to_string(node.modified) +
+        ",\"createdIndex\":" + std::to_string(node.created) + "}";
+}
+
+/**
+ * @brief Node of a delete or expire event, modified at the current index
+ */
+inline std::string MockServer::
+_RemovedJson(const std::string& key, const Node& prev) const {
+    return "{\"key\":\"" + _Escape(key) + "\"," +
+        (prev.dir ? "\"dir\":true," : "") +
+        "\"modifiedIndex\":" + std::to_string(index_) +
+        ",\"createdIndex\":" + std::to_string(prev.created) + "}";
+}
+
+inline std::string MockServer::
+_Escape(const std::string& value) {
+    std::string out;
+    out.reserve(value.size());
+    for (size_t i = 0; i < value.size(); ++i) {
+        unsigned char c = value[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            char u[8];
+            snprintf(u, sizeof(u), "\\u%04x", c);
+            out += u;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+inline std::string MockServer::
+_Decode(const std::string& value) {
+    std::string out;
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] == '+') {
+            out += ' ';
+        } else if (value[i] == '%' && i + 2 < value.size() &&
+                   isxdigit((unsigned char) value[i + 1]) &&
+                   isxdigit((unsigned char) value[i + 2])) {
+            out += (char) std::strtol(value.substr(i + 1, 2).c_str(), NULL,
+                                      16);
+            i += 2;
+        } else {
+            out += value[i];
+        }
+    }
+    return out;
+}
+
+inline std::string MockServer::
+_CleanKey(const std::string& key) {
+    std::string out("/");
+    for (size_t i = 0; i < key.size(); ++i) {
+        if (key[i] == '/' && out[out.size() - 1] == '/')
+            continue;
+        out += key[i];
+    }
+    if (out.size() > 1 && out[out.size() - 1] == '/')
+        out.erase(out.size() - 1);
+    return out;
+}
+
+inline std::string MockServer::
+_Parent(const std::string& key) {
+    std::string::size_type slash = key.rfind('/');
+    return slash == 0 ? "/" : key.substr(0, slash);
+}
+
+inline bool MockServer::
+_IsHidden(const std::string& key) {
+    return key[key.rfind('/') + 1] == '_';
+}
+
+inline bool MockServer::
+_IsBelow(const std::string& key, const std::string& dir) {
+    if (dir == "/")
+        return key.size() > 1;
+    return key.size() > dir.size() && key[dir.size()] == '/' &&
+        key.compare(0, dir.size(), dir) == 0;
+}
+
+inline void MockServer::
+_ParseParams(const std::string& text, Params& params) {
+    // The client separates form fields with ';', older etcd accepted both
+    std::string::size_type pos = 0;
+    while (pos < text.size()) {
+        std::string::size_type end = text.find_first_of("&;", pos);
+        if (end == std::string::npos)
+            end = text.size();
+        std::string field = text.substr(pos, end - pos);
+        pos = end + 1;
+        if (field.empty())
+            continue;
+        std::string::size_type eq = field.find('=');
+        if (eq == std::string::npos)
+            params[_Decode(field)] = "";
+        else
+            params[_Decode(field.substr(0, eq))] =
+                _Decode(field.substr(eq + 1));
+    }
+}
+
+inline const char* MockServer::
+_Reason(int status) {
+    switch (status) {
+      case 200: return "OK";
+      case 201: return "Created";
+      case 400: return "Bad Request";
+      case 403: return "Forbidden";
+      case 404: return "Not Found";
+      case 405: return "Method Not Allowed";
+      case 412: return "Precondition Failed";
+      case 503: return "Service Unavailable";
+    }
+    return "Unknown";
+}
+
+} // namespace test
+} // namespace etcd
+
+#endif // __ETCD_MOCK_SERVER_HPP_INCLUDED__
@@ -0,0 +1,837 @@
+#ifndef __ETCD_TEST_MOCK_V3_HPP_INCLUDED__
+#define __ETCD_TEST_MOCK_V3_HPP_INCLUDED__
+
+#include "internal/base64.hpp"
+#include "json.hpp"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace etcd {
+namespace test {
+
+/**
+ * @brief The v3 keyspace of the mock server, as seen through the JSON
+ * gateway: /v3/kv/range, /v3/kv/put, /v3/kv/deleterange, /v3/kv/txn,
+ * /v3/kv/compaction and /v3/lease/grant, revoke, keepalive and timetolive,
+ * and the messages of /v3/watch streams, served by MockServer.
+ *
+ * Every key keeps its history, so reads at a past revision are answered
+ * until the revision is compacted. Like etcd, a delete which removes no key
+ * does not create a revision. Transactions are checked as by etcd: at most
+ * kMaxTxnOps operations per branch and no key written twice, and every
+ * write of a transaction shares one revision. Leases expire on the first
+ * request after their deadline, deleting their keys. A keepalive body may
+ * hold many requests, one per line, answered by as many lines. A watch
+ * started before the compacted revision is created, then canceled with
+ * the compact revision. int64 fields are answered as JSON strings and
+ * fields left at their default are omitted, as the gateway does.
+ *
+ * Not thread safe, MockServer calls it with its mutex held.
+ */
+class MockV3Store {
+  public:
+    // CONSTANTS
+    static const size_t kMaxTxnOps = 128;
+
+    // TYPES
+    struct Result {
+        Result() :status(200) {}
+
+        int status;
+        std::string body;
+    };
+
+    // A watch of a /v3/watch stream
+    struct Watcher {
+        Watcher()
+          :id(0), next(0), prev_kv(false), progress_notify(false),
+           canceled(false)
+          {}
+
+        int64_t id;
+        std::string key;
+        std::string range_end;
+        int64_t next;           // revision of the next event to send
+        bool prev_kv;
+        bool progress_notify;
+        bool canceled;
+    };
+
+    // LIFECYCLE
+    MockV3Store()
+      :revision_(1),
+       compacted_(0),
+       next_lease_(7587862078219001000LL)
+      {}
+
+    // OPERATIONS
+    /**
+     * @brief Serve a POST to a /v3/ path
+     */
+    Result Handle(const std::string& path, const std::string& body);
+
+    /**
+     * @brief Open a watch stream
+     *
+     * @param body create and cancel requests, one per line
+     * @param watchers receives the watches of the stream
+     *
+     * @return the messages to send first, a line each
+     */
+    std::string WatchStart(const std::string& body,
+                           std::vector<Watcher>& watchers);
+
+    /**
+     * @brief Messages of the changes made since the last call, a line for
+     * each watcher with events
+     */
+    std::string WatchPoll(std::vector<Watcher>& watchers);
+
+    /**
+     * @brief Progress notifications of the watchers asking for them
+     */
+    std::string WatchProgress(const std::vector<Watcher>& watchers) const;
+
+    /**
+     * @brief Revision of the last change, 1 for an empty store
+     */
+    int64_t GetRevision() const {
+        return revision_;
+    }
+
+  private:
+    // TYPES
+    struct Version {
+        Version() :mod(0), create(0), version(0), lease(0), deleted(false) {}
+
+        int64_t mod;
+        int64_t create;
+        int64_t version;
+        int64_t lease;
+        std::string value;
+        bool deleted;           // tombstone
+    };
+
+    typedef std::map<std::string, std::vector<Version> > History;
+    typedef std::chrono::steady_clock Clock;
+
+    struct Lease {
+        int64_t ttl;            // granted, in seconds
+        Clock::time_point expires;
+    };
+
+    // DATA MEMBERS
+    History keys_;
+    int64_t revision_;
+    int64_t compacted_;
+    std::map<int64_t, Lease> leases_;
+    int64_t next_lease_;
+
+    // OPERATIONS
+    Result _Range(const Json& request) const;
+    Result _Put(const Json& request);
+    Result _DeleteRange(const Json& request);
+    Result _Txn(const Json& request);
+    Result _Compact(const Json& request);
+    Result _LeaseGrant(const Json& request);
+    Result _LeaseRevoke(const Json& request);
+    Result _LeaseKeepAlive(const std::string& body);
+    Result _LeaseTimeToLive(const Json& request) const;
+
+    void _ExpireLeases();
+    void _DeleteLeaseKeys(int64_t id);
+    std::vector<std::string> _LeaseKeys(int64_t id) const;
+
+    bool _Check(const Json& ops, Result& error) const;
+    bool _Compare(const Json& compare) const;
+    bool _RangeFields(const Json& request, int64_t current,
+                      std::string& fields, Result& error) const;
+    void _PutFields(const Json& request, int64_t revision,
+                    std::string& fields);
+    bool _DeleteFields(const Json& request, int64_t revision,
+                       std::string& fields);
+
+    Result _Reply(const std::string& fields) const;
+    Result _Error(int code, const std::string& message) const;
+    std::string _Header() const;
+
+    const Version* _At(const std::vector<Version>& history,
+                       int64_t revision) const;
+    History::const_iterator _End(const std::string& key,
+                                 const std::string& range_end) const;
+    static bool _Bytes(const Json& request, const char* name,
+                       std::string& out);
+    static std::string _KvJson(const std::string& key, const Version& v,
+                               bool keys_only);
+    static std::string _Int(int64_t value);
+};
+
+//------------------------------- OPERATIONS ---------------------------------
+
+inline MockV3Store::Result MockV3Store::
+Handle(const std::string& path, const std::string& body) {
+    _ExpireLeases();
+    if (path == "/v3/lease/keepalive")
+        return _LeaseKeepAlive(body);
+
+    Json request;
+    if (! Json::Parse(body, request) || request.type != Json::JSON_OBJECT)
+        return _Error(3, "invalid character in request body");
+
+    if (path == "/v3/kv/range")
+        return _Range(request);
+    if (path == "/v3/kv/put")
+        return _Put(request);
+    if (path == "/v3/kv/deleterange")
+        return _DeleteRange(request);
+    if (path == "/v3/kv/txn")
+        return _Txn(request);
+    if (path == "/v3/kv/compaction")
+        return _Compact(request);
+    if (path == "/v3/lease/grant")
+        return _LeaseGrant(request);
+    if (path == "/v3/lease/revoke" || path == "/v3/kv/lease/revoke")
+        return _LeaseRevoke(request);
+    if (path == "/v3/lease/timetolive" || path == "/v3/kv/lease/timetolive")
+        return _LeaseTimeToLive(request);
+
+    Result result;
+    result.status = 404;
+    result.body = "{\"error\":\"Not Found\",\"code\":5,"
+                  "\"message\":\"Not Found\"}";
+    return result;
+}
+
+inline std::string MockV3Store::
+WatchStart(const std::string& body, std::vector<Watcher>& watchers) {
+    _ExpireLeases();
+    std::string out;
+    int64_t next_id = 0;
+    for (size_t pos = 0; pos < body.size(); ) {
+        size_t end = body.find('\n', pos);
+        if (end == std::string::npos)
+            end = body.size();
+        Json message;
+        bool parsed = Json::Parse(body.substr(pos, end - pos), message);
+        pos = end + 1;
+        if (! parsed)
+            continue;
+
+        if (const Json* cancel = message.Find("cancel_request")) {
+            int64_t id = cancel->Int("watch_id");
+            for (auto& w :watchers) {
+                if (w.id == id && ! w.canceled) {
+                    w.canceled = true;
+                    out += "{\"result\":" + _Reply("\"watch_id\":" +
+                        _Int(id) + ",\"canceled\":true").body + "}\n";
+                }
+            }
+            continue;
+        }
+        const Json* create = message.Find("create_request");
+        if (! create)
+            continue;
+
+        // Ids given by the client are kept, others are numbered from 0
+        Watcher w;
+        w.id = create->Int("watch_id");
+        if (! w.id) {
+            while (std::find_if(watchers.begin(), watchers.end(),
+                                [next_id](const Watcher& x) {
+                                    return x.id == next_id;
+                                }) != watchers.end())
+                ++next_id;
+            w.id = next_id++;
+        }
+        _Bytes(*create, "key", w.key);
+        _Bytes(*create, "range_end", w.range_end);
+        int64_t start = create->Int("start_revision");
+        w.next = start > 0 ? start : revision_ + 1;
+        w.prev_kv = create->Bool("prev_kv");
+        w.progress_notify = create->Bool("progress_notify");
+
+        std::string id = "\"watch_id\":" + _Int(w.id);
+        out += "{\"result\":" + _Reply(id + ",\"created\":true").body +
+            "}\n";
+        if (start > 0 && start < compacted_) {
+            w.canceled = true;
+            out += "{\"result\":" + _Reply(id + ",\"canceled\":true,"
+                "\"compact_revision\":" + _Int(compacted_) +
+                ",\"cancel_reason\":\"etcdserver: mvcc: required revision "
+                "has been compacted\"").body + "}\n";
+        }
+        watchers.push_back(w);
+    }
+    return out;
+}
+
+inline std::string MockV3Store::
+WatchPoll(std::vector<Watcher>& watchers) {
+    _ExpireLeases();
+    std::string out;
+    for (auto& w :watchers) {
+        if (w.canceled || w.next > revision_)
+            continue;
+
+        // Every version made since next, in revision order
+        std::vector<std::pair<int64_t, std::string> > events;
+        History::const_iterator end = _End(w.key, w.range_end);
+        for (History::const_iterator it = keys_.lower_bound(w.key);
+             it != end; ++it) {
+            const std::vector<Version>& history = it->second;
+            for (size_t i = 0; i < history.size(); ++i) {
+                if (history[i].mod < w.next)
+                    continue;
+                const Version& v = history[i];
+                std::string event;
+                if (v.deleted) {
+                    event = "{\"type\":\"DELETE\",\"kv\":{\"key\":\"" +
+                        etcd::internal::Base64Encode(it->first) +
+                        "\",\"mod_revision\":" + _Int(v.mod) + "}";
+                } else {
+                    event = "{\"kv\":" + _KvJson(it->first, v, false);
+                }
+                if (w.prev_kv && i > 0 && ! history[i - 1].deleted)
+                    event += ",\"prev_kv\":" +
+                        _KvJson(it->first, history[i - 1], false);
+                events.push_back(std::make_pair(v.mod, event + "}"));
+            }
+        }
+        w.next = revision_ + 1;
+        if (events.empty())
+            continue;
+
+        std::stable_sort(events.begin(), events.end(),
+            [](const std::pair<int64_t, std::string>& a,
+               const std::pair<int64_t, std::string>& b) {
+                return a.first < b.first;
+            });
+        std::string list;
+        for (size_t i = 0; i < events.size(); ++i)
+            list += (i ? "," : "") + events[i].second;
+        out += "{\"result\":" + _Reply("\"watch_id\":" + _Int(w.id) +
+            ",\"events\":[" + list + "]").body + "}\n";
+    }
+    return out;
+}
+
+inline std::string MockV3Store::
+WatchProgress(const std::vector<Watcher>& watchers) const {
+    std::string out;
+    for (auto& w :watchers) {
+        if (w.progress_notify && ! w.canceled)
+            out += "{\"result\":" + _Reply("\"watch_id\":" +
+                _Int(w.id)).body + "}\n";
+    }
+    return out;
+}
+
+inline MockV3Store::Result MockV3Store::
+_Range(const Json& request) const {
+    std::string fields;
+    Result error;
+    if (! _RangeFields(request, revision_, fields, error))
+        return error;
+    return _Reply(fields);
+}
+
+inline MockV3Store::Result MockV3Store::
+_Put(const Json& request) {
+    int64_t lease = request.Int("lease");
+    if (lease && ! leases_.count(lease))
+        return _Error(5, "etcdserver: requested lease not found");
+    std::string fields;
+    _PutFields(request, ++revision_, fields);
+    return _Reply(fields);
+}
+
+inline MockV3Store::Result MockV3Store::
+_DeleteRange(const Json& request) {
+    std::string fields;
+    if (_DeleteFields(request, revision_ + 1, fields))
+        ++revision_;
+    return _Reply(fields);
+}
+
+inline MockV3Store::Result MockV3Store::
+_Txn(const Json& request) {
+    static const Json kNone;
+
+    const Json* compare = request.Find("compare");
+    bool succeeded = true;
+    for (size_t i = 0; compare && i < compare->items.size(); ++i)
+        succeeded = succeeded && _Compare(compare->items[i]);
+
+    const Json* ops = request.Find(succeeded ? "success" : "failure");
+    if (! ops)
+        ops = &kNone;
+    Result error;
+    if (! _Check(*ops, error))
+        return error;
+
+    // Reads see the writes made before them in the transaction
+    int64_t revision = revision_ + 1;
+    bool written = false;
+    std::vector<std::pair<std::string, std::string> > responses;
+    for (size_t i = 0; i < ops->items.size(); ++i) {
+        const Json& op = ops->items[i];
+        std::string fields;
+        if (const Json* range = op.Find("request_range")) {
+            if (! _RangeFields(*range, written ? revision : revision_,
+                               fields, error))
+                return error;
+            responses.push_back(std::make_pair("response_range", fields));
+        } else if (const Json* put = op.Find("request_put")) {
+            _PutFields(*put, revision, fields);
+            written = true;
+            responses.push_back(std::make_pair("response_put", fields));
+        } else if (const Json* del = op.Find("request_delete_range")) {
+            written = _DeleteFields(*del, revision, fields) || written;
+            responses.push_back(std::make_pair("response_delete_range",
+                                               fields));
+        }
+    }
+    if (written)
+        revision_ = revision;
+
+    std::string body;
+    if (succeeded)
+        body = "\"succeeded\":true";
+    if (! responses.empty()) {
+        if (! body.empty())
+            body += ',';
+        body += "\"responses\":[";
+        for (size_t i = 0; i < responses.size(); ++i) {
+            if (i)
+                body += ',';
+            body += "{\"" + responses[i].first + "\":" +
+                _Reply(responses[i].second).body + "}";
+        }
+        body += "]";
+    }
+    return _Reply(body);
+}
+
+inline MockV3Store::Result MockV3Store::
+_Compact(const Json& request) {
+    int64_t revision = request.Int("revision");
+    if (revision > revision_)
+        return _Error(11, "etcdserver: mvcc: required revision is a future "
+                          "revision");
+    if (revision <= compacted_)
+        return _Error(11, "etcdserver: mvcc: required revision has been "
+                          "compacted");
+
+    // Keep the version visible at the compacted revision and the newer ones
+    compacted_ = revision;
+    for (History::iterator it = keys_.begin(); it != keys_.end(); ) {
+        std::vector<Version>& history = it->second;
+        size_t keep = 0;
+        while (keep + 1 < history.size() && history[keep + 1].mod <= revision)
+            ++keep;
+        history.erase(history.begin(), history.begin() + keep);
+        if (history.size() == 1 && history[0].deleted)
+            keys_.erase(it++);
+        else
+            ++it;
+    }
+    return _Reply(std::string());
+}
+
+inline MockV3Store::Result MockV3Store::
+_LeaseGrant(const Json& request) {
+    int64_t id = request.Int("ID");
+    if (id && leases_.count(id))
+        return _Error(9, "etcdserver: lease already exists");
+    if (! id) {
+        while (leases_.count(next_lease_))
+            ++next_lease_;
+        id = next_lease_++;
+    }
+
+    Lease& lease = leases_[id];
+    lease.ttl = std::max<int64_t>(request.Int("TTL"), 1);
+    lease.expires = Clock::now() + std::chrono::seconds(lease.ttl);
+    return _Reply("\"ID\":" + _Int(id) + ",\"TTL\":" + _Int(lease.ttl));
+}
+
+inline MockV3Store::Result MockV3Store::
+_LeaseRevoke(const Json& request) {
+    int64_t id = request.Int("ID");
+    if (! leases_.erase(id))
+        return _Error(5, "etcdserver: requested lease not found");
+    _DeleteLeaseKeys(id);
+    return _Reply(std::string());
+}
+
+inline MockV3Store::Result MockV3Store::
+_LeaseKeepAlive(const std::string& body) {
+    Result result;
+    for (size_t pos = 0; pos < body.size(); ) {
+        size_t end = body.find('\n', pos);
+        if (end == std::string::npos)
+            end = body.size();
+        std::string line = body.substr(pos, end - pos);
+        pos = end + 1;
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        Json request;
+        if (! Json::Parse(line, request) ||
+            request.type != Json::JSON_OBJECT) {
+            // A stream fails with a last message, after the ones answered
+            result.body += "{\"error\":{\"grpc_code\":3,\"http_code\":400,"
+                "\"message\":\"invalid character in request body\","
+                "\"http_status\":\"Bad Request\"}}\n";
+            return result;
+        }
+
+        // An unknown or expired lease is answered with no TTL
+        int64_t id = request.Int("ID");
+        std::string fields = "\"ID\":" + _Int(id);
+        std::map<int64_t, Lease>::iterator it = leases_.find(id);
+        if (it != leases_.end()) {
+            it->second.expires = Clock::now() +
+                std::chrono::seconds(it->second.ttl);
+            fields += ",\"TTL\":" + _Int(it->second.ttl);
+        }
+        result.body += "{\"result\":" + _Reply(fields).body + "}\n";
+    }
+    return result;
+}
+
+inline MockV3Store::Result MockV3Store::
+_LeaseTimeToLive(const Json& request) const {
+    int64_t id = request.Int("ID");
+    std::map<int64_t, Lease>::const_iterator it = leases_.find(id);
+    if (it == leases_.end())
+        return _Reply("\"ID\":" + _Int(id) + ",\"TTL\":\"-1\"");
+
+    int64_t left = std::chrono::duration_cast<std::chrono::seconds>(
+        it->second.expires - Clock::now()).count();
+    std::string fields = "\"ID\":" + _Int(id) + ",\"TTL\":" +
+        _Int(std::max<int64_t>(left, 0)) + ",\"grantedTTL\":" +
+        _Int(it->second.ttl);
+    if (request.Bool("keys")) {
+        std::vector<std::string> keys = _LeaseKeys(id);
+        fields += ",\"keys\":[";
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (i)
+                fields += ',';
+            fields += "\"" + etcd::internal::Base64Encode(keys[i]) + "\"";
+        }
+        fields += "]";
+    }
+    return _Reply(fields);
+}
+
+inline void MockV3Store::
+_ExpireLeases() {
+    Clock::time_point now = Clock::now();
+    for (std::map<int64_t, Lease>::iterator it = leases_.begin();
+         it != leases_.end(); ) {
+        if (it->second.expires <= now) {
+            _DeleteLeaseKeys(it->first);
+            leases_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+inline void MockV3Store::
+_DeleteLeaseKeys(int64_t id) {
+    // Every key of the lease goes in one revision, as with etcd
+    std::vector<std::string> keys = _LeaseKeys(id);
+    if (keys.empty())
+        return;
+    ++revision_;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        Version tombstone;
+        tombstone.mod = revision_;
+        tombstone.deleted = true;
+        keys_[keys[i]].push_back(tombstone);
+    }
+}
+
+inline std::vector<std::string> MockV3Store::
+_LeaseKeys(int64_t id) const {
+    std::vector<std::string> keys;
+    for (History::const_iterator it = keys_.begin(); it != keys_.end();
+         ++it) {
+        const std::vector<Version>& history = it->second;
+        if (! history.empty() && ! history.back().deleted &&
+            history.back().lease == id)
+            keys.push_back(it->first);
+    }
+    return keys;
+}
+
+inline bool MockV3Store::
+_Check(const Json& ops, Result& error) const {
+    if (ops.items.size() > kMaxTxnOps) {
+        error = _Error(3, "etcdserver: too many operations in txn request");
+        return false;
+    }
+    std::vector<std::string> written;
+    for (size_t i = 0; i < ops.items.size(); ++i) {
+        const Json* put = ops.items[i].Find("request_put");
+        const Json* del = ops.items[i].Find("request_delete_range");
+        if (! put && ! del)
+            continue;
+        if (put && put->Int("lease") && ! leases_.count(put->Int("lease"))) {
+            error = _Error(5, "etcdserver: requested lease not found");
+            return false;
+        }
+        std::string key = (put ? put : del)->String("key");
+        if (std::find(written.begin(), written.end(), key) != written.end()) {
+            error = _Error(3, "etcdserver: duplicate key given in txn "
+                              "request");
+            return false;
+        }
+        written.push_back(key);
+    }
+    return true;
+}
+
+inline bool MockV3Store::
+_Compare(const Json& compare) const {
+    std::string key;
+    _Bytes(compare, "key", key);
+    History::const_iterator it = keys_.find(key);
+    const Version* v = it == keys_.end() ? NULL : _At(it->second, revision_);
+
+    std::string target = compare.String("target");
+    int order;
+    if (target == "VALUE") {
+        // A missing key fails every value comparison
+        if (! v)
+            return false;
+        std::string value;
+        _Bytes(compare, "value", value);
+        order = v->value.compare(value);
+    } else {
+        int64_t actual = 0, expected = 0;
+        if (target == "CREATE") {
+            actual = v ? v->create : 0;
+            expected = compare.Int("create_revision");
+        } else if (target == "MOD") {
+            actual = v ? v->mod : 0;
+            expected = compare.Int("mod_revision");
+        } else if (target == "LEASE") {
+            actual = v ? v->lease : 0;
+            expected = compare.Int("lease");
+        } else {
+            actual = v ? v->version : 0;
+            expected = compare.Int("version");
+        }
+        order = actual < expected ? -1 : actual > expected ? 1 : 0;
+    }
+
+    std::string result = compare.String("result");
+    if (result == "GREATER")
+        return order > 0;
+    if (result == "LESS")
+        return order < 0;
+    if (result == "NOT_EQUAL")
+        return order != 0;
+    return order == 0;
+}
+
+inline bool MockV3Store::
+_RangeFields(const Json& request, int64_t current, std::string& fields,
+             Result& error) const {
+    std::string key, range_end;
+    if (! _Bytes(request, "key", key) ||
+        ! _Bytes(request, "range_end", range_end)) {
+        error = _Error(3, "illegal base64 data");
+        return false;
+    }
+
+    int64_t revision = request.Int("revision");
+    if (revision > current) {
+        error = _Error(11, "etcdserver: mvcc: required revision is a future "
+                           "revision");
+        return false;
+    }
+    if (revision && revision < compacted_) {
+        error = _Error(11, "etcdserver: mvcc: required revision has been "
+                           "compacted");
+        return false;
+    }
+    if (revision <= 0)
+        revision = current;
+
+    int64_t limit = request.Int("limit");
+    bool keys_only = request.Bool("keys_only");
+    bool count_only = request.Bool("count_only");
+
+    int64_t count = 0;
+    std::string kvs;
+    History::const_iterator end = _End(key, range_end);
+    for (History::const_iterator it = keys_.lower_bound(key); it != end;
+         ++it) {
+        const Version* v = _At(it->second, revision);
+        if (! v)
+            continue;
+        ++count;
+        if (count_only || (limit > 0 && count > limit))
+            continue;
+        if (! kvs.empty())
+            kvs += ',';
+        kvs += _KvJson(it->first, *v, keys_only);
+    }
+
+    if (! kvs.empty())
+        fields += "\"kvs\":[" + kvs + "],";
+    if (limit > 0 && count > limit)
+        fields += "\"more\":true,";
+    if (count)
+        fields += "\"count\":" + _Int(count) + ",";
+    if (! fields.empty())
+        fields.erase(fields.size() - 1);
+    return true;
+}
+
+inline void MockV3Store::
+_PutFields(const Json& request, int64_t revision, std::string& fields) {
+    std::string key, value;
+    _Bytes(request, "key", key);
+    _Bytes(request, "value", value);
+
+    std::vector<Version>& history = keys_[key];
+    const Version* prev = history.empty() || history.back().deleted ?
+        NULL : &history.back();
+
+    Version v;
+    v.mod = revision;
+    v.create = prev ? prev->create : revision;
+    v.version = prev ? prev->version + 1 : 1;
+    v.lease = request.Bool("ignore_lease") && prev ?
+        prev->lease : request.Int("lease");
+    v.value = request.Bool("ignore_value") && prev ? prev->value : value;
+
+    if (prev && request.Bool("prev_kv"))
+        fields = "\"prev_kv\":" + _KvJson(key, *prev, false);
+    history.push_back(v);
+}
+
+inline bool MockV3Store::
+_DeleteFields(const Json& request, int64_t revision, std::string& fields) {
+    std::string key, range_end;
+    _Bytes(request, "key", key);
+    _Bytes(request, "range_end", range_end);
+    bool prev_kv = request.Bool("prev_kv");
+
+    int64_t deleted = 0;
+    std::string prev_kvs;
+    History::iterator it = keys_.lower_bound(key);
+    History::const_iterator end = _End(key, range_end);
+    for (; it != end; ++it) {
+        std::vector<Version>& history = it->second;
+        if (history.empty() || history.back().deleted)
+            continue;
+        if (prev_kv) {
+            if (! prev_kvs.empty())
+                prev_kvs += ',';
+            prev_kvs += _KvJson(it->first, history.back(), false);
+        }
+        Version tombstone;
+        tombstone.mod = revision;
+        tombstone.deleted = true;
+        history.push_back(tombstone);
+        ++deleted;
+    }
+
+    if (deleted)
+        fields = "\"deleted\":" + _Int(deleted);
+    if (! prev_kvs.empty())
+        fields += ",\"prev_kvs\":[" + prev_kvs + "]";
+    return deleted > 0;
+}
+
+inline MockV3Store::Result MockV3Store::
+_Reply(const std::string& fields) const {
+    Result result;
+    result.body = "{\"header\":" + _Header();
+    if (! fields.empty())
+        result.body += "," + fields;
+    result.body += "}";
+    return result;
+}
+
+inline MockV3Store::Result MockV3Store::
+_Error(int code, const std::string& message) const {
+    // The gateway maps the gRPC code to an HTTP status
+    Result result;
+    switch (code) {
+      case 5:  result.status = 404; break;
+      case 7:  result.status = 403; break;
+      case 14: result.status = 503; break;
+      default: result.status = 400; break;
+    }
+    result.body = "{\"error\":\"" + message + "\",\"code\":" +
+        std::to_string(code) + ",\"message\":\"" + message + "\"}";
+    return result;
+}
+
+inline std::string MockV3Store::
+_Header() const {
+    return "{\"cluster_id\":\"14841639068965178418\","
+           "\"member_id\":\"10276657743932975437\",\"revision\":" +
+           _Int(revision_) + ",\"raft_term\":\"2\"}";
+}
+
+inline const MockV3Store::Version* MockV3Store::
+_At(const std::vector<Version>& history, int64_t revision) const {
+    for (size_t i = history.size(); i-- > 0; ) {
+        if (history[i].mod <= revision)
+            return history[i].deleted ? NULL : &history[i];
+    }
+    return NULL;
+}
+
+inline MockV3Store::History::const_iterator MockV3Store::
+_End(const std::string& key, const std::string& range_end) const {
+    // No range_end reads one key, "\0" every key from key on
+    if (range_end.empty())
+        return keys_.upper_bound(key);
+    if (range_end == std::string(1, '\0'))
+        return keys_.end();
+    if (range_end <= key)
+        return keys_.lower_bound(key);
+    return keys_.lower_bound(range_end);
+}
+
+inline bool MockV3Store::
+_Bytes(const Json& request, const char* name, std::string& out) {
+    out.clear();
+    return etcd::internal::Base64Decode(request.String(name), out);
+}
+
+inline std::string MockV3Store::
+_KvJson(const std::string& key, const Version& v, bool keys_only) {
+    std::string json = "{\"key\":\"" + etcd::internal::Base64Encode(key) +
+        "\",\"create_revision\":" + _Int(v.create) +
+        ",\"mod_revision\":" + _Int(v.mod) +
+        ",\"version\":" + _Int(v.version);
+    if (! keys_only && ! v.value.empty())
+        json += ",\"value\":\"" + etcd::internal::Base64Encode(v.value) +
+            "\"";
+    if (v.lease)
+        json += ",\"lease\":" + _Int(v.lease);
+    return json + "}";
+}
+
+inline std::string MockV3Store::
+_Int(int64_t value) {
+    return "\"" + std::to_string(value) + "\"";
+}
+
+} // namespace test
+} // namespace etcd
+
+#endif // __ETCD_TEST_MOCK_V3_HPP_INCLUDED__
@@ -0,0 +1,246 @@
+/*
+ * Tracer hooks of etcd::Client and etcd::V3Client against an embedded
+ * etcd::test::MockServer. A recording tracer checks that every request
+ * opens exactly one span and closes it once, with the span Begin returned,
+ * whether the request succeeds, gets an etcd error back or fails in the
+ * transport, and that End carries the status and byte counts only when a
+ * response was read. Every case gets a server of its own.
+ *
+ *   tracer [--filter=substring]
+ *
+ * The program exits with status 1 when a check fails.
+ */
+
+#include "client.hpp"
+#include "mock_server.hpp"
+#include "rapid_reply.hpp"
+#include "trace.hpp"
+#include "v3_client.hpp"
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace {
+
+using namespace etcd;
+
+//------------------------------- CHECKS -------------------------------------
+
+int failed = 0;
+
+void Check(bool ok, const char* what, int line) {
+    if (! ok) {
+        ++failed;
+        fprintf(stderr, "  line %d: %s\n", line, what);
+    }
+}
+
+#define CHECK(condition) Check((condition), #condition, __LINE__)
+
+/**
+ * @brief What End was told about a span
+ */
+struct Ended {
+    Operation operation;
+    std::string key;
+    long status;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+};
+
+/**
+ * @brief Tracer policy recording every span. Begin and End have to
+ * alternate, End has to be handed the span Begin returned; anything else
+ * counts as a mismatch.
+ */
+class RecordingTracer {
+  public:
+    static const bool kEnabled = true;
+
+    typedef int Span;
+
+    RecordingTracer()
+      :begins_(0),
+       mismatches_(0),
+       open_(0)
+      {}
+
+    Span Begin(const TraceEvent&) {
+        if (open_)
+            ++mismatches_;
+        open_ = ++begins_;
+        return open_;
+    }
+
+    void End(Span& span, const TraceEvent& event) {
+        if (! open_ || span != open_)
+            ++mismatches_;
+        open_ = 0;
+        Ended closed = {event.operation, event.key, event.status,
+                        event.bytes_sent, event.bytes_received};
+        ends_.push_back(closed);
+    }
+
+    int Begins() const { return begins_; }
+    int Mismatches() const { return mismatches_; }
+    bool Open() const { return open_ != 0; }
+    const std::vector<Ended>& Ends() const { return ends_; }
+
+  private:
+    int begins_;
+    int mismatches_;
+    int open_;
+    std::vector<Ended> ends_;
+};
+
+typedef Client<RapidReply, RecordingTracer> TracedClient;
+typedef V3Client<RapidReply, RecordingTracer> TracedClient3;
+
+/**
+ * @brief Check the tracer saw n requests, each one a Begin and one End
+ */
+void CheckPairs(const RecordingTracer& tracer, int n, int line) {
+    Check(tracer.Begins() == n, "one Begin per request", line);
+    Check(tracer.Ends().size() == static_cast<size_t>(n),
+          "one End per request", line);
+    Check(tracer.Mismatches() == 0, "End closes the span of Begin", line);
+    Check(! tracer.Open(), "no span left open", line);
+}
+
+#define CHECK_PAIRS(tracer, n) CheckPairs((tracer), (n), __LINE__)
+
+//------------------------------- CASES --------------------------------------
+
+void ClientSuccess(test::MockServer& server) {
+    TracedClient client("127.0.0.1", server.GetPort());
+    client.Set("/a", "1");
+    client.Get("/a");
+    const RecordingTracer& tracer = client.GetTracer();
+    CHECK_PAIRS(tracer, 2);
+    if (tracer.Ends().size() != 2)
+        return;
+    const Ended& get = tracer.Ends()[1];
+    CHECK(get.operation == Operation::OPERATION_GET);
+    CHECK(get.key == "/a");
+    CHECK(get.status == 200);
+    CHECK(get.bytes_sent > 0);
+    CHECK(get.bytes_received > 0);
+}
+
+void ClientEtcdError(test::MockServer& server) {
+    TracedClient client("127.0.0.1", server.GetPort());
+    bool threw = false;
+    try {
+        client.Get("/missing");
+    } catch (const ReplyException& e) {
+        threw = e.error_code == 100;
+    }
+    CHECK(threw);
+    const RecordingTracer& tracer = client.GetTracer();
+    CHECK_PAIRS(tracer, 1);
+    if (! tracer.Ends().empty())
+        CHECK(tracer.Ends()[0].status == 404);
+}
+
+void ClientTransportFailure(test::MockServer& server) {
+    // Nothing listens on the port of a stopped server
+    Port port = server.GetPort();
+    server.Stop();
+    TracedClient client("127.0.0.1", port);
+    bool threw = false;
+    try {
+        client.Get("/a");
+    } catch (const ClientException&) {
+        threw = true;
+    }
+    CHECK(threw);
+    const RecordingTracer& tracer = client.GetTracer();
+    CHECK_PAIRS(tracer, 1);
+    if (tracer.Ends().empty())
+        return;
+    const Ended& get = tracer.Ends()[0];
+    CHECK(get.status == 0);
+    CHECK(get.bytes_received == 0);
+}
+
+void V3Success(test::MockServer& server) {
+    TracedClient3 client("127.0.0.1", server.GetPort());
+    client.Put("/a", "1");
+    client.Get("/a");
+    const RecordingTracer& tracer = client.GetTracer();
+    CHECK_PAIRS(tracer, 2);
+    if (tracer.Ends().size() != 2)
+        return;
+    CHECK(tracer.Ends()[1].status == 200);
+    CHECK(tracer.Ends()[1].bytes_received > 0);
+}
+
+void V3TransportFailure(test::MockServer& server) {
+    Port port = server.GetPort();
+    server.Stop();
+    TracedClient3 client("127.0.0.1", port);
+    bool threw = false;
+    try {
+        client.Get("/a");
+    } catch (const ClientException&) {
+        threw = true;
+    }
+    CHECK(threw);
+    const RecordingTracer& tracer = client.GetTracer();
+    CHECK_PAIRS(tracer, 1);
+    if (! tracer.Ends().empty())
+        CHECK(tracer.Ends()[0].status == 0);
+}
+
+struct Case {
+    const char* name;
+    std::function<void(test::MockServer&)> run;
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string filter;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--filter=", 9) == 0) {
+            filter = argv[i] + 9;
+        } else {
+            fprintf(stderr, "usage: tracer [--filter=substring]\n");
+            return 2;
+        }
+    }
+
+    std::vector<Case> cases;
+    cases.push_back(Case{"Client/success", ClientSuccess});
+    cases.push_back(Case{"Client/etcd error", ClientEtcdError});
+    cases.push_back(Case{"Client/transport", ClientTransportFailure});
+    cases.push_back(Case{"V3Client/success", V3Success});
+    cases.push_back(Case{"V3Client/transport", V3TransportFailure});
+
+    int failures = 0;
+    for (size_t i = 0; i < cases.size(); ++i) {
+        const Case& c = cases[i];
+        if (! filter.empty() && std::string(c.name).find(filter) ==
+            std::string::npos)
+            continue;
+
+        failed = 0;
+        try {
+            etcd::test::MockServer server;
+            c.run(server);
+            server.Stop();
+        } catch (const std::exception& e) {
+            ++failed;
+            fprintf(stderr, "  exception: %s\n", e.what());
+        }
+        printf("%-24s %s\n", c.name, failed ? "FAILED" : "ok");
+        if (failed)
+            ++failures;
+    }
+
+    if (failures)
+        fprintf(stderr, "%d case(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,466 @@
+/*
+ * Behavior of the v3 clients against an embedded etcd::test::MockServer:
+ * ranges and transactions, which failures move a client to the next
+ * endpoint, Apply splitting a batch into transactions, the lease manager,
+ * a v3 watch resuming after its revision was compacted, range scans, the
+ * backend AutoClient picks and the fallback of reads with a minimum index.
+ * Every case gets a server of its own.
+ *
+ *   v3 [--filter=substring]
+ *
+ * The program exits with status 1 when a check fails.
+ */
+
+#include "auto_client.hpp"
+#include "lease_manager.hpp"
+#include "mock_server.hpp"
+#include "rapid_reply.hpp"
+#include "v3_watch.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace etcd;
+
+typedef V3Client<RapidReply> Client3;
+
+//------------------------------- CHECKS -------------------------------------
+
+int failed = 0;
+
+void Check(bool ok, const char* what, int line) {
+    if (! ok) {
+        ++failed;
+        fprintf(stderr, "  line %d: %s\n", line, what);
+    }
+}
+
+#define CHECK(condition) Check((condition), #condition, __LINE__)
+
+/**
+ * @brief Updates given to a watch callback, waited for by the test
+ */
+class Updates {
+  public:
+    void Add(const v3::WatchUpdate& update) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        updates_.push_back(update);
+        added_.notify_all();
+    }
+
+    /**
+     * @brief Wait up to 5 seconds for the n-th update, counting from 1
+     */
+    bool Wait(size_t n, v3::WatchUpdate& update) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (! added_.wait_for(lock, std::chrono::seconds(5),
+                              [&] { return updates_.size() >= n; }))
+            return false;
+        update = updates_[n - 1];
+        return true;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable added_;
+    std::vector<v3::WatchUpdate> updates_;
+};
+
+size_t Gets(const ClientMetrics& metrics) {
+    MetricsSnapshot snapshot;
+    metrics.Snapshot(snapshot);
+    return snapshot[Operation::OPERATION_GET][Phase::PHASE_TOTAL].count;
+}
+
+void Compact(const test::MockServer& server, v3::Revision revision) {
+    internal::Curl curl;
+    curl.PostJson("http://127.0.0.1:" + std::to_string(server.GetPort()) +
+                  "/v3/kv/compaction",
+                  "{\"revision\":" + std::to_string(revision) + "}");
+}
+
+//------------------------------- CASES --------------------------------------
+
+void RangeAndTxn(test::MockServer& server) {
+    Client3 client("127.0.0.1", server.GetPort());
+    v3::Revision first = client.Put("/r/a", "1").header.revision;
+    client.Put("/r/b", "2");
+    client.Put("/r/c", "3");
+    client.Put("/r/a", "4");
+    client.Put("/s", "outside");
+
+    v3::RangeOptions options;
+    options.limit = 2;
+    v3::RangeResponse range = client.GetPrefix("/r/", options);
+    CHECK(range.kvs.size() == 2);
+    CHECK(range.more);
+    CHECK(range.count == 3);
+    CHECK(range.kvs[0].key == "/r/a" && range.kvs[0].value == "4");
+    CHECK(range.kvs[0].version == 2);
+
+    options = v3::RangeOptions();
+    options.revision = first;
+    range = client.Get("/r/a");
+    CHECK(range.kvs.size() == 1 && range.kvs[0].value == "4");
+    range = client.Range("/r/a", options);
+    CHECK(range.kvs.size() == 1 && range.kvs[0].value == "1");
+
+    v3::TxnResponse txn = client.CompareAndSwapIf("/r/a", "5",
+                                                  std::string("1"));
+    CHECK(! txn.succeeded);
+    CHECK(txn.responses.size() == 1 &&
+          txn.responses[0].range.kvs.size() == 1 &&
+          txn.responses[0].range.kvs[0].value == "4");
+    txn = client.CompareAndSwapIf("/r/a", "5", std::string("4"));
+    CHECK(txn.succeeded);
+    CHECK(client.CompareAndSwapIf("/r/new", "n", v3::Revision(0)).succeeded);
+    CHECK(! client.CompareAndSwapIf("/r/new", "n", v3::Revision(0))
+          .succeeded);
+
+    CHECK(client.DeletePrefix("/r/").deleted == 4);
+    CHECK(client.Get("/s").kvs.size() == 1);
+}
+
+void EndpointFailover(test::MockServer& server) {
+    const std::string url = "http://127.0.0.1:" +
+        std::to_string(server.GetPort());
+    const std::string unreachable = "http://127.0.0.1:1";
+
+    // A timeout leaves a shared endpoint current
+    std::shared_ptr<ClusterEndpoints> endpoints(
+        new ClusterEndpoints(std::vector<std::string>{url, unreachable}));
+    Client3 client(endpoints);
+    client.SetTimeouts(std::chrono::milliseconds(1000),
+                       std::chrono::milliseconds(100));
+    server.SetLatency(300000);
+    bool threw = false;
+    try {
+        client.Get("/f");
+    } catch (const ClientException&) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(endpoints->Failures() == 0);
+    CHECK(client.GetEndpoint() == url);
+    server.SetLatency(0);
+
+    // A member which cannot be reached is moved off
+    endpoints.reset(
+        new ClusterEndpoints(std::vector<std::string>{unreachable, url}));
+    Client3 moved(endpoints);
+    threw = false;
+    try {
+        moved.Get("/f");
+    } catch (const ClientException&) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(endpoints->Failures() == 1);
+    CHECK(moved.GetEndpoint() == url);
+    CHECK(moved.Get("/f").kvs.empty());
+}
+
+void ApplySplitting(test::MockServer& server) {
+    Client3 client("127.0.0.1", server.GetPort());
+    v3::Ops ops;
+    for (int i = 0; i < 300; ++i)
+        ops.push_back(v3::Op::Put("/batch/" + std::to_string(i), "v"));
+    ops.push_back(v3::Op::Delete("/batch/0"));
+    std::vector<v3::TxnResponse> responses = client.Apply(ops);
+    // kMaxTxnOps operations per transaction
+    CHECK(responses.size() == 3);
+    CHECK(responses[0].responses.size() == v3::kMaxTxnOps);
+    CHECK(responses[2].responses.size() == 301 - 2 * v3::kMaxTxnOps);
+
+    v3::RangeOptions count;
+    count.count_only = true;
+    CHECK(client.GetPrefix("/batch/", count).count == 299);
+
+    // A key written twice starts a new transaction, applied in order
+    ops.clear();
+    ops.push_back(v3::Op::Put("/dup", "1"));
+    ops.push_back(v3::Op::Put("/other", "1"));
+    ops.push_back(v3::Op::Put("/dup", "2"));
+    responses = client.Apply(ops);
+    CHECK(responses.size() == 2);
+    v3::RangeResponse range = client.Get("/dup");
+    CHECK(range.kvs.size() == 1 && range.kvs[0].value == "2");
+
+    ops.clear();
+    for (int i = 0; i < 25; ++i)
+        ops.push_back(v3::Op::Put("/small/" + std::to_string(i), "v"));
+    CHECK(client.Apply(ops, 10).size() == 3);
+}
+
+void LeaseRenewal(test::MockServer& server) {
+    Client3 client("127.0.0.1", server.GetPort());
+    LeaseManager<RapidReply> leases("127.0.0.1", server.GetPort());
+    std::atomic<int> lost(0);
+    leases.Start([&](v3::LeaseId) { ++lost; });
+
+    v3::LeaseId kept = leases.Grant(1);
+    v3::LeaseId revoked = leases.Grant(1);
+    CHECK(leases.Size() == 2);
+    v3::PutOptions options;
+    options.lease = kept;
+    client.Put("/lease/kept", "k", options);
+    options.lease = revoked;
+    client.Put("/lease/revoked", "r", options);
+
+    // Well past the ttl, the keys are kept alive
+    std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+    CHECK(client.GetPrefix("/lease/").kvs.size() == 2);
+    CHECK(lost == 0);
+
+    leases.Revoke(revoked);
+    CHECK(! leases.Has(revoked));
+    CHECK(client.Get("/lease/revoked").kvs.empty());
+
+    // A lease which cannot be renewed is reported lost
+    server.Stop();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+    CHECK(lost == 1);
+    CHECK(! leases.Has(kept));
+    leases.Stop();
+}
+
+void WatchCompacted(test::MockServer& server) {
+    Client3 client("127.0.0.1", server.GetPort());
+    V3Watch<RapidReply> watch("127.0.0.1", server.GetPort());
+    v3::Revision start = client.Put("/w/a", "1").header.revision;
+
+    Updates updates;
+    v3::WatchOptions options;
+    options.start_revision = start + 1;
+    v3::WatchId id = watch.AddPrefix("/w/", options,
+        [&](const v3::WatchUpdate& update) { updates.Add(update); });
+    watch.Start();
+
+    v3::WatchUpdate update;
+    v3::Revision put = client.Put("/w/b", "2").header.revision;
+    CHECK(updates.Wait(1, update));
+    CHECK(update.kind == v3::WatchUpdate::UPDATE_EVENTS);
+    CHECK(update.revision == put);
+
+    // Changes while stopped, then the history the watch resumes from is
+    // compacted: the watch is given the keys at the compact revision
+    watch.Stop();
+    client.Put("/w/c", "3");
+    v3::Revision compacted = client.Put("/w/a", "4").header.revision;
+    Compact(server, compacted);
+    watch.Start();
+
+    CHECK(updates.Wait(2, update));
+    CHECK(update.kind == v3::WatchUpdate::UPDATE_RESYNC);
+    CHECK(update.revision == compacted);
+    CHECK(update.kvs.size() == 3);
+    CHECK(! update.kvs.empty() && update.kvs[0].value == "4");
+
+    // and continues after it
+    put = client.Put("/w/d", "5").header.revision;
+    CHECK(updates.Wait(3, update));
+    CHECK(update.kind == v3::WatchUpdate::UPDATE_EVENTS);
+    CHECK(update.events.size() == 1 && update.events[0].kv.key == "/w/d");
+    CHECK(watch.GetRevision(id) == put);
+    CHECK(watch.GetMetrics().Watch()->Resyncs() == 1);
+    watch.Stop();
+}
+
+void ScanPaging(test::MockServer& server) {
+    Client3 client("127.0.0.1", server.GetPort());
+    v3::Ops ops;
+    for (int i = 0; i < 250; ++i)
+        ops.push_back(v3::Op::Put("/scan/" + std::to_string(1000 + i), "v"));
+    client.Apply(ops);
+    client.Put("/scao", "outside");
+    v3::Revision revision = client.Get("/scan/1000").header.revision;
+
+    RangeScan<RapidReply> scan("127.0.0.1", server.GetPort(), "/scan/", 100);
+    v3::KeyValues page;
+    size_t pages = 0;
+    size_t keys = 0;
+    std::string last;
+    bool sorted = true;
+    while (scan.Next(page)) {
+        // Changes after the first page are not seen by the scan
+        if (pages == 0) {
+            client.Put("/scan/0000", "new");
+            client.Delete("/scan/1249");
+        }
+        for (size_t i = 0; i < page.size(); ++i) {
+            sorted = sorted && page[i].key > last;
+            last = page[i].key;
+        }
+        keys += page.size();
+        ++pages;
+    }
+    CHECK(pages == 3);
+    CHECK(keys == 250);
+    CHECK(sorted);
+    CHECK(last == "/scan/1249");
+    CHECK(scan.GetRevision() == revision);
+    CHECK(page.empty());
+
+    // v2 lists directory by directory
+    Client<RapidReply> v2("127.0.0.1", server.GetPort());
+    for (int d = 0; d < 3; ++d) {
+        for (int k = 0; k < 10; ++k) {
+            v2.Set("/tree/d" + std::to_string(d) + "/k" + std::to_string(k),
+                   "x");
+        }
+    }
+    RangeScan<RapidReply> tree("127.0.0.1", server.GetPort(), "/tree", 7,
+                               RangeScan<RapidReply>::API_V2);
+    keys = 0;
+    while (tree.Next(page)) {
+        CHECK(page.size() <= 7);
+        keys += page.size();
+    }
+    CHECK(keys == 30);
+}
+
+void AutoBackend(test::MockServer& server) {
+    VersionInfo version;
+    version.server = "3.5.9";
+    CHECK(HasV3Gateway(version));
+    version.cluster = "3.3.0";
+    CHECK(! HasV3Gateway(version));
+    version.cluster = "10.0.0";
+    CHECK(HasV3Gateway(version));
+    version.cluster.clear();
+    version.server.clear();
+    CHECK(! HasV3Gateway(version));
+
+    Client<RapidReply> v2("127.0.0.1", server.GetPort());
+    Client3 v3("127.0.0.1", server.GetPort());
+    v3::KeyValue kv;
+    {
+        AutoClient<RapidReply> client("127.0.0.1", server.GetPort());
+        CHECK(! client.HasV3());
+        CHECK(client.GetV3Client() == NULL);
+        client.Put("/auto/v2", "a");
+        CHECK(v2.Get("/auto/v2").GetModifiedIndex() != 0);
+        CHECK(client.Get("/auto/v2", kv) && kv.value == "a");
+    }
+
+    server.SetVersion("3.5.9", "3.5.0");
+    {
+        AutoClient<RapidReply> client("127.0.0.1", server.GetPort());
+        CHECK(client.HasV3());
+        CHECK(client.GetV3Client() != NULL);
+        client.Put("/auto/v3", "b");
+        CHECK(v3.Get("/auto/v3").kvs.size() == 1);
+        CHECK(client.Get("/auto/v3", kv) && kv.value == "b");
+        CHECK(! client.Get("/auto/v2", kv));
+        client.Put("/auto/ttl", "t", 30);
+        CHECK(client.Get("/auto/ttl", kv) && kv.lease != 0);
+
+        // Puts with one ttl share a lease, a revoked one is replaced
+        v3::LeaseId lease = kv.lease;
+        client.Put("/auto/ttl2", "t", 30);
+        CHECK(client.Get("/auto/ttl2", kv) && kv.lease == lease);
+        client.Put("/auto/ttl3", "t", 60);
+        CHECK(client.Get("/auto/ttl3", kv) && kv.lease != lease);
+        v3.LeaseRevoke(lease);
+        client.Put("/auto/ttl4", "t", 30);
+        CHECK(client.Get("/auto/ttl4", kv) && kv.lease != 0 &&
+              kv.lease != lease);
+    }
+
+    server.SetVersion("3.5.9", "3.3.0");
+    AutoClient<RapidReply> client("127.0.0.1", server.GetPort());
+    CHECK(! client.HasV3());
+}
+
+void QuorumFallback(test::MockServer& server) {
+    Client<RapidReply> v2("127.0.0.1", server.GetPort());
+    v2.Set("/c", "1");
+    Index index = server.GetIndex();
+
+    // A member at the index answers alone, one behind costs a quorum read
+    size_t before = Gets(v2.GetMetrics());
+    v2.Get("/c", ReadConsistency::AtLeast(index));
+    CHECK(Gets(v2.GetMetrics()) - before == 1);
+    before = Gets(v2.GetMetrics());
+    CHECK(v2.Get("/c", ReadConsistency::AtLeast(index + 100))
+          .GetModifiedIndex() == index);
+    CHECK(Gets(v2.GetMetrics()) - before == 2);
+    v2.SetReadConsistency(ReadConsistency::AtLeast(index + 100));
+    before = Gets(v2.GetMetrics());
+    v2.Get("/c");
+    CHECK(Gets(v2.GetMetrics()) - before == 2);
+
+    Client3 v3("127.0.0.1", server.GetPort());
+    v3::Revision revision = v3.Put("/c", "v3").header.revision;
+    v3.SetReadConsistency(ReadConsistency::AtLeast(revision));
+    before = Gets(v3.GetMetrics());
+    v3.Get("/c");
+    CHECK(Gets(v3.GetMetrics()) - before == 1);
+    v3.SetReadConsistency(ReadConsistency::AtLeast(revision + 5));
+    before = Gets(v3.GetMetrics());
+    v3::RangeResponse range = v3.Get("/c");
+    CHECK(range.kvs.size() == 1 && range.kvs[0].value == "v3");
+    CHECK(Gets(v3.GetMetrics()) - before == 2);
+}
+
+struct Case {
+    const char* name;
+    std::function<void(test::MockServer&)> run;
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string filter;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--filter=", 9) == 0) {
+            filter = argv[i] + 9;
+        } else {
+            fprintf(stderr, "usage: v3 [--filter=substring]\n");
+            return 2;
+        }
+    }
+
+    std::vector<Case> cases;
+    cases.push_back(Case{"V3Client::Range/Txn", RangeAndTxn});
+    cases.push_back(Case{"V3Client::Apply", ApplySplitting});
+    cases.push_back(Case{"V3Client/endpoints", EndpointFailover});
+    cases.push_back(Case{"LeaseManager", LeaseRenewal});
+    cases.push_back(Case{"V3Watch/compacted", WatchCompacted});
+    cases.push_back(Case{"RangeScan", ScanPaging});
+    cases.push_back(Case{"AutoClient", AutoBackend});
+    cases.push_back(Case{"ReadConsistency", QuorumFallback});
+
+    int failures = 0;
+    for (size_t i = 0; i < cases.size(); ++i) {
+        const Case& c = cases[i];
+        if (! filter.empty() && std::string(c.name).find(filter) ==
+            std::string::npos)
+            continue;
+
+        failed = 0;
+        try {
+            etcd::test::MockServer server;
+            c.run(server);
+            server.Stop();
+        } catch (const std::exception& e) {
+            ++failed;
+            fprintf(stderr, "  exception: %s\n", e.what());
+        }
+        printf("%-24s %s\n", c.name, failed ? "FAILED" : "ok");
+        if (failed)
+            ++failures;
+    }
+
+    if (failures)
+        fprintf(stderr, "%d case(s) failed\n", failures);
+    return failures ? 1 : 0;
+}